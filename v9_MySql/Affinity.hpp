@@ -0,0 +1,151 @@
+#pragma once
+//  CPU亲和性和NUMA  --  把主循环、工作线程和执行数据库请求的线程绑定到指定的CPU上，
+//  线程不会被调度器在核之间搬来搬去，缓存和分支预测的状态留在同一个核上；
+//  NUMA机器上每个线程的内存块从它所在节点的内存里分配（见BufferPool）
+//  CPU列表的写法和taskset -c一样："0"、"0-3"、"0,2,4-7"
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "Logger.hpp"
+using namespace std;
+
+#define AFFINITY_MAX_NODES 8            //  最多区分的NUMA节点数，更多的节点合并到最后一个
+#define AFFINITY_MPOL_PREFERRED 1       //  mbind的策略：优先从指定节点分配，不够时用别的节点
+#define AFFINITY_MPOL_MF_MOVE 2         //  mbind时把已经分配的页也搬到指定节点
+
+
+class Affinity {
+public:
+    //  解析CPU列表，格式不对时返回false
+    static bool parseCpuList(const string& text,vector<int>& cpus) {
+        cpus.clear();
+        size_t pos = 0;
+        while(pos < text.size()) {
+            size_t comma = text.find(',',pos);
+            if(comma == string::npos) comma = text.size();
+            string item = text.substr(pos,comma - pos);
+            size_t dash = item.find('-');
+            char* end = nullptr;
+            long first = strtol(item.c_str(),&end,10);
+            if(item.empty() || end == item.c_str() || first < 0) return false;
+            long last = first;
+            if(dash != string::npos) {
+                last = strtol(item.c_str() + dash + 1,&end,10);
+                if(*end != '\0' || last < first) return false;
+            } else if(*end != '\0') {
+                return false;
+            }
+            for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) cpus.push_back(static_cast<int>(cpu));
+            pos = comma + 1;
+        }
+        return !cpus.empty();
+    }
+
+    //  把当前线程绑定到这些CPU上，列表为空时不做任何事
+    static bool pinCurrentThread(const vector<int>& cpus) {
+        if(cpus.empty()) return true;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int cpu : cpus) CPU_SET(cpu,&set);
+        if(sched_setaffinity(0,sizeof(set),&set) != 0) {
+            LOG_WARNING("cannot pin thread to %zu cpus starting at %d",cpus.size(),cpus[0]);
+            return false;
+        }
+        //  线程换了节点，之后分配的内存块跟着换
+        currentNode() = nodeOfCpu(cpus[0]);
+        return true;
+    }
+
+    static bool pinCurrentThread(int cpu) {
+        return pinCurrentThread(vector<int>(1,cpu));
+    }
+
+    //  当前线程允许运行的CPU
+    static vector<int> currentCpus() {
+        vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if(sched_getaffinity(0,sizeof(set),&set) != 0) return cpus;
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if(CPU_ISSET(cpu,&set)) cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    //  当前线程所在的NUMA节点：绑定过CPU时是绑定的节点，否则是第一次调用时所在的节点
+    static int& currentNode() {
+        thread_local int node = nodeOfCpu(sched_getcpu());
+        return node;
+    }
+
+    //  CPU所在的NUMA节点，没有NUMA信息时是0；/sys只在第一次调用时读，之后查表
+    static int nodeOfCpu(int cpu) {
+        const vector<int>& nodes = cpuNodes();
+        if(cpu < 0 || static_cast<size_t>(cpu) >= nodes.size()) return 0;
+        return nodes[cpu];
+    }
+
+    //  在线的NUMA节点数，只读一次
+    static int nodeCount() {
+        static int count = readNodeCount();
+        return count;
+    }
+
+    //  让[addr,addr+len)的页优先放在node节点上，addr要按页对齐；单节点的机器上什么都不做
+    //  容器里没有权限时mbind会失败，这时只是不保证位置，不影响正确性
+    static void bindToNode(void* addr,size_t len,int node) {
+#ifdef SYS_mbind
+        if(nodeCount() <= 1) return;
+        unsigned long mask = 1UL << node;
+        syscall(SYS_mbind,addr,len,AFFINITY_MPOL_PREFERRED,&mask,sizeof(mask) * 8,AFFINITY_MPOL_MF_MOVE);
+#else
+        (void)addr; (void)len; (void)node;
+#endif
+    }
+
+private:
+    //  CPU编号到NUMA节点的表，从每个节点的cpulist读出来
+    static const vector<int>& cpuNodes() {
+        static const vector<int> nodes = readCpuNodes();
+        return nodes;
+    }
+
+    static vector<int> readCpuNodes() {
+        vector<int> nodes,online;
+        if(nodeCount() <= 1 || !parseCpuList(readLine("/sys/devices/system/node/online"),online)) return nodes;
+        for(int node : online) {
+            string path = "/sys/devices/system/node/node" + to_string(node) + "/cpulist";
+            vector<int> cpus;
+            if(!parseCpuList(readLine(path),cpus)) continue;
+            for(int cpu : cpus) {
+                if(static_cast<size_t>(cpu) >= nodes.size()) nodes.resize(cpu + 1,0);
+                nodes[cpu] = min(node,AFFINITY_MAX_NODES - 1);
+            }
+        }
+        return nodes;
+    }
+
+    //  读文件的第一行，去掉结尾的换行，读不到时返回空串
+    static string readLine(const string& path) {
+        FILE* file = fopen(path.c_str(),"r");
+        if(file == nullptr) return string();
+        char line[4096] = { 0 };
+        bool ok = fgets(line,sizeof(line),file) != nullptr;
+        fclose(file);
+        string text = ok ? string(line) : string();
+        while(!text.empty() && (text.back() == '\n' || text.back() == ' ')) text.pop_back();
+        return text;
+    }
+
+    //  /sys/devices/system/node/online的格式也是CPU列表那样的区间
+    static int readNodeCount() {
+        vector<int> nodes;
+        if(!parseCpuList(readLine("/sys/devices/system/node/online"),nodes)) return 1;
+        return min(nodes.back() + 1,AFFINITY_MAX_NODES);
+    }
+};
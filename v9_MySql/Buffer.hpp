@@ -0,0 +1,480 @@
+#pragma once
+//  链式缓冲区和内存块池   --  连接的输入和输出都用它
+//  缓冲区由固定大小的内存块串成链表：读数据时用readv直接读到空闲空间里，消费数据时只移动下标，
+//  整块用完就还给内存池，不需要memmove也不会因为'\0'截断数据
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include <mutex>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include "Affinity.hpp"
+using namespace std;
+
+
+//  一块固定大小的内存，[begin,end)是可读数据，[end,SIZE)是可写的空闲空间
+struct BufferSlab {
+    static const size_t SIZE = 8192 - 4 * sizeof(void*);
+
+    BufferSlab* next;
+    size_t begin;
+    size_t end;
+    size_t node;        //  内存所在的NUMA节点，用完还给这个节点的仓库
+    char data[SIZE];
+};
+
+
+//  内存池的统计信息
+struct BufferPoolStats {
+    uint64_t hits;          //  从空闲链表里拿到的次数
+    uint64_t misses;        //  空闲链表为空只能向系统申请的次数
+    uint64_t in_use;        //  正在被缓冲区使用的块数
+    uint64_t cached;        //  缓存在空闲链表里的块数
+
+    //  命中率
+    double hitRate() const {
+        uint64_t total = hits + misses;
+        return total == 0 ? 0.0 : static_cast<double>(hits) / total;
+    }
+
+    //  内存占用（字节）
+    uint64_t footprintBytes() const {
+        return (in_use + cached) * sizeof(BufferSlab);
+    }
+};
+
+
+//  内存块池：每个线程一个空闲链表，不需要加锁；
+//  某个线程缓存太多时把一半放到全局仓库里，其他线程空了再从仓库批量取，避免内存只在一个线程里堆积
+//  NUMA机器上每个节点一个仓库：新的块按页对齐分配并绑定到申请线程所在的节点，
+//  其他节点的线程用完后直接还给它自己节点的仓库，线程拿到的块总是本节点的内存
+class BufferPool {
+public:
+    //  取一块内存
+    static BufferSlab* acquire() {
+        FreeList& list = local();
+        if(list.head == nullptr) {
+            refill(list);
+        }
+        BufferSlab* slab = list.head;
+        if(slab != nullptr) {
+            list.head = slab->next;
+            list.size--;
+            counters().hits++;
+            counters().cached--;
+        } else {
+            slab = allocate();
+            counters().misses++;
+        }
+        counters().in_use++;
+        slab->next = nullptr;
+        slab->begin = slab->end = 0;
+        return slab;
+    }
+
+    //  归还一块内存
+    static void release(BufferSlab* slab) {
+        if(numaActive() && slab->node != static_cast<size_t>(Affinity::currentNode())) {
+            giveBack(slab);
+            return;
+        }
+        FreeList& list = local();
+        slab->next = list.head;
+        list.head = slab;
+        list.size++;
+        counters().in_use--;
+        counters().cached++;
+        if(list.size > LOCAL_LIMIT) {
+            spill(list);
+        }
+    }
+
+    //  是否按NUMA节点分配和缓存内存块，默认开启，只有多个节点时才有作用；要在服务器启动时设置
+    static void setNumaLocal(bool enabled) {
+        numaLocal() = enabled;
+    }
+
+    //  获取统计信息
+    static BufferPoolStats getStats() {
+        BufferPoolStats stats;
+        stats.hits = counters().hits.load(memory_order_relaxed);
+        stats.misses = counters().misses.load(memory_order_relaxed);
+        stats.in_use = counters().in_use.load(memory_order_relaxed);
+        stats.cached = counters().cached.load(memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    static const size_t LOCAL_LIMIT = 64;       //  每个线程最多缓存的块数
+    static const size_t BATCH = 32;             //  和全局仓库之间一次移动的块数
+    static const size_t DEPOT_LIMIT = 4096;     //  全局仓库最多缓存的块数，再多就还给系统
+
+    struct FreeList {
+        BufferSlab* head = nullptr;
+        size_t size = 0;
+        //  线程退出时把缓存的块还给全局仓库
+        ~FreeList() {
+            while(size > 0) spill(*this);
+        }
+    };
+
+    struct Depot {
+        mutex lock;
+        BufferSlab* head = nullptr;
+        size_t size = 0;
+    };
+
+    struct Counters {
+        atomic<uint64_t> hits{0};
+        atomic<uint64_t> misses{0};
+        atomic<uint64_t> in_use{0};
+        atomic<uint64_t> cached{0};
+    };
+
+    static FreeList& local() {
+        thread_local FreeList list;
+        return list;
+    }
+
+    //  每个NUMA节点一个仓库，单节点的机器只用第0个
+    static Depot& depot(size_t node) {
+        static Depot depots[AFFINITY_MAX_NODES];
+        return depots[node];
+    }
+
+    static bool& numaLocal() {
+        static bool enabled = true;
+        return enabled;
+    }
+
+    static bool numaActive() {
+        return numaLocal() && Affinity::nodeCount() > 1;
+    }
+
+    //  当前线程的块放在哪个仓库
+    static size_t localNode() {
+        return numaActive() ? static_cast<size_t>(Affinity::currentNode()) : 0;
+    }
+
+    //  向系统申请一块；NUMA机器上按页对齐，绑定到当前线程的节点（两页正好一块）
+    static BufferSlab* allocate() {
+        void* memory = nullptr;
+        size_t node = localNode();
+        if(numaActive()) {
+            if(posix_memalign(&memory,4096,sizeof(BufferSlab)) != 0) memory = nullptr;
+            if(memory != nullptr) Affinity::bindToNode(memory,sizeof(BufferSlab),static_cast<int>(node));
+        } else {
+            memory = malloc(sizeof(BufferSlab));
+        }
+        if(memory == nullptr) throw bad_alloc();
+        BufferSlab* slab = static_cast<BufferSlab*>(memory);
+        slab->node = node;
+        return slab;
+    }
+
+    //  其他节点的块直接还给它所在节点的仓库
+    static void giveBack(BufferSlab* slab) {
+        Depot& d = depot(slab->node);
+        counters().in_use--;
+        unique_lock<mutex> lock(d.lock);
+        if(d.size < DEPOT_LIMIT) {
+            slab->next = d.head;
+            d.head = slab;
+            d.size++;
+            counters().cached++;
+        } else {
+            free(slab);
+        }
+    }
+
+    static Counters& counters() {
+        static Counters counters;
+        return counters;
+    }
+
+    //  从全局仓库批量取
+    static void refill(FreeList& list) {
+        Depot& d = depot(localNode());
+        unique_lock<mutex> lock(d.lock);
+        for(size_t i = 0;i < BATCH && d.head != nullptr;++i) {
+            BufferSlab* slab = d.head;
+            d.head = slab->next;
+            d.size--;
+            slab->next = list.head;
+            list.head = slab;
+            list.size++;
+        }
+    }
+
+    //  把一批块放回全局仓库，仓库满了就直接释放
+    static void spill(FreeList& list) {
+        Depot& d = depot(localNode());
+        unique_lock<mutex> lock(d.lock);
+        for(size_t i = 0;i < BATCH && list.head != nullptr;++i) {
+            BufferSlab* slab = list.head;
+            list.head = slab->next;
+            list.size--;
+            if(d.size < DEPOT_LIMIT) {
+                slab->next = d.head;
+                d.head = slab;
+                d.size++;
+            } else {
+                free(slab);
+                counters().cached--;
+            }
+        }
+    }
+};
+
+
+//  链式缓冲区
+class ChainBuffer {
+public:
+    ChainBuffer(): head(nullptr),tail(nullptr),bytes(0) {}
+
+    ~ChainBuffer() {
+        clear();
+    }
+
+    ChainBuffer(const ChainBuffer&) = delete;
+    ChainBuffer& operator=(const ChainBuffer&) = delete;
+
+    //  可读数据的字节数
+    size_t size() const {
+        return this->bytes;
+    }
+
+    bool empty() const {
+        return this->bytes == 0;
+    }
+
+    //  追加数据
+    void append(const char* data,size_t len) {
+        while(len > 0) {
+            if(tail == nullptr || tail->end == BufferSlab::SIZE) {
+                link(BufferPool::acquire());
+            }
+            size_t n = min(len,BufferSlab::SIZE - tail->end);
+            memcpy(tail->data + tail->end,data,n);
+            tail->end += n;
+            bytes += n;
+            data += n;
+            len -= n;
+        }
+    }
+
+    void append(const string& str) {
+        append(str.data(),str.size());
+    }
+
+    //  从fd读一次数据，直接读进尾块的空闲空间，不够的部分读进一块新的内存
+    //  返回值同read：>0为读到的字节数，0为对端关闭，-1为出错（errno保留）
+    ssize_t readFd(int fd) {
+        BufferSlab* extra = BufferPool::acquire();
+        struct iovec iov[2];
+        int cnt = 0;
+        if(tail != nullptr && tail->end < BufferSlab::SIZE) {
+            iov[cnt].iov_base = tail->data + tail->end;
+            iov[cnt].iov_len = BufferSlab::SIZE - tail->end;
+            cnt++;
+        }
+        iov[cnt].iov_base = extra->data;
+        iov[cnt].iov_len = BufferSlab::SIZE;
+        cnt++;
+
+        ssize_t n = readv(fd,iov,cnt);
+        if(n <= 0) {
+            int saved = errno;
+            BufferPool::release(extra);
+            errno = saved;
+            return n;
+        }
+        size_t first = cnt == 2 ? iov[0].iov_len : 0;
+        if(static_cast<size_t>(n) <= first) {
+            tail->end += n;
+            BufferPool::release(extra);
+        } else {
+            if(first > 0) tail->end = BufferSlab::SIZE;
+            extra->end = n - first;
+            link(extra);
+        }
+        bytes += n;
+        return n;
+    }
+
+    //  把数据尽量写到fd里，写出去的部分直接消费掉
+    //  返回值同writev：>=0为写出的字节数，-1为出错（errno保留）
+    ssize_t writeFd(int fd) {
+        static const int MAX_IOV = 64;
+        struct iovec iov[MAX_IOV];
+        int cnt = 0;
+        for(BufferSlab* slab = head;slab != nullptr && cnt < MAX_IOV;slab = slab->next) {
+            iov[cnt].iov_base = slab->data + slab->begin;
+            iov[cnt].iov_len = slab->end - slab->begin;
+            cnt++;
+        }
+        if(cnt == 0) return 0;
+        ssize_t n = writev(fd,iov,cnt);
+        if(n > 0) consume(n);
+        return n;
+    }
+
+    //  用read(char* buf,size_t len)读一次数据到尾块的空闲空间（没有时先接一块新的），用于TLS等不能直接readv的情况
+    //  read的返回值约定同read系统调用，这里原样返回
+    template<typename Reader>
+    ssize_t readWith(Reader read) {
+        if(tail == nullptr || tail->end == BufferSlab::SIZE) link(BufferPool::acquire());
+        ssize_t n = read(tail->data + tail->end,BufferSlab::SIZE - tail->end);
+        if(n > 0) {
+            tail->end += n;
+            bytes += n;
+        } else if(bytes == 0) {
+            //  没读到数据，空块不留在空闲连接上
+            int saved = errno;
+            clear();
+            errno = saved;
+        }
+        return n;
+    }
+
+    //  用write(const char* buf,size_t len)写出头块里的数据，写出去的部分消费掉；返回值约定同write系统调用
+    template<typename Writer>
+    ssize_t writeWith(Writer write) {
+        if(head == nullptr) return 0;
+        ssize_t n = write(head->data + head->begin,head->end - head->begin);
+        if(n > 0) consume(n);
+        return n;
+    }
+
+    //  丢弃前n个字节，只移动下标，用完的块还给内存池
+    void consume(size_t n) {
+        n = min(n,bytes);
+        bytes -= n;
+        while(n > 0) {
+            size_t avail = head->end - head->begin;
+            if(n < avail) {
+                head->begin += n;
+                break;
+            }
+            n -= avail;
+            unlinkHead();
+        }
+        //  数据都消费完了，剩下的空块也还回去，空闲连接不占用缓冲区内存
+        if(bytes == 0) clear();
+    }
+
+    //  从pos开始查找needle，跨块也能找到，找不到返回string::npos
+    size_t find(const char* needle,size_t len,size_t pos = 0) const {
+        if(len == 0 || bytes < len) return string::npos;
+        for(size_t i = pos;i + len <= bytes;++i) {
+            //  先用memchr跳到下一个首字符，再逐字节比较
+            size_t next = findChar(needle[0],i);
+            if(next == string::npos || next + len > bytes) return string::npos;
+            i = next;
+            size_t j = 1;
+            while(j < len && at(i + j) == needle[j]) ++j;
+            if(j == len) return i;
+        }
+        return string::npos;
+    }
+
+    //  复制出[pos,pos+len)的数据
+    string copyOut(size_t pos,size_t len) const {
+        string out;
+        if(pos >= bytes) return out;
+        len = min(len,bytes - pos);
+        out.reserve(len);
+        for(BufferSlab* slab = head;slab != nullptr && len > 0;slab = slab->next) {
+            size_t avail = slab->end - slab->begin;
+            if(pos >= avail) {
+                pos -= avail;
+                continue;
+            }
+            size_t n = min(len,avail - pos);
+            out.append(slab->data + slab->begin + pos,n);
+            pos = 0;
+            len -= n;
+        }
+        return out;
+    }
+
+    //  依次把[pos,pos+len)范围内每一块里的数据交给visit(const char* data,size_t len)，不复制
+    template<typename Visitor>
+    void visit(size_t pos,size_t len,Visitor visit) const {
+        for(BufferSlab* slab = head;slab != nullptr && len > 0;slab = slab->next) {
+            size_t avail = slab->end - slab->begin;
+            if(pos >= avail) {
+                pos -= avail;
+                continue;
+            }
+            size_t n = min(len,avail - pos);
+            visit(slab->data + slab->begin + pos,n);
+            pos = 0;
+            len -= n;
+        }
+    }
+
+    //  清空并归还所有块
+    void clear() {
+        while(head != nullptr) unlinkHead();
+        bytes = 0;
+    }
+
+    //  当前占用的块数
+    size_t slabCount() const {
+        size_t n = 0;
+        for(BufferSlab* slab = head;slab != nullptr;slab = slab->next) ++n;
+        return n;
+    }
+
+private:
+    void link(BufferSlab* slab) {
+        if(tail == nullptr) {
+            head = tail = slab;
+        } else {
+            tail->next = slab;
+            tail = slab;
+        }
+    }
+
+    void unlinkHead() {
+        BufferSlab* slab = head;
+        head = slab->next;
+        if(head == nullptr) tail = nullptr;
+        BufferPool::release(slab);
+    }
+
+    //  第i个可读字节
+    char at(size_t i) const {
+        for(BufferSlab* slab = head;slab != nullptr;slab = slab->next) {
+            size_t avail = slab->end - slab->begin;
+            if(i < avail) return slab->data[slab->begin + i];
+            i -= avail;
+        }
+        return '\0';
+    }
+
+    //  从pos开始查找字符c
+    size_t findChar(char c,size_t pos) const {
+        size_t offset = 0;
+        for(BufferSlab* slab = head;slab != nullptr;slab = slab->next) {
+            size_t avail = slab->end - slab->begin;
+            if(pos < offset + avail) {
+                size_t start = pos > offset ? pos - offset : 0;
+                const char* base = slab->data + slab->begin;
+                const void* hit = memchr(base + start,c,avail - start);
+                if(hit != nullptr) return offset + (static_cast<const char*>(hit) - base);
+            }
+            offset += avail;
+        }
+        return string::npos;
+    }
+
+    BufferSlab* head;
+    BufferSlab* tail;
+    size_t bytes;
+};
@@ -0,0 +1,159 @@
+#pragma once
+//  流量录制  --  按连接采样，把读到的原始请求字节（TLS连接是解密后的明文）连同到达时间写进一个紧凑的二进制文件，
+//  用bench/replay按原速、按倍数加速或者全速回放到任意服务器上
+//  工作线程只在内存里追加记录，后台线程定期把攒下的一批一次写进文件，读请求的路径上没有系统调用
+//  文件格式（小端）：
+//      文件头  "HCAP"  uint32 版本  uint64 开始录制的墙上时间（微秒）
+//      记录    uint64 相对开始录制的时间（单调时钟，微秒）  uint32 连接编号  uint32 长度  长度个字节的数据
+//      长度为0的记录表示这个连接关闭了
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Buffer.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+using namespace std;
+
+#define CAPTURE_MAGIC "HCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_FLUSH_BYTES (256 * 1024)    //  攒够这么多字节就唤醒后台线程写文件
+#define CAPTURE_FLUSH_MS 100                //  不够也每隔这么久写一次，进程被杀时最多丢这么久的数据
+
+
+class TrafficCapture {
+public:
+    //  path为空时不录制；每sample_every个连接录制一个，文件达到max_bytes后停止录制
+    TrafficCapture(const string& path,size_t sample_every,size_t max_bytes)
+    :fd(-1),sample_every(sample_every == 0 ? 1 : sample_every),max_bytes(max_bytes),connections(0),next_id(0),
+     start_us(0),written(0),stopping(false),
+     captured(MetricsRegistry::global().counter("http_capture_bytes_total","Request bytes written to the capture file")),
+     dropped(MetricsRegistry::global().counter("http_capture_dropped_total","Capture records dropped after the size limit")) {
+        if(path.empty()) return;
+        fd = open(path.c_str(),O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,0644);
+        if(fd == -1) {
+            LOG_ERROR("cannot open capture file %s",path.c_str());
+            return;
+        }
+        start_us = Metrics::nowUs();
+        uint64_t wall_us = chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        uint32_t version = CAPTURE_VERSION;
+        pending.append(CAPTURE_MAGIC,4);
+        pending.append(reinterpret_cast<const char*>(&version),sizeof(version));
+        pending.append(reinterpret_cast<const char*>(&wall_us),sizeof(wall_us));
+        writer = thread(&TrafficCapture::writeLoop,this);
+        LOG_INFO("capturing 1 in %zu connections to %s",this->sample_every,path.c_str());
+    }
+
+    ~TrafficCapture() {
+        if(fd == -1) return;
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        cond.notify_one();
+        writer.join();
+        close(fd);
+    }
+
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+    bool enabled() const {
+        return fd != -1;
+    }
+
+    //  新连接是否录制，返回连接编号（从1开始），不录制时返回0  --  只在主循环中调用
+    uint32_t sample() {
+        if(fd == -1 || connections++ % sample_every != 0) return 0;
+        return ++next_id;
+    }
+
+    //  记录buffer末尾刚读进来的n个字节
+    void record(uint32_t id,const ChainBuffer& buffer,size_t n) {
+        lock_guard<mutex> lock(mtx);
+        if(!reserve(n)) return;
+        appendHeader(id,n);
+        buffer.visit(buffer.size() - n,n,[this](const char* data,size_t len){ pending.append(data,len); });
+        captured.add(n);
+        if(pending.size() >= CAPTURE_FLUSH_BYTES) cond.notify_one();
+    }
+
+    //  连接关闭  --  只在主循环中调用，只追加记录，写文件留给后台线程
+    void closed(uint32_t id) {
+        lock_guard<mutex> lock(mtx);
+        if(reserve(0)) appendHeader(id,0);
+    }
+
+private:
+    //  记录头16个字节；时间在锁里取，文件里的记录按时间排好序
+    void appendHeader(uint32_t id,size_t n) {
+        char header[16];
+        uint64_t offset_us = Metrics::nowUs() - start_us;
+        uint32_t len = static_cast<uint32_t>(n);
+        memcpy(header,&offset_us,8);
+        memcpy(header + 8,&id,4);
+        memcpy(header + 12,&len,4);
+        pending.append(header,sizeof(header));
+    }
+
+    //  文件大小超过上限后丢弃之后的记录
+    bool reserve(size_t n) {
+        if(written + pending.size() + 16 + n > max_bytes) {
+            if(dropped.value() == 0) LOG_WARNING("capture file reached %zu bytes, stop capturing",max_bytes);
+            dropped.add();
+            return false;
+        }
+        return true;
+    }
+
+    void writeLoop() {
+        string batch;
+        unique_lock<mutex> lock(mtx);
+        while(1) {
+            cond.wait_for(lock,chrono::milliseconds(CAPTURE_FLUSH_MS),[this]{
+                return stopping || pending.size() >= CAPTURE_FLUSH_BYTES;
+            });
+            bool last = stopping;
+            batch.swap(pending);
+            written += batch.size();
+            lock.unlock();
+            for(size_t off = 0;off < batch.size();) {
+                ssize_t n = ::write(fd,batch.data() + off,batch.size() - off);
+                if(n <= 0) {
+                    if(n == -1 && errno == EINTR) continue;
+                    LOG_ERROR("capture write failed: %s",strerror(errno));
+                    break;
+                }
+                off += n;
+            }
+            batch.clear();
+            lock.lock();
+            if(last) return;
+        }
+    }
+
+    int fd;
+    size_t sample_every;
+    size_t max_bytes;
+    uint64_t connections;       //  接受过的连接数，只由主循环访问
+    uint32_t next_id;           //  上一个录制的连接的编号，只由主循环访问
+    uint64_t start_us;          //  开始录制的时间（单调时钟）
+
+    mutex mtx;                  //  保护下面几个成员
+    string pending;             //  还没写进文件的记录
+    size_t written;             //  已经交给后台线程写的字节数
+    bool stopping;
+    condition_variable cond;
+    thread writer;              //  后台写文件的线程
+
+    Counter& captured;
+    Counter& dropped;
+};
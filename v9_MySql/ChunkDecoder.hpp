@@ -0,0 +1,164 @@
+#pragma once
+//  分块编码请求体的增量解码器  --  每块是 十六进制长度[;扩展]\r\n数据\r\n，以长度为0的块和可选的尾部头结束
+//  状态保存在连接上，每次读到新数据时从上次停下的地方继续，解码过的原始字节立即从输入缓冲区里消费掉，
+//  不会因为请求体分很多次到达而反复扫描前面的块
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include "Buffer.hpp"
+using namespace std;
+
+#define MAX_CHUNK_LINE 1024             //  长度行（包括扩展）和尾部头每一行的最大长度
+#define MAX_CHUNK_OVERHEAD 65536        //  分块格式本身（长度行和换行）的字节数最多比数据多这么多，防止用1字节的块拖垮CPU
+#define CHUNK_LINE_PROBE 32             //  找长度行的结尾时先看这么多字节
+
+
+class ChunkDecoder {
+public:
+    enum Result {
+        COMPLETE,       //  请求体已经读完
+        PARTIAL,        //  还要继续读
+        INVALID,        //  格式错误
+        TOO_LARGE       //  超过了max_body
+    };
+
+    ChunkDecoder(): state(IDLE),remaining(0),overhead(0),trailer_bytes(0),max_body(0),max_trailer(0) {}
+
+    //  开始解码一个新的请求体
+    void start(size_t max_body,size_t max_trailer) {
+        reset();
+        state = SIZE;
+        this->max_body = max_body;
+        this->max_trailer = max_trailer;
+    }
+
+    //  放弃正在解码的请求体
+    void reset() {
+        state = IDLE;
+        remaining = overhead = trailer_bytes = 0;
+        string().swap(decoded);
+    }
+
+    //  是否有解码到一半的请求体
+    bool active() const {
+        return state != IDLE;
+    }
+
+    //  解码in开头的数据，用掉的字节从in里消费；返回COMPLETE后用takeBody取出请求体，解码器回到空闲
+    int decode(ChainBuffer& in) {
+        while(state != IDLE) {
+            if(state == SIZE) {
+                string line;
+                if(!readLine(in,line)) return in.size() > MAX_CHUNK_LINE ? fail(INVALID) : PARTIAL;
+                size_t size = 0;
+                if(!parseSize(line,size)) return fail(INVALID);
+                if(size > max_body || decoded.size() + size > max_body) return fail(TOO_LARGE);
+                overhead += line.size() + 2;
+                if(overhead > decoded.size() + size + MAX_CHUNK_OVERHEAD) return fail(INVALID);
+                remaining = static_cast<size_t>(size);
+                if(remaining == 0) {
+                    state = TRAILER;
+                } else {
+                    decoded.reserve(decoded.size() + remaining);
+                    state = DATA;
+                }
+            } else if(state == DATA) {
+                size_t n = min(remaining,in.size());
+                if(n == 0) return PARTIAL;
+                in.visit(0,n,[this](const char* data,size_t len){ decoded.append(data,len); });
+                in.consume(n);
+                remaining -= n;
+                if(remaining == 0) state = DATA_END;
+            } else if(state == DATA_END) {
+                if(in.size() < 2) return PARTIAL;
+                if(in.copyOut(0,2) != "\r\n") return fail(INVALID);
+                in.consume(2);
+                overhead += 2;
+                state = SIZE;
+            } else {
+                //  尾部头一行一行丢弃，空行结束
+                string line;
+                if(!readLine(in,line)) return in.size() > MAX_CHUNK_LINE ? fail(INVALID) : PARTIAL;
+                trailer_bytes += line.size() + 2;
+                if(trailer_bytes > max_trailer) return fail(INVALID);
+                if(line.empty()) {
+                    state = IDLE;
+                    return COMPLETE;
+                }
+            }
+        }
+        return INVALID;
+    }
+
+    //  取出解码好的请求体
+    string takeBody() {
+        string body;
+        body.swap(decoded);
+        return body;
+    }
+
+private:
+    enum State {
+        IDLE,           //  没有在解码
+        SIZE,           //  等长度行
+        DATA,           //  读块的数据，还剩remaining字节
+        DATA_END,       //  等块数据后面的\r\n
+        TRAILER         //  丢弃尾部头
+    };
+
+    //  从in开头取出一行（不含\r\n）并消费掉，只在前MAX_CHUNK_LINE个字节里找，找不到返回false
+    //  长度行一般只有几个字节，先看开头的一小段，找不到再看完整的MAX_CHUNK_LINE
+    static bool readLine(ChainBuffer& in,string& line) {
+        string head = in.copyOut(0,CHUNK_LINE_PROBE);
+        size_t line_end = head.find("\r\n");
+        if(line_end == string::npos && in.size() > CHUNK_LINE_PROBE) {
+            head = in.copyOut(0,MAX_CHUNK_LINE + 2);
+            line_end = head.find("\r\n");
+        }
+        if(line_end == string::npos) return false;
+        line = head.substr(0,line_end);
+        in.consume(line_end + 2);
+        return true;
+    }
+
+    //  长度行必须是 1*HEXDIG [BWS ";" 扩展]，不接受strtoull认的空白、正负号和0x前缀
+    //  前面的代理和这里对长度的理解不一样就可能被用来夹带请求；太长溢出时返回SIZE_MAX，由调用的地方当成TOO_LARGE
+    static bool parseSize(const string& line,size_t& size) {
+        size_t i = 0;
+        size = 0;
+        for(; i < line.size(); ++i) {
+            int digit = hexDigit(line[i]);
+            if(digit < 0) break;
+            if(size > (SIZE_MAX >> 4)) {
+                size = SIZE_MAX;
+            } else {
+                size = (size << 4) | digit;
+            }
+        }
+        if(i == 0) return false;
+        if(i == line.size()) return true;
+        //  空白后面一定要有扩展
+        while(i < line.size() && (line[i] == ' ' || line[i] == '\t')) ++i;
+        return i < line.size() && line[i] == ';';
+    }
+
+    static int hexDigit(char c) {
+        if(c >= '0' && c <= '9') return c - '0';
+        if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    int fail(int result) {
+        reset();
+        return result;
+    }
+
+    State state;
+    size_t remaining;       //  当前块还没读到的数据
+    size_t overhead;        //  到目前为止格式本身占的字节数
+    size_t trailer_bytes;   //  到目前为止尾部头的字节数
+    size_t max_body;
+    size_t max_trailer;
+    string decoded;         //  已经解码出来的请求体
+};
@@ -0,0 +1,349 @@
+#pragma once
+//  响应压缩  --  根据Accept-Encoding协商编码，gzip和deflate用zlib实现，编译时定义了USE_BROTLI还支持br
+//  动态生成的响应在工作线程里压缩；静态内容在加载时就把各种编码压缩好，请求时直接挑一个
+#include <zlib.h>
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+#include <time.h>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+#include "MimeTypes.hpp"
+using namespace std;
+
+
+//  路由的压缩策略
+struct CompressionPolicy {
+    bool enabled = true;        //  是否压缩该路由的响应
+    size_t min_bytes = 1024;    //  响应体小于这个长度时不压缩，压缩头的开销和CPU都不划算
+    int level = 6;              //  压缩级别，zlib为1-9，brotli为0-11（超出时截断）
+};
+
+
+//  压缩的统计：压缩花的CPU时间和省下的字节数
+struct CompressionStats {
+    atomic<uint64_t> compressed{0};     //  在工作线程里压缩的响应数
+    atomic<uint64_t> precompressed{0};  //  直接发送预压缩版本的响应数
+    atomic<uint64_t> skipped{0};        //  太小或者压缩后没有变小而原样发送的响应数
+    atomic<uint64_t> bytes_in{0};       //  压缩前的字节数（包括预压缩的）
+    atomic<uint64_t> bytes_out{0};      //  压缩后的字节数（包括预压缩的）
+    atomic<uint64_t> cpu_ns{0};         //  工作线程压缩花费的CPU时间
+
+    //  压缩后占原来的比例
+    double ratio() const {
+        uint64_t in = bytes_in.load(memory_order_relaxed);
+        return in == 0 ? 1.0 : static_cast<double>(bytes_out.load(memory_order_relaxed)) / in;
+    }
+
+    //  每省下一个字节花费的CPU时间（纳秒）
+    double nsPerSavedByte() const {
+        uint64_t in = bytes_in.load(memory_order_relaxed);
+        uint64_t out = bytes_out.load(memory_order_relaxed);
+        return in <= out ? 0.0 : static_cast<double>(cpu_ns.load(memory_order_relaxed)) / (in - out);
+    }
+};
+
+
+class Compression {
+public:
+    enum Encoding {
+        IDENTITY,
+        GZIP,
+        DEFLATE,
+        BROTLI,
+        ENCODING_COUNT
+    };
+
+    //  Content-Encoding里的名字
+    static const char* name(Encoding encoding) {
+        switch(encoding) {
+        case GZIP:      return "gzip";
+        case DEFLATE:   return "deflate";
+        case BROTLI:    return "br";
+        default:        return "identity";
+        }
+    }
+
+    //  当前编译的版本是否支持该编码
+    static bool available(Encoding encoding) {
+#ifdef USE_BROTLI
+        return encoding != ENCODING_COUNT;
+#else
+        return encoding != BROTLI && encoding != ENCODING_COUNT;
+#endif
+    }
+
+    //  根据Accept-Encoding选出编码：q值最大的优先，q值相同时按br，gzip，deflate的顺序
+    //  mask的第i位表示第i种编码可选，客户端没有接受任何可选的编码时返回IDENTITY
+    static Encoding negotiate(const string& accept_encoding,unsigned mask = ~0u) {
+        //  没有出现的编码q值为-1，之后用*的q值代替
+        double q[ENCODING_COUNT] = {-1,-1,-1,-1};
+        double star = -1;
+        size_t pos = 0;
+        while(pos < accept_encoding.size()) {
+            size_t end = accept_encoding.find(',',pos);
+            if(end == string::npos) end = accept_encoding.size();
+            string item = accept_encoding.substr(pos,end - pos);
+            pos = end + 1;
+
+            size_t semi = item.find(';');
+            string coding = trim(item.substr(0,semi));
+            double value = 1.0;
+            if(semi != string::npos) {
+                size_t qpos = item.find("q=",semi);
+                if(qpos != string::npos) value = atof(item.c_str() + qpos + 2);
+            }
+            for(char& c : coding) c = tolower(static_cast<unsigned char>(c));
+            if(coding == "gzip" || coding == "x-gzip") q[GZIP] = value;
+            else if(coding == "deflate") q[DEFLATE] = value;
+            else if(coding == "br") q[BROTLI] = value;
+            else if(coding == "*") star = value;
+        }
+
+        static const Encoding preference[] = {BROTLI,GZIP,DEFLATE};
+        Encoding best = IDENTITY;
+        double best_q = 0;
+        for(Encoding encoding : preference) {
+            if(!available(encoding) || !(mask & (1u << encoding))) continue;
+            double value = q[encoding] < 0 ? star : q[encoding];
+            if(value > best_q) {
+                best = encoding;
+                best_q = value;
+            }
+        }
+        return best;
+    }
+
+    //  压缩in写到out里，失败时返回false
+    static bool compress(Encoding encoding,const string& in,string& out,int level) {
+        return compress(encoding,in.data(),in.size(),out,level);
+    }
+
+    static bool compress(Encoding encoding,const char* data,size_t size,string& out,int level) {
+        if(encoding == GZIP || encoding == DEFLATE) {
+            //  HTTP的deflate是带zlib头的格式，gzip在windowBits上加16
+            z_stream zs;
+            memset(&zs,0,sizeof(zs));
+            int window_bits = encoding == GZIP ? 15 + 16 : 15;
+            level = level < 1 ? 1 : (level > 9 ? 9 : level);
+            if(deflateInit2(&zs,level,Z_DEFLATED,window_bits,8,Z_DEFAULT_STRATEGY) != Z_OK) {
+                return false;
+            }
+            out.resize(deflateBound(&zs,size));
+            zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            zs.avail_in = size;
+            zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+            zs.avail_out = out.size();
+            int ret = deflate(&zs,Z_FINISH);
+            out.resize(zs.total_out);
+            deflateEnd(&zs);
+            return ret == Z_STREAM_END;
+        }
+#ifdef USE_BROTLI
+        if(encoding == BROTLI) {
+            size_t bound = BrotliEncoderMaxCompressedSize(size);
+            if(bound == 0) return false;
+            out.resize(bound);
+            int quality = level < 0 ? 0 : (level > 11 ? 11 : level);
+            if(!BrotliEncoderCompress(quality,BROTLI_DEFAULT_WINDOW,BROTLI_MODE_TEXT,size,
+                                      reinterpret_cast<const uint8_t*>(data),&bound,
+                                      reinterpret_cast<uint8_t*>(&out[0]))) {
+                return false;
+            }
+            out.resize(bound);
+            return true;
+        }
+#endif
+        return false;
+    }
+
+    //  该类型的内容是否值得压缩
+    static bool compressible(const string& content_type) {
+        return MimeTypes::compressible(content_type);
+    }
+
+    //  当前线程消耗的CPU时间（纳秒），用来统计压缩的开销
+    static uint64_t threadCpuNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+    //  全局的压缩统计
+    static CompressionStats& stats() {
+        static CompressionStats stats;
+        return stats;
+    }
+
+    //  在工作线程里按协商结果压缩一个响应，压缩了返回true
+    //  已经设置了Content-Encoding（比如预压缩的静态内容）和流式的响应不处理
+    static bool compressResponse(const HttpRequest& request,HttpResponse& response,const CompressionPolicy& policy) {
+        //  只压缩完整的200响应，304/206等的响应体和压缩无关
+        if(!policy.enabled || response.getStatusCode() != 200 || response.isChunked()) return false;
+        if(!response.getHeader("Content-Encoding").empty()) return false;
+        if(!compressible(response.getHeader("Content-Type"))) return false;
+        //  响应内容随Accept-Encoding变化，告诉缓存按它区分
+        response.setHeader("Vary","Accept-Encoding");
+        const string& body = response.getBody();
+        if(body.size() < policy.min_bytes) {
+            stats().skipped++;
+            return false;
+        }
+        Encoding encoding = negotiate(request.getHeader("Accept-Encoding"));
+        if(encoding == IDENTITY) return false;
+
+        uint64_t start = threadCpuNs();
+        string out;
+        bool ok = compress(encoding,body,out,policy.level);
+        stats().cpu_ns += threadCpuNs() - start;
+        if(!ok || out.size() >= body.size()) {
+            stats().skipped++;
+            return false;
+        }
+        stats().compressed++;
+        stats().bytes_in += body.size();
+        stats().bytes_out += out.size();
+        response.setBody(out);
+        response.setHeader("Content-Encoding",name(encoding));
+        return true;
+    }
+
+private:
+    static string trim(const string& str) {
+        size_t begin = str.find_first_not_of(" \t");
+        if(begin == string::npos) return string();
+        size_t end = str.find_last_not_of(" \t");
+        return str.substr(begin,end - begin + 1);
+    }
+};
+
+
+//  预压缩的内容：加载时把每种可用的编码都压缩一次，之后请求只是挑一个版本，不再花CPU
+//  内容可以复制一份保存，也可以直接引用外部的内存（比如mmap映射的文件，或者编译时嵌入的数组）
+class PrecompressedBody {
+public:
+    PrecompressedBody() {}
+
+    explicit PrecompressedBody(const string& body) {
+        load(body);
+    }
+
+    //  内部可能指向自己保存的原始内容，不能复制
+    PrecompressedBody(const PrecompressedBody&) = delete;
+    PrecompressedBody& operator=(const PrecompressedBody&) = delete;
+
+    //  复制一份内容并压缩出各个版本；level为-1时用最高级别
+    void load(const string& body,int level = -1) {
+        owned = body;
+        compressVariants(owned.data(),owned.size(),level);
+    }
+
+    //  引用外部的内容并压缩出各个版本，调用者保证data在本对象存活期间有效；compress为false时只保留原始内容
+    void load(const char* data,size_t size,int level,bool compress) {
+        owned.clear();
+        if(compress) {
+            compressVariants(data,size,level);
+        } else {
+            setIdentity(data,size);
+        }
+    }
+
+    //  原始内容
+    const char* data() const {
+        return this->content;
+    }
+
+    size_t size() const {
+        return this->length;
+    }
+
+    //  直接使用已经压缩好的各个版本，不复制，调用者保证这些内存在本对象存活期间有效
+    //  data和size的下标为Compression::Encoding，size为0的压缩版本表示没有
+    void loadPrepared(const char* const data[],const size_t size[]) {
+        owned.clear();
+        setIdentity(data[Compression::IDENTITY],size[Compression::IDENTITY]);
+        for(int i = Compression::GZIP;i < Compression::ENCODING_COUNT;++i) {
+            if(size[i] == 0 || !Compression::available(static_cast<Compression::Encoding>(i))) continue;
+            variant_data[i] = data[i];
+            variant_size[i] = size[i];
+            mask |= 1u << i;
+        }
+    }
+
+    //  某种压缩版本的长度，为0表示没有
+    size_t variantSize(Compression::Encoding encoding) const {
+        return variant_size[encoding];
+    }
+
+    //  是否有压缩版本，有的话响应内容会随Accept-Encoding变化
+    bool hasVariants() const {
+        return mask != (1u << Compression::IDENTITY);
+    }
+
+    //  按请求的Accept-Encoding选出要发送的版本
+    Compression::Encoding negotiate(const HttpRequest& request) const {
+        return Compression::negotiate(request.getHeader("Accept-Encoding"),mask);
+    }
+
+    //  按请求的Accept-Encoding把合适的版本放进响应里
+    void apply(const HttpRequest& request,HttpResponse& response) const {
+        apply(negotiate(request),response);
+    }
+
+    //  把某个版本放进响应里
+    void apply(Compression::Encoding encoding,HttpResponse& response) const {
+        if(hasVariants()) response.setHeader("Vary","Accept-Encoding");
+        if(encoding == Compression::IDENTITY) {
+            response.setBody(string(content,length));
+            return;
+        }
+        response.setBody(string(variant_data[encoding],variant_size[encoding]));
+        response.setHeader("Content-Encoding",Compression::name(encoding));
+        CompressionStats& stats = Compression::stats();
+        stats.precompressed++;
+        stats.bytes_in += length;
+        stats.bytes_out += variant_size[encoding];
+    }
+
+private:
+    void setIdentity(const char* data,size_t size) {
+        content = size == 0 ? "" : data;
+        length = size;
+        mask = 1u << Compression::IDENTITY;
+        for(int i = 0;i < Compression::ENCODING_COUNT;++i) {
+            variants[i].clear();
+            variant_data[i] = "";
+            variant_size[i] = 0;
+        }
+    }
+
+    //  压缩后没有变小的编码不保留
+    void compressVariants(const char* data,size_t size,int level) {
+        setIdentity(data,size);
+        for(int i = Compression::GZIP;i < Compression::ENCODING_COUNT;++i) {
+            Compression::Encoding encoding = static_cast<Compression::Encoding>(i);
+            if(!Compression::available(encoding)) continue;
+            string out;
+            int effective = level >= 0 ? level : (encoding == Compression::BROTLI ? 11 : 9);
+            if(Compression::compress(encoding,data,size,out,effective) && out.size() < size) {
+                variants[i] = out;
+                variant_data[i] = variants[i].data();
+                variant_size[i] = variants[i].size();
+                mask |= 1u << i;
+            }
+        }
+    }
+
+    string owned;                       //  复制保存的原始内容
+    const char* content = "";           //  原始内容，指向owned或者外部的内存
+    size_t length = 0;
+    string variants[Compression::ENCODING_COUNT];   //  自己压缩出来的各个版本，下标为Compression::Encoding
+    const char* variant_data[Compression::ENCODING_COUNT] = {"","","",""};  //  各个压缩版本，指向variants或者外部的内存
+    size_t variant_size[Compression::ENCODING_COUNT] = {0,0,0,0};
+    unsigned mask = 1u << Compression::IDENTITY;    //  有哪些版本可用
+};
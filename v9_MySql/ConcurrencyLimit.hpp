@@ -0,0 +1,111 @@
+#pragma once
+//  自适应并发限制  --  HttpServer把耗时的请求交给处理函数（进而访问数据库）之前先拿一个名额，在途的请求数达到限制时
+//  直接拒绝；限制根据测到的延迟（从拿到名额到处理完，包括在线程池里排队的时间）不断调整，不用为每台机器手工调队列容量
+//  aimd：延迟超过阈值时乘以0.9，否则在途请求用到了限制的一半以上时加1
+//  gradient：比较没有排队时的延迟（见过的最小延迟）和最近的延迟，最近变慢了就按比例收缩，再留出sqrt(limit)的排队余量；
+//           在途请求不到限制的一半时不调整，这时负载还没到瓶颈，延迟说明不了问题
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include "Metrics.hpp"
+#include "ServerConfig.hpp"
+using namespace std;
+
+#define LIMIT_AIMD_BACKOFF 0.9          //  aimd过载时限制乘以这个系数
+#define LIMIT_TOLERANCE 1.5             //  gradient：最近的延迟不超过最小延迟的这么多倍时不收缩
+#define LIMIT_SMOOTHING 0.2             //  gradient：每个样本把限制向新的估计值移动这么多
+#define LIMIT_BASE_DRIFT 1.001          //  gradient：最小延迟每个样本上浮这么多，没有排队的延迟本身变大时也能跟上
+#define LIMIT_SHORT_WINDOW 10           //  最近延迟的窗口（样本数）
+
+
+class ConcurrencyLimiter {
+public:
+    explicit ConcurrencyLimiter(const ConcurrencyLimitOptions& options)
+    :options(options),limit(0),inflight(0),samples(0),base_us(0),short_us(0),
+     limit_gauge(MetricsRegistry::global().gauge("http_concurrency_limit","Adaptive in-flight limit for slow requests")),
+     inflight_gauge(MetricsRegistry::global().gauge("http_concurrency_inflight","Slow requests holding a limiter slot")),
+     rejected(MetricsRegistry::global().counter("http_concurrency_rejections_total",
+                                                "Slow requests answered with 503 by the concurrency limiter")) {
+        this->options.min_limit = max<size_t>(this->options.min_limit,1);
+        this->options.max_limit = max(this->options.max_limit,this->options.min_limit);
+        if(enabled()) setLimit(static_cast<double>(options.initial_limit));
+    }
+
+    bool enabled() const {
+        return options.algorithm != ConcurrencyLimitOptions::OFF;
+    }
+
+    //  拿一个名额，在途的请求已经达到限制时返回false
+    bool tryAcquire() {
+        {
+            lock_guard<mutex> lock(limit_mutex);
+            if(inflight < static_cast<size_t>(limit)) {
+                inflight++;
+                inflight_gauge.inc();
+                return true;
+            }
+        }
+        rejected.add();
+        return false;
+    }
+
+    //  请求处理完，归还名额并用它的延迟调整限制
+    void release(uint64_t latency_us) {
+        lock_guard<mutex> lock(limit_mutex);
+        if(options.algorithm == ConcurrencyLimitOptions::AIMD) {
+            aimd(static_cast<double>(latency_us));
+        } else {
+            gradient(static_cast<double>(latency_us));
+        }
+        inflight--;
+        inflight_gauge.dec();
+    }
+
+    size_t getLimit() {
+        lock_guard<mutex> lock(limit_mutex);
+        return static_cast<size_t>(limit);
+    }
+
+    size_t getInflight() {
+        lock_guard<mutex> lock(limit_mutex);
+        return inflight;
+    }
+
+private:
+    //  调用时必须持有limit_mutex，inflight还包括正在归还的这个请求
+    void aimd(double latency_us) {
+        if(latency_us > options.latency_ms * 1000.0) {
+            setLimit(limit * LIMIT_AIMD_BACKOFF);
+        } else if(inflight * 2 >= static_cast<size_t>(limit)) {
+            setLimit(limit + 1);
+        }
+    }
+
+    void gradient(double latency_us) {
+        samples++;
+        base_us = samples == 1 ? latency_us : min(latency_us,base_us * LIMIT_BASE_DRIFT);
+        short_us = samples == 1 ? latency_us : short_us + (latency_us - short_us) / LIMIT_SHORT_WINDOW;
+        if(inflight * 2 < static_cast<size_t>(limit)) return;
+        double ratio = max(0.5,min(1.0,LIMIT_TOLERANCE * base_us / max(short_us,1.0)));
+        double estimate = limit * ratio + sqrt(limit);
+        setLimit(limit * (1 - LIMIT_SMOOTHING) + estimate * LIMIT_SMOOTHING);
+    }
+
+    void setLimit(double value) {
+        value = max(static_cast<double>(options.min_limit),min(static_cast<double>(options.max_limit),value));
+        limit_gauge.add(static_cast<int64_t>(value) - static_cast<int64_t>(limit));
+        limit = value;
+    }
+
+    ConcurrencyLimitOptions options;
+    mutex limit_mutex;          //  保护下面几个成员
+    double limit;               //  当前的限制，取整数部分
+    size_t inflight;            //  拿着名额的请求数
+    uint64_t samples;           //  收到的延迟样本数
+    double base_us;             //  没有排队时的延迟
+    double short_us;            //  最近的延迟
+    Gauge& limit_gauge;
+    Gauge& inflight_gauge;
+    Counter& rejected;
+};
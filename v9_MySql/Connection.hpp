@@ -0,0 +1,107 @@
+#pragma once
+//  该类保存一个客户端连接的状态：读到一半的数据，当前所处的超时阶段以及对应的定时器
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include "TimerWheel.hpp"
+#include "Buffer.hpp"
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+#include "ChunkDecoder.hpp"
+#include "Http2.hpp"
+#include "Tls.hpp"
+using namespace std;
+
+
+//  排在流式响应后面、还不能写进输出缓冲区的响应
+struct PendingResponse {
+    PendingResponse(const HttpResponse& response,bool keep_alive,const string& version)
+    : response(response),keep_alive(keep_alive),version(version) {}
+
+    HttpResponse response;
+    bool keep_alive;
+    string version;     //  请求的协议版本，决定流式响应能不能用分块编码
+};
+
+
+struct Connection {
+    //  连接当前所处的阶段，决定了挂在时间轮上的是哪一种超时
+    enum Phase {
+        IDLE,       //  空闲，等待下一个请求的第一个字节  --  空闲超时
+        HEADER,     //  已经收到数据但请求头还没读完      --  请求头超时（防slowloris）
+        REQUEST     //  请求头已读完，正在读请求体或处理  --  请求超时
+    };
+
+    //  工作线程处理完之后告诉主循环该怎么做
+    enum Action {
+        KEEP,       //  继续监听该连接
+        CLOSE       //  关闭连接
+    };
+
+    Connection(): fd(-1),generation(0),in_use(false) {
+        reset(-1);
+    }
+
+    //  复用连接对象前重置状态  --  缓冲区在关闭时已经清空，定时器已经取消
+    void reset(int fd) {
+        this->fd = fd;
+        busy = false;
+        expired = false;
+        phase = IDLE;
+        action = KEEP;
+        want_write = false;
+        close_after_write = false;
+        peer_closed = false;
+        deadline = 0;
+        deadline_phase = IDLE;
+        dispatched_us = started_us = 0;
+        capture_id = 0;
+        cpu = -1;
+        stream = nullptr;
+        stream_chunked = true;
+        queued.clear();
+        body_request = HttpRequest();
+        body_wanted = 0;
+        chunked.reset();
+        h2.reset();
+#ifdef USE_TLS
+        tls.reset();
+#endif
+    }
+
+    //  放进epoll_event.data里的标识：高32位是代数，低32位是fd
+    uint64_t token() const {
+        return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+    }
+
+    int fd;             //  客户端socket
+    uint32_t generation;    //  代数，每次复用都加一，用来识别过期的事件
+    bool in_use;        //  是否正在使用
+    bool busy;          //  是否正在被工作线程处理，只由主循环读写
+    bool expired;       //  在工作线程处理期间超时了，处理完后直接关闭
+    Phase phase;        //  当前阶段，由工作线程更新
+    Action action;      //  工作线程的处理结果
+    bool want_write;    //  输出缓冲区还有数据没发完，需要等可写事件
+    bool close_after_write;     //  发送完输出缓冲区后关闭连接
+    bool peer_closed;   //  对端已经关闭了写方向（读到了EOF）
+    uint64_t deadline;  //  当前定时器的截止时间（毫秒，单调时钟），为0表示需要重新计算
+    Phase deadline_phase;   //  当前定时器对应的阶段
+    ChainBuffer inbuf;  //  读到但还没处理完的数据
+    ChainBuffer outbuf; //  还没发送出去的响应
+    HttpResponse::BodyProducer stream;  //  正在发送的流式响应体，输出缓冲区低于水位线时继续生成
+    bool stream_chunked;                //  流式响应体是否按分块编码发送，HTTP/1.0的客户端直接发原始数据
+    vector<PendingResponse> queued;     //  流式响应发完之前，后面的流水线响应在这里排队
+    HttpRequest body_request;           //  请求头已经解析、分块的请求体还没读完的请求
+    ChunkDecoder chunked;               //  这个请求的请求体解码到了哪里
+    size_t body_wanted;                 //  输入缓冲区开头的请求在等的Content-Length请求体的长度，决定最多读多少数据
+    unique_ptr<Http2Session> h2;        //  换成HTTP/2之后的会话状态，HTTP/1.1连接为空
+#ifdef USE_TLS
+    unique_ptr<TlsStream> tls;          //  TLS连接的状态，明文连接为空
+#endif
+    uint64_t dispatched_us; //  启用阶段计时时，主循环最近一次把连接交给线程池的时间
+    uint64_t started_us;    //  启用阶段计时时，工作线程最近一次开始处理连接的时间
+    uint32_t capture_id;    //  录制流量时这个连接的编号，不录制为0
+    int cpu;                //  收包的CPU（SO_INCOMING_CPU），不知道时为-1
+    TimerNode timer;    //  挂在时间轮上的定时器
+};
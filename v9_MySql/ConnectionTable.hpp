@@ -0,0 +1,124 @@
+#pragma once
+//  连接表  --  按fd直接索引的连接对象数组
+//  内核分配fd时总是取最小的可用值，所以fd本身就是很紧凑的下标；连接对象按块（1024个）申请，
+//  第一次用到某个fd范围时才申请对应的块，之后accept和close都只是复用，不再申请和释放内存
+//  epoll_event.data里放的是 代数<<32 | fd，连接被关闭再复用后代数变化，旧的事件就能被识别出来丢掉
+#include <sys/resource.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Connection.hpp"
+using namespace std;
+
+
+class ConnectionTable {
+public:
+    //  capacity为最多能容纳的fd数量，on_timeout为连接定时器到期时的回调
+    ConnectionTable(size_t capacity,function<void(Connection*)> on_timeout)
+    :capacity(capacity),chunks((capacity + CHUNK - 1) / CHUNK),on_timeout(on_timeout),active(0) {}
+
+    //  根据进程当前的fd软上限确定容量，只读取不修改；提高上限由服务器启动时负责
+    static size_t fdLimit(size_t max_connections) {
+        struct rlimit limit;
+        if(getrlimit(RLIMIT_NOFILE,&limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < max_connections) {
+            return limit.rlim_cur;
+        }
+        return max_connections;
+    }
+
+    //  改变容量，只能在还没有连接的时候调用
+    void resize(size_t capacity) {
+        this->capacity = capacity;
+        chunks.resize((capacity + CHUNK - 1) / CHUNK);
+    }
+
+    //  为新接受的fd取一个连接对象，fd超出容量时返回nullptr
+    Connection* acquire(int fd) {
+        if(fd < 0 || static_cast<size_t>(fd) >= capacity) return nullptr;
+        unique_ptr<Connection[]>& chunk = chunks[fd / CHUNK];
+        if(!chunk) {
+            chunk.reset(new Connection[CHUNK]);
+            for(size_t i = 0;i < CHUNK;++i) {
+                Connection* conn = &chunk[i];
+                conn->timer.callback = [conn,this]{ this->on_timeout(conn); };
+            }
+        }
+        Connection* conn = &chunk[fd % CHUNK];
+        conn->reset(fd);
+        //  代数为0留给监听socket等非连接的fd使用
+        if(++conn->generation == 0) conn->generation = 1;
+        conn->in_use = true;
+        ++active;
+        return conn;
+    }
+
+    //  释放连接对象，只清空状态，内存留着下次复用
+    void release(Connection* conn) {
+        conn->inbuf.clear();
+        conn->outbuf.clear();
+        conn->stream = nullptr;     //  流式响应的生成函数可能持有文件等资源，关闭时就释放
+        conn->queued.clear();
+        conn->h2.reset();
+#ifdef USE_TLS
+        conn->tls.reset();
+#endif
+        conn->in_use = false;
+        conn->fd = -1;
+        --active;
+    }
+
+    //  根据epoll_event.data里的标识找到连接，连接已关闭或者已被复用时返回nullptr
+    Connection* lookup(uint64_t token) const {
+        uint32_t fd = static_cast<uint32_t>(token);
+        uint32_t generation = static_cast<uint32_t>(token >> 32);
+        if(generation == 0 || fd >= capacity) return nullptr;
+        const unique_ptr<Connection[]>& chunk = chunks[fd / CHUNK];
+        if(!chunk) return nullptr;
+        Connection* conn = &chunk[fd % CHUNK];
+        if(!conn->in_use || conn->generation != generation) return nullptr;
+        return conn;
+    }
+
+    //  遍历所有正在使用的连接
+    void forEach(const function<void(Connection*)>& func) {
+        for(auto& chunk : chunks) {
+            if(!chunk) continue;
+            for(size_t i = 0;i < CHUNK;++i) {
+                if(chunk[i].in_use) func(&chunk[i]);
+            }
+        }
+    }
+
+    //  正在使用的连接数
+    size_t size() const {
+        return active;
+    }
+
+    //  一个空闲keep-alive连接占用的用户态内存：连接对象本身加上它在块目录中的份额
+    //  空闲连接的输入输出缓冲区都是空的，不占用内存块；内核socket缓冲区不计算在内
+    //  目录的份额不到一个字节，按整数除会变成0，所以用浮点数算
+    static double bytesPerIdleConnection() {
+        return sizeof(Connection) + static_cast<double>(sizeof(unique_ptr<Connection[]>)) / CHUNK;
+    }
+
+    //  已经申请的连接对象占用的内存
+    size_t allocatedBytes() const {
+        size_t n = 0;
+        for(auto& chunk : chunks) {
+            if(chunk) n += CHUNK * sizeof(Connection);
+        }
+        return n + chunks.size() * sizeof(unique_ptr<Connection[]>);
+    }
+
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+private:
+    static const size_t CHUNK = 1024;
+
+    size_t capacity;                                //  最大fd数量
+    vector<unique_ptr<Connection[]>> chunks;        //  块目录，按容量预先分配好
+    function<void(Connection*)> on_timeout;         //  定时器到期回调
+    size_t active;                                  //  正在使用的连接数
+};
@@ -3,19 +3,36 @@
 #include <string>
 #include <stdexcept>        //  错误管理的头文件
 #include <cstring>        
+#include <mutex>          //  一个MYSQL连接不能被多个线程同时使用
 
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
 using namespace std;
 
 
 class Database {
 private:
+    //  在请求的阶段计时里记下数据库调用的开始和结束
+    struct DbStage {
+        DbStage() { Tracer::mark(RequestTrace::DB_BEGIN); }
+        ~DbStage() { Tracer::mark(RequestTrace::DB_END); }
+    };
+
+
     MYSQL mysql;
     MYSQL *conn;
+    mutex conn_mutex;   //  工作线程会并发调用，同一时间只能有一个线程使用conn
+    Histogram& register_latency;    //  注册的耗时，包括等待conn_mutex的时间
+    Histogram& login_latency;       //  登录的耗时，包括等待conn_mutex的时间
 
 public:
     //  构造函数，用于打开数据库并创建用户表
-    Database() {
+    Database()
+    :register_latency(MetricsRegistry::global().histogram("db_query_duration_seconds","Database call latency",
+                                                           MetricsRegistry::label("op","register"))),
+     login_latency(MetricsRegistry::global().histogram("db_query_duration_seconds","Database call latency",
+                                                        MetricsRegistry::label("op","login"))) {
        conn = mysql_init(&mysql);
        if(conn == nullptr) {
             LOG_ERROR("Failed to initialize MySQL connection");
@@ -49,6 +66,9 @@ public:
 
     //  用户注册函数    -- 需要接收前端传入的username 和 password
     bool registerUser(const string& username, const string& password) {
+        ScopedTimer timer(register_latency);
+        DbStage stage;
+        lock_guard<mutex> lock(conn_mutex);
         //  预先构建sql语句，用于插入新用户
         string  insert_sql = "INSERT INTO users (username,password) values(?,?)";
         //  准备预处理对象  --  直接将创建和初始化预处理对象结合
@@ -102,6 +122,9 @@ public:
 
     //  用户登录函数
     bool loginUser(const string& username,const string& password) {
+        ScopedTimer timer(login_latency);
+        DbStage stage;
+        lock_guard<mutex> lock(conn_mutex);
         //  构建查询用户密码的sql语句
         string sql = "SELECT password FROM users WHERE username = ?";
         //  准备stmt
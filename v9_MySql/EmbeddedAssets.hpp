@@ -0,0 +1,68 @@
+#pragma once
+//  编译时嵌入的静态资源  --  用EMBED_ASSETS构建时，CMake先运行tools/embed_assets把static_rc/整个目录
+//  生成成EmbeddedAssets.inc：原始内容和预压缩版本都是常量数组，ETag和Last-Modified也已经算好
+//  静态文件处理器先查这里，命中时不需要任何系统调用，也不依赖运行时的工作目录
+#include <ctime>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "StaticAsset.hpp"
+#include "MimeTypes.hpp"
+using namespace std;
+
+
+//  生成的表里的一项
+struct EmbeddedAsset {
+    const char* path;           //  相对static_rc的路径
+    const char* content_type;
+    const char* etag;
+    const char* last_modified_text;     //  Last-Modified头的值
+    long long last_modified;
+    const char* data[4];        //  下标为Compression::Encoding，原始内容和各个压缩版本
+    size_t size[4];             //  压缩版本的长度为0表示没有
+};
+
+#ifdef EMBED_ASSETS
+#include "EmbeddedAssets.inc"
+#else
+static const EmbeddedAsset* const embedded_assets = nullptr;
+static const size_t embedded_asset_count = 0;
+#endif
+
+
+class EmbeddedAssets {
+public:
+    //  按相对路径查找，没有时返回nullptr
+    static shared_ptr<const StaticAsset> find(const string& path) {
+        const auto& assets = table();
+        auto it = assets.find(path);
+        return it == assets.end() ? nullptr : it->second;
+    }
+
+    //  嵌入的文件数
+    static size_t count() {
+        return embedded_asset_count;
+    }
+
+private:
+    //  第一次使用时把生成的数组包装成StaticAsset，内容不复制
+    static const unordered_map<string,shared_ptr<const StaticAsset>>& table() {
+        static const unordered_map<string,shared_ptr<const StaticAsset>> assets = build();
+        return assets;
+    }
+
+    static unordered_map<string,shared_ptr<const StaticAsset>> build() {
+        unordered_map<string,shared_ptr<const StaticAsset>> assets;
+        for(size_t i = 0;i < embedded_asset_count;++i) {
+            const EmbeddedAsset& embedded = embedded_assets[i];
+            shared_ptr<StaticAsset> asset = make_shared<StaticAsset>();
+            asset->body.loadPrepared(embedded.data,embedded.size);
+            asset->content_type = embedded.content_type;
+            asset->etag = embedded.etag;
+            asset->last_modified = static_cast<time_t>(embedded.last_modified);
+            asset->last_modified_text = embedded.last_modified_text;
+            assets[embedded.path] = asset;
+        }
+        return assets;
+    }
+};
@@ -1,4 +1,5 @@
 #include <fstream>
+#include <string>
 using namespace std;
 
 
@@ -6,28 +7,33 @@ using namespace std;
 class FileUtils {
 public:
 
+    //  读取整个文件，按二进制读，内容里有'\0'也不会被截断；打不开时返回空串
     static string readfile(string file_path) {
         ifstream ifs;
         ifs.open(file_path,ios::binary | ios::in);
         if(!ifs.is_open()) {
-            return nullptr;
+            return string();
         }
 
-        //  得到buf
         //  获取文件长度
         //  seekg(0,ios::end) 表示将文件指针自end位置偏移0字节--也就是置于文件尾
         ifs.seekg(0,ios::end);
         //  tellg() 表示从文件指针的位置到文件头位置的字节数
-        size_t length = ifs.tellg();
+        streamoff length = ifs.tellg();
+        if(length <= 0) {
+            return string();
+        }
         //  再将文件指针复位至文件开头以正常操作文件
         ifs.seekg(0,ios::beg);
 
-        char buf[length];
-        ifs.read(buf,length);
-        return string(buf); 
+        //  直接读进string的内存里，不经过栈上的缓冲区，大文件也不会栈溢出
+        string content(static_cast<size_t>(length),'\0');
+        ifs.read(&content[0],length);
+        content.resize(static_cast<size_t>(ifs.gcount()));
+        return content;
     }
 
 
 
 
-};
\ No newline at end of file
+};
@@ -0,0 +1,1095 @@
+#pragma once
+//  HTTP/2（RFC 7540）的明文版本h2c  --  帧的解析和生成，HPACK头部压缩（RFC 7541），流的状态和流量控制
+//  一个连接上的多个流解析出来之后交给服务器，和HTTP/1.1的流水线请求一样分派到线程池并发处理，
+//  处理完再按流写回HEADERS和DATA帧；会话只会同时被一个工作线程访问（连接是EPOLLONESHOT的），不需要加锁
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Buffer.hpp"
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+#include "ServerConfig.hpp"
+#include "Logger.hpp"
+using namespace std;
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"     //  客户端的连接前言
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEADER 9               //  帧头长度
+#define H2_DEFAULT_FRAME_SIZE 16384     //  SETTINGS_MAX_FRAME_SIZE的初始值，也是我们接受的最大帧
+#define H2_DEFAULT_WINDOW 65535         //  流量控制窗口的初始值
+#define H2_MAX_WINDOW 0x7fffffff        //  流量控制窗口的上限
+#define HPACK_TABLE_SIZE 4096           //  解码用的动态表大小（SETTINGS_HEADER_TABLE_SIZE的默认值）
+#define H2_RESET_ALLOWANCE 100          //  客户端取消的流超过这么多、并且超过打开的流的一半时发GOAWAY（防rapid reset）
+
+
+//  HPACK的静态Huffman编码（RFC 7541附录B），只用来解码客户端发来的字符串
+class Huffman {
+public:
+    //  解码，出现EOS、填充超过7位或者填充不全是1时返回false
+    static bool decode(const uint8_t* data,size_t len,string& out) {
+        const vector<Node>& nodes = tree();
+        int node = 0;
+        int pad_bits = 0;       //  上一个符号之后读了多少位
+        bool all_ones = true;   //  这些位是否都是1
+        for(size_t i = 0;i < len;++i) {
+            for(int bit = 7;bit >= 0;--bit) {
+                int b = (data[i] >> bit) & 1;
+                node = nodes[node].child[b];
+                if(node < 0) return false;
+                ++pad_bits;
+                all_ones = all_ones && b == 1;
+                int symbol = nodes[node].symbol;
+                if(symbol < 0) continue;
+                if(symbol == 256) return false;
+                out += static_cast<char>(symbol);
+                node = 0;
+                pad_bits = 0;
+                all_ones = true;
+            }
+        }
+        return pad_bits < 8 && all_ones;
+    }
+
+private:
+    struct Code {
+        uint32_t code;
+        int bits;
+    };
+
+    struct Node {
+        int child[2];
+        int symbol;     //  叶子节点的符号，内部节点为-1
+    };
+
+    //  0-255是字节，256是EOS
+    static const Code* codes() {
+        static const Code table[257] = {
+        {0x1ff8,13},{0x7fffd8,23},{0xfffffe2,28},{0xfffffe3,28},{0xfffffe4,28},{0xfffffe5,28},
+        {0xfffffe6,28},{0xfffffe7,28},{0xfffffe8,28},{0xffffea,24},{0x3ffffffc,30},{0xfffffe9,28},
+        {0xfffffea,28},{0x3ffffffd,30},{0xfffffeb,28},{0xfffffec,28},{0xfffffed,28},{0xfffffee,28},
+        {0xfffffef,28},{0xffffff0,28},{0xffffff1,28},{0xffffff2,28},{0x3ffffffe,30},{0xffffff3,28},
+        {0xffffff4,28},{0xffffff5,28},{0xffffff6,28},{0xffffff7,28},{0xffffff8,28},{0xffffff9,28},
+        {0xffffffa,28},{0xffffffb,28},{0x14,6},{0x3f8,10},{0x3f9,10},{0xffa,12},
+        {0x1ff9,13},{0x15,6},{0xf8,8},{0x7fa,11},{0x3fa,10},{0x3fb,10},
+        {0xf9,8},{0x7fb,11},{0xfa,8},{0x16,6},{0x17,6},{0x18,6},
+        {0x0,5},{0x1,5},{0x2,5},{0x19,6},{0x1a,6},{0x1b,6},
+        {0x1c,6},{0x1d,6},{0x1e,6},{0x1f,6},{0x5c,7},{0xfb,8},
+        {0x7ffc,15},{0x20,6},{0xffb,12},{0x3fc,10},{0x1ffa,13},{0x21,6},
+        {0x5d,7},{0x5e,7},{0x5f,7},{0x60,7},{0x61,7},{0x62,7},
+        {0x63,7},{0x64,7},{0x65,7},{0x66,7},{0x67,7},{0x68,7},
+        {0x69,7},{0x6a,7},{0x6b,7},{0x6c,7},{0x6d,7},{0x6e,7},
+        {0x6f,7},{0x70,7},{0x71,7},{0x72,7},{0xfc,8},{0x73,7},
+        {0xfd,8},{0x1ffb,13},{0x7fff0,19},{0x1ffc,13},{0x3ffc,14},{0x22,6},
+        {0x7ffd,15},{0x3,5},{0x23,6},{0x4,5},{0x24,6},{0x5,5},
+        {0x25,6},{0x26,6},{0x27,6},{0x6,5},{0x74,7},{0x75,7},
+        {0x28,6},{0x29,6},{0x2a,6},{0x7,5},{0x2b,6},{0x76,7},
+        {0x2c,6},{0x8,5},{0x9,5},{0x2d,6},{0x77,7},{0x78,7},
+        {0x79,7},{0x7a,7},{0x7b,7},{0x7ffe,15},{0x7fc,11},{0x3ffd,14},
+        {0x1ffd,13},{0xffffffc,28},{0xfffe6,20},{0x3fffd2,22},{0xfffe7,20},{0xfffe8,20},
+        {0x3fffd3,22},{0x3fffd4,22},{0x3fffd5,22},{0x7fffd9,23},{0x3fffd6,22},{0x7fffda,23},
+        {0x7fffdb,23},{0x7fffdc,23},{0x7fffdd,23},{0x7fffde,23},{0xffffeb,24},{0x7fffdf,23},
+        {0xffffec,24},{0xffffed,24},{0x3fffd7,22},{0x7fffe0,23},{0xffffee,24},{0x7fffe1,23},
+        {0x7fffe2,23},{0x7fffe3,23},{0x7fffe4,23},{0x1fffdc,21},{0x3fffd8,22},{0x7fffe5,23},
+        {0x3fffd9,22},{0x7fffe6,23},{0x7fffe7,23},{0xffffef,24},{0x3fffda,22},{0x1fffdd,21},
+        {0xfffe9,20},{0x3fffdb,22},{0x3fffdc,22},{0x7fffe8,23},{0x7fffe9,23},{0x1fffde,21},
+        {0x7fffea,23},{0x3fffdd,22},{0x3fffde,22},{0xfffff0,24},{0x1fffdf,21},{0x3fffdf,22},
+        {0x7fffeb,23},{0x7fffec,23},{0x1fffe0,21},{0x1fffe1,21},{0x3fffe0,22},{0x1fffe2,21},
+        {0x7fffed,23},{0x3fffe1,22},{0x7fffee,23},{0x7fffef,23},{0xfffea,20},{0x3fffe2,22},
+        {0x3fffe3,22},{0x3fffe4,22},{0x7ffff0,23},{0x3fffe5,22},{0x3fffe6,22},{0x7ffff1,23},
+        {0x3ffffe0,26},{0x3ffffe1,26},{0xfffeb,20},{0x7fff1,19},{0x3fffe7,22},{0x7ffff2,23},
+        {0x3fffe8,22},{0x1ffffec,25},{0x3ffffe2,26},{0x3ffffe3,26},{0x3ffffe4,26},{0x7ffffde,27},
+        {0x7ffffdf,27},{0x3ffffe5,26},{0xfffff1,24},{0x1ffffed,25},{0x7fff2,19},{0x1fffe3,21},
+        {0x3ffffe6,26},{0x7ffffe0,27},{0x7ffffe1,27},{0x3ffffe7,26},{0x7ffffe2,27},{0xfffff2,24},
+        {0x1fffe4,21},{0x1fffe5,21},{0x3ffffe8,26},{0x3ffffe9,26},{0xffffffd,28},{0x7ffffe3,27},
+        {0x7ffffe4,27},{0x7ffffe5,27},{0xfffec,20},{0xfffff3,24},{0xfffed,20},{0x1fffe6,21},
+        {0x3fffe9,22},{0x1fffe7,21},{0x1fffe8,21},{0x7ffff3,23},{0x3fffea,22},{0x3fffeb,22},
+        {0x1ffffee,25},{0x1ffffef,25},{0xfffff4,24},{0xfffff5,24},{0x3ffffea,26},{0x7ffff4,23},
+        {0x3ffffeb,26},{0x7ffffe6,27},{0x3ffffec,26},{0x3ffffed,26},{0x7ffffe7,27},{0x7ffffe8,27},
+        {0x7ffffe9,27},{0x7ffffea,27},{0x7ffffeb,27},{0xffffffe,28},{0x7ffffec,27},{0x7ffffed,27},
+        {0x7ffffee,27},{0x7ffffef,27},{0x7fffff0,27},{0x3ffffee,26},{0x3fffffff,30},
+        };
+        return table;
+    }
+
+    //  由编码表建出的二叉树，第一次使用时构建
+    static const vector<Node>& tree() {
+        static const vector<Node> nodes = build();
+        return nodes;
+    }
+
+    static vector<Node> build() {
+        vector<Node> nodes(1,Node{{-1,-1},-1});
+        const Code* table = codes();
+        for(int symbol = 0;symbol < 257;++symbol) {
+            int node = 0;
+            for(int i = table[symbol].bits - 1;i >= 0;--i) {
+                int b = (table[symbol].code >> i) & 1;
+                if(nodes[node].child[b] < 0) {
+                    nodes[node].child[b] = static_cast<int>(nodes.size());
+                    nodes.push_back(Node{{-1,-1},-1});
+                }
+                node = nodes[node].child[b];
+            }
+            nodes[node].symbol = symbol;
+        }
+        return nodes;
+    }
+};
+
+
+//  HPACK的静态表和整数、字符串的编码
+class Hpack {
+public:
+    using HeaderList = vector<pair<string,string>>;
+
+    static const int STATIC_COUNT = 61;
+
+    //  静态表，下标从1开始
+    static const pair<const char*,const char*>& staticEntry(size_t index) {
+        static const pair<const char*,const char*> table[STATIC_COUNT] = {
+            {":authority",""},{":method","GET"},{":method","POST"},{":path","/"},{":path","/index.html"},
+            {":scheme","http"},{":scheme","https"},{":status","200"},{":status","204"},{":status","206"},
+            {":status","304"},{":status","400"},{":status","404"},{":status","500"},{"accept-charset",""},
+            {"accept-encoding","gzip, deflate"},{"accept-language",""},{"accept-ranges",""},{"accept",""},
+            {"access-control-allow-origin",""},{"age",""},{"allow",""},{"authorization",""},
+            {"cache-control",""},{"content-disposition",""},{"content-encoding",""},{"content-language",""},
+            {"content-length",""},{"content-location",""},{"content-range",""},{"content-type",""},
+            {"cookie",""},{"date",""},{"etag",""},{"expect",""},{"expires",""},{"from",""},{"host",""},
+            {"if-match",""},{"if-modified-since",""},{"if-none-match",""},{"if-range",""},
+            {"if-unmodified-since",""},{"last-modified",""},{"link",""},{"location",""},{"max-forwards",""},
+            {"proxy-authenticate",""},{"proxy-authorization",""},{"range",""},{"referer",""},{"refresh",""},
+            {"retry-after",""},{"server",""},{"set-cookie",""},{"strict-transport-security",""},
+            {"transfer-encoding",""},{"user-agent",""},{"vary",""},{"via",""},{"www-authenticate",""}
+        };
+        return table[index - 1];
+    }
+
+    //  静态表里名字为name的第一项，没有时返回0
+    static size_t findName(const string& name) {
+        static const unordered_map<string,size_t> names = [] {
+            unordered_map<string,size_t> m;
+            for(size_t i = STATIC_COUNT;i >= 1;--i) m[staticEntry(i).first] = i;
+            return m;
+        }();
+        auto it = names.find(name);
+        return it == names.end() ? 0 : it->second;
+    }
+
+    //  整数编码：first是第一个字节里前缀之外的标志位
+    static void encodeInteger(uint64_t value,int prefix_bits,uint8_t first,string& out) {
+        uint64_t max = (1u << prefix_bits) - 1;
+        if(value < max) {
+            out += static_cast<char>(first | value);
+            return;
+        }
+        out += static_cast<char>(first | max);
+        value -= max;
+        while(value >= 128) {
+            out += static_cast<char>((value & 127) | 128);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    //  整数解码，超过32位的值视为错误
+    static bool decodeInteger(const uint8_t*& p,const uint8_t* end,int prefix_bits,uint64_t& value) {
+        if(p >= end) return false;
+        uint64_t max = (1u << prefix_bits) - 1;
+        value = *p++ & max;
+        if(value < max) return true;
+        for(int shift = 0;shift <= 28;shift += 7) {
+            if(p >= end) return false;
+            uint8_t b = *p++;
+            value += static_cast<uint64_t>(b & 127) << shift;
+            if((b & 128) == 0) return value <= 0xffffffffu;
+        }
+        return false;
+    }
+
+    //  字符串不用Huffman编码：响应头大多是短值，省下的字节不值得每个响应多花的CPU
+    static void encodeString(const string& str,string& out) {
+        encodeInteger(str.size(),7,0,out);
+        out += str;
+    }
+
+    static bool decodeString(const uint8_t*& p,const uint8_t* end,string& out) {
+        if(p >= end) return false;
+        bool huffman = (*p & 0x80) != 0;
+        uint64_t len;
+        if(!decodeInteger(p,end,7,len) || len > static_cast<uint64_t>(end - p)) return false;
+        out.clear();
+        bool ok = true;
+        if(huffman) ok = Huffman::decode(p,len,out);
+        else out.assign(reinterpret_cast<const char*>(p),len);
+        p += len;
+        return ok;
+    }
+};
+
+
+//  头部块的解码器，每个连接一个，动态表在连接的所有头部块之间共享
+class HpackDecoder {
+public:
+    enum Result {
+        DECODE_OK,
+        DECODE_ERROR,       //  格式错误，连接必须以COMPRESSION_ERROR关闭
+        DECODE_TOO_LARGE    //  解码后超过了长度限制，动态表已经正确更新，只拒绝这个请求
+    };
+
+    HpackDecoder(): capacity(HPACK_TABLE_SIZE),size(0) {}
+
+    //  解码一个完整的头部块，头部的总长度（按RFC的算法，每项加32）超过max_list时返回DECODE_TOO_LARGE
+    int decode(const string& block,Hpack::HeaderList& headers,size_t max_list) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(block.data());
+        const uint8_t* end = p + block.size();
+        size_t list_size = 0;
+        bool too_large = false;
+        bool first = true;      //  动态表大小的更新只能出现在头部块开头
+        while(p < end) {
+            uint8_t b = *p;
+            string name,value;
+            uint64_t index;
+            if(b & 0x80) {
+                //  索引
+                if(!Hpack::decodeInteger(p,end,7,index) || !lookup(index,name,value)) return DECODE_ERROR;
+            } else if((b & 0xe0) == 0x20) {
+                //  动态表大小更新
+                if(!first || !Hpack::decodeInteger(p,end,5,index) || index > HPACK_TABLE_SIZE) return DECODE_ERROR;
+                capacity = index;
+                evict(0);
+                continue;
+            } else {
+                //  字面量：01带索引，0000不索引，0001永不索引
+                bool indexing = (b & 0xc0) == 0x40;
+                if(!Hpack::decodeInteger(p,end,indexing ? 6 : 4,index)) return DECODE_ERROR;
+                if(index == 0) {
+                    if(!Hpack::decodeString(p,end,name)) return DECODE_ERROR;
+                } else if(!lookup(index,name,value)) {
+                    return DECODE_ERROR;
+                }
+                if(!Hpack::decodeString(p,end,value)) return DECODE_ERROR;
+                if(indexing) insert(name,value);
+            }
+            first = false;
+            list_size += name.size() + value.size() + 32;
+            if(list_size > max_list) too_large = true;
+            if(!too_large) headers.push_back(make_pair(name,value));
+        }
+        return too_large ? DECODE_TOO_LARGE : DECODE_OK;
+    }
+
+    //  动态表现在的大小（按RFC的算法，每项加32）
+    size_t tableSize() const {
+        return size;
+    }
+
+private:
+    bool lookup(uint64_t index,string& name,string& value) const {
+        if(index == 0) return false;
+        if(index <= Hpack::STATIC_COUNT) {
+            name = Hpack::staticEntry(index).first;
+            value = Hpack::staticEntry(index).second;
+            return true;
+        }
+        index -= Hpack::STATIC_COUNT + 1;
+        if(index >= entries.size()) return false;
+        name = entries[index].first;
+        value = entries[index].second;
+        return true;
+    }
+
+    //  新的项放在最前面，超出容量时从最老的开始淘汰；比整个表还大的项会清空动态表
+    void insert(const string& name,const string& value) {
+        size_t entry = name.size() + value.size() + 32;
+        evict(entry);
+        if(entry > capacity) return;
+        entries.push_front(make_pair(name,value));
+        size += entry;
+    }
+
+    void evict(size_t room) {
+        while(!entries.empty() && size + room > capacity) {
+            size -= entries.back().first.size() + entries.back().second.size() + 32;
+            entries.pop_back();
+        }
+    }
+
+    deque<pair<string,string>> entries;     //  动态表，下标0是最新的
+    size_t capacity;
+    size_t size;
+};
+
+
+//  把流式响应体的数据追加到流的待发数据里，由会话切成DATA帧
+class StringSink : public ChunkSink {
+public:
+    explicit StringSink(string& out): out(out) {}
+
+    using ChunkSink::write;
+
+    void write(const char* data,size_t len) override {
+        out.append(data,len);
+    }
+
+private:
+    string& out;
+};
+
+
+//  一个HTTP/2连接的会话状态
+class Http2Session {
+public:
+    //  一个接收完整的请求
+    struct Request {
+        uint32_t stream_id;
+        HttpRequest request;
+        int error;      //  不为0时不经过路由，直接返回这个状态码
+    };
+
+    enum FrameType {
+        DATA = 0, HEADERS = 1, PRIORITY = 2, RST_STREAM = 3, SETTINGS = 4,
+        PUSH_PROMISE = 5, PING = 6, GOAWAY = 7, WINDOW_UPDATE = 8, CONTINUATION = 9
+    };
+
+    enum Flag {
+        FLAG_END_STREAM = 0x1, FLAG_ACK = 0x1, FLAG_END_HEADERS = 0x4, FLAG_PADDED = 0x8, FLAG_PRIORITY = 0x20
+    };
+
+    enum ErrorCode {
+        NO_ERROR = 0, PROTOCOL_ERROR = 1, INTERNAL_ERROR = 2, FLOW_CONTROL_ERROR = 3, STREAM_CLOSED = 5,
+        FRAME_SIZE_ERROR = 6, REFUSED_STREAM = 7, CANCEL = 8, COMPRESSION_ERROR = 9, ENHANCE_YOUR_CALM = 11
+    };
+
+    enum Setting {
+        HEADER_TABLE_SIZE = 1, ENABLE_PUSH = 2, MAX_CONCURRENT_STREAMS = 3,
+        INITIAL_WINDOW_SIZE = 4, MAX_FRAME_SIZE = 5, MAX_HEADER_LIST_SIZE = 6
+    };
+
+    explicit Http2Session(const ServerConfig& config)
+    :max_streams(config.h2_max_streams),max_header_bytes(config.max_header_bytes),
+     max_body_bytes(config.max_body_bytes),recv_window(max(config.h2_window_bytes,H2_DEFAULT_WINDOW)),
+     preface_received(false),goaway_sent(false),goaway_received(false),table_update_pending(true),
+     last_stream_id(0),opened(0),client_resets(0),orphaned(0),header_stream(0),header_end_stream(false),conn_recv_consumed(0),
+     conn_recv_left(recv_window),buffered_body(0),conn_send_window(H2_DEFAULT_WINDOW),peer_initial_window(H2_DEFAULT_WINDOW),
+     peer_max_frame(H2_DEFAULT_FRAME_SIZE) {}
+
+    //  输入缓冲区开头是不是HTTP/2的连接前言，只需要看到HTTP/1.1解析器会当作请求头结尾的前18个字节
+    static bool isPreface(const ChainBuffer& in) {
+        static const size_t prefix = 18;    //  "PRI * HTTP/2.0\r\n\r\n"
+        return in.size() >= prefix && in.copyOut(0,prefix) == string(H2_PREFACE,prefix);
+    }
+
+    //  升级请求是否要换成h2c：Upgrade里有h2c并且带着HTTP2-Settings
+    static bool wantsUpgrade(const HttpRequest& request) {
+        string upgrade = request.getHeader("Upgrade");
+        return upgrade.find("h2c") != string::npos && request.getHeader("HTTP2-Settings").size() > 0;
+    }
+
+    //  服务器的连接前言：SETTINGS，再把连接的接收窗口调到和流一样大
+    void start(ChainBuffer& out) {
+        string payload;
+        appendSetting(payload,MAX_CONCURRENT_STREAMS,max_streams);
+        appendSetting(payload,INITIAL_WINDOW_SIZE,recv_window);
+        appendSetting(payload,MAX_HEADER_LIST_SIZE,max_header_bytes);
+        writeFrame(out,SETTINGS,0,0,payload.data(),payload.size());
+        if(recv_window > H2_DEFAULT_WINDOW) writeWindowUpdate(out,0,recv_window - H2_DEFAULT_WINDOW);
+    }
+
+    //  从HTTP/1.1升级：settings是HTTP2-Settings头（base64url编码的SETTINGS载荷），升级的请求成为流1
+    //  流1对客户端已经是半关闭的，它的响应用HTTP/2发送
+    bool upgrade(const string& settings) {
+        string payload;
+        if(!decodeBase64Url(settings,payload) || payload.size() % 6 != 0) return false;
+        if(applySettings(payload) != NO_ERROR) return false;
+        Stream& stream = streams[1];
+        stream.remote_closed = true;
+        stream.send_window = peer_initial_window;
+        stream.responding = true;
+        last_stream_id = 1;
+        opened = 1;
+        return true;
+    }
+
+    //  解析输入缓冲区里所有完整的帧，协议需要的回应（SETTINGS和PING的确认，WINDOW_UPDATE等）写进out，
+    //  接收完整的请求放进ready，最多max_ready个，剩下的帧留在in里下次再解析；
+    //  出现连接错误时写GOAWAY并返回false，之后应该发完输出再关闭连接
+    bool receive(ChainBuffer& in,ChainBuffer& out,vector<Request>& ready,size_t max_ready) {
+        if(goaway_sent) {
+            in.clear();
+            return false;
+        }
+        if(!preface_received) {
+            if(in.size() < H2_PREFACE_LEN) return true;
+            if(in.copyOut(0,H2_PREFACE_LEN) != string(H2_PREFACE,H2_PREFACE_LEN)) {
+                return connectionError(out,PROTOCOL_ERROR);
+            }
+            in.consume(H2_PREFACE_LEN);
+            preface_received = true;
+        }
+        while(in.size() >= H2_FRAME_HEADER && ready.size() < max_ready) {
+            string head = in.copyOut(0,H2_FRAME_HEADER);
+            const uint8_t* h = reinterpret_cast<const uint8_t*>(head.data());
+            size_t length = (h[0] << 16) | (h[1] << 8) | h[2];
+            uint8_t type = h[3];
+            uint8_t flags = h[4];
+            uint32_t stream_id = readUint32(h + 5) & 0x7fffffff;
+            if(length > H2_DEFAULT_FRAME_SIZE) return connectionError(out,FRAME_SIZE_ERROR);
+            if(in.size() < H2_FRAME_HEADER + length) break;
+            string payload = in.copyOut(H2_FRAME_HEADER,length);
+            in.consume(H2_FRAME_HEADER + length);
+            //  头部块没结束时只能收到同一个流的CONTINUATION
+            if(header_stream != 0 && (type != CONTINUATION || stream_id != header_stream)) {
+                return connectionError(out,PROTOCOL_ERROR);
+            }
+            if(!onFrame(type,flags,stream_id,payload,out,ready)) return false;
+        }
+        //  请求交给服务器之后缓存的请求体少了，之前扣着的连接窗口可以还了
+        returnConnectionCredit(out);
+        return true;
+    }
+
+    //  发送一个流的响应：HEADERS立即写进out，响应体作为待发数据，由flush按流量控制窗口切成DATA帧
+    //  流已经被客户端取消时直接丢弃
+    void respond(uint32_t stream_id,const HttpResponse& response,ChainBuffer& out) {
+        auto it = streams.find(stream_id);
+        if(it == streams.end() || !it->second.responding) {
+            //  处理期间流被取消了，它占的名额到这里才还
+            if(orphaned > 0) orphaned--;
+            return;
+        }
+        Stream& stream = it->second;
+        stream.responding = false;
+        string block;
+        //  我们不使用动态表，第一个头部块里把它的大小设为0，之后客户端改了表大小也再确认一次
+        if(table_update_pending) {
+            Hpack::encodeInteger(0,5,0x20,block);
+            table_update_pending = false;
+        }
+        int code = response.getStatusCode();
+        encodeStatus(code,block);
+        for(const auto& header : response.getHeaders()) {
+            string name = toLower(header.first);
+            //  HTTP/2里不允许出现这些逐跳的头
+            if(name == "connection" || name == "keep-alive" || name == "transfer-encoding"
+               || name == "upgrade" || name == "proxy-connection") continue;
+            encodeHeader(name,header.second,block);
+        }
+        if(response.isChunked()) {
+            stream.producer = response.getProducer();
+        } else if(code != 204 && code != 304) {
+            encodeHeader("content-length",to_string(response.getBody().size()),block);
+            stream.pending = response.getBody();
+        }
+        bool end = !stream.producer && stream.pending.empty();
+        writeHeaders(out,stream_id,block,end);
+        if(end) {
+            finishStream(out,stream_id);
+        } else {
+            sending.push_back(stream_id);
+        }
+    }
+
+    //  按流量控制窗口把待发数据写成DATA帧，直到out达到limit或者都发不动了
+    //  多个流轮流发，每轮每个流最多一帧，一个大响应不会让其他流一直等
+    void flush(ChainBuffer& out,size_t limit) {
+        bool progress = true;
+        while(progress && !sending.empty() && out.size() < limit) {
+            progress = false;
+            size_t i = 0;
+            while(i < sending.size() && out.size() < limit) {
+                uint32_t id = sending[i];
+                auto it = streams.find(id);
+                if(it == streams.end()) {
+                    sending.erase(sending.begin() + i);
+                    continue;
+                }
+                Stream& stream = it->second;
+                if(stream.pending_offset == stream.pending.size() && stream.producer) refill(stream);
+                size_t left = stream.pending.size() - stream.pending_offset;
+                size_t n = min(left,peer_max_frame);
+                n = min(n,static_cast<size_t>(max<int64_t>(0,min(conn_send_window,stream.send_window))));
+                bool end = !stream.producer && n == left;
+                if(n == 0 && !end) {
+                    //  窗口用完了，或者生成函数这次没有数据
+                    ++i;
+                    continue;
+                }
+                writeFrame(out,DATA,end ? FLAG_END_STREAM : 0,id,stream.pending.data() + stream.pending_offset,n);
+                conn_send_window -= n;
+                stream.send_window -= n;
+                stream.pending_offset += n;
+                if(stream.pending_offset == stream.pending.size()) {
+                    stream.pending.clear();
+                    stream.pending_offset = 0;
+                }
+                progress = true;
+                if(end) {
+                    sending.erase(sending.begin() + i);
+                    finishStream(out,id);
+                    continue;
+                }
+                ++i;
+            }
+        }
+    }
+
+    //  是否还有数据可以马上发送（窗口没用完）
+    bool canSend() const {
+        for(uint32_t id : sending) {
+            auto it = streams.find(id);
+            if(it == streams.end()) return true;
+            const Stream& stream = it->second;
+            bool has_data = stream.pending_offset < stream.pending.size() || stream.producer;
+            if(!has_data) return true;
+            if(conn_send_window > 0 && stream.send_window > 0) return true;
+        }
+        return false;
+    }
+
+    //  是否有响应因为流量控制窗口用完了在等客户端的WINDOW_UPDATE
+    bool isBlocked() const {
+        return !sending.empty();
+    }
+
+    //  是否发送过GOAWAY，发完输出缓冲区后应该关闭连接
+    bool isClosing() const {
+        return this->goaway_sent;
+    }
+
+    //  对端已经发送GOAWAY，处理完已有的流之后关闭
+    bool peerGoingAway() const {
+        return this->goaway_received;
+    }
+
+    //  头部块是否只收到了一部分（还在等CONTINUATION）
+    bool inHeaderBlock() const {
+        return this->header_stream != 0;
+    }
+
+    //  还没有完全关闭的流的数量，包括已经被取消、请求还在处理的流
+    size_t streamCount() const {
+        return streams.size() + orphaned;
+    }
+
+private:
+    struct Stream {
+        HttpRequest request;        //  正在接收的请求
+        string body;                //  已经收到的请求体
+        bool remote_closed = false; //  客户端已经发完（END_STREAM）
+        int error = 0;              //  请求已经因为这个状态码被拒绝，之后的数据直接丢弃
+        bool responding = false;    //  请求已经交给服务器，还没有调用respond
+        int64_t send_window = H2_DEFAULT_WINDOW;    //  发送窗口
+        int64_t recv_left = 0;      //  接收窗口还剩多少，客户端发的DATA不能超过它
+        size_t recv_consumed = 0;   //  收到之后还没有通过WINDOW_UPDATE还给客户端的字节数
+        string pending;             //  待发送的响应体
+        size_t pending_offset = 0;
+        HttpResponse::BodyProducer producer;    //  流式响应体的生成函数
+    };
+
+    bool onFrame(uint8_t type,uint8_t flags,uint32_t stream_id,const string& payload,
+                 ChainBuffer& out,vector<Request>& ready) {
+        switch(type) {
+        case DATA:          return onData(flags,stream_id,payload,out,ready);
+        case HEADERS:       return onHeaders(flags,stream_id,payload,out,ready);
+        case CONTINUATION:  return onContinuation(flags,stream_id,payload,out,ready);
+        case PRIORITY:
+            //  不按优先级调度，只检查格式
+            if(stream_id == 0) return connectionError(out,PROTOCOL_ERROR);
+            if(payload.size() != 5) return connectionError(out,FRAME_SIZE_ERROR);
+            return true;
+        case RST_STREAM:
+            if(stream_id == 0) return connectionError(out,PROTOCOL_ERROR);
+            if(payload.size() != 4) return connectionError(out,FRAME_SIZE_ERROR);
+            if(stream_id > last_stream_id) return connectionError(out,PROTOCOL_ERROR);
+            return onReset(stream_id,out,ready);
+        case SETTINGS:      return onSettings(flags,stream_id,payload,out);
+        case PING:
+            if(stream_id != 0) return connectionError(out,PROTOCOL_ERROR);
+            if(payload.size() != 8) return connectionError(out,FRAME_SIZE_ERROR);
+            if((flags & FLAG_ACK) == 0) writeFrame(out,PING,FLAG_ACK,0,payload.data(),payload.size());
+            return true;
+        case GOAWAY:
+            if(stream_id != 0) return connectionError(out,PROTOCOL_ERROR);
+            goaway_received = true;
+            return true;
+        case WINDOW_UPDATE: return onWindowUpdate(stream_id,payload,out);
+        case PUSH_PROMISE:
+            //  客户端不能推送
+            return connectionError(out,PROTOCOL_ERROR);
+        default:
+            //  未知类型的帧必须忽略
+            return true;
+        }
+    }
+
+    bool onHeaders(uint8_t flags,uint32_t stream_id,const string& payload,ChainBuffer& out,vector<Request>& ready) {
+        if(stream_id == 0 || stream_id % 2 == 0) return connectionError(out,PROTOCOL_ERROR);
+        size_t begin = 0,end = payload.size();
+        if(!stripPadding(flags,payload,begin,end)) return connectionError(out,PROTOCOL_ERROR);
+        if(flags & FLAG_PRIORITY) {
+            if(end - begin < 5) return connectionError(out,FRAME_SIZE_ERROR);
+            begin += 5;
+        }
+        auto it = streams.find(stream_id);
+        if(it != streams.end()) {
+            //  已经存在的流上的HEADERS只能是请求体后面的尾部头，必须带END_STREAM
+            if(it->second.remote_closed || (flags & FLAG_END_STREAM) == 0) {
+                return connectionError(out,it->second.remote_closed ? STREAM_CLOSED : PROTOCOL_ERROR);
+            }
+        } else if(stream_id <= last_stream_id) {
+            return connectionError(out,STREAM_CLOSED);
+        }
+        header_block.assign(payload,begin,end - begin);
+        header_end_stream = (flags & FLAG_END_STREAM) != 0;
+        if(flags & FLAG_END_HEADERS) return onHeaderBlock(stream_id,out,ready);
+        header_stream = stream_id;
+        return true;
+    }
+
+    bool onContinuation(uint8_t flags,uint32_t stream_id,const string& payload,ChainBuffer& out,vector<Request>& ready) {
+        if(header_stream == 0 || stream_id != header_stream) return connectionError(out,PROTOCOL_ERROR);
+        header_block += payload;
+        //  压缩后的头部块就超过了上限，不再继续攒
+        if(header_block.size() > max_header_bytes) return connectionError(out,PROTOCOL_ERROR);
+        if((flags & FLAG_END_HEADERS) == 0) return true;
+        header_stream = 0;
+        return onHeaderBlock(stream_id,out,ready);
+    }
+
+    //  一个完整的头部块：新请求的请求头，或者请求体后面的尾部头
+    bool onHeaderBlock(uint32_t stream_id,ChainBuffer& out,vector<Request>& ready) {
+        Hpack::HeaderList headers;
+        //  即使之后要拒绝这个流，也必须先解码，保持动态表和客户端同步
+        int ret = decoder.decode(header_block,headers,max_header_bytes);
+        header_block.clear();
+        if(ret == HpackDecoder::DECODE_ERROR) return connectionError(out,COMPRESSION_ERROR);
+
+        auto it = streams.find(stream_id);
+        if(it != streams.end()) {
+            //  尾部头直接丢弃
+            it->second.remote_closed = true;
+            if(it->second.error == 0) completeRequest(stream_id,it->second,ready);
+            return true;
+        }
+        last_stream_id = stream_id;
+        if(goaway_received || streamCount() >= max_streams) {
+            writeRstStream(out,stream_id,REFUSED_STREAM);
+            return true;
+        }
+        Stream& stream = streams[stream_id];
+        opened++;
+        stream.send_window = peer_initial_window;
+        stream.recv_left = recv_window;
+        stream.remote_closed = header_end_stream;
+        size_t length = 0;
+        if(ret == HpackDecoder::DECODE_TOO_LARGE || !buildRequest(headers,stream.request) ||
+           !stream.request.getContentLength(length)) {
+            stream.error = 400;
+        } else if(length > max_body_bytes) {
+            stream.error = 413;
+        }
+        //  被拒绝的请求不用等请求体，马上回错误响应
+        if(stream.remote_closed || stream.error != 0) completeRequest(stream_id,stream,ready);
+        return true;
+    }
+
+    //  客户端取消了一个流：请求还在这次解析出来的ready里时直接去掉，已经交给服务器的照常处理，
+    //  处理完之后发现流不在了就丢掉响应，在那之前它仍然占着一个流的名额
+    //  不停地打开再取消流（rapid reset）可以绕过流的上限让服务器白白处理请求，取消得太多时关闭连接
+    bool onReset(uint32_t stream_id,ChainBuffer& out,vector<Request>& ready) {
+        auto it = streams.find(stream_id);
+        if(it == streams.end()) return true;
+        if(it->second.responding) {
+            auto pending = find_if(ready.begin(),ready.end(),[stream_id](const Request& r){ return r.stream_id == stream_id; });
+            if(pending != ready.end()) {
+                ready.erase(pending);
+            } else {
+                orphaned++;
+            }
+        }
+        releaseBody(it->second);
+        streams.erase(it);
+        if(++client_resets > H2_RESET_ALLOWANCE && client_resets * 2 > opened) {
+            return connectionError(out,ENHANCE_YOUR_CALM);
+        }
+        return true;
+    }
+
+    //  由伪头部和普通头部构造请求
+    bool buildRequest(const Hpack::HeaderList& headers,HttpRequest& request) {
+        string method,path,authority;
+        bool regular = false;
+        for(const auto& header : headers) {
+            const string& name = header.first;
+            if(!name.empty() && name[0] == ':') {
+                //  伪头部必须在普通头部之前
+                if(regular) return false;
+                if(name == ":method") method = header.second;
+                else if(name == ":path") path = header.second;
+                else if(name == ":authority") authority = header.second;
+                else if(name != ":scheme") return false;
+                continue;
+            }
+            regular = true;
+            //  HTTP/2的头部名必须是小写的，也不能有逐跳的头
+            if(name != toLower(name) || name == "connection") return false;
+            request.addHeader(name,header.second);
+        }
+        if(method.empty() || path.empty()) return false;
+        if(!authority.empty() && request.getHeader("Host").empty()) request.addHeader("host",authority);
+        return request.init(method,path,"HTTP/2.0");
+    }
+
+    bool onData(uint8_t flags,uint32_t stream_id,const string& payload,ChainBuffer& out,vector<Request>& ready) {
+        if(stream_id == 0) return connectionError(out,PROTOCOL_ERROR);
+        size_t begin = 0,end = payload.size();
+        if(!stripPadding(flags,payload,begin,end)) return connectionError(out,PROTOCOL_ERROR);
+        //  整个帧（包括填充）都算在流量控制里，超出我们给的窗口说明客户端不遵守流量控制
+        if(static_cast<int64_t>(payload.size()) > conn_recv_left) return connectionError(out,FLOW_CONTROL_ERROR);
+        conn_recv_left -= payload.size();
+        auto it = streams.find(stream_id);
+        if(it == streams.end()) {
+            //  已经被取消或者拒绝的流，路上的数据直接丢弃；从来没打开过的流是协议错误
+            if(stream_id > last_stream_id) return connectionError(out,PROTOCOL_ERROR);
+            consumeConnection(out,payload.size());
+            return true;
+        }
+        Stream& stream = it->second;
+        if(stream.remote_closed) {
+            if(stream.error != 0) {
+                consumeConnection(out,payload.size());
+                return true;
+            }
+            return connectionError(out,STREAM_CLOSED);
+        }
+        if(static_cast<int64_t>(payload.size()) > stream.recv_left) {
+            consumeConnection(out,payload.size());
+            resetStream(out,stream_id,FLOW_CONTROL_ERROR);
+            return true;
+        }
+        stream.recv_left -= payload.size();
+        if(stream.error == 0) {
+            if(stream.body.size() + (end - begin) > max_body_bytes) {
+                stream.error = 413;
+                releaseBody(stream);
+                completeRequest(stream_id,stream,ready);
+            } else {
+                stream.body.append(payload,begin,end - begin);
+                buffered_body += end - begin;
+            }
+        }
+        consumeConnection(out,payload.size());
+        if(flags & FLAG_END_STREAM) {
+            stream.remote_closed = true;
+            if(stream.error == 0) completeRequest(stream_id,stream,ready);
+            return true;
+        }
+        //  按流把读掉的数据还给客户端，攒到窗口的一半再发，少发一些WINDOW_UPDATE
+        stream.recv_consumed += payload.size();
+        if(stream.recv_consumed >= static_cast<size_t>(recv_window) / 2) {
+            writeWindowUpdate(out,stream_id,stream.recv_consumed);
+            stream.recv_left += stream.recv_consumed;
+            stream.recv_consumed = 0;
+        }
+        return true;
+    }
+
+    bool onSettings(uint8_t flags,uint32_t stream_id,const string& payload,ChainBuffer& out) {
+        if(stream_id != 0) return connectionError(out,PROTOCOL_ERROR);
+        if(flags & FLAG_ACK) {
+            if(!payload.empty()) return connectionError(out,FRAME_SIZE_ERROR);
+            return true;
+        }
+        if(payload.size() % 6 != 0) return connectionError(out,FRAME_SIZE_ERROR);
+        int error = applySettings(payload);
+        if(error != NO_ERROR) return connectionError(out,static_cast<ErrorCode>(error));
+        writeFrame(out,SETTINGS,FLAG_ACK,0,nullptr,0);
+        return true;
+    }
+
+    int applySettings(const string& payload) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(payload.data());
+        for(size_t i = 0;i + 6 <= payload.size();i += 6) {
+            uint16_t id = (p[i] << 8) | p[i + 1];
+            uint32_t value = readUint32(p + i + 2);
+            switch(id) {
+            case HEADER_TABLE_SIZE:
+                //  客户端的解码表大小变了，下一个头部块开头要重新确认动态表大小
+                table_update_pending = true;
+                break;
+            case ENABLE_PUSH:
+                if(value > 1) return PROTOCOL_ERROR;
+                break;
+            case INITIAL_WINDOW_SIZE: {
+                if(value > H2_MAX_WINDOW) return FLOW_CONTROL_ERROR;
+                //  初始窗口的变化对所有已经打开的流生效，窗口可能因此变成负数
+                int64_t delta = static_cast<int64_t>(value) - peer_initial_window;
+                for(auto& entry : streams) {
+                    entry.second.send_window += delta;
+                    if(entry.second.send_window > H2_MAX_WINDOW) return FLOW_CONTROL_ERROR;
+                }
+                peer_initial_window = value;
+                break;
+            }
+            case MAX_FRAME_SIZE:
+                if(value < H2_DEFAULT_FRAME_SIZE || value > 16777215) return PROTOCOL_ERROR;
+                peer_max_frame = value;
+                break;
+            default:
+                //  MAX_CONCURRENT_STREAMS只限制服务器推送，MAX_HEADER_LIST_SIZE是建议值，未知的设置忽略
+                break;
+            }
+        }
+        return NO_ERROR;
+    }
+
+    bool onWindowUpdate(uint32_t stream_id,const string& payload,ChainBuffer& out) {
+        if(payload.size() != 4) return connectionError(out,FRAME_SIZE_ERROR);
+        uint32_t increment = readUint32(reinterpret_cast<const uint8_t*>(payload.data())) & 0x7fffffff;
+        if(stream_id == 0) {
+            if(increment == 0) return connectionError(out,PROTOCOL_ERROR);
+            conn_send_window += increment;
+            if(conn_send_window > H2_MAX_WINDOW) return connectionError(out,FLOW_CONTROL_ERROR);
+            return true;
+        }
+        auto it = streams.find(stream_id);
+        //  已经关闭的流上的WINDOW_UPDATE可能是路上的，忽略
+        if(it == streams.end()) return true;
+        if(increment == 0) {
+            resetStream(out,stream_id,PROTOCOL_ERROR);
+            return true;
+        }
+        it->second.send_window += increment;
+        if(it->second.send_window > H2_MAX_WINDOW) resetStream(out,stream_id,FLOW_CONTROL_ERROR);
+        return true;
+    }
+
+    //  请求接收完整（或者被拒绝），交给服务器处理
+    void completeRequest(uint32_t stream_id,Stream& stream,vector<Request>& ready) {
+        Request request;
+        request.stream_id = stream_id;
+        request.error = stream.error;
+        request.request = stream.request;
+        if(stream.error == 0) request.request.setBody(stream.body);
+        stream.request = HttpRequest();
+        releaseBody(stream);
+        stream.responding = true;
+        ready.push_back(request);
+    }
+
+    //  响应发完了：客户端还没发完请求体（比如请求被提前拒绝）时用RST_STREAM(NO_ERROR)告诉它不用再发
+    void finishStream(ChainBuffer& out,uint32_t stream_id) {
+        auto it = streams.find(stream_id);
+        if(it == streams.end()) return;
+        if(!it->second.remote_closed) writeRstStream(out,stream_id,NO_ERROR);
+        releaseBody(it->second);
+        streams.erase(it);
+    }
+
+    void resetStream(ChainBuffer& out,uint32_t stream_id,ErrorCode code) {
+        writeRstStream(out,stream_id,code);
+        auto it = streams.find(stream_id);
+        if(it == streams.end()) return;
+        if(it->second.responding) orphaned++;
+        releaseBody(it->second);
+        streams.erase(it);
+    }
+
+    //  连接错误：发送GOAWAY，之后不再处理这个连接上的任何帧
+    bool connectionError(ChainBuffer& out,ErrorCode code) {
+        LOG_WARNING("http2 connection error %d",code);
+        char payload[8];
+        writeUint32(payload,last_stream_id);
+        writeUint32(payload + 4,code);
+        writeFrame(out,GOAWAY,0,0,payload,sizeof(payload));
+        goaway_sent = true;
+        return false;
+    }
+
+    //  连接级别的接收窗口，攒到一半再还给客户端
+    void consumeConnection(ChainBuffer& out,size_t n) {
+        conn_recv_consumed += n;
+        returnConnectionCredit(out);
+    }
+
+    //  连接上缓存的请求体超过max_body_bytes时先不还连接窗口，客户端最多再发一个窗口的数据就得停下，
+    //  等请求交给服务器、缓存减少之后再还；否则每个流都能缓存到max_body_bytes，一个连接就能占住
+    //  h2_max_streams倍的内存。单个流的窗口照常还，一个请求体总能传完
+    void returnConnectionCredit(ChainBuffer& out) {
+        if(goaway_sent || buffered_body > max_body_bytes) return;
+        if(conn_recv_consumed >= static_cast<size_t>(recv_window) / 2) {
+            writeWindowUpdate(out,0,conn_recv_consumed);
+            conn_recv_left += conn_recv_consumed;
+            conn_recv_consumed = 0;
+        }
+    }
+
+    //  流的请求体交出去或者丢掉了，不再算在连接缓存的请求体里
+    void releaseBody(Stream& stream) {
+        buffered_body -= stream.body.size();
+        stream.body.clear();
+        stream.body.shrink_to_fit();
+    }
+
+    //  流式响应体再生成一帧左右的数据
+    void refill(Stream& stream) {
+        stream.pending.clear();
+        stream.pending_offset = 0;
+        StringSink sink(stream.pending);
+        while(stream.producer && stream.pending.size() < peer_max_frame) {
+            if(!stream.producer(sink)) stream.producer = nullptr;
+        }
+    }
+
+    //  去掉PADDED帧的填充，[begin,end)是剩下的内容
+    static bool stripPadding(uint8_t flags,const string& payload,size_t& begin,size_t& end) {
+        if((flags & FLAG_PADDED) == 0) return true;
+        if(payload.empty()) return false;
+        size_t pad = static_cast<uint8_t>(payload[0]);
+        if(pad + 1 > payload.size()) return false;
+        begin = 1;
+        end = payload.size() - pad;
+        return true;
+    }
+
+    //  :status常见的值在静态表里，直接用索引
+    static void encodeStatus(int code,string& out) {
+        static const int indexed[] = {200,204,206,304,400,404,500};
+        for(size_t i = 0;i < sizeof(indexed) / sizeof(indexed[0]);++i) {
+            if(indexed[i] == code) {
+                Hpack::encodeInteger(8 + i,7,0x80,out);
+                return;
+            }
+        }
+        encodeHeader(":status",to_string(code),out);
+    }
+
+    //  不索引的字面量，名字在静态表里时用索引
+    static void encodeHeader(const string& name,const string& value,string& out) {
+        size_t index = Hpack::findName(name);
+        Hpack::encodeInteger(index,4,0,out);
+        if(index == 0) Hpack::encodeString(name,out);
+        Hpack::encodeString(value,out);
+    }
+
+    //  头部块超过对端的最大帧长度时拆成HEADERS加若干CONTINUATION
+    void writeHeaders(ChainBuffer& out,uint32_t stream_id,const string& block,bool end_stream) {
+        size_t offset = 0;
+        bool first = true;
+        do {
+            size_t n = min(block.size() - offset,peer_max_frame);
+            bool last = offset + n == block.size();
+            uint8_t flags = last ? FLAG_END_HEADERS : 0;
+            if(first && end_stream) flags |= FLAG_END_STREAM;
+            writeFrame(out,first ? HEADERS : CONTINUATION,flags,stream_id,block.data() + offset,n);
+            offset += n;
+            first = false;
+        } while(offset < block.size());
+    }
+
+    static void writeFrame(ChainBuffer& out,uint8_t type,uint8_t flags,uint32_t stream_id,const char* data,size_t len) {
+        char head[H2_FRAME_HEADER];
+        head[0] = static_cast<char>(len >> 16);
+        head[1] = static_cast<char>(len >> 8);
+        head[2] = static_cast<char>(len);
+        head[3] = static_cast<char>(type);
+        head[4] = static_cast<char>(flags);
+        writeUint32(head + 5,stream_id);
+        out.append(head,sizeof(head));
+        if(len > 0) out.append(data,len);
+    }
+
+    static void writeWindowUpdate(ChainBuffer& out,uint32_t stream_id,uint32_t increment) {
+        char payload[4];
+        writeUint32(payload,increment);
+        writeFrame(out,WINDOW_UPDATE,0,stream_id,payload,sizeof(payload));
+    }
+
+    static void writeRstStream(ChainBuffer& out,uint32_t stream_id,uint32_t code) {
+        char payload[4];
+        writeUint32(payload,code);
+        writeFrame(out,RST_STREAM,0,stream_id,payload,sizeof(payload));
+    }
+
+    static void appendSetting(string& payload,uint16_t id,uint32_t value) {
+        char buf[6];
+        buf[0] = static_cast<char>(id >> 8);
+        buf[1] = static_cast<char>(id);
+        writeUint32(buf + 2,value);
+        payload.append(buf,sizeof(buf));
+    }
+
+    static uint32_t readUint32(const uint8_t* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    static void writeUint32(char* p,uint32_t value) {
+        p[0] = static_cast<char>(value >> 24);
+        p[1] = static_cast<char>(value >> 16);
+        p[2] = static_cast<char>(value >> 8);
+        p[3] = static_cast<char>(value);
+    }
+
+    //  HTTP2-Settings用的是不带填充的base64url
+    static bool decodeBase64Url(const string& in,string& out) {
+        int bits = 0;
+        uint32_t acc = 0;
+        for(char c : in) {
+            int v;
+            if(c >= 'A' && c <= 'Z') v = c - 'A';
+            else if(c >= 'a' && c <= 'z') v = c - 'a' + 26;
+            else if(c >= '0' && c <= '9') v = c - '0' + 52;
+            else if(c == '-' || c == '+') v = 62;
+            else if(c == '_' || c == '/') v = 63;
+            else if(c == '=') break;
+            else return false;
+            acc = (acc << 6) | v;
+            bits += 6;
+            if(bits >= 8) {
+                bits -= 8;
+                out += static_cast<char>((acc >> bits) & 0xff);
+            }
+        }
+        return true;
+    }
+
+    static string toLower(const string& str) {
+        string out = str;
+        for(char& c : out) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        return out;
+    }
+
+    size_t max_streams;         //  同时打开的流的上限
+    size_t max_header_bytes;    //  解码后请求头的上限
+    size_t max_body_bytes;      //  请求体的上限
+    int recv_window;            //  我们给每个流和整个连接的接收窗口
+
+    bool preface_received;      //  已经收到客户端的连接前言
+    bool goaway_sent;           //  已经因为连接错误发送了GOAWAY
+    bool goaway_received;       //  客户端发送了GOAWAY，不再接受新的流
+    bool table_update_pending;  //  下一个头部块开头要发送动态表大小更新
+    uint32_t last_stream_id;    //  客户端打开过的最大的流
+    size_t opened;              //  接受过的流的数量
+    size_t client_resets;       //  客户端用RST_STREAM取消的流的数量
+    size_t orphaned;            //  被取消时请求已经交给服务器、还没有respond的流
+
+    uint32_t header_stream;     //  正在接收头部块（等CONTINUATION）的流，0表示没有
+    bool header_end_stream;     //  这个头部块的HEADERS帧带了END_STREAM
+    string header_block;        //  已经收到的头部块片段
+
+    size_t conn_recv_consumed;  //  连接上收到之后还没还给客户端的字节数
+    int64_t conn_recv_left;     //  连接的接收窗口还剩多少
+    size_t buffered_body;       //  所有流缓存的还没交给服务器的请求体的总字节数
+    int64_t conn_send_window;   //  连接的发送窗口
+    int64_t peer_initial_window;    //  客户端设置的流的初始发送窗口
+    size_t peer_max_frame;      //  客户端允许的最大帧长度
+
+    HpackDecoder decoder;
+    unordered_map<uint32_t,Stream> streams;     //  没有完全关闭的流
+    vector<uint32_t> sending;   //  响应体还没发完的流，按开始发送的顺序
+};
@@ -4,6 +4,9 @@
 #include <iostream>
 #include <unordered_map>
 #include <sstream>
+#include <cstdlib>
+#include <cstdint>
+#include <cctype>
 #include "Router.hpp"
 #include "HttpResponse.hpp"
 #include "Logger.hpp"
@@ -104,6 +107,90 @@ public:
         return this->url;
     }
 
+    //  获取Http协议版本
+    const string& getVersion() const {
+        return this->version;
+    }
+
+    //  获取请求头的值，名字不区分大小写，不存在时返回空串
+    string getHeader(const string& name) const {
+        auto it = headers.find(toLower(name));
+        return it == headers.end() ? string() : it->second;
+    }
+
+    //  是否有这个请求头，名字不区分大小写
+    bool hasHeader(const string& name) const {
+        return headers.find(toLower(name)) != headers.end();
+    }
+
+    //  请求体的长度，没有Content-Length时为0
+    //  值必须全是数字，不能溢出；重复的Content-Length（连成了"5, 5"）必须都一样，否则返回false
+    bool getContentLength(size_t& length) const {
+        length = 0;
+        auto it = headers.find("content-length");
+        if(it == headers.end()) return true;
+        const string& value = it->second;
+        bool found = false;
+        size_t pos = 0;
+        while(pos <= value.size()) {
+            size_t comma = value.find(',',pos);
+            if(comma == string::npos) comma = value.size();
+            if(found) {
+                while(pos < comma && value[pos] == ' ') ++pos;
+            }
+            if(pos == comma) return false;
+            size_t n = 0;
+            for(; pos < comma; ++pos) {
+                if(value[pos] < '0' || value[pos] > '9') return false;
+                size_t digit = value[pos] - '0';
+                if(n > (SIZE_MAX - digit) / 10) return false;
+                n = n * 10 + digit;
+            }
+            if(found && n != length) return false;
+            length = n;
+            found = true;
+            pos = comma + 1;
+        }
+        return true;
+    }
+
+    //  请求体是否使用分块编码发送：只看最后一个编码，"notchunked"或者"chunked, gzip"都不算
+    bool isChunked() const {
+        string value = toLower(getHeader("Transfer-Encoding"));
+        size_t comma = value.rfind(',');
+        size_t begin = value.find_first_not_of(" \t",comma == string::npos ? 0 : comma + 1);
+        size_t end = value.find_last_not_of(" \t");
+        return begin != string::npos && value.compare(begin,end - begin + 1,"chunked") == 0;
+    }
+
+    //  获取请求体
+    const string& getBody() const {
+        return this->body;
+    }
+
+    //  设置请求体  --  请求体可能分多次读到，由服务器读完后再设置
+    void setBody(const string& body) {
+        this->body = body;
+    }
+
+    //  处理完该请求后是否保持连接：HTTP/1.1默认保持，HTTP/1.0默认关闭
+    bool keepAlive() const {
+        string conn = toLower(getHeader("Connection"));
+        if(version == "HTTP/1.1") return conn != "close";
+        return conn == "keep-alive";
+    }
+
+    //  不经过文本解析，直接由请求方法、路径和版本初始化（HTTP/2的请求来自伪头部）
+    bool init(const string& method,const string& url,const string& version) {
+        if(method.find(' ') != string::npos || url.empty() || url.find(' ') != string::npos) return false;
+        return parseRequestLine(method + " " + url + " " + version);
+    }
+
+    //  添加一个请求头，名字不区分大小写
+    void addHeader(const string& name,const string& value) {
+        headers[toLower(name)] = value;
+    }
+
     //  其他成员函数和变量
     //  ...
 
@@ -131,12 +218,27 @@ private:
         if (pos == string::npos) {
             return false;   //  请求头格式错误
         }
-        string key = line.substr(0,pos);
-        string value = line.substr(pos + 1);
-        headers[key] = value;   //  存储键值对到headers字典里
+        //  请求头的名字不区分大小写，统一存成小写；值去掉前面的空格和行尾的\r
+        string key = toLower(line.substr(0,pos));
+        size_t begin = line.find_first_not_of(' ',pos + 1);
+        size_t end = line.find_last_not_of("\r ");
+        string value = (begin == string::npos || end < begin) ? "" : line.substr(begin,end - begin + 1);
+        //  存储键值对到headers字典里，同名的头按RFC 7230 3.2.2用逗号连起来，
+        //  不能只留最后一个，否则重复而且不一致的Content-Length就检查不出来
+        auto it = headers.find(key);
+        if(it == headers.end()) {
+            headers[key] = value;
+        } else {
+            it->second += ", " + value;
+        }
         return true;        
     }
 
+    static string toLower(string str) {
+        for(char& c : str) c = tolower(static_cast<unsigned char>(c));
+        return str;
+    }
+
 
     Method method;  //  请求方法
     string url;     //  请求路径
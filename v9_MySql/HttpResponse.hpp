@@ -3,8 +3,21 @@
 #include <string>
 #include <sstream>
 #include <unordered_map>
+#include <functional>
 using namespace std;
 
+
+//  流式响应体的输出端，处理函数通过它一块一块地写响应体
+class ChunkSink {
+public:
+    virtual ~ChunkSink() {}
+    virtual void write(const char* data,size_t len) = 0;
+
+    void write(const string& data) {
+        write(data.data(),data.size());
+    }
+};
+
 class HttpResponse {
 public:
 
@@ -25,6 +38,47 @@ public:
         headers[name] = value;
     }
 
+    //  获取响应头，没有时返回空字符串
+    string getHeader(const string& name) const {
+        auto it = headers.find(name);
+        return it == headers.end() ? string() : it->second;
+    }
+
+    //  获取所有响应头
+    const unordered_map<string,string>& getHeaders() const {
+        return this->headers;
+    }
+
+    //  获取响应体
+    const string& getBody() const {
+        return this->body;
+    }
+
+    //  获取状态码
+    int getStatusCode() const {
+        return this->statusCode;
+    }
+
+    //  流式响应体的生成函数：每次调用往sink里写一块数据，返回false表示已经写完
+    //  服务器会在套接字可写、输出缓冲区低于水位线时才调用它，所以内存占用和响应体大小无关
+    using BodyProducer = function<bool(ChunkSink&)>;
+
+    //  设置流式响应体，响应以 Transfer-Encoding: chunked 发送
+    void setChunkedBody(BodyProducer producer) {
+        this->producer = producer;
+        this->body.clear();
+    }
+
+    //  是否是流式响应
+    bool isChunked() const {
+        return static_cast<bool>(this->producer);
+    }
+
+    //  获取流式响应体的生成函数
+    const BodyProducer& getProducer() const {
+        return this->producer;
+    }
+
     //  一个响应数据的例子
     /*
         HTTP/1.1 200 OK
@@ -44,7 +98,9 @@ public:
 
 
     //  将响应转换成响应信息结构的字符串，按如上的格式拼接
-    string toString() const {
+    //  chunked为false时（HTTP/1.0的客户端不认识分块编码）流式响应既不发Transfer-Encoding也不发Content-Length，
+    //  响应体直接跟在后面，以关闭连接表示结束
+    string toString(bool chunked = true) const {
         ostringstream oss;
         //  添加Http头信息：版本协议 状态码 状态消息
         oss << "HTTP/1.1 " << statusCode << " " << getStatusMessage() << "\r\n";
@@ -53,8 +109,13 @@ public:
             oss << header.first << ": " << header.second << "\r\n";
         }
 
-        //	手动添加实体头部
-        oss << "Content-Length: " << body.size() << "\r\n";
+        //	手动添加实体头部    --  流式响应的长度事先不知道，用分块编码，响应体由服务器之后逐块发送
+        //  204和304没有响应体，也不发Content-Length
+        if(isChunked()) {
+            if(chunked) oss << "Transfer-Encoding: chunked\r\n";
+        } else if(statusCode != 204 && statusCode != 304) {
+            oss << "Content-Length: " << body.size() << "\r\n";
+        }
         
         
         //  添加空分行间隔响应头和响应体
@@ -84,16 +145,23 @@ private:
     string getStatusMessage() const {
         switch(statusCode) {
         case 200: return "OK";  //  请求成功，一切正常
+        case 206: return "Partial Content"; //  只返回了请求的范围
+        case 304: return "Not Modified";    //  客户端缓存的版本仍然有效
         case 404: return "Not Found";   //  找不到请求的资源
+        case 301: return "Moved Permanently";   //  资源永久重定向
         case 302: return "Moved Permanently";   //资源临时重定向
         case 400: return "Bad Request"; //  客户端请求无法解析或有语法试错法
         case 204: return "Unauthorized";    //  未授权，需要有效的身份凭证
+        case 408: return "Request Timeout"; //  客户端在规定时间内没有发完请求
+        case 413: return "Payload Too Large";   //  请求体超过了服务器允许的大小
+        case 416: return "Range Not Satisfiable";   //  请求的范围超出了内容长度
         default: return "Unknown";  //  默认是未知
         }
     }
     
     int statusCode;    //  状态码
     string body;    //  响应体
+    BodyProducer producer;  //  流式响应体的生成函数，为空表示普通响应
     unordered_map<string,string> headers;  //  响应头信息
 
 };
\ No newline at end of file
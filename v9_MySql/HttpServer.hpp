@@ -3,9 +3,17 @@
 
 #include <arpa/inet.h>     
 #include <sys/socket.h>          
+#include <netinet/tcp.h>    //  TCP层的套接字选项
 #include <sys/epoll.h>      //  引入epoll
+#include <sys/eventfd.h>    //  工作线程通知主循环
+#include <sys/resource.h>   //  进程的fd上限
 #include <fcntl.h>          //  进行非阻塞模式设置
 #include <unistd.h>         //  IO函数
+#include <signal.h>
+#include <cstring>
+#include <cstdio>
+#include <atomic>
+#include <memory>
 
 #include "Database.hpp"     //  引入数据库
 #include "Logger.hpp"       //  引入日志
@@ -13,53 +21,213 @@
 #include "Router.hpp"       //  引入路由
 #include "HttpResponse.hpp" //  引入响应
 #include "FileUtils.hpp" //  引入响应
+#include "ServerConfig.hpp" //  引入服务器配置
+#include "Connection.hpp"   //  引入连接状态
+#include "ConnectionTable.hpp"  //  引入连接表
+#include "TimerWheel.hpp"   //  引入时间轮
+#include "Compression.hpp"  //  引入响应压缩
+#include "StaticFiles.hpp"  //  引入静态文件服务
+#include "Http2.hpp"        //  引入HTTP/2
+#include "Tls.hpp"          //  引入TLS
+#include "Metrics.hpp"      //  引入指标
+#include "Trace.hpp"        //  引入请求的阶段计时
+#include "Capture.hpp"      //  引入流量录制
+#include "ConcurrencyLimit.hpp" //  引入自适应并发限制
 
 #define PORT 8080           //  定义端口
 #define EPOLL_SIZE 50       //  定义监听最大的数量
-#define BUF_SIZE 4096       //  定义缓冲区大小
+#define ACCEPT_RETRY_MS 10  //  accept出错后的退避时间
+
+
+//  流水线中的一个请求和它的响应
+struct PipelineItem {
+    PipelineItem(): keep_alive(true),ready(false),stream_id(0),admitted_us(0) {}
+
+    HttpRequest request;
+    HttpResponse response;
+    bool keep_alive;    //  处理完该请求后是否保持连接
+    bool ready;         //  响应已经生成或者已经交给其他线程
+    uint32_t stream_id; //  HTTP/2的流，HTTP/1.1的请求为0
+    Router::Match route;    //  匹配到的路由，分派时匹配一次，处理时直接用；其中的优先级决定交不交给其他线程、放进哪个队列
+    uint64_t admitted_us;   //  拿到并发限制名额的时间，没有经过并发限制时为0
+    RequestTrace trace; //  各阶段的时间，启用了阶段计时才记录
+};
+
+
+//  把流式响应体按分块编码（长度\r\n数据\r\n）追加到连接的输出缓冲区，chunked为false时原样追加
+class ChunkWriter : public ChunkSink {
+public:
+    ChunkWriter(ChainBuffer& out,bool chunked): out(out),chunked(chunked) {}
+
+    using ChunkSink::write;
+
+    void write(const char* data,size_t len) override {
+        //  长度为0的块表示响应体结束，由服务器在生成函数返回false之后再写
+        if(len == 0) return;
+        if(!chunked) {
+            out.append(data,len);
+            return;
+        }
+        char head[24];
+        int n = snprintf(head,sizeof(head),"%zx\r\n",len);
+        out.append(head,n);
+        out.append(data,len);
+        out.append("\r\n",2);
+    }
+
+private:
+    ChainBuffer& out;
+    bool chunked;
+};
+
+
+//  一批流水线请求，可能由多个工作线程同时处理
+struct PipelineBatch {
+    Connection* conn;
+    vector<PipelineItem> items;     //  按请求到达的顺序
+    atomic<int> remaining;          //  还没处理完的数量
+    mutex output_mutex;             //  HTTP/2的响应处理完就发，几个线程同时处理完时保护会话和输出缓冲区
+};
+
+
+//  accept的统计，由主循环写，其他线程可以随时读
+struct AcceptStats {
+    atomic<uint64_t> accepted{0};       //  成功接受并注册的连接数
+    atomic<uint64_t> drained{0};        //  把监听队列取空（EAGAIN）的次数
+    atomic<uint64_t> budget_exhausted{0};   //  单轮accept数量达到上限，留到下一轮的次数
+    atomic<uint64_t> shed{0};           //  fd耗尽（EMFILE/ENFILE）时接受后立即关闭的连接数
+    atomic<uint64_t> rejected{0};       //  fd超出连接表容量或注册epoll失败而关闭的连接数
+    atomic<uint64_t> aborted{0};        //  还没accept对端就断开了（ECONNABORTED等）
+    atomic<uint64_t> errors{0};         //  其他错误（ENOBUFS/ENOMEM等），稍后重试
+};
+
+
+//  超时统计，由主循环写，其他线程可以随时读
+struct TimeoutStats {
+    atomic<uint64_t> idle{0};       //  空闲超时关闭的连接数
+    atomic<uint64_t> header{0};     //  请求头超时关闭的连接数
+    atomic<uint64_t> request{0};    //  请求超时关闭的连接数
+};
 
 
 class HttpServer {
 public:
     //  构造函数，初始化成员变量并传入参数（端口号，epoll的最大监听事件，以及数据库的使用）
-    HttpServer(int port,int max_events,Database& db)
-    :port(port),max_events(max_events),db(db),server_fd(-1),epoll_fd(-1){}
+    HttpServer(int port,int max_events,Database& db,const ServerConfig& config = ServerConfig())
+    :port(port),max_events(max_events),db(db),config(config),server_fd(-1),epoll_fd(-1),wake_fd(-1),
+     reserve_fd(-1),accept_pending(false),accept_delay_ms(0),pool(nullptr),
+     connections(ConnectionTable::fdLimit(config.max_connections),[this](Connection* conn){ this->onTimeout(conn); }),
+     timers(config.timer_tick_ms),
+     active_connections(MetricsRegistry::global().gauge("http_active_connections","Open client connections")),
+     bytes_in(MetricsRegistry::global().counter("http_received_bytes_total","Bytes read from clients (after TLS)")),
+     bytes_out(MetricsRegistry::global().counter("http_sent_bytes_total","Bytes written to clients (before TLS)")),
+     overload_rejections(MetricsRegistry::global().counter("http_overload_rejections_total",
+                                                           "Connections answered with 503 because the ThreadPool queue was full")),
+     tracer(config.trace_sample,config.trace_slow_ms,config.trace_buffer),
+     capture(config.capture_path,config.capture_sample,config.capture_max_bytes),
+     limiter(config.limit){}
 
     //  启动服务器，设置套接字，epoll，启动线程池并进入主循环
     void start() {
+        //  fd的软上限提高之后，连接表按新的上限确定容量
+        raiseFdLimit();
+        connections.resize(ConnectionTable::fdLimit(config.max_connections));
         setupServerSocket();    //  创建并配置服务器套接字
         setupEpoll();           //  创建epoll实例
-        ThreadPool pool(4);    //  创建线程池
+        signal(SIGPIPE,SIG_IGN);    //  对端关闭后再写不能让整个进程退出
+        BufferPool::setNumaLocal(config.numa_local);
+        ThreadPool pool(config.pool);    //  创建线程池，线程数随排队情况在最小和最大之间调整
+        this->pool = &pool;
+        //  线程池创建之后再绑定主循环，没有指定CPU的工作线程不继承主循环的亲和性
+        pinReactor();
 
         //  初始化epoll_event数组
         auto events = new epoll_event[max_events];
+        LOG_INFO("connection table: capacity %zu, %.2f bytes per idle connection",
+                 connections.getCapacity(),ConnectionTable::bytesPerIdleConnection());
         LOG_INFO("start loop");
         //  主循环
         while(1) {
-            LOG_INFO("1");
-            int nfds = epoll_wait(epoll_fd,events,max_events,-1);   //  开始监听
-            LOG_INFO("2");
+            //  等待时间由时间轮决定，没有定时器时一直阻塞；上一轮还有连接没accept完时最多等accept_delay_ms
+            int timeout = timers.nextTimeoutMs(TimerWheel::nowMs());
+            if(accept_pending && (timeout < 0 || timeout > accept_delay_ms)) timeout = accept_delay_ms;
+            int nfds = epoll_wait(epoll_fd,events,max_events,timeout);   //  开始监听
+            //  监听socket是边沿触发，上一轮没取完的连接不会再有事件，需要主动继续
+            if(accept_pending) {
+                acceptConnection();
+            }
             //  轮询事件
             for(int i = 0;i < nfds;++i) {
-                if(events[i].data.fd == this->server_fd) {
-                    acceptConnection();
+                uint64_t token = events[i].data.u64;
+                if(token == static_cast<uint64_t>(this->server_fd)) {
+                    if(!accept_pending) acceptConnection();
+                } else if(token == static_cast<uint64_t>(this->wake_fd)) {
+                    finishConnections();
                 } else {
-                    int fd = events[i].data.fd;
-                    pool.enqueue([fd,this]{
-                        this->handleConnection(fd);
-                    });
+                    //  连接已经关闭或者fd已经被新连接复用时，这是一个过期的事件，直接忽略
+                    Connection* conn = connections.lookup(token);
+                    if(conn == nullptr || conn->busy) continue;
+                    //  有新数据说明不再空闲，空闲超时取消；请求头和请求超时不因为有数据而重置
+                    if(conn->phase == Connection::IDLE) {
+                        timers.cancel(&conn->timer);
+                        conn->deadline = 0;
+                    }
+                    conn->busy = true;
+                    if(tracer.enabled()) conn->dispatched_us = Metrics::nowUs();
+                    //  读连接的任务是高优先级的，慢的请求由它再放进低优先级的队列
+                    //  队列满了（或者这个连接的任务后来被更新的任务挤掉了）就直接回503
+                    bool admitted = pool.submit([conn,this]{ this->handleConnection(conn); },
+                                                [conn,this]{ this->rejectConnection(conn); },PRIORITY_HIGH,conn->cpu);
+                    if(!admitted) rejectConnection(conn);
                 }
             }
+            //  处理到期的定时器
+            timers.advance(TimerWheel::nowMs());
         }
         delete[] events;
     }
       
     //  析构，释放资源关闭连接
     ~HttpServer() {
+        connections.forEach([](Connection* conn){ close(conn->fd); });
         close(server_fd);
         close(epoll_fd);
+        close(wake_fd);
+        close(reserve_fd);
     }   
 
+    //  获取accept统计
+    const AcceptStats& getAcceptStats() const {
+        return this->accept_stats;
+    }
+
+    //  获取路由器，在start之前可以添加自定义的路由
+    Router& getRouter() {
+        return this->router;
+    }
+
+    //  获取超时统计
+    const TimeoutStats& getTimeoutStats() const {
+        return this->timeout_stats;
+    }
+
+    //  获取静态文件缓存的统计，start之前为nullptr
+    const FileCacheStats* getFileCacheStats() const {
+        return static_files ? &static_files->getStats() : nullptr;
+    }
+
+    //  获取压缩统计
+    const CompressionStats& getCompressionStats() const {
+        return Compression::stats();
+    }
+
+#ifdef USE_TLS
+    //  获取TLS统计，没有启用TLS时为nullptr
+    const TlsStats* getTlsStats() const {
+        return tls ? &tls->getStats() : nullptr;
+    }
+#endif
+
 
 private:
 
@@ -67,14 +235,45 @@ private:
     int port;       //  服务器使用的端口
     int max_events; //  能够监听的最多的端口数
     int epoll_fd;   //  epoll实例的文件描述符
-       //  epoll实例的文件描述符
+    int wake_fd;    //  工作线程处理完连接后通过它唤醒主循环
+    int reserve_fd; //  预留的fd，fd耗尽时释放它来accept并关闭新连接
+    bool accept_pending;    //  监听队列里可能还有没取完的连接
+    int accept_delay_ms;    //  多久之后再继续accept：数量用完时为0，出错时稍微退避
+    AcceptStats accept_stats;   //  accept统计
 
     Database& db;    //  数据库    
+    ServerConfig config;    //  服务器配置
 
     Router router;  //  路由器处理路由分发
+    ThreadPool* pool;   //  工作线程池，在start中创建
+    shared_ptr<StaticFiles> static_files;   //  静态文件服务，在setupRoutes中创建
+#ifdef USE_TLS
+    shared_ptr<TlsContext> tls;             //  启用TLS时的证书和会话缓存，在setupServerSocket中创建
+#endif
+
+    ConnectionTable connections;                    //  所有的客户端连接，只由主循环访问
+    TimerWheel timers;                              //  超时定时器，只由主循环访问
+    TimeoutStats timeout_stats;                     //  超时统计
+    Gauge& active_connections;                      //  打开的连接数
+    Counter& bytes_in;                              //  从客户端读到的字节数
+    Counter& bytes_out;                             //  发给客户端的字节数
+    Counter& overload_rejections;                   //  线程池满了回复503的连接数
+    Tracer tracer;                                  //  请求的阶段计时
+    TrafficCapture capture;                         //  流量录制
+    ConcurrencyLimiter limiter;                     //  耗时请求的自适应并发限制
+
+    mutex done_mutex;                   //  保护done_conns
+    vector<Connection*> done_conns;     //  工作线程处理完，等待主循环收尾的连接
+    vector<Connection*> done_batch;     //  主循环正在收尾的一批，和done_conns交换使用，避免反复申请内存
 
     //  初始化路由
     void setupRoutes() {
+        CompressionPolicy policy;
+        policy.enabled = config.compression;
+        policy.min_bytes = config.compression_min_bytes;
+        policy.level = config.compression_level;
+        this->router.setDefaultCompression(policy);
+
         //  添加根路由处理器，返回"Hello World"响应
         this->router.addRoute("GET","/",[this](const HttpRequest& req){ 
             HttpResponse response;
@@ -83,33 +282,94 @@ private:
             response.setStatusCode(200);
             return response;
         });
-        //  添加索引界面的路由
-        this->router.addRoute("GET","/index.html",[this](const HttpRequest& req){ 
-            HttpResponse response;
-            response.setBody(FileUtils::readfile("../static_rc/index.html"));
-            response.setHeader("Content-Type","text/html");
-            response.setStatusCode(200);
-            return response;
+        //  静态文件：static_root整个目录挂在static_prefix下，文件映射后缓存，已经预压缩，不再走动态压缩
+        auto files = make_shared<StaticFiles>(config.static_root,config.static_prefix,config);
+        this->static_files = files;
+        this->router.addPrefixRoute("GET",config.static_prefix,[files](const HttpRequest& request) {
+            return files->serve(request);
         });
+        CompressionPolicy no_compression;
+        no_compression.enabled = false;
+        this->router.setCompression("GET",config.static_prefix + "*",no_compression);
+        //  这些路由都很快，放进高优先级的队列；没有单独设置的路由是普通优先级
+        this->router.setPriority("GET","/",PRIORITY_HIGH);
+        this->router.setPriority("GET",config.static_prefix + "*",PRIORITY_HIGH);
         
         //  设置与数据库有关的路由
         router.setupDatabaseRoutes(this->db);
         //  其他路由在这里添加...
-        //  GET登录和注册 -- 获取静态资源           但实际上对于get请求的处理函数不传request也没事，因为没用到
-        this->router.addRoute("GET","/login",[this](HttpRequest request) {
-            HttpResponse response;
-            response.setStatusCode(200);
-            response.setHeader("Content-Type","text/html");
-            response.setBody(FileUtils::readfile("../static_rc/login.html")); //  读取html文件
-            return response;
+        //  GET登录和注册 -- 获取静态资源
+        this->router.addRoute("GET","/login",[files](const HttpRequest& request) {
+            return files->serveFile(request,"login.html");
         });
-        this->router.addRoute("GET","/register",[this](HttpRequest request) {
+        this->router.addRoute("GET","/register",[files](const HttpRequest& request) {
+            return files->serveFile(request,"register.html");
+        });
+        this->router.setPriority("GET","/login",PRIORITY_HIGH);
+        this->router.setPriority("GET","/register",PRIORITY_HIGH);
+        setupMetrics();
+        //  阶段计时保存的请求，导出成Chrome trace JSON
+        if(tracer.enabled()) {
+            this->router.addRoute("GET",config.trace_path,[this](const HttpRequest&) {
+                HttpResponse response;
+                response.setHeader("Content-Type","application/json");
+                response.setBody(tracer.chromeTrace());
+                return response;
+            });
+            this->router.setPriority("GET",config.trace_path,PRIORITY_HIGH);
+        }
+    }
+
+    //  把已有的统计注册到指标里（导出时才读），并添加指标的路由
+    void setupMetrics() {
+        MetricsRegistry& registry = MetricsRegistry::global();
+        auto stat = [](const atomic<uint64_t>& value) {
+            return [&value]{ return static_cast<double>(value.load(memory_order_relaxed)); };
+        };
+        registry.callback("http_accepted_connections_total","Connections accepted","counter","",
+                          stat(accept_stats.accepted));
+        registry.callback("http_refused_connections_total","Connections closed right after accept","counter",
+                          MetricsRegistry::label("reason","shed"),stat(accept_stats.shed));
+        registry.callback("http_refused_connections_total","Connections closed right after accept","counter",
+                          MetricsRegistry::label("reason","rejected"),stat(accept_stats.rejected));
+        registry.callback("http_accept_errors_total","accept failures other than EAGAIN","counter","",
+                          stat(accept_stats.errors));
+        registry.callback("http_timeouts_total","Connections closed by a timeout","counter",
+                          MetricsRegistry::label("phase","idle"),stat(timeout_stats.idle));
+        registry.callback("http_timeouts_total","Connections closed by a timeout","counter",
+                          MetricsRegistry::label("phase","header"),stat(timeout_stats.header));
+        registry.callback("http_timeouts_total","Connections closed by a timeout","counter",
+                          MetricsRegistry::label("phase","request"),stat(timeout_stats.request));
+        registry.callback("buffer_pool_slabs","Buffer slabs in use or cached","gauge",MetricsRegistry::label("state","in_use"),
+                          []{ return static_cast<double>(BufferPool::getStats().in_use); });
+        registry.callback("buffer_pool_slabs","Buffer slabs in use or cached","gauge",MetricsRegistry::label("state","cached"),
+                          []{ return static_cast<double>(BufferPool::getStats().cached); });
+        const FileCacheStats& files = static_files->getStats();
+        registry.callback("static_cache_lookups_total","Static file cache lookups","counter",
+                          MetricsRegistry::label("result","hit"),stat(files.hits));
+        registry.callback("static_cache_lookups_total","Static file cache lookups","counter",
+                          MetricsRegistry::label("result","miss"),stat(files.misses));
+        registry.callback("static_cache_lookups_total","Static file cache lookups","counter",
+                          MetricsRegistry::label("result","wait"),stat(files.waits));
+#ifdef USE_TLS
+        if(tls) {
+            const TlsStats& tls_stats = tls->getStats();
+            registry.callback("tls_handshakes_total","TLS handshakes","counter",
+                              MetricsRegistry::label("result","full"),stat(tls_stats.handshakes));
+            registry.callback("tls_handshakes_total","TLS handshakes","counter",
+                              MetricsRegistry::label("result","resumed"),stat(tls_stats.resumed));
+            registry.callback("tls_handshakes_total","TLS handshakes","counter",
+                              MetricsRegistry::label("result","failed"),stat(tls_stats.failed));
+        }
+#endif
+        if(!config.metrics) return;
+        this->router.addRoute("GET",config.metrics_path,[](const HttpRequest&) {
             HttpResponse response;
-            response.setStatusCode(200);
-            response.setHeader("Content-Type","text/html");
-            response.setBody(FileUtils::readfile("../static_rc/register.html")); //  读取html文件
+            response.setHeader("Content-Type","text/plain; version=0.0.4; charset=utf-8");
+            response.setBody(MetricsRegistry::global().exposition());
             return response;
         });
+        this->router.setPriority("GET",config.metrics_path,PRIORITY_HIGH);
     }
 
      //  初始化服务器
@@ -118,13 +378,15 @@ private:
         struct sockaddr_in serveraddr;
         socklen_t socklen = sizeof(struct sockaddr_in);
         
-        this->server_fd = socket(AF_INET,SOCK_STREAM,0);
+        this->server_fd = socket(AF_INET,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
         if(this->server_fd == -1) {
             LOG_INFO("socket failed");
             exit(EXIT_FAILURE);
         } 
-        setNonBlocking(this->server_fd);
         LOG_INFO("socket created");
+        //  预留一个fd，fd耗尽时用来接受并关闭连接，否则连接一直留在监听队列里，边沿触发的监听socket再也不会通知
+        this->reserve_fd = open("/dev/null",O_RDONLY | O_CLOEXEC);
+        applyListenerOptions();
 
         serveraddr.sin_family = AF_INET;
         serveraddr.sin_port = htons(port);
@@ -135,96 +397,916 @@ private:
             exit(EXIT_FAILURE);
         }
 
-        if(listen(server_fd,5) == -1) {
+        if(listen(server_fd,config.listen_backlog) == -1) {
             LOG_INFO("listen failed");
             exit(EXIT_FAILURE);
         }
+        //  TCP_DEFER_ACCEPT要在listen之后设置才有效
+        if(config.socket.defer_accept_s > 0) {
+            setSocketOption(server_fd,IPPROTO_TCP,TCP_DEFER_ACCEPT,config.socket.defer_accept_s,"TCP_DEFER_ACCEPT");
+        }
         LOG_INFO("Server listening on port %d",port);   //记录服务器监听
+        setupTls();
 
         //  初始化路由
         this->setupRoutes();
 
     }
 
+
+    //  按配置加载证书，启用了TLS但是加载失败或者没有用USE_TLS构建时直接退出，不能退回明文
+    void setupTls() {
+        if(!config.tls) return;
+#ifdef USE_TLS
+        this->tls = TlsContext::create(config);
+        if(this->tls) {
+            LOG_INFO("tls enabled, certificate %s",config.tls_cert.c_str());
+            return;
+        }
+#else
+        LOG_ERROR("tls requested but the server was built without USE_TLS");
+#endif
+        exit(EXIT_FAILURE);
+    }
     
+    //  把进程的fd软上限提高到硬上限，连接多的时候不会因为软上限（通常是1024）过早地EMFILE
+    static void raiseFdLimit() {
+        struct rlimit limit;
+        if(getrlimit(RLIMIT_NOFILE,&limit) == -1 || limit.rlim_cur >= limit.rlim_max) return;
+        rlim_t soft = limit.rlim_cur;
+        limit.rlim_cur = limit.rlim_max;
+        if(setrlimit(RLIMIT_NOFILE,&limit) == -1) {
+            LOG_WARNING("setrlimit(RLIMIT_NOFILE) failed, keep the soft limit %llu",static_cast<unsigned long long>(soft));
+        }
+    }
+
     //  创建epoll实例
     void setupEpoll() {
         epoll_fd = epoll_create(EPOLL_SIZE);
         //  将监听socket先注册进去
         struct epoll_event event;
-        event.data.fd = this->server_fd;
+        event.data.u64 = this->server_fd;
         event.events = EPOLLIN | EPOLLET;
         if(epoll_ctl(this->epoll_fd,EPOLL_CTL_ADD,this->server_fd,&event) == -1) {
             LOG_ERROR("epoll_ctl: server_fd");
             exit(EXIT_FAILURE);
         }
+        //  注册用于唤醒主循环的eventfd
+        this->wake_fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+        event.data.u64 = this->wake_fd;
+        event.events = EPOLLIN | EPOLLET;
+        if(this->wake_fd == -1 || epoll_ctl(this->epoll_fd,EPOLL_CTL_ADD,this->wake_fd,&event) == -1) {
+            LOG_ERROR("epoll_ctl: wake_fd");
+            exit(EXIT_FAILURE);
+        }
     }
 
     //  接收新的连接
+    //  每轮最多接受accept_budget个，剩下的留到下一轮，避免大量新连接让已有连接的事件得不到处理
     void acceptConnection() {
         LOG_INFO("new connection");
-        struct sockaddr_in clntaddr;
-        socklen_t socklen = sizeof(clntaddr);
-        int clnt_fd;
-        while((clnt_fd = accept(this->server_fd,(struct sockaddr*)&clntaddr,&socklen)) > 0 ) {
-            setNonBlocking(clnt_fd);
-            //  将其注册到epoll_events中
-            struct epoll_event event;
-            event.data.fd = clnt_fd;
-            event.events = EPOLLIN | EPOLLET;
-            if(epoll_ctl(this->epoll_fd,EPOLL_CTL_ADD,clnt_fd,&event) == -1) {
-                LOG_ERROR("Error adding new socket on epoll");
-                close(clnt_fd);
-                exit(EXIT_FAILURE);
-            } else {
-                LOG_INFO("New connection accepted");
+        accept_pending = false;
+        for(int budget = config.accept_budget;budget > 0;--budget) {
+            //  accept4直接得到非阻塞且exec时关闭的fd，省掉两次fcntl
+            int clnt_fd = accept4(this->server_fd,nullptr,nullptr,SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(clnt_fd == -1) {
+                if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                    //  监听队列已经取空
+                    accept_stats.drained++;
+                    return;
+                } else if(errno == EINTR) {
+                    continue;
+                } else if(errno == ECONNABORTED || errno == EPROTO || errno == EPERM) {
+                    //  对端在accept之前就断开了，跳过这个继续
+                    accept_stats.aborted++;
+                    continue;
+                } else if(errno == EMFILE || errno == ENFILE) {
+                    //  fd耗尽，用预留的fd接受再马上关闭，把连接从队列里清掉
+                    if(!shedConnection()) {
+                        retryAcceptLater(ACCEPT_RETRY_MS);
+                        return;
+                    }
+                    continue;
+                } else {
+                    //  ENOBUFS/ENOMEM等，等下一轮再试
+                    LOG_ERROR("accept failed: %s",strerror(errno));
+                    accept_stats.errors++;
+                    retryAcceptLater(ACCEPT_RETRY_MS);
+                    return;
+                }
             }
+            registerConnection(clnt_fd);
         }
+        //  本轮的数量用完了，下一轮继续
+        accept_stats.budget_exhausted++;
+        retryAcceptLater(0);
+    }
+
+    void retryAcceptLater(int delay_ms) {
+        accept_pending = true;
+        accept_delay_ms = delay_ms;
+    }
 
-        //  如果accept失败且错误原因不是EAGAIN或EWOULDBLOCK，那就说明有错误，则报错
-        if(clnt_fd == -1 && (errno != EAGAIN || errno != EWOULDBLOCK)) {
+    //  把新连接放进连接表并注册到epoll
+    void registerConnection(int clnt_fd) {
+        Connection* conn = connections.acquire(clnt_fd);
+        if(conn == nullptr) {
+            LOG_ERROR("fd %d exceeds connection table capacity",clnt_fd);
+            accept_stats.rejected++;
+            close(clnt_fd);
+            return;
+        }
+        applyClientOptions(clnt_fd);
+#ifdef USE_TLS
+        if(tls) {
+            SSL* ssl = tls->accept(clnt_fd);
+            if(ssl == nullptr) {
+                accept_stats.rejected++;
+                connections.release(conn);
+                close(clnt_fd);
+                return;
+            }
+            conn->tls.reset(new TlsStream(ssl,tls->getStats()));
+        }
+#endif
+        //  将其注册到epoll_events中    --  ONESHOT保证同一时间只有一个工作线程处理该连接
+        struct epoll_event event;
+        event.data.u64 = conn->token();
+        event.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+        if(epoll_ctl(this->epoll_fd,EPOLL_CTL_ADD,clnt_fd,&event) == -1) {
             LOG_ERROR("Error adding new socket on epoll");
+            accept_stats.rejected++;
+            connections.release(conn);
+            close(clnt_fd);
+            return;
+        }
+        conn->capture_id = capture.sample();
+        conn->cpu = incomingCpu(clnt_fd);
+        armTimer(conn);
+        accept_stats.accepted++;
+        active_connections.inc();
+        LOG_INFO("New connection accepted");
+    }
+
+    //  fd耗尽时释放预留fd，接受一个连接后立即关闭，再把预留fd拿回来
+    bool shedConnection() {
+        if(reserve_fd == -1) {
+            accept_stats.errors++;
+            return false;
         }
+        close(reserve_fd);
+        reserve_fd = -1;
+        int clnt_fd = accept4(this->server_fd,nullptr,nullptr,SOCK_CLOEXEC);
+        bool drained = clnt_fd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        if(clnt_fd != -1) {
+            close(clnt_fd);
+            accept_stats.shed++;
+            LOG_WARNING("out of file descriptors, shed a connection");
+        }
+        reserve_fd = open("/dev/null",O_RDONLY | O_CLOEXEC);
+        //  预留fd拿不回来（被其他线程占用了）时退避一会儿再试
+        return (clnt_fd != -1 || drained) && reserve_fd != -1;
     }
 
-    //  处理新的事件
-    void handleConnection(int fd) {
+    //  处理新的事件  --  在工作线程中执行，结果写在conn->action和conn->phase里
+    //  处理完（包括交给其他线程的流水线请求）之后调用notifyDone把连接交还给主循环
+    void handleConnection(Connection* conn) {
         LOG_INFO("handle");
-        char buf[BUF_SIZE];
-        string tmp;
-        HttpRequest request;
-        while(1) {
-            ssize_t strlen = read(fd,buf,BUF_SIZE - 1);
+        int fd = conn->fd;
+        conn->action = Connection::KEEP;
+        if(tracer.enabled()) conn->started_us = Metrics::nowUs();
+#ifdef USE_TLS
+        //  TLS握手没完成时先推进握手，需要等数据或者等可写时交还主循环
+        if(conn->tls && !conn->tls->handshakeDone() && !continueHandshake(conn)) {
+            notifyDone(conn);
+            return;
+        }
+#endif
+        //  上次没发完的响应（包括流式响应剩下的部分）先发出去，发不完就继续等可写，暂时不读新的请求
+        if(!pumpOutput(conn)) {
+            notifyDone(conn);
+            return;
+        }
+
+        //  输入缓冲区最多读到一个请求头加上正在等的请求体，剩下的留在套接字里，
+        //  处理完这些之后重新监听时epoll还会通知；不然客户端可以一直发，在一次处理里塞满内存
+        size_t read_limit = config.max_header_bytes + conn->body_wanted;
+        while(conn->inbuf.size() <= read_limit || hasPendingInput(conn)) {
+            ssize_t strlen = readInput(conn);
             if(strlen == -1) {
                 if(errno == EAGAIN || errno == EWOULDBLOCK) {
                     //  此时就是没数据可读了
                     break;
                 } else {
-                    //  此时才是真正出错了
+                    //  此时才是真正出错了，只关闭这一个连接
                     LOG_INFO("read error");
-                    close(fd);
-                    exit(EXIT_FAILURE);
+                    conn->action = Connection::CLOSE;
+                    notifyDone(conn);
+                    return;
                 }
             } else if(strlen == 0) {
                 LOG_INFO("disConnecting");
+                conn->peer_closed = true;
                 break;
-            } else {
-                buf[strlen] = '\0';
-                tmp += buf;
-            }  
+            }
+        }
+        //  TCP_QUICKACK不是持久的，内核在之后可能又进入延迟ACK模式，所以每次读完都重新设置
+        if(config.socket.quickack && !conn->peer_closed) {
+            setSocketOption(fd,IPPROTO_TCP,TCP_QUICKACK,1,nullptr);
         }
         //  此时读完了输入缓冲区的数据
-        //  解析Request数据并通过Rouer获得HttpResponse对象
-        if(request.parse(tmp)) {
-            HttpResponse  response = router.routeRequest(request);
-            string response_str = response.toString();
-            send(fd,response_str.c_str(),response_str.size(),0);
+        processRequests(conn);
+    }
+
+    //  TLS连接已经读进SSL里、还没有解密出来的数据，停止读取时不能留下，否则再也等不到事件
+    bool hasPendingInput(Connection* conn) const {
+#ifdef USE_TLS
+        return conn->tls && conn->tls->hasPending();
+#else
+        return false;
+#endif
+    }
+
+    //  读一次数据到输入缓冲区，TLS连接读解密后的数据；返回值同read
+    ssize_t readInput(Connection* conn) {
+#ifdef USE_TLS
+        TlsStream* tls = conn->tls.get();
+        ssize_t n = tls ? conn->inbuf.readWith([tls](char* buf,size_t len){ return tls->read(buf,len); })
+                        : conn->inbuf.readFd(conn->fd);
+#else
+        ssize_t n = conn->inbuf.readFd(conn->fd);
+#endif
+        if(n > 0) {
+            bytes_in.add(n);
+            if(conn->capture_id != 0) capture.record(conn->capture_id,conn->inbuf,n);
         }
+        return n;
+    }
+
+    //  写一次输出缓冲区：TLS连接在内核接管了加密（kTLS）之后和明文一样直接writev，否则经过SSL_write；返回值同write
+    ssize_t writeOutput(Connection* conn) {
+#ifdef USE_TLS
+        TlsStream* tls = conn->tls && !conn->tls->kernelSend() ? conn->tls.get() : nullptr;
+        ssize_t n = tls ? conn->outbuf.writeWith([tls](const char* buf,size_t len){ return tls->write(buf,len); })
+                        : conn->outbuf.writeFd(conn->fd);
+#else
+        ssize_t n = conn->outbuf.writeFd(conn->fd);
+#endif
+        if(n > 0) bytes_out.add(n);
+        return n;
+    }
+
+#ifdef USE_TLS
+    //  推进TLS握手，返回是否已经完成；握手期间按请求头超时计时，防止只连接不握手的客户端占着连接
+    //  ALPN选了h2的连接直接进入HTTP/2，等客户端的连接前言
+    bool continueHandshake(Connection* conn) {
+        switch(conn->tls->handshake()) {
+        case TlsStream::HANDSHAKE_DONE:
+            conn->want_write = false;
+            conn->phase = Connection::IDLE;
+            conn->deadline = 0;
+            if(conn->tls->negotiatedHttp2()) {
+                conn->h2.reset(new Http2Session(config));
+                conn->h2->start(conn->outbuf);
+            }
+            return true;
+        case TlsStream::HANDSHAKE_WANT_READ:
+            conn->want_write = false;
+            conn->phase = Connection::HEADER;
+            return false;
+        case TlsStream::HANDSHAKE_WANT_WRITE:
+            conn->want_write = true;
+            conn->phase = Connection::HEADER;
+            return false;
+        default:
+            conn->action = Connection::CLOSE;
+            return false;
+        }
+    }
+#endif
+
+    //  连接是否是TLS的
+    static bool isTls(const Connection* conn) {
+#ifdef USE_TLS
+        return static_cast<bool>(conn->tls);
+#else
+        (void)conn;
+        return false;
+#endif
+    }
+
+    //  处理输入缓冲区里的请求  --  客户端可能一次发来多个请求（流水线），每次取一批
+    //  低优先级（访问数据库）的请求总是按优先级放进线程池的队列，当前线程不等它们，接着去处理别的连接上的快请求；
+    //  普通优先级的请求在批次里有多个请求时交给其他工作线程并发处理，其余的在当前线程依次处理；
+    //  响应按请求顺序放在批次里对应的位置，最后一个处理完的线程负责按顺序写进输出缓冲区，一次writev发出
+    void processRequests(Connection* conn) {
+        while(1) {
+            shared_ptr<PipelineBatch> batch = make_shared<PipelineBatch>();
+            batch->conn = conn;
+            if(conn->h2) {
+                parseFrames(conn,*batch);
+            } else {
+                parseRequests(conn,*batch);
+            }
+            if(batch->items.empty()) {
+                //  HTTP/2即使没有新请求，也可能有SETTINGS确认、WINDOW_UPDATE要发，或者收到窗口后能继续发响应体
+                if(conn->h2) pumpOutput(conn);
+                finishHandling(conn);
+                return;
+            }
 
-        //  关闭socket
-        close(fd);
+            for(PipelineItem& item : batch->items) item.route = router.match(item.request);
+            if(limiter.enabled()) admitRequests(*batch);
+
+            //  remaining里多算的1代表当前线程，保证当前线程分派完之前批次不会被其他线程提前完成
+            size_t count = batch->items.size();
+            batch->remaining = 1;
+            //  HTTP/2解析时就被拒绝的流马上回复
+            if(conn->h2) {
+                for(PipelineItem& item : batch->items) {
+                    if(item.ready) respondStream(*batch,item);
+                }
+            }
+            for(size_t i = 0;i < count;++i) {
+                PipelineItem& item = batch->items[i];
+                TaskPriority priority = item.route.priority;
+                if(item.ready || priority == PRIORITY_HIGH || (priority == PRIORITY_NORMAL && count == 1)) continue;
+                item.ready = true;
+                batch->remaining++;
+                item.trace.mark(RequestTrace::ENQUEUE);
+                bool queued = pool->submit([this,batch,i]{
+                    batch->items[i].trace.mark(RequestTrace::DEQUEUE);
+                    this->runRequest(batch->items[i]);
+                    this->respondStream(*batch,batch->items[i]);
+                    if(--batch->remaining != 0) return;
+                    if(this->writeBatch(*batch)) {
+                        this->processRequests(batch->conn);
+                    } else {
+                        this->finishHandling(batch->conn);
+                    }
+                },nullptr,priority);
+                //  队列满了就在当前线程里处理，连接已经被接收了，它的请求不再拒绝
+                if(!queued) {
+                    item.ready = false;
+                    batch->remaining--;
+                }
+            }
+            for(size_t i = 0;i < count;++i) {
+                if(batch->items[i].ready) continue;
+                runRequest(batch->items[i]);
+                respondStream(*batch,batch->items[i]);
+            }
+            //  其他线程还没处理完，由最后完成的那个线程接着处理
+            if(--batch->remaining != 0) return;
+            if(!writeBatch(*batch)) {
+                finishHandling(conn);
+                return;
+            }
+        }
     }
 
+    //  从输入缓冲区里解析出最多max_pipeline_depth个完整的请求放进批次里
+    //  遇到HTTP/2的连接前言或者h2c升级请求时换成HTTP/2，剩下的数据按帧解析
+    void parseRequests(Connection* conn,PipelineBatch& batch) {
+        while(batch.items.size() < config.max_pipeline_depth && !conn->close_after_write) {
+            //  上次没读完的分块请求体接着解码，请求头已经解析过、从输入缓冲区里去掉了
+            if(conn->chunked.active()) {
+                batch.items.push_back(PipelineItem());
+                if(!finishChunkedBody(conn,batch)) return;
+                if(!finishRequest(conn,batch.items.back())) return;
+                continue;
+            }
+            if(batch.items.empty() && canSwitchToHttp2(conn) && Http2Session::isPreface(conn->inbuf)) {
+                conn->h2.reset(new Http2Session(config));
+                conn->h2->start(conn->outbuf);
+                parseFrames(conn,batch);
+                return;
+            }
+            size_t header_end = conn->inbuf.find("\r\n\r\n",4);
+            if(header_end == string::npos) {
+                //  请求头还没读完
+                if(conn->inbuf.size() > config.max_header_bytes) {
+                    conn->action = Connection::CLOSE;
+                }
+                conn->phase = conn->inbuf.empty() ? Connection::IDLE : Connection::HEADER;
+                return;
+            }
+            //  解析Request数据，之后再通过Rouer获得HttpResponse对象
+            batch.items.push_back(PipelineItem());
+            PipelineItem& item = batch.items.back();
+            if(!item.request.parse(conn->inbuf.copyOut(0,header_end + 4))) {
+                rejectRequest(conn,item,400,"Bad Request");
+                return;
+            }
+            //  升级请求要等前面的响应都写出去之后再处理，101必须紧跟在它们后面
+            //  h2c升级只用于明文连接，TLS连接通过ALPN协商
+            bool upgrade = config.http2 && !isTls(conn) && Http2Session::wantsUpgrade(item.request);
+            if(upgrade && batch.items.size() > 1) {
+                batch.items.pop_back();
+                return;
+            }
+            size_t body_start = header_end + 4;
+            //  Transfer-Encoding和Content-Length同时出现，或者最后一个编码不是chunked时请求体的长度不确定，
+            //  前面的代理可能和这里分得不一样（请求夹带），直接拒绝
+            if(item.request.hasHeader("Transfer-Encoding") &&
+               (item.request.hasHeader("Content-Length") || !item.request.isChunked())) {
+                rejectRequest(conn,item,400,"Bad Request");
+                return;
+            }
+            if(item.request.isChunked()) {
+                //  分块的请求体边读边解码，请求头先从输入缓冲区里去掉，解析好的请求留在连接上
+                conn->inbuf.consume(body_start);
+                conn->chunked.start(config.max_body_bytes,config.max_header_bytes);
+                conn->body_request = move(item.request);
+                if(!finishChunkedBody(conn,batch)) return;
+            } else {
+                size_t total = 0;
+                int ret = readBody(conn->inbuf,body_start,item.request,total);
+                if(ret == BODY_INVALID) {
+                    rejectRequest(conn,item,400,"Bad Request");
+                    return;
+                } else if(ret == BODY_TOO_LARGE) {
+                    rejectRequest(conn,item,413,"Payload Too Large");
+                    return;
+                } else if(ret == BODY_PARTIAL) {
+                    //  请求体还没读完，下次要把整个请求体读进来
+                    conn->body_wanted = total - body_start;
+                    batch.items.pop_back();
+                    conn->phase = Connection::REQUEST;
+                    return;
+                }
+                conn->inbuf.consume(total);
+                conn->body_wanted = 0;
+            }
+            if(upgrade && upgradeToHttp2(conn,item)) {
+                startTrace(conn,item);
+                conn->deadline = 0;
+                conn->phase = Connection::IDLE;
+                parseFrames(conn,batch);
+                return;
+            }
+            if(!finishRequest(conn,item)) return;
+        }
+    }
+
+    //  继续解码连接上的分块请求体，读完时把请求放进批次的最后一项；没读完或者出错时返回false，
+    //  没读完时最后一项从批次里去掉，出错时它是错误响应
+    bool finishChunkedBody(Connection* conn,PipelineBatch& batch) {
+        int ret = conn->chunked.decode(conn->inbuf);
+        if(ret == ChunkDecoder::PARTIAL) {
+            batch.items.pop_back();
+            conn->phase = Connection::REQUEST;
+            return false;
+        }
+        PipelineItem& item = batch.items.back();
+        item.request = move(conn->body_request);
+        conn->body_request = HttpRequest();
+        if(ret == ChunkDecoder::INVALID) {
+            rejectRequest(conn,item,400,"Bad Request");
+            return false;
+        } else if(ret == ChunkDecoder::TOO_LARGE) {
+            rejectRequest(conn,item,413,"Payload Too Large");
+            return false;
+        }
+        item.request.setBody(conn->chunked.takeBody());
+        return true;
+    }
+
+    //  一个请求完整地读完了，返回能不能接着解析后面的请求
+    bool finishRequest(Connection* conn,PipelineItem& item) {
+        startTrace(conn,item);
+        conn->deadline = 0;     //  下一个请求重新计时
+        conn->phase = Connection::IDLE;
+        //  不保持连接的请求之后的请求都不再处理
+        item.keep_alive = item.request.keepAlive() && !conn->peer_closed;
+        return item.keep_alive;
+    }
+
+    //  前面的响应都已经写进输出缓冲区时才能换协议
+    bool canSwitchToHttp2(Connection* conn) const {
+        return config.http2 && !conn->stream && conn->queued.empty();
+    }
+
+    //  h2c升级：回101之后马上发送服务器的连接前言，升级的请求作为流1处理，响应用HTTP/2发送
+    //  HTTP2-Settings不合法时忽略升级，按HTTP/1.1处理
+    bool upgradeToHttp2(Connection* conn,PipelineItem& item) {
+        if(!canSwitchToHttp2(conn)) return false;
+        unique_ptr<Http2Session> session(new Http2Session(config));
+        if(!session->upgrade(item.request.getHeader("HTTP2-Settings"))) return false;
+        conn->outbuf.append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+        session->start(conn->outbuf);
+        conn->h2 = move(session);
+        item.stream_id = 1;
+        return true;
+    }
+
+    //  解析HTTP/2的帧，接收完整的请求放进批次里；一次最多max_pipeline_depth个流在同一批里并发处理，剩下的帧下一批再解析
+    void parseFrames(Connection* conn,PipelineBatch& batch) {
+        Http2Session& session = *conn->h2;
+        vector<Http2Session::Request> ready;
+        if(!session.receive(conn->inbuf,conn->outbuf,ready,config.max_pipeline_depth)) {
+            //  连接错误，发完GOAWAY就关闭
+            conn->close_after_write = true;
+            return;
+        }
+        for(Http2Session::Request& request : ready) {
+            batch.items.push_back(PipelineItem());
+            PipelineItem& item = batch.items.back();
+            item.stream_id = request.stream_id;
+            item.request = request.request;
+            startTrace(conn,item);
+            if(request.error != 0) {
+                item.response = HttpResponse::makeErrorResponse(request.error,
+                                    request.error == 413 ? "Payload Too Large" : "Bad Request");
+                item.ready = true;
+            }
+        }
+        if(!ready.empty()) conn->deadline = 0;
+        conn->phase = conn->inbuf.empty() && !session.inHeaderBlock() ? Connection::IDLE : Connection::HEADER;
+        //  客户端说要走了，已有的流都处理完就关闭
+        if(session.peerGoingAway() && session.streamCount() == 0 && ready.empty()) {
+            conn->close_after_write = true;
+        }
+    }
+
+    //  读取请求体的结果
+    enum BodyResult {
+        BODY_COMPLETE,      //  请求体已经读完
+        BODY_PARTIAL,       //  还要继续读
+        BODY_INVALID,       //  格式错误
+        BODY_TOO_LARGE      //  超过了max_body_bytes
+    };
+
+    //  回一个错误响应并关闭连接，输入缓冲区里剩下的数据已经无法可靠地分出下一个请求
+    void rejectRequest(Connection* conn,PipelineItem& item,int code,const string& message) {
+        item.response = HttpResponse::makeErrorResponse(code,message);
+        item.keep_alive = false;
+        item.ready = true;
+        conn->inbuf.clear();
+    }
+
+    //  读取Content-Length指定长度的请求体，total为整个请求（含请求头）的长度
+    int readBody(const ChainBuffer& in,size_t body_start,HttpRequest& request,size_t& total) {
+        size_t length = 0;
+        if(!request.getContentLength(length)) return BODY_INVALID;
+        if(length > config.max_body_bytes) return BODY_TOO_LARGE;
+        total = body_start + length;
+        if(in.size() < total) return BODY_PARTIAL;
+        request.setBody(in.copyOut(body_start,length));
+        return BODY_COMPLETE;
+    }
+
+    //  低优先级（耗时）的请求先向并发限制要名额，拿不到的直接回复503，不执行处理函数，连接保持
+    void admitRequests(PipelineBatch& batch) {
+        for(PipelineItem& item : batch.items) {
+            if(item.ready || item.route.priority != PRIORITY_LOW) continue;
+            if(limiter.tryAcquire()) {
+                item.admitted_us = Metrics::nowUs();
+                continue;
+            }
+            item.response = HttpResponse::makeErrorResponse(503,"Service Unavailable");
+            item.response.setHeader("Retry-After",to_string(config.overload_retry_after_s));
+            item.ready = true;
+        }
+    }
+
+    //  执行一个请求的处理函数
+    //  动态生成的响应在这里按路由的压缩策略压缩，仍然在工作线程里，不占用主循环
+    //  处理期间这个请求是当前线程的请求，数据库调用的阶段记在它上面
+    void runRequest(PipelineItem& item) {
+        Tracer::Scope scope(item.trace);
+        item.trace.mark(RequestTrace::HANDLER);
+        item.trace.worker = Tracer::threadIndex();
+        item.response = router.routeRequest(item.request,item.route);
+        Compression::compressResponse(item.request,item.response,*item.route.compression);
+        item.trace.mark(RequestTrace::HANDLED);
+        if(item.admitted_us != 0) limiter.release(Metrics::nowUs() - item.admitted_us);
+    }
+
+    //  请求解析完，开始计时：分派和开始处理的时间来自连接
+    void startTrace(Connection* conn,PipelineItem& item) {
+        if(!tracer.enabled()) return;
+        item.trace.active = true;
+        item.trace.at[RequestTrace::DISPATCH] = conn->dispatched_us;
+        item.trace.at[RequestTrace::READ] = conn->started_us;
+        item.trace.mark(RequestTrace::PARSE);
+        item.trace.reader = Tracer::threadIndex();
+    }
+
+    //  响应发出去之后，保存采样到的和慢的请求
+    void finishTraces(PipelineBatch& batch) {
+        for(PipelineItem& item : batch.items) {
+            item.trace.mark(RequestTrace::SENT);
+            if(tracer.sampled(item.trace)) {
+                tracer.record(item.trace,item.request.getMethodString(),item.request.getPath(),
+                              item.response.getStatusCode());
+            }
+        }
+    }
+
+    //  HTTP/2的响应各自在自己的流上，不需要排队：一个请求处理完就写进它的流并尽量发出去，
+    //  不用等同一批里慢的请求；发不完的部分由最后完成的线程在writeBatch里接着发
+    void respondStream(PipelineBatch& batch,PipelineItem& item) {
+        Connection* conn = batch.conn;
+        if(!conn->h2) return;
+        lock_guard<mutex> lock(batch.output_mutex);
+        conn->h2->respond(item.stream_id,item.response,conn->outbuf);
+        pumpOutput(conn);
+    }
+
+    //  按顺序把一批响应写进输出缓冲区并发送，返回是否可以继续处理后面的请求
+    //  HTTP/2的响应已经由respondStream写过了，这里只发送剩下的输出
+    bool writeBatch(PipelineBatch& batch) {
+        Connection* conn = batch.conn;
+        if(!conn->h2) {
+            for(PipelineItem& item : batch.items) {
+                //  前一个响应要以关闭连接结束，后面的响应都不再发送
+                if(conn->close_after_write) break;
+                //  前面有流式响应还没发完时，后面的响应先排队，保证顺序
+                if(conn->stream || !conn->queued.empty()) {
+                    conn->queued.push_back(PendingResponse(item.response,item.keep_alive,item.request.getVersion()));
+                } else {
+                    appendResponse(conn,item.response,item.keep_alive,item.request.getVersion());
+                }
+            }
+        }
+        bool more = pumpOutput(conn) && conn->action == Connection::KEEP;
+        if(tracer.enabled()) finishTraces(batch);
+        return more;
+    }
+
+    //  请求都处理完了，把连接交还给主循环
+    void finishHandling(Connection* conn) {
+        if(conn->peer_closed && !conn->want_write) {
+            conn->action = Connection::CLOSE;
+        }
+        notifyDone(conn);
+    }
+
+    //  把响应追加到输出缓冲区，并通过Connection头告诉客户端是否保持连接
+    //  流式响应只追加响应头，响应体之后由pumpOutput边生成边发送；
+    //  HTTP/1.0不支持分块编码（RFC 7230 3.3.1），响应体原样发送，发完关闭连接
+    void appendResponse(Connection* conn,HttpResponse& response,bool keep_alive,const string& version) {
+        bool chunked = version != "HTTP/1.0";
+        if(response.isChunked() && !chunked) keep_alive = false;
+        response.setHeader("Connection",keep_alive ? "keep-alive" : "close");
+        conn->outbuf.append(response.toString(chunked));
+        if(response.isChunked()) {
+            conn->stream = response.getProducer();
+            conn->stream_chunked = chunked;
+        }
+        if(!keep_alive) conn->close_after_write = true;
+    }
+
+    //  发送连接上所有待发的响应：流式响应体每次只生成到stream_buffer_bytes，发出去之后再继续生成，
+    //  发完之后再把排在后面的响应写进输出缓冲区；返回是否全部发完
+    //  HTTP/2的响应体同样每次只生成到stream_buffer_bytes，还受流量控制窗口限制
+    //  没发完时设置want_write等待可写事件，出错或者发完需要关闭时设置action
+    bool pumpOutput(Connection* conn) {
+        while(1) {
+            if(conn->stream) {
+                produceChunks(conn);
+            } else if(conn->h2 && conn->h2->canSend()) {
+                conn->h2->flush(conn->outbuf,config.stream_buffer_bytes);
+            } else if(!conn->queued.empty()) {
+                //  排队的响应写进输出缓冲区，遇到下一个流式响应就停下
+                //  写进去的响应要以关闭连接结束时，剩下的都丢掉
+                size_t i = 0;
+                while(i < conn->queued.size() && !conn->stream && !conn->close_after_write) {
+                    PendingResponse& pending = conn->queued[i];
+                    appendResponse(conn,pending.response,pending.keep_alive,pending.version);
+                    ++i;
+                }
+                if(conn->close_after_write) {
+                    conn->queued.clear();
+                } else {
+                    conn->queued.erase(conn->queued.begin(),conn->queued.begin() + i);
+                }
+                continue;
+            }
+            if(!flushOutput(conn)) return false;
+            if(!conn->stream && conn->queued.empty() && !(conn->h2 && conn->h2->canSend())) break;
+        }
+        if(conn->h2) {
+            if(conn->h2->isClosing()) conn->close_after_write = true;
+            //  响应体在等客户端的WINDOW_UPDATE，按请求超时计时
+            if(conn->h2->isBlocked() && conn->phase == Connection::IDLE) conn->phase = Connection::REQUEST;
+        }
+        if(conn->close_after_write) {
+            conn->action = Connection::CLOSE;
+            return false;
+        }
+        return true;
+    }
+
+    //  调用流式响应的生成函数，直到输出缓冲区达到水位线或者响应体结束
+    void produceChunks(Connection* conn) {
+        ChunkWriter writer(conn->outbuf,conn->stream_chunked);
+        while(conn->stream && conn->outbuf.size() < config.stream_buffer_bytes) {
+            if(!conn->stream(writer)) {
+                if(conn->stream_chunked) conn->outbuf.append("0\r\n\r\n",5);
+                conn->stream = nullptr;
+            }
+        }
+    }
+
+    //  尽量发送输出缓冲区，返回是否全部发完
+    //  没发完时设置want_write等待可写事件，出错时设置action
+    bool flushOutput(Connection* conn) {
+        size_t written = 0;
+        while(!conn->outbuf.empty()) {
+            ssize_t n = writeOutput(conn);
+            if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                //  发送缓冲区满了，等它可写，期间按请求超时计时；
+                //  这次写出了数据说明客户端还在读，重新计时，长时间的流式响应不会因此超时
+                conn->want_write = true;
+                if(conn->phase == Connection::IDLE) conn->phase = Connection::REQUEST;
+                if(written > 0) conn->deadline = 0;
+                return false;
+            } else if(n == -1) {
+                conn->action = Connection::CLOSE;
+                return false;
+            }
+            written += n;
+        }
+        conn->want_write = false;
+        return true;
+    }
+
+    //  工作线程处理完后交还给主循环
+    void notifyDone(Connection* conn) {
+        {
+            unique_lock<mutex> lock(done_mutex);
+            done_conns.push_back(conn);
+        }
+        uint64_t one = 1;
+        ssize_t ret = write(wake_fd,&one,sizeof(one));
+        (void)ret;
+    }
+
+    //  主循环中对工作线程处理完的连接收尾：关闭，或者重新设置定时器并继续监听
+    void finishConnections() {
+        uint64_t value;
+        while(read(wake_fd,&value,sizeof(value)) > 0) {}
+        {
+            unique_lock<mutex> lock(done_mutex);
+            done_batch.swap(done_conns);
+        }
+        for(Connection* conn : done_batch) {
+            conn->busy = false;
+            if(conn->expired || conn->action == Connection::CLOSE) {
+                closeConnection(conn);
+                continue;
+            }
+            armTimer(conn);
+            //  还有响应没发完时只等可写事件，客户端读得慢就不再读它的新请求
+            struct epoll_event event;
+            event.data.u64 = conn->token();
+            event.events = (conn->want_write ? EPOLLOUT : EPOLLIN) | EPOLLET | EPOLLONESHOT;
+            if(epoll_ctl(this->epoll_fd,EPOLL_CTL_MOD,conn->fd,&event) == -1) {
+                LOG_ERROR("Error rearming socket on epoll");
+                closeConnection(conn);
+            }
+        }
+        done_batch.clear();
+    }
+
+    //  根据连接当前的阶段设置定时器；阶段没有变化时保持原来的截止时间
+    void armTimer(Connection* conn) {
+        uint64_t now = TimerWheel::nowMs();
+        if(conn->deadline == 0 || conn->deadline_phase != conn->phase) {
+            int timeout_ms = timeoutOf(conn->phase);
+            conn->deadline_phase = conn->phase;
+            conn->deadline = timeout_ms > 0 ? now + timeout_ms : 0;
+        }
+        if(conn->deadline == 0) {
+            timers.cancel(&conn->timer);
+            return;
+        }
+        timers.add(&conn->timer,conn->deadline > now ? conn->deadline - now : 0);
+    }
+
+    //  各阶段对应的超时时间
+    int timeoutOf(Connection::Phase phase) const {
+        switch(phase) {
+        case Connection::IDLE:      return config.idle_timeout_ms;
+        case Connection::HEADER:    return config.header_timeout_ms;
+        case Connection::REQUEST:   return config.request_timeout_ms;
+        }
+        return 0;
+    }
+
+    //  定时器到期  --  在主循环中执行
+    void onTimeout(Connection* conn) {
+        switch(conn->deadline_phase) {
+        case Connection::IDLE:      timeout_stats.idle++;       break;
+        case Connection::HEADER:    timeout_stats.header++;     break;
+        case Connection::REQUEST:   timeout_stats.request++;    break;
+        }
+        LOG_INFO("connection %d timed out in phase %d",conn->fd,conn->deadline_phase);
+        //  正在被工作线程处理，不能在这里关闭，等它处理完再关
+        if(conn->busy) {
+            conn->expired = true;
+            return;
+        }
+        //  请求没读完就超时的，尽量告诉客户端一声（HTTP/2的连接不能再发HTTP/1.1的响应）
+        if(conn->deadline_phase != Connection::IDLE && !conn->h2 && !isTls(conn)) {
+            static const char timeout_response[] =
+                "HTTP/1.1 408 Request Timeout\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+            ssize_t ret = send(conn->fd,timeout_response,sizeof(timeout_response) - 1,MSG_NOSIGNAL | MSG_DONTWAIT);
+            (void)ret;
+        }
+        closeConnection(conn);
+    }
+
+    //  线程池的队列满了，不再处理这个连接上的新数据  --  只能在主循环中调用
+    //  明文HTTP/1.1连接没有发到一半的响应时，读掉已经到达的请求，回复503和Retry-After再关闭；HTTP/2和TLS连接直接关闭
+    void rejectConnection(Connection* conn) {
+        overload_rejections.add();
+        if(!isTls(conn) && !conn->h2 && conn->outbuf.empty() && !conn->stream) {
+            //  接收缓冲区里留着数据时close会发RST，客户端可能来不及读到503
+            char discard[4096];
+            for(int i = 0;i < 16 && read(conn->fd,discard,sizeof(discard)) > 0;++i) {}
+            string response = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: " +
+                              to_string(config.overload_retry_after_s) +
+                              "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            ssize_t ret = send(conn->fd,response.data(),response.size(),MSG_NOSIGNAL | MSG_DONTWAIT);
+            (void)ret;
+        }
+        closeConnection(conn);
+    }
+
+    //  关闭连接并释放连接状态   --  只能在主循环中调用
+    void closeConnection(Connection* conn) {
+        timers.cancel(&conn->timer);
+#ifdef USE_TLS
+        if(conn->tls) conn->tls->shutdown();
+#endif
+        if(conn->capture_id != 0) capture.closed(conn->capture_id);
+        close(conn->fd);
+        connections.release(conn);
+        active_connections.dec();
+    }
+
+    //  设置监听socket的选项，在bind之前调用；接受的socket会继承缓冲区大小
+    void applyListenerOptions() {
+        const SocketOptions& opt = config.socket;
+        if(opt.reuse_addr) setSocketOption(server_fd,SOL_SOCKET,SO_REUSEADDR,1,"SO_REUSEADDR");
+        if(opt.reuse_port) setSocketOption(server_fd,SOL_SOCKET,SO_REUSEPORT,1,"SO_REUSEPORT");
+        if(opt.rcvbuf > 0) setSocketOption(server_fd,SOL_SOCKET,SO_RCVBUF,opt.rcvbuf,"SO_RCVBUF");
+        if(opt.sndbuf > 0) setSocketOption(server_fd,SOL_SOCKET,SO_SNDBUF,opt.sndbuf,"SO_SNDBUF");
+        if(opt.fastopen_qlen > 0) setSocketOption(server_fd,IPPROTO_TCP,TCP_FASTOPEN,opt.fastopen_qlen,"TCP_FASTOPEN");
+    }
+
+    //  设置新接受的socket的选项
+    //  连接的包由哪个CPU收（网卡队列的中断或者RPS决定），之后在同一个CPU附近处理，收包时热起来的缓存不浪费
+    //  连接的CPU只在accept时读一次，不知道时返回-1
+    int incomingCpu(int fd) {
+#ifdef SO_INCOMING_CPU
+        if(!config.socket.incoming_cpu) return -1;
+        int cpu = -1;
+        socklen_t len = sizeof(cpu);
+        if(getsockopt(fd,SOL_SOCKET,SO_INCOMING_CPU,&cpu,&len) == -1) return -1;
+        return cpu;
+#else
+        (void)fd;
+        return -1;
+#endif
+    }
+
+    //  把主循环绑定到--reactor_cpus上
+    void pinReactor() {
+        if(config.reactor_cpus.empty()) return;
+        vector<int> cpus;
+        if(!Affinity::parseCpuList(config.reactor_cpus,cpus)) {
+            LOG_WARNING("invalid reactor_cpus '%s', reactor is not pinned",config.reactor_cpus.c_str());
+            return;
+        }
+        if(Affinity::pinCurrentThread(cpus)) LOG_INFO("reactor pinned to cpus %s",config.reactor_cpus.c_str());
+    }
+
+    void applyClientOptions(int fd) {
+        const SocketOptions& opt = config.socket;
+        if(opt.tcp_nodelay) setSocketOption(fd,IPPROTO_TCP,TCP_NODELAY,1,"TCP_NODELAY");
+        if(opt.quickack) setSocketOption(fd,IPPROTO_TCP,TCP_QUICKACK,1,"TCP_QUICKACK");
+        if(opt.keepalive) {
+            setSocketOption(fd,SOL_SOCKET,SO_KEEPALIVE,1,"SO_KEEPALIVE");
+            if(opt.keepalive_idle_s > 0) setSocketOption(fd,IPPROTO_TCP,TCP_KEEPIDLE,opt.keepalive_idle_s,"TCP_KEEPIDLE");
+            if(opt.keepalive_interval_s > 0) setSocketOption(fd,IPPROTO_TCP,TCP_KEEPINTVL,opt.keepalive_interval_s,"TCP_KEEPINTVL");
+            if(opt.keepalive_count > 0) setSocketOption(fd,IPPROTO_TCP,TCP_KEEPCNT,opt.keepalive_count,"TCP_KEEPCNT");
+        }
+        if(opt.rcvbuf > 0) setSocketOption(fd,SOL_SOCKET,SO_RCVBUF,opt.rcvbuf,"SO_RCVBUF");
+        if(opt.sndbuf > 0) setSocketOption(fd,SOL_SOCKET,SO_SNDBUF,opt.sndbuf,"SO_SNDBUF");
+    }
+
+    //  设置一个整型的套接字选项，失败只记录日志（name为空时不记录），不影响服务
+    bool setSocketOption(int fd,int level,int option,int value,const char* name) {
+        if(setsockopt(fd,level,option,&value,sizeof(value)) == -1) {
+            if(name != nullptr) LOG_WARNING("setsockopt %s failed: %s",name,strerror(errno));
+            return false;
+        }
+        return true;
+    }
 
     //  设置为非阻塞模式
     void setNonBlocking(int fd) {
@@ -50,7 +50,9 @@ public:
         va_end(args);    
 
         //  将时间戳，日志级别，以及格式化后的日志信息写入日志文件
-        logFile << ctime(&now_c) << " [" << levelStr << "] " << buffer <<endl;
+        //  多个工作线程会同时写日志，ctime返回的是共享的静态缓冲区，用ctime_r
+        char time_buffer[32];
+        logFile << ctime_r(&now_c,time_buffer) << " [" << levelStr << "] " << buffer <<endl;
 
         //  关闭日志文件
         logFile.close();    
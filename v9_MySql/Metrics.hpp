@@ -0,0 +1,302 @@
+#pragma once
+//  运行指标  --  计数器、仪表和延迟直方图，由/metrics按Prometheus的文本格式导出
+//  记录在热路径上，代价是O(1)：每个线程固定写自己的分片（relaxed的原子加，不同线程不会争同一个缓存行），
+//  只有导出的时候才把所有分片加起来
+//  直方图是对数线性的（HDR风格）：每个2的幂区间再等分成8个桶，相对误差不超过12.5%，定位桶只需要几次位运算
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+#define METRIC_SHARDS 16            //  每个指标的分片数，线程按第一次记录的顺序轮流分到一个分片
+#define CACHE_LINE 64
+#define HISTOGRAM_SUB_BITS 3        //  每个2的幂区间等分成2^3个桶
+#define HISTOGRAM_MAX_EXP 36        //  最多区分到2^36微秒（约19小时），更大的值都记在最后一个桶里
+#define HISTOGRAM_EXPORT_MIN 4      //  导出的桶边界从2^4微秒到2^25微秒（约33秒），每次翻倍
+#define HISTOGRAM_EXPORT_MAX 25
+
+
+class Metrics {
+public:
+    //  单调时钟的微秒数，用来计算延迟
+    static uint64_t nowUs() {
+        return chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //  当前线程的分片下标
+    static size_t shard() {
+        static atomic<size_t> next{0};
+        thread_local size_t index = next.fetch_add(1,memory_order_relaxed) % METRIC_SHARDS;
+        return index;
+    }
+};
+
+
+//  独占一个缓存行的原子变量
+template<typename T>
+struct PaddedAtomic {
+    atomic<T> value{0};
+    char pad[CACHE_LINE - sizeof(atomic<T>)];
+};
+
+
+//  只增不减的计数器
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        cells[Metrics::shard()].value.fetch_add(n,memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t sum = 0;
+        for(const auto& cell : cells) sum += cell.value.load(memory_order_relaxed);
+        return sum;
+    }
+
+private:
+    PaddedAtomic<uint64_t> cells[METRIC_SHARDS];
+};
+
+
+//  可增可减的仪表，比如活跃连接数、队列长度；增和减可以发生在不同的线程，只有总和有意义
+class Gauge {
+public:
+    void add(int64_t n) {
+        cells[Metrics::shard()].value.fetch_add(n,memory_order_relaxed);
+    }
+
+    void inc() { add(1); }
+    void dec() { add(-1); }
+
+    int64_t value() const {
+        int64_t sum = 0;
+        for(const auto& cell : cells) sum += cell.value.load(memory_order_relaxed);
+        return sum;
+    }
+
+private:
+    PaddedAtomic<int64_t> cells[METRIC_SHARDS];
+};
+
+
+//  延迟直方图，单位为微秒
+//  记录的值是截断到微秒的，真实值一定小于所在桶的上界，所以导出时用上界作为le是精确的
+class Histogram {
+public:
+    static const int SUB = 1 << HISTOGRAM_SUB_BITS;
+    static const int BUCKETS = (HISTOGRAM_MAX_EXP - HISTOGRAM_SUB_BITS + 2) * SUB;
+
+    void record(uint64_t us) {
+        Shard& s = shards[Metrics::shard()];
+        s.buckets[bucketOf(us)].fetch_add(1,memory_order_relaxed);
+        s.sum.fetch_add(us,memory_order_relaxed);
+    }
+
+    //  值所在的桶：小于SUB的值每个一个桶，之后每个2的幂区间SUB个桶
+    static int bucketOf(uint64_t us) {
+        if(us < static_cast<uint64_t>(SUB)) return static_cast<int>(us);
+        int exp = 63 - __builtin_clzll(us);
+        if(exp > HISTOGRAM_MAX_EXP) return BUCKETS - 1;
+        return (exp - HISTOGRAM_SUB_BITS + 1) * SUB + static_cast<int>((us >> (exp - HISTOGRAM_SUB_BITS)) & (SUB - 1));
+    }
+
+    //  桶的上界（不包含）
+    static uint64_t upperBound(int bucket) {
+        if(bucket < SUB) return bucket + 1;
+        int exp = bucket / SUB + HISTOGRAM_SUB_BITS - 1;
+        uint64_t width = 1ULL << (exp - HISTOGRAM_SUB_BITS);
+        return (SUB + bucket % SUB) * width + width;
+    }
+
+    //  把所有分片合并成一份，counts[i]为第i个桶的计数
+    void snapshot(vector<uint64_t>& counts,uint64_t& sum) const {
+        counts.assign(BUCKETS,0);
+        sum = 0;
+        for(const Shard& s : shards) {
+            for(int i = 0;i < BUCKETS;++i) counts[i] += s.buckets[i].load(memory_order_relaxed);
+            sum += s.sum.load(memory_order_relaxed);
+        }
+    }
+
+private:
+    struct Shard {
+        atomic<uint64_t> buckets[BUCKETS];
+        atomic<uint64_t> sum;
+        char pad[CACHE_LINE];       //  和下一个分片的第一个桶隔开
+
+        Shard(): sum(0) {
+            for(auto& bucket : buckets) bucket.store(0,memory_order_relaxed);
+        }
+    };
+
+    Shard shards[METRIC_SHARDS];
+};
+
+
+//  在作用域结束时把经过的时间记进直方图
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram): histogram(histogram),start(Metrics::nowUs()) {}
+
+    ~ScopedTimer() {
+        histogram.record(Metrics::nowUs() - start);
+    }
+
+private:
+    Histogram& histogram;
+    uint64_t start;
+};
+
+
+//  所有指标的注册表，同名同标签的指标只创建一次（取得的引用一直有效），热路径上只用取得的引用，不查表
+//  已经有原子统计的模块（accept、超时、文件缓存等）注册回调，导出时再读，不增加记录的开销
+class MetricsRegistry {
+public:
+    static MetricsRegistry& global() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    //  labels是已经格式化好的标签，比如 route="GET /login"，可以用label()生成
+    Counter& counter(const string& name,const string& help,const string& labels = "") {
+        lock_guard<mutex> lock(registry_mutex);
+        Series& series = find(name,help,"counter",labels);
+        if(!series.counter) series.counter.reset(new Counter());
+        return *series.counter;
+    }
+
+    Gauge& gauge(const string& name,const string& help,const string& labels = "") {
+        lock_guard<mutex> lock(registry_mutex);
+        Series& series = find(name,help,"gauge",labels);
+        if(!series.gauge) series.gauge.reset(new Gauge());
+        return *series.gauge;
+    }
+
+    //  延迟直方图，名字以_seconds结尾，导出时从微秒换算成秒
+    Histogram& histogram(const string& name,const string& help,const string& labels = "") {
+        lock_guard<mutex> lock(registry_mutex);
+        Series& series = find(name,help,"histogram",labels);
+        if(!series.histogram) series.histogram.reset(new Histogram());
+        return *series.histogram;
+    }
+
+    //  导出时调用read取值，type为counter或者gauge；同名同标签的回调会被替换
+    void callback(const string& name,const string& help,const string& type,const string& labels,
+                  function<double()> read) {
+        lock_guard<mutex> lock(registry_mutex);
+        find(name,help,type,labels).read = read;
+    }
+
+    //  生成一个标签，值里的反斜杠、引号和换行按格式转义
+    static string label(const string& name,const string& value) {
+        string out = name + "=\"";
+        for(char c : value) {
+            if(c == '\\' || c == '"') out += '\\';
+            if(c == '\n') {
+                out += "\\n";
+                continue;
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    //  按Prometheus文本格式（0.0.4）导出所有指标
+    string exposition() const {
+        lock_guard<mutex> lock(registry_mutex);
+        string out;
+        vector<uint64_t> counts;
+        for(const auto& entry : families) {
+            const string& name = entry.first;
+            const Family& family = entry.second;
+            out += "# HELP " + name + " " + family.help + "\n";
+            out += "# TYPE " + name + " " + family.type + "\n";
+            for(const auto& series : family.series) {
+                if(series->histogram) {
+                    appendHistogram(out,name,series->labels,*series->histogram,counts);
+                } else if(series->read) {
+                    appendSample(out,name,series->labels,series->read());
+                } else if(series->counter) {
+                    appendSample(out,name,series->labels,static_cast<double>(series->counter->value()));
+                } else if(series->gauge) {
+                    appendSample(out,name,series->labels,static_cast<double>(series->gauge->value()));
+                }
+            }
+        }
+        return out;
+    }
+
+private:
+    struct Series {
+        string labels;
+        unique_ptr<Counter> counter;
+        unique_ptr<Gauge> gauge;
+        unique_ptr<Histogram> histogram;
+        function<double()> read;
+    };
+
+    struct Family {
+        string help;
+        string type;
+        vector<unique_ptr<Series>> series;
+    };
+
+    MetricsRegistry() = default;
+
+    //  调用时必须持有registry_mutex
+    Series& find(const string& name,const string& help,const string& type,const string& labels) {
+        Family& family = families[name];
+        if(family.type.empty()) {
+            family.help = help;
+            family.type = type;
+        }
+        for(auto& series : family.series) {
+            if(series->labels == labels) return *series;
+        }
+        family.series.emplace_back(new Series());
+        family.series.back()->labels = labels;
+        return *family.series.back();
+    }
+
+    static void appendSample(string& out,const string& name,const string& labels,double value) {
+        char number[32];
+        snprintf(number,sizeof(number),"%.15g",value);
+        out += name;
+        if(!labels.empty()) out += "{" + labels + "}";
+        out += " ";
+        out += number;
+        out += "\n";
+    }
+
+    //  累计计数按2的幂的边界导出，再加上+Inf、_sum和_count
+    static void appendHistogram(string& out,const string& name,const string& labels,const Histogram& histogram,
+                                vector<uint64_t>& counts) {
+        uint64_t sum = 0;
+        histogram.snapshot(counts,sum);
+        string prefix = labels.empty() ? "" : labels + ",";
+        uint64_t cumulative = 0;
+        for(int i = 0;i < Histogram::BUCKETS;++i) {
+            cumulative += counts[i];
+            uint64_t upper = Histogram::upperBound(i);
+            if((upper & (upper - 1)) != 0 || upper < (1ULL << HISTOGRAM_EXPORT_MIN)
+               || upper > (1ULL << HISTOGRAM_EXPORT_MAX)) continue;
+            char le[32];
+            snprintf(le,sizeof(le),"%.9g",upper / 1e6);
+            appendSample(out,name + "_bucket",prefix + "le=\"" + le + "\"",static_cast<double>(cumulative));
+        }
+        appendSample(out,name + "_bucket",prefix + "le=\"+Inf\"",static_cast<double>(cumulative));
+        appendSample(out,name + "_sum",labels,sum / 1e6);
+        appendSample(out,name + "_count",labels,static_cast<double>(cumulative));
+    }
+
+    mutable mutex registry_mutex;
+    map<string,Family> families;    //  按名字排序，导出的顺序固定
+};
@@ -0,0 +1,64 @@
+#pragma once
+//  MIME类型  --  按扩展名确定Content-Type，以及该类型是否值得压缩
+//  不依赖服务器的其他部分，构建时嵌入静态资源的工具也用它
+#include <cctype>
+#include <string>
+#include <unordered_map>
+using namespace std;
+
+
+//  扩展名到MIME类型的映射
+class MimeTypes {
+public:
+    static string lookup(const string& path) {
+        static const unordered_map<string,string> table = {
+            {"html","text/html; charset=utf-8"},
+            {"htm","text/html; charset=utf-8"},
+            {"css","text/css; charset=utf-8"},
+            {"js","application/javascript; charset=utf-8"},
+            {"mjs","application/javascript; charset=utf-8"},
+            {"json","application/json"},
+            {"map","application/json"},
+            {"txt","text/plain; charset=utf-8"},
+            {"csv","text/csv; charset=utf-8"},
+            {"xml","application/xml"},
+            {"svg","image/svg+xml"},
+            {"png","image/png"},
+            {"jpg","image/jpeg"},
+            {"jpeg","image/jpeg"},
+            {"gif","image/gif"},
+            {"webp","image/webp"},
+            {"avif","image/avif"},
+            {"ico","image/x-icon"},
+            {"woff","font/woff"},
+            {"woff2","font/woff2"},
+            {"ttf","font/ttf"},
+            {"otf","font/otf"},
+            {"wasm","application/wasm"},
+            {"pdf","application/pdf"},
+            {"zip","application/zip"},
+            {"gz","application/gzip"},
+            {"mp3","audio/mpeg"},
+            {"mp4","video/mp4"},
+            {"webm","video/webm"},
+        };
+        size_t dot = path.rfind('.');
+        size_t slash = path.rfind('/');
+        if(dot == string::npos || (slash != string::npos && dot < slash)) return "application/octet-stream";
+        string ext = path.substr(dot + 1);
+        for(char& c : ext) c = tolower(static_cast<unsigned char>(c));
+        auto it = table.find(ext);
+        return it == table.end() ? "application/octet-stream" : it->second;
+    }
+
+    //  该类型的内容是否值得压缩：文本类的压缩效果好，图片和压缩包已经压缩过了
+    static bool compressible(const string& content_type) {
+        string type = content_type.substr(0,content_type.find(';'));
+        for(char& c : type) c = tolower(static_cast<unsigned char>(c));
+        return type.compare(0,5,"text/") == 0
+            || type.find("json") != string::npos
+            || type.find("javascript") != string::npos
+            || type.find("xml") != string::npos
+            || type == "image/svg+xml";
+    }
+};
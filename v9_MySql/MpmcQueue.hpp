@@ -0,0 +1,190 @@
+#pragma once
+//  无锁的有界多生产者多消费者队列（Dmitry Vyukov的环形队列）和基于futex的EventCount
+//  每个槽位带一个序号：序号等于入队位置时可以写，等于入队位置+1时可以读，读完后加上容量留给下一圈；
+//  生产者和消费者各自只在自己的位置上做一次CAS，不争同一把锁；槽位按缓存行对齐，相邻的槽位不会伪共享
+//  EventCount让取不到元素的消费者睡在futex上：先prepareWait拿到当前的纪元，再检查一次队列，还是空的才wait；
+//  生产者放进元素之后notify，有人在等时才推进纪元、调用futex唤醒，没人等时只是一次原子读
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+using namespace std;
+
+#define CACHE_LINE_SIZE 64
+
+
+template<typename T>
+class MpmcQueue {
+public:
+    //  容量向上取到2的幂
+    explicit MpmcQueue(size_t capacity)
+    :enqueue_pos(0),dequeue_pos(0) {
+        size_t size = 2;
+        while(size < capacity) size <<= 1;
+        mask = size - 1;
+        //  C++11的new不保证超过16字节的对齐，自己对齐到缓存行
+        raw = new char[sizeof(Cell) * size + CACHE_LINE_SIZE];
+        size_t offset = reinterpret_cast<uintptr_t>(raw) % CACHE_LINE_SIZE;
+        cells = reinterpret_cast<Cell*>(raw + (offset == 0 ? 0 : CACHE_LINE_SIZE - offset));
+        for(size_t i = 0; i < size; ++i) {
+            new(&cells[i]) Cell();
+            cells[i].seq.store(i,memory_order_relaxed);
+        }
+    }
+
+    ~MpmcQueue() {
+        for(size_t i = 0; i <= mask; ++i) cells[i].~Cell();
+        delete[] raw;
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    //  放进一个元素，队列满时返回false；stamp和元素一起保存，可以用frontStamp读队首的
+    bool tryPush(T&& value,uint64_t stamp = 0) {
+        Cell* cell;
+        size_t pos = enqueue_pos.load(memory_order_relaxed);
+        while(1) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->seq.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if(diff == 0) {
+                if(enqueue_pos.compare_exchange_weak(pos,pos + 1,memory_order_relaxed)) break;
+            } else if(diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(memory_order_relaxed);
+            }
+        }
+        cell->data = move(value);
+        cell->stamp.store(stamp,memory_order_relaxed);
+        cell->seq.store(pos + 1,memory_order_release);
+        return true;
+    }
+
+    //  取出一个元素，队列空时返回false
+    bool tryPop(T& value) {
+        Cell* cell;
+        size_t pos = dequeue_pos.load(memory_order_relaxed);
+        while(1) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->seq.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if(diff == 0) {
+                if(dequeue_pos.compare_exchange_weak(pos,pos + 1,memory_order_relaxed)) break;
+            } else if(diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos.load(memory_order_relaxed);
+            }
+        }
+        value = move(cell->data);
+        //  槽位里留下的对象（比如function捕获的shared_ptr）要立即释放，不能等到下一圈被覆盖
+        cell->data = T();
+        cell->seq.store(pos + mask + 1,memory_order_release);
+        return true;
+    }
+
+    //  读队首元素的stamp，队列空或者队首正在被读写时返回false
+    //  读stamp前后序号都没变说明读到的是这个元素的：序号只增不减，槽位被下一圈复用之前序号一定会变
+    bool frontStamp(uint64_t& stamp) const {
+        size_t pos = dequeue_pos.load(memory_order_relaxed);
+        const Cell& cell = cells[pos & mask];
+        if(cell.seq.load(memory_order_acquire) != pos + 1) return false;
+        stamp = cell.stamp.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        return cell.seq.load(memory_order_relaxed) == pos + 1;
+    }
+
+    //  大致的元素个数，并发修改时只是一个估计
+    size_t sizeApprox() const {
+        size_t tail = enqueue_pos.load(memory_order_relaxed);
+        size_t head = dequeue_pos.load(memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Cell {
+        atomic<size_t> seq;
+        atomic<uint64_t> stamp;
+        T data;
+    };
+
+    //  两个位置分别占一个缓存行，生产者和消费者互不干扰
+    char pad0[CACHE_LINE_SIZE];
+    atomic<size_t> enqueue_pos;
+    char pad1[CACHE_LINE_SIZE - sizeof(atomic<size_t>)];
+    atomic<size_t> dequeue_pos;
+    char pad2[CACHE_LINE_SIZE - sizeof(atomic<size_t>)];
+    size_t mask;
+    Cell* cells;
+    char* raw;
+};
+
+
+//  等待“某个条件可能变了”的通知，条件本身由调用者检查：
+//      uint32_t key = ec.prepareWait();
+//      if(条件已经满足) ec.cancelWait(); else ec.wait(key,timeout_ms);
+//  prepareWait之后发生的notify一定会让wait返回，不会漏掉唤醒
+class EventCount {
+public:
+    EventCount(): epoch(0),waiters(0) {}
+
+    uint32_t prepareWait() {
+        waiters.fetch_add(1,memory_order_seq_cst);
+        atomic_thread_fence(memory_order_seq_cst);
+        return epoch.load(memory_order_seq_cst);
+    }
+
+    void cancelWait() {
+        waiters.fetch_sub(1,memory_order_seq_cst);
+    }
+
+    //  等到纪元不再是key，timeout_ms小于0时不超时；超时返回false
+    bool wait(uint32_t key,int timeout_ms) {
+        bool woken = true;
+        while(epoch.load(memory_order_acquire) == key) {
+            timespec timeout = { timeout_ms / 1000,(timeout_ms % 1000) * 1000000L };
+            long rc = syscall(SYS_futex,reinterpret_cast<uint32_t*>(&epoch),FUTEX_WAIT_PRIVATE,key,
+                              timeout_ms < 0 ? nullptr : &timeout,nullptr,0);
+            if(rc == -1 && errno == ETIMEDOUT) {
+                woken = false;
+                break;
+            }
+        }
+        waiters.fetch_sub(1,memory_order_seq_cst);
+        return woken;
+    }
+
+    void notifyOne() {
+        notify(1);
+    }
+
+    void notifyAll() {
+        notify(INT32_MAX);
+    }
+
+private:
+    //  和prepareWait里的操作配对：调用者改完条件之后的fence保证要么看到等待的人，要么等待的人看到新条件
+    void notify(int count) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if(waiters.load(memory_order_seq_cst) == 0) return;
+        epoch.fetch_add(1,memory_order_seq_cst);
+        syscall(SYS_futex,reinterpret_cast<uint32_t*>(&epoch),FUTEX_WAKE_PRIVATE,count,nullptr,nullptr,0);
+    }
+
+    static_assert(sizeof(atomic<uint32_t>) == sizeof(uint32_t),"futex needs a plain 32-bit word");
+
+    atomic<uint32_t> epoch;     //  每次有人等待时的notify加1
+    atomic<uint32_t> waiters;   //  prepareWait之后还没返回的等待者
+};
@@ -1,30 +1,110 @@
 //  该类主要根据请求的路径和方法，决定调用哪个处理函数，实现请求的具体逻辑
 #pragma once
 #include <functional>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include <algorithm>
 #include "Database.hpp"
 #include "HttpRequest.hpp"
 #include "HttpResponse.hpp"
+#include "Compression.hpp"
+#include "Metrics.hpp"
+#include "ServerConfig.hpp"
 using namespace std;
 
 
+//  一个路由的指标：处理函数的耗时，按状态码类别（1xx-5xx）计数，其他状态码记在下标0
+struct RouteMetrics {
+    explicit RouteMetrics(const string& route) {
+        MetricsRegistry& registry = MetricsRegistry::global();
+        string labels = MetricsRegistry::label("route",route);
+        latency = &registry.histogram("http_handler_duration_seconds","Time spent in route handlers",labels);
+        static const char* classes[] = { "other","1xx","2xx","3xx","4xx","5xx" };
+        for(int i = 0;i < 6;++i) {
+            status[i] = &registry.counter("http_requests_total","Requests by route and status class",
+                                          labels + "," + MetricsRegistry::label("code",classes[i]));
+        }
+    }
+
+    void record(int code,uint64_t us) {
+        latency->record(us);
+        status[code >= 100 && code < 600 ? code / 100 : 0]->add();
+    }
+
+    Histogram* latency;
+    Counter* status[6];
+};
+
+
 class Router {
+    struct Route;
 public:
     
     //  定义处理函数的类型
     using RequestHandler = std::function<HttpResponse(const HttpRequest&)>;
 
+    //  请求匹配到的路由和它的设置，每个请求只匹配一次，分派和处理都用这个结果
+    struct Match {
+        Route* route = nullptr;                         //  没有匹配到路由时为nullptr
+        TaskPriority priority = PRIORITY_HIGH;          //  在线程池里的优先级
+        const CompressionPolicy* compression = nullptr; //  压缩策略
+    };
+
+
+    Router(): unmatched("none") {}
 
     //  添加路由，将    "method|url"    的组合当作routes的key
     void addRoute(string method,string url,RequestHandler func) {
         //  判断方法类型，给对应的方法加上处理函数
-        routes[method + "|" + url] = func;
+        setRoute(method + "|" + url,func);
         //  ...more methods
     }
     
 
     
+    //  添加前缀路由：路径以prefix开头、又没有精确匹配的路由时调用，有多个前缀匹配时最长的优先
+    //  在routes里的key是 "method|prefix*"，和精确路由区分开
+    void addPrefixRoute(string method,string prefix,RequestHandler func) {
+        string key = method + "|" + prefix + "*";
+        if(routes.count(key) == 0) {
+            prefixes.push_back(key);
+            sort(prefixes.begin(),prefixes.end(),[](const string& a,const string& b){ return a.size() > b.size(); });
+        }
+        setRoute(key,func);
+    }
+
+    //  设置某个路由的压缩策略，没有单独设置的路由使用默认策略；前缀路由的url写成 "prefix*"
+    void setCompression(string method,string url,CompressionPolicy policy) {
+        compression[method + "|" + url] = policy;
+    }
+
+    //  设置默认的压缩策略
+    void setDefaultCompression(CompressionPolicy policy) {
+        default_compression = policy;
+    }
+
+    //  设置某个路由在线程池里的优先级；前缀路由的url写成 "prefix*"
+    void setPriority(string method,string url,TaskPriority priority) {
+        priorities[method + "|" + url] = priority;
+    }
+
+    //  匹配请求对应的路由，取出它的优先级和压缩策略：
+    //  没有单独设置的路由为普通优先级、默认压缩策略；没有匹配到路由的请求只是回一个404，为高优先级
+    Match match(const HttpRequest& request) {
+        Match result;
+        result.compression = &default_compression;
+        string key = matchRoute(request);
+        if(key.empty()) return result;
+        result.route = &routes.find(key)->second;
+        auto priority = priorities.find(key);
+        result.priority = priority == priorities.end() ? PRIORITY_NORMAL : priority->second;
+        auto policy = compression.find(key);
+        if(policy != compression.end()) result.compression = &policy->second;
+        return result;
+    }
+
     //  设置数据库有关的路由
     void setupDatabaseRoutes(Database& db) {
 
@@ -70,21 +150,65 @@ public:
                 return response;
             }
         });
+        //  登录和注册都要访问数据库，放进低优先级的队列，堆积时不影响静态页面
+        setPriority("POST","/register",PRIORITY_LOW);
+        setPriority("POST","/login",PRIORITY_LOW);
     }
 
-    //  通过传进来的request来分配处理函数
+    //  通过传进来的request来分配处理函数，同时记录该路由的耗时和状态码
     HttpResponse routeRequest(HttpRequest& request) {
-        string key = request.getMethodString() + "|" + request.getPath();
+        return routeRequest(request,match(request));
+    }
+
+    //  用已经匹配好的结果调用处理函数
+    HttpResponse routeRequest(HttpRequest& request,const Match& matched) {
         //  判断是否有相应的路由
-        if(routes.count(key) > 0) {
-            return routes[key](request);
+        if(matched.route != nullptr) {
+            Route& route = *matched.route;
+            uint64_t start = Metrics::nowUs();
+            HttpResponse response = route.handler(request);
+            route.metrics->record(response.getStatusCode(),Metrics::nowUs() - start);
+            return response;
         }
         
         //  如果没有找到对应的路由那就404
+        unmatched.status[4]->add();
         return HttpResponse::makeErrorResponse(404,"Not Found");
     } 
 
 private:
+    struct Route {
+        RequestHandler handler;
+        RouteMetrics* metrics = nullptr;    //  路由的指标
+    };
+
+    //  添加或者替换一个路由，指标的标签是 "method url"，前缀路由以*结尾
+    void setRoute(const string& key,RequestHandler func) {
+        Route& route = routes[key];
+        route.handler = func;
+        if(route.metrics == nullptr) {
+            string name = key;
+            name[name.find('|')] = ' ';
+            metrics.emplace_back(new RouteMetrics(name));
+            route.metrics = metrics.back().get();
+        }
+    }
+
+    //  找到请求对应的路由的key：先精确匹配，再按前缀匹配，找不到时返回空串
+    string matchRoute(const HttpRequest& request) const {
+        string key = request.getMethodString() + "|" + request.getPath();
+        if(routes.count(key) > 0) return key;
+        for(const string& prefix : prefixes) {
+            if(key.compare(0,prefix.size() - 1,prefix,0,prefix.size() - 1) == 0) return prefix;
+        }
+        return string();
+    }
     
-    unordered_map<string,RequestHandler> routes;    //  存储路由映射
+    unordered_map<string,Route> routes;             //  存储路由映射
+    vector<unique_ptr<RouteMetrics>> metrics;       //  每个路由的指标
+    RouteMetrics unmatched;                         //  没有匹配到路由的请求
+    vector<string> prefixes;                        //  前缀路由的key，按长度从长到短
+    unordered_map<string,CompressionPolicy> compression;    //  单独设置了压缩策略的路由
+    CompressionPolicy default_compression;          //  默认的压缩策略
+    unordered_map<string,TaskPriority> priorities;  //  单独设置了优先级的路由
 };
\ No newline at end of file
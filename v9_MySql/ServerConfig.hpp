@@ -0,0 +1,279 @@
+#pragma once
+//  服务器的可调参数，使用默认值构造之后按需修改再传给HttpServer
+//  也可以通过命令行参数 --name=value 修改，名字和成员变量名相同（套接字选项去掉socket.前缀也可以，线程池选项写成pool_前缀，线程池绑定的CPU写成worker_cpus、db_cpus和db_threads）
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+using namespace std;
+
+
+//  套接字选项，每一项都可以单独开关，值为0表示不设置、使用系统默认值
+struct SocketOptions {
+    //  监听socket
+    bool reuse_addr = true;             //  SO_REUSEADDR，重启时不用等TIME_WAIT
+    bool reuse_port = false;            //  SO_REUSEPORT
+    int defer_accept_s = 0;             //  TCP_DEFER_ACCEPT，连接上有数据到达才唤醒accept，最多等这么多秒
+    int fastopen_qlen = 0;              //  TCP_FASTOPEN，允许SYN携带数据，值为等待队列长度
+
+    //  接受的socket
+    bool tcp_nodelay = true;            //  TCP_NODELAY，关闭Nagle算法，小响应不被延迟
+    bool quickack = false;              //  TCP_QUICKACK，立即回ACK（内核会自动清除，每次读完后重新设置）
+    bool keepalive = false;             //  SO_KEEPALIVE，探测死掉的对端
+    int keepalive_idle_s = 60;          //  TCP_KEEPIDLE
+    int keepalive_interval_s = 10;      //  TCP_KEEPINTVL
+    int keepalive_count = 5;            //  TCP_KEEPCNT
+
+    //  两者都设置
+    int rcvbuf = 0;                     //  SO_RCVBUF
+    int sndbuf = 0;                     //  SO_SNDBUF
+
+    //  接受的socket
+    bool incoming_cpu = false;          //  用SO_INCOMING_CPU查到处理这个连接收包的CPU，连接优先交给绑定在那个CPU上的工作线程
+};
+
+
+//  线程池任务的优先级，每个优先级一个队列；路由可以按优先级分类（Router::setPriority）
+enum TaskPriority {
+    PRIORITY_HIGH,                      //  读连接、静态文件这类很快的工作
+    PRIORITY_NORMAL,                    //  默认的优先级
+    PRIORITY_LOW,                       //  访问数据库这类慢的处理函数
+    PRIORITY_CLASSES                    //  优先级的个数
+};
+
+
+//  工作线程池：线程数在最小和最大之间按排队情况自动调整，两者相同时是固定大小的线程池
+struct ThreadPoolOptions {
+    //  队列满了之后新任务的处理方式
+    enum QueuePolicy {
+        REJECT,                         //  拒绝新任务
+        BLOCK,                          //  提交的线程等到有空位
+        DROP_OLDEST                     //  丢掉队列里最旧的任务，给新任务腾位置
+    };
+
+    size_t min_threads = 2;             //  一直保留的线程数
+    size_t max_threads = 32;            //  最多的线程数，处理函数阻塞在数据库上时靠多开线程维持吞吐
+    int keep_alive_ms = 10000;          //  多出min_threads的线程空闲这么久之后退出
+    int grow_wait_ms = 2;               //  队首的任务等了这么久还没有线程来取就加线程
+    size_t grow_depth = 8;              //  排队的任务比空闲线程多出这么多时立即加线程，不等下一次检查
+    int manage_ms = 5;                  //  检查排队时间的周期，也就是按排队时间加线程的最长反应时间
+    size_t queue_capacity = 1024;       //  最多排队的任务数，为0时是POOL_RING_CAPACITY；每个优先级的环形队列都有这么多个槽位
+    QueuePolicy queue_policy = REJECT;  //  队列满了之后怎么办：reject、block、drop_oldest
+    int starvation_ms = 100;            //  低优先级的任务排队超过这么久就先于高优先级的任务执行，为0时严格按优先级
+    string cpus = "";                   //  工作线程轮流绑定到这些CPU上（每个线程一个CPU），例如 "1-7"；为空时不绑定
+    string low_cpus = "";               //  不为空时低优先级的任务（访问数据库）只由绑定在这些CPU上的low_threads个执行线程执行
+    size_t low_threads = 8;             //  low_cpus上的执行线程数，数据库调用会阻塞，比CPU多一些
+};
+
+
+//  自适应并发限制：根据测到的延迟估计耗时请求（会访问数据库）的最佳并发数，超出的请求直接回复503
+struct ConcurrencyLimitOptions {
+    enum Algorithm {
+        OFF,                            //  不限制
+        AIMD,                           //  延迟超过latency_ms就乘性减少，否则加1
+        GRADIENT                        //  按长期平均延迟和最近延迟之比调整（类似Netflix concurrency-limits的Gradient2）
+    };
+
+    Algorithm algorithm = OFF;          //  off、aimd、gradient
+    size_t initial_limit = 20;          //  开始时的并发限制
+    size_t min_limit = 1;               //  限制的下限
+    size_t max_limit = 1000;            //  限制的上限
+    int latency_ms = 100;               //  aimd认为过载的延迟
+};
+
+
+struct ServerConfig {
+    //  超时相关（毫秒），为0表示不启用该超时
+    int idle_timeout_ms = 60000;        //  keep-alive连接两个请求之间的最长空闲时间
+    int header_timeout_ms = 10000;      //  从收到第一个字节到读完请求头的最长时间
+    int request_timeout_ms = 30000;     //  从读完请求头到发送完响应的最长时间
+    int timer_tick_ms = 10;             //  时间轮的精度
+
+    size_t max_header_bytes = 64 * 1024;    //  请求头的最大长度，超过则直接拒绝
+    size_t max_body_bytes = 8 * 1024 * 1024;    //  请求体的最大长度（包括分块编码的请求体），超过则返回413
+    size_t stream_buffer_bytes = 64 * 1024;     //  流式响应在输出缓冲区里最多积压的字节数，超过就先等客户端读走
+
+    size_t max_pipeline_depth = 64;         //  一次最多处理的流水线请求数，剩下的处理完这一批再继续
+
+    size_t max_connections = 1 << 20;       //  连接表的最大容量，实际还会受进程fd上限限制
+
+    //  响应压缩的默认策略，单个路由可以通过Router::setCompression覆盖
+    bool compression = true;                //  是否根据Accept-Encoding压缩响应
+    size_t compression_min_bytes = 1024;    //  响应体小于这个长度时不压缩
+    int compression_level = 6;              //  动态响应和静态文件缓存的压缩级别，启动时加载的页面总是用最高级别预压缩
+
+    //  静态文件
+    string static_root = "../static_rc";    //  静态文件的根目录
+    string static_prefix = "/";             //  根目录挂在哪个URL前缀下，精确匹配的路由优先
+    size_t static_cache_bytes = 64 * 1024 * 1024;   //  文件缓存的容量（映射的文件加上压缩版本）
+    size_t static_stream_bytes = 1024 * 1024;       //  不小于这个大小的文件分块流式发送，也不再预压缩
+    int static_revalidate_ms = 1000;        //  缓存的文件多久之后用stat检查一次有没有被修改
+    bool static_embedded = true;            //  优先使用编译时嵌入的static_rc（用EMBED_ASSETS构建时才有）
+
+    //  HTTP/2（明文h2c，支持直接发连接前言和从HTTP/1.1升级两种方式）
+    bool http2 = true;                      //  是否接受HTTP/2连接
+    size_t h2_max_streams = 100;            //  一个连接上同时打开的流的上限，通过SETTINGS告诉客户端
+    int h2_window_bytes = 1024 * 1024;      //  每个流的接收窗口，客户端上传请求体时不用频繁等WINDOW_UPDATE
+
+    //  TLS（用USE_TLS构建时才有），开启后这个端口只接受HTTPS，通过ALPN协商h2或者http/1.1
+    bool tls = false;                       //  是否启用TLS
+    string tls_cert = "";                   //  证书链文件（PEM）
+    string tls_key = "";                    //  私钥文件（PEM）
+    size_t tls_session_cache = 20480;       //  服务端会话缓存的条目数，为0时不缓存
+    int tls_session_timeout_s = 300;        //  缓存的会话和票据的有效期
+    bool tls_tickets = true;                //  是否发送会话票据（无状态恢复，不占用服务端缓存）
+    bool tls_ktls = true;                   //  握手完成后尽量把加密交给内核（kTLS），内核不支持时自动退回用户态加密
+
+    //  指标（Prometheus文本格式）
+    bool metrics = true;                    //  是否提供指标的路由，指标本身总是记录
+    string metrics_path = "/metrics";       //  指标的路径
+
+    //  请求的阶段计时，两个都为0时不计时；导出的路由和指标一样是公开的，只应该在内网使用
+    size_t trace_sample = 0;                //  每这么多个请求保存一个
+    int trace_slow_ms = 0;                  //  从分派到发送超过这个时间的请求总是保存
+    size_t trace_buffer = 1024;             //  最多保存的请求数，满了覆盖最旧的
+    string trace_path = "/debug/trace";     //  导出Chrome trace JSON的路径
+
+    //  流量录制，文件用bench/replay回放；capture_path为空时不录制
+    string capture_path = "";               //  录制文件，启动时清空
+    size_t capture_sample = 1;              //  每这么多个连接录制一个（整个连接的请求都录下来）
+    size_t capture_max_bytes = 1024 * 1024 * 1024;  //  文件达到这个大小后停止录制
+
+    //  过载保护：线程池的队列满了不再接收连接上的新请求、或者耗时请求超出并发限制时回复503，告诉客户端这么多秒后再试
+    int overload_retry_after_s = 1;
+
+    //  accept相关
+    int listen_backlog = 1024;          //  监听队列长度，内核还会用somaxconn截断
+    int accept_budget = 64;             //  每轮事件循环最多accept的连接数
+
+    //  CPU亲和性和NUMA，CPU列表的写法和taskset -c一样
+    string reactor_cpus = "";           //  主循环（epoll）绑定的CPU，例如 "0"；为空时不绑定
+    bool numa_local = true;             //  每个线程的内存块从它所在NUMA节点的内存里分配，单节点的机器上没有作用
+
+    SocketOptions socket;               //  套接字选项
+    ThreadPoolOptions pool;             //  工作线程池
+    ConcurrencyLimitOptions limit;      //  自适应并发限制
+
+    //  解析一个 name=value 形式的参数，名字不存在或者值不合法时返回false
+    bool parseOption(const string& option) {
+        size_t pos = option.find('=');
+        string name = option.substr(0,pos);
+        string value = pos == string::npos ? "1" : option.substr(pos + 1);
+        if(name.compare(0,7,"socket.") == 0) name = name.substr(7);
+
+        if(name == "idle_timeout_ms")           return assign(idle_timeout_ms,value);
+        if(name == "header_timeout_ms")         return assign(header_timeout_ms,value);
+        if(name == "request_timeout_ms")        return assign(request_timeout_ms,value);
+        if(name == "timer_tick_ms")             return assign(timer_tick_ms,value);
+        if(name == "max_header_bytes")          return assign(max_header_bytes,value);
+        if(name == "max_body_bytes")            return assign(max_body_bytes,value);
+        if(name == "stream_buffer_bytes")       return assign(stream_buffer_bytes,value);
+        if(name == "max_pipeline_depth")        return assign(max_pipeline_depth,value);
+        if(name == "max_connections")           return assign(max_connections,value);
+        if(name == "compression")               return assign(compression,value);
+        if(name == "compression_min_bytes")     return assign(compression_min_bytes,value);
+        if(name == "compression_level")         return assign(compression_level,value);
+        if(name == "static_root")               return assign(static_root,value);
+        if(name == "static_prefix")             return assign(static_prefix,value);
+        if(name == "static_cache_bytes")        return assign(static_cache_bytes,value);
+        if(name == "static_stream_bytes")       return assign(static_stream_bytes,value);
+        if(name == "static_revalidate_ms")      return assign(static_revalidate_ms,value);
+        if(name == "static_embedded")           return assign(static_embedded,value);
+        if(name == "http2")                     return assign(http2,value);
+        if(name == "h2_max_streams")            return assign(h2_max_streams,value);
+        if(name == "h2_window_bytes")           return assign(h2_window_bytes,value);
+        if(name == "tls")                       return assign(tls,value);
+        if(name == "tls_cert")                  return assign(tls_cert,value);
+        if(name == "tls_key")                   return assign(tls_key,value);
+        if(name == "tls_session_cache")         return assign(tls_session_cache,value);
+        if(name == "tls_session_timeout_s")     return assign(tls_session_timeout_s,value);
+        if(name == "tls_tickets")               return assign(tls_tickets,value);
+        if(name == "tls_ktls")                  return assign(tls_ktls,value);
+        if(name == "metrics")                   return assign(metrics,value);
+        if(name == "metrics_path")              return assign(metrics_path,value);
+        if(name == "trace_sample")              return assign(trace_sample,value);
+        if(name == "trace_slow_ms")             return assign(trace_slow_ms,value);
+        if(name == "trace_buffer")              return assign(trace_buffer,value);
+        if(name == "trace_path")                return assign(trace_path,value);
+        if(name == "capture_path")              return assign(capture_path,value);
+        if(name == "capture_sample")            return assign(capture_sample,value);
+        if(name == "capture_max_bytes")         return assign(capture_max_bytes,value);
+        if(name == "listen_backlog")            return assign(listen_backlog,value);
+        if(name == "accept_budget")             return assign(accept_budget,value);
+        if(name == "reuse_addr")                return assign(socket.reuse_addr,value);
+        if(name == "reuse_port")                return assign(socket.reuse_port,value);
+        if(name == "defer_accept_s")            return assign(socket.defer_accept_s,value);
+        if(name == "fastopen_qlen")             return assign(socket.fastopen_qlen,value);
+        if(name == "tcp_nodelay")               return assign(socket.tcp_nodelay,value);
+        if(name == "quickack")                  return assign(socket.quickack,value);
+        if(name == "keepalive")                 return assign(socket.keepalive,value);
+        if(name == "keepalive_idle_s")          return assign(socket.keepalive_idle_s,value);
+        if(name == "keepalive_interval_s")      return assign(socket.keepalive_interval_s,value);
+        if(name == "keepalive_count")           return assign(socket.keepalive_count,value);
+        if(name == "rcvbuf")                    return assign(socket.rcvbuf,value);
+        if(name == "sndbuf")                    return assign(socket.sndbuf,value);
+        if(name == "pool_min_threads")          return assign(pool.min_threads,value);
+        if(name == "pool_max_threads")          return assign(pool.max_threads,value);
+        if(name == "pool_keep_alive_ms")        return assign(pool.keep_alive_ms,value);
+        if(name == "pool_grow_wait_ms")         return assign(pool.grow_wait_ms,value);
+        if(name == "pool_grow_depth")           return assign(pool.grow_depth,value);
+        if(name == "pool_manage_ms")            return assign(pool.manage_ms,value);
+        if(name == "pool_queue_capacity")       return assign(pool.queue_capacity,value);
+        if(name == "pool_queue_policy")         return assign(pool.queue_policy,value);
+        if(name == "pool_starvation_ms")        return assign(pool.starvation_ms,value);
+        if(name == "worker_cpus")               return assign(pool.cpus,value);
+        if(name == "db_cpus")                   return assign(pool.low_cpus,value);
+        if(name == "db_threads")                return assign(pool.low_threads,value);
+        if(name == "reactor_cpus")              return assign(reactor_cpus,value);
+        if(name == "numa_local")                return assign(numa_local,value);
+        if(name == "incoming_cpu")              return assign(socket.incoming_cpu,value);
+        if(name == "overload_retry_after_s")    return assign(overload_retry_after_s,value);
+        if(name == "limit_algorithm")           return assign(limit.algorithm,value);
+        if(name == "limit_initial")             return assign(limit.initial_limit,value);
+        if(name == "limit_min")                 return assign(limit.min_limit,value);
+        if(name == "limit_max")                 return assign(limit.max_limit,value);
+        if(name == "limit_latency_ms")          return assign(limit.latency_ms,value);
+        return false;
+    }
+
+private:
+    static bool assign(bool& field,const string& value) {
+        if(value == "1" || value == "true" || value == "on")  { field = true;  return true; }
+        if(value == "0" || value == "false" || value == "off") { field = false; return true; }
+        return false;
+    }
+
+    static bool assign(int& field,const string& value) {
+        char* end = nullptr;
+        long v = strtol(value.c_str(),&end,10);
+        if(value.empty() || *end != '\0') return false;
+        field = static_cast<int>(v);
+        return true;
+    }
+
+    static bool assign(ThreadPoolOptions::QueuePolicy& field,const string& value) {
+        if(value == "reject")      { field = ThreadPoolOptions::REJECT;      return true; }
+        if(value == "block")       { field = ThreadPoolOptions::BLOCK;       return true; }
+        if(value == "drop_oldest") { field = ThreadPoolOptions::DROP_OLDEST; return true; }
+        return false;
+    }
+
+    static bool assign(ConcurrencyLimitOptions::Algorithm& field,const string& value) {
+        if(value == "off")      { field = ConcurrencyLimitOptions::OFF;      return true; }
+        if(value == "aimd")     { field = ConcurrencyLimitOptions::AIMD;     return true; }
+        if(value == "gradient") { field = ConcurrencyLimitOptions::GRADIENT; return true; }
+        return false;
+    }
+
+    static bool assign(string& field,const string& value) {
+        field = value;
+        return true;
+    }
+
+    static bool assign(size_t& field,const string& value) {
+        char* end = nullptr;
+        unsigned long long v = strtoull(value.c_str(),&end,10);
+        if(value.empty() || *end != '\0') return false;
+        field = static_cast<size_t>(v);
+        return true;
+    }
+};
@@ -0,0 +1,333 @@
+#pragma once
+//  静态资源的响应  --  ETag/Last-Modified，条件请求（If-None-Match/If-Modified-Since返回304），
+//  以及字节范围请求（Range/If-Range返回206，支持单个和多个范围）
+//  范围总是对原始内容计算，压缩版本只在完整响应时使用；重叠和相邻的范围合并成一个（RFC 7233 6.1），
+//  合并后覆盖了整个内容或者请求的范围加起来比内容还长时忽略Range，不让一个请求把内容放大很多倍
+#include <sys/stat.h>
+#include <time.h>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+#include "Compression.hpp"
+using namespace std;
+
+#define MAX_RANGES 16       //  一个请求最多的范围数，超过则忽略Range返回完整内容
+#define STREAM_PIECE (64 * 1024)    //  大文件流式发送时每次生成的块大小
+
+
+//  一个静态资源：内容（含预压缩版本）和条件请求用到的校验信息
+struct StaticAsset {
+    string content_type;        //  Content-Type
+    PrecompressedBody body;     //  原始内容和各个编码的版本
+    time_t last_modified = 0;   //  最后修改时间
+    string last_modified_text;  //  Last-Modified头的值，加载时算好
+    string etag;                //  原始内容的ETag，压缩版本在引号内加上编码名
+    shared_ptr<void> storage;   //  原始内容所在的外部内存（比如文件的mmap映射），和资源一起释放
+
+    //  复制一份内容并用最高级别预压缩
+    void load(const string& content,time_t mtime,const string& type) {
+        body.load(content);
+        setValidators(mtime,type);
+    }
+
+    //  引用storage里的内容，不复制；compress为false时不生成压缩版本
+    void load(const char* data,size_t size,time_t mtime,const string& type,int level,bool compress) {
+        body.load(data,size,level,compress);
+        setValidators(mtime,type);
+    }
+
+    //  ETag由长度和修改时间生成，Last-Modified的值也在这里算好
+    void setValidators(time_t mtime,const string& type);
+
+    //  某个编码版本的ETag
+    string etagOf(Compression::Encoding encoding) const {
+        if(encoding == Compression::IDENTITY) return etag;
+        return etag.substr(0,etag.size() - 1) + "-" + Compression::name(encoding) + "\"";
+    }
+};
+
+
+class StaticResponse {
+public:
+    //  根据请求的条件和范围生成响应：304，206，416或者200
+    //  原始内容不小于stream_bytes的完整响应和范围加起来不小于stream_bytes的206响应用分块编码边读边发，
+    //  不把文件的内容复制进响应里
+    static HttpResponse serve(const HttpRequest& request,const shared_ptr<const StaticAsset>& shared,
+                              size_t stream_bytes = SIZE_MAX) {
+        const StaticAsset& asset = *shared;
+        HttpResponse response;
+        Compression::Encoding encoding = asset.body.negotiate(request);
+        string etag = asset.etagOf(encoding);
+        response.setHeader("ETag",etag);
+        response.setHeader("Last-Modified",asset.last_modified_text);
+        response.setHeader("Accept-Ranges","bytes");
+        if(asset.body.hasVariants()) response.setHeader("Vary","Accept-Encoding");
+
+        //  有If-None-Match时忽略If-Modified-Since
+        string if_none_match = request.getHeader("If-None-Match");
+        bool not_modified;
+        if(!if_none_match.empty()) {
+            not_modified = matchETag(if_none_match,etag,false);
+        } else {
+            time_t since = parseHttpDate(request.getHeader("If-Modified-Since"));
+            not_modified = since != -1 && asset.last_modified <= since;
+        }
+        if(not_modified) {
+            response.setStatusCode(304);
+            return response;
+        }
+
+        response.setHeader("Content-Type",asset.content_type);
+        string range = request.getHeader("Range");
+        if(!range.empty() && ifRangeMatches(request.getHeader("If-Range"),asset)) {
+            size_t size = asset.body.size();
+            vector<pair<size_t,size_t>> ranges;
+            int ret = parseRanges(range,size,ranges);
+            if(ret == RANGE_UNSATISFIABLE) {
+                response = HttpResponse::makeErrorResponse(416,"Range Not Satisfiable");
+                response.setHeader("Content-Range","bytes */" + to_string(size));
+                return response;
+            }
+            if(ret == RANGE_OK && coalesceRanges(ranges,size)) {
+                //  范围是对原始内容算的，ETag也要换回原始内容的
+                response.setHeader("ETag",asset.etag);
+                response.setStatusCode(206);
+                vector<Segment> segments;
+                if(ranges.size() == 1) {
+                    response.setHeader("Content-Range",contentRange(ranges[0],size));
+                    segments.push_back(Segment{ string(),ranges[0].first,ranges[0].second - ranges[0].first + 1 });
+                } else {
+                    string boundary = makeBoundary();
+                    response.setHeader("Content-Type","multipart/byteranges; boundary=" + boundary);
+                    segments = multipartSegments(ranges,size,boundary,asset.content_type);
+                }
+                setSegments(response,shared,move(segments),stream_bytes);
+                return response;
+            }
+        }
+
+        if(encoding == Compression::IDENTITY && asset.body.size() >= stream_bytes) {
+            setSegments(response,shared,vector<Segment>(1,Segment{ string(),0,asset.body.size() }),stream_bytes);
+        } else {
+            asset.body.apply(encoding,response);
+        }
+        response.setStatusCode(200);
+        return response;
+    }
+
+    //  把时间格式化成HTTP日期：Sun, 06 Nov 1994 08:49:37 GMT
+    static string httpDate(time_t t) {
+        struct tm tm;
+        gmtime_r(&t,&tm);
+        char buf[64];
+        strftime(buf,sizeof(buf),"%a, %d %b %Y %H:%M:%S GMT",&tm);
+        return buf;
+    }
+
+    //  解析HTTP日期，格式不对时返回-1
+    static time_t parseHttpDate(const string& date) {
+        if(date.empty()) return -1;
+        struct tm tm = {};
+        const char* end = strptime(date.c_str(),"%a, %d %b %Y %H:%M:%S GMT",&tm);
+        if(end == nullptr) return -1;
+        return timegm(&tm);
+    }
+
+private:
+    //  响应体的一段：先是prefix，再是原始内容里从begin开始的length个字节
+    struct Segment {
+        string prefix;
+        size_t begin;
+        size_t length;
+    };
+
+    enum RangeResult {
+        RANGE_IGNORED,          //  不是字节范围或者格式不对，返回完整内容
+        RANGE_OK,
+        RANGE_UNSATISFIABLE     //  所有范围都超出了内容长度
+    };
+
+    //  解析 bytes=a-b,c-,-n 形式的范围，结果是闭区间
+    static int parseRanges(const string& header,size_t size,vector<pair<size_t,size_t>>& ranges) {
+        if(header.compare(0,6,"bytes=") != 0) return RANGE_IGNORED;
+        size_t pos = 6;
+        int count = 0;
+        while(pos <= header.size()) {
+            size_t end = header.find(',',pos);
+            if(end == string::npos) end = header.size();
+            string spec = header.substr(pos,end - pos);
+            pos = end + 1;
+            size_t begin = spec.find_first_not_of(' ');
+            if(begin == string::npos) continue;
+            spec = spec.substr(begin,spec.find_last_not_of(' ') - begin + 1);
+            if(++count > MAX_RANGES) return RANGE_IGNORED;
+
+            size_t dash = spec.find('-');
+            if(dash == string::npos) return RANGE_IGNORED;
+            string first = spec.substr(0,dash);
+            string last = spec.substr(dash + 1);
+            if(!isNumber(first) && !first.empty()) return RANGE_IGNORED;
+            if(!isNumber(last) && !last.empty()) return RANGE_IGNORED;
+            if(first.empty()) {
+                //  -n：最后n个字节
+                if(last.empty()) return RANGE_IGNORED;
+                unsigned long long n = strtoull(last.c_str(),nullptr,10);
+                if(n == 0 || size == 0) continue;
+                ranges.push_back(make_pair(n >= size ? 0 : size - n,size - 1));
+                continue;
+            }
+            unsigned long long from = strtoull(first.c_str(),nullptr,10);
+            unsigned long long to = last.empty() ? from : strtoull(last.c_str(),nullptr,10);
+            if(to < from) return RANGE_IGNORED;
+            //  起点超出内容长度的范围不可满足，跳过
+            if(from >= size) continue;
+            if(last.empty() || to >= size) to = size - 1;
+            ranges.push_back(make_pair(static_cast<size_t>(from),static_cast<size_t>(to)));
+        }
+        if(count == 0) return RANGE_IGNORED;
+        return ranges.empty() ? RANGE_UNSATISFIABLE : RANGE_OK;
+    }
+
+    //  按起点排序，合并重叠和相邻的范围；合并后覆盖了整个内容，或者请求的范围加起来比内容还长
+    //  （同一段内容被要了很多遍）时返回false，这时忽略Range返回完整内容
+    static bool coalesceRanges(vector<pair<size_t,size_t>>& ranges,size_t size) {
+        size_t requested = 0;
+        for(const auto& range : ranges) requested += range.second - range.first + 1;
+        if(requested > size) return false;
+        sort(ranges.begin(),ranges.end());
+        vector<pair<size_t,size_t>> merged;
+        for(const auto& range : ranges) {
+            if(!merged.empty() && range.first <= merged.back().second + 1) {
+                merged.back().second = max(merged.back().second,range.second);
+            } else {
+                merged.push_back(range);
+            }
+        }
+        ranges.swap(merged);
+        return !(ranges.size() == 1 && ranges[0].first == 0 && ranges[0].second == size - 1);
+    }
+
+    //  If-Range：ETag必须强匹配，日期必须和最后修改时间完全相同，否则忽略Range
+    static bool ifRangeMatches(const string& if_range,const StaticAsset& asset) {
+        if(if_range.empty()) return true;
+        if(if_range[0] == '"' || if_range.compare(0,2,"W/") == 0) {
+            return if_range == asset.etag;
+        }
+        return parseHttpDate(if_range) == asset.last_modified;
+    }
+
+    //  ETag列表里是否有和etag匹配的，strong为false时用弱比较（忽略W/前缀）；If-None-Match用弱比较
+    static bool matchETag(const string& list,const string& etag,bool strong) {
+        size_t pos = 0;
+        while(pos < list.size()) {
+            size_t end = list.find(',',pos);
+            if(end == string::npos) end = list.size();
+            string tag = list.substr(pos,end - pos);
+            pos = end + 1;
+            size_t begin = tag.find_first_not_of(' ');
+            if(begin == string::npos) continue;
+            tag = tag.substr(begin,tag.find_last_not_of(' ') - begin + 1);
+            if(tag == "*") return true;
+            if(!strong && tag.compare(0,2,"W/") == 0) tag = tag.substr(2);
+            if(tag == etag) return true;
+        }
+        return false;
+    }
+
+    //  多个范围用multipart/byteranges，每一段带自己的Content-Type和Content-Range
+    static vector<Segment> multipartSegments(const vector<pair<size_t,size_t>>& ranges,size_t size,
+                                             const string& boundary,const string& content_type) {
+        vector<Segment> segments;
+        for(const auto& range : ranges) {
+            string head = "\r\n--" + boundary + "\r\n";
+            head += "Content-Type: " + content_type + "\r\n";
+            head += "Content-Range: " + contentRange(range,size) + "\r\n\r\n";
+            segments.push_back(Segment{ head,range.first,range.second - range.first + 1 });
+        }
+        segments.push_back(Segment{ "\r\n--" + boundary + "--\r\n",0,0 });
+        return segments;
+    }
+
+    //  把各段设置成响应体：原始内容一共不小于stream_bytes时用分块编码每次生成STREAM_PIECE字节左右，否则复制进响应
+    static void setSegments(HttpResponse& response,const shared_ptr<const StaticAsset>& shared,
+                            vector<Segment> segments,size_t stream_bytes) {
+        const char* content = shared->body.data();
+        size_t total = 0;
+        for(const Segment& segment : segments) total += segment.length;
+        if(total < stream_bytes) {
+            string body;
+            for(const Segment& segment : segments) {
+                body += segment.prefix;
+                body.append(content + segment.begin,segment.length);
+            }
+            response.setBody(body);
+            return;
+        }
+        //  生成函数持有资源的引用，发送期间文件映射不会被缓存淘汰释放掉
+        struct Cursor {
+            vector<Segment> segments;
+            size_t index;       //  正在发送的段
+            size_t offset;      //  这一段的内容已经发了多少
+        };
+        shared_ptr<Cursor> cursor = make_shared<Cursor>(Cursor{ move(segments),0,0 });
+        response.setChunkedBody([shared,cursor](ChunkSink& sink) {
+            size_t budget = STREAM_PIECE;
+            while(cursor->index < cursor->segments.size() && budget > 0) {
+                Segment& segment = cursor->segments[cursor->index];
+                if(!segment.prefix.empty()) {
+                    sink.write(segment.prefix.data(),segment.prefix.size());
+                    budget -= min(budget,segment.prefix.size());
+                    segment.prefix.clear();
+                    continue;
+                }
+                size_t n = min(budget,segment.length - cursor->offset);
+                sink.write(shared->body.data() + segment.begin + cursor->offset,n);
+                cursor->offset += n;
+                budget -= n;
+                if(cursor->offset == segment.length) {
+                    cursor->index++;
+                    cursor->offset = 0;
+                }
+            }
+            return cursor->index < cursor->segments.size();
+        });
+    }
+
+    static string contentRange(const pair<size_t,size_t>& range,size_t size) {
+        return "bytes " + to_string(range.first) + "-" + to_string(range.second) + "/" + to_string(size);
+    }
+
+    //  分隔符用单调时钟生成，内容里几乎不可能出现
+    static string makeBoundary() {
+        char buf[32];
+        snprintf(buf,sizeof(buf),"%016llx",static_cast<unsigned long long>(
+            chrono::steady_clock::now().time_since_epoch().count()));
+        return string("BYTERANGES_") + buf;
+    }
+
+    static bool isNumber(const string& str) {
+        if(str.empty()) return false;
+        for(char c : str) {
+            if(c < '0' || c > '9') return false;
+        }
+        return true;
+    }
+};
+
+
+inline void StaticAsset::setValidators(time_t mtime,const string& type) {
+    content_type = type;
+    last_modified = mtime;
+    last_modified_text = StaticResponse::httpDate(mtime);
+    char buf[64];
+    snprintf(buf,sizeof(buf),"\"%zx-%lx\"",body.size(),static_cast<unsigned long>(mtime));
+    etag = buf;
+}
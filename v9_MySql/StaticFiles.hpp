@@ -0,0 +1,365 @@
+#pragma once
+//  静态文件服务  --  把一个目录树挂在URL前缀下：规范化路径防止访问根目录以外的文件，按扩展名确定MIME类型，
+//  文件用mmap映射后放进缓存（LRU，按字节数限制容量），超过一段时间再用stat检查文件有没有被修改
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdlib>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "StaticAsset.hpp"
+#include "MimeTypes.hpp"
+#include "EmbeddedAssets.hpp"
+#include "TimerWheel.hpp"
+#include "ServerConfig.hpp"
+#include "Logger.hpp"
+using namespace std;
+
+#define WILLNEED_LIMIT (1024 * 1024)    //  不超过这个大小的文件映射后立即预读
+
+
+//  文件的只读映射，析构时解除映射
+//  注意：文件在映射期间被截短，访问超出部分会收到SIGBUS，部署时应该用替换（rename）而不是原地改写来更新文件
+class MappedFile {
+public:
+    //  打开并映射一个普通文件，st返回文件信息，失败时返回nullptr
+    static shared_ptr<MappedFile> open(const string& path,struct stat& st) {
+        int fd = ::open(path.c_str(),O_RDONLY | O_CLOEXEC);
+        if(fd == -1) return nullptr;
+        if(fstat(fd,&st) == -1 || !S_ISREG(st.st_mode)) {
+            close(fd);
+            return nullptr;
+        }
+        void* addr = nullptr;
+        size_t length = st.st_size;
+        if(length > 0) {
+            addr = mmap(nullptr,length,PROT_READ,MAP_PRIVATE,fd,0);
+            if(addr == MAP_FAILED) {
+                close(fd);
+                return nullptr;
+            }
+            //  小文件马上就会被整个读一遍，让内核提前读进来；大文件是顺序发送的，让内核加大预读
+            madvise(addr,length,length <= WILLNEED_LIMIT ? MADV_WILLNEED : MADV_SEQUENTIAL);
+        }
+        //  映射建立之后fd就不需要了
+        close(fd);
+        return shared_ptr<MappedFile>(new MappedFile(addr,length));
+    }
+
+    ~MappedFile() {
+        if(addr != nullptr) munmap(addr,length);
+    }
+
+    const char* data() const {
+        return static_cast<const char*>(addr);
+    }
+
+    size_t size() const {
+        return this->length;
+    }
+
+private:
+    MappedFile(void* addr,size_t length): addr(addr),length(length) {}
+
+    void* addr;
+    size_t length;
+};
+
+
+//  文件缓存的统计
+struct FileCacheStats {
+    atomic<uint64_t> hits{0};           //  直接从缓存返回
+    atomic<uint64_t> misses{0};         //  需要打开并映射文件
+    atomic<uint64_t> waits{0};          //  别的线程正在加载同一个文件，等它加载完直接用
+    atomic<uint64_t> revalidations{0};  //  用stat确认文件没有变化
+    atomic<uint64_t> evictions{0};      //  因为超出容量被淘汰
+};
+
+
+//  mmap映射的文件缓存，多个工作线程共享
+//  加载（映射和预压缩）在锁外进行，不会因为一个大文件阻塞其他线程的命中；
+//  同一个文件同时未命中时只由第一个线程加载，其他线程等它的结果，不会各自映射、各自预压缩一遍
+class FileCache {
+public:
+    FileCache(const string& root,size_t capacity,int revalidate_ms,size_t precompress_limit,int level)
+    :root(root),capacity(capacity),revalidate_ms(revalidate_ms),precompress_limit(precompress_limit),
+     level(level),bytes(0) {}
+
+    //  获取文件，不存在、不是普通文件或者在根目录之外时返回nullptr
+    shared_ptr<const StaticAsset> get(const string& path) {
+        uint64_t now = TimerWheel::nowMs();
+        {
+            lock_guard<mutex> lock(cache_mutex);
+            auto it = entries.find(path);
+            if(it != entries.end() && now - it->second.checked_ms < static_cast<uint64_t>(revalidate_ms)) {
+                touch(it->second);
+                stats.hits++;
+                return it->second.asset;
+            }
+        }
+        //  超过了检查间隔，确认文件有没有变化
+        struct stat st;
+        if(stat(path.c_str(),&st) == -1 || !S_ISREG(st.st_mode)) {
+            lock_guard<mutex> lock(cache_mutex);
+            remove(path);
+            return nullptr;
+        }
+        shared_ptr<Pending> pending;
+        {
+            unique_lock<mutex> lock(cache_mutex);
+            auto it = entries.find(path);
+            if(it != entries.end() && sameFile(it->second,st)) {
+                it->second.checked_ms = now;
+                touch(it->second);
+                stats.hits++;
+                stats.revalidations++;
+                return it->second.asset;
+            }
+            //  别的线程正在加载，等它加载完用同一个结果
+            auto loading_it = loading.find(path);
+            if(loading_it != loading.end()) {
+                shared_ptr<Pending> other = loading_it->second;
+                stats.waits++;
+                other->done.wait(lock,[&other]{ return other->finished; });
+                return other->asset;
+            }
+            pending = make_shared<Pending>();
+            loading[path] = pending;
+        }
+
+        stats.misses++;
+        shared_ptr<StaticAsset> asset = load(path);
+        lock_guard<mutex> lock(cache_mutex);
+        //  不管加载成功与否都要唤醒等待的线程
+        loading.erase(path);
+        pending->asset = asset;
+        pending->finished = true;
+        pending->done.notify_all();
+        if(!asset) return nullptr;
+        remove(path);
+        size_t cost = costOf(*asset);
+        //  比整个缓存还大的文件不缓存，这次用完就解除映射
+        if(cost > capacity) return asset;
+        lru.push_front(path);
+        Entry& entry = entries[path];
+        entry.asset = asset;
+        entry.checked_ms = now;
+        entry.ino = st.st_ino;
+        entry.mtime = asset->last_modified;
+        entry.size = asset->body.size();
+        entry.cost = cost;
+        entry.position = lru.begin();
+        bytes += cost;
+        evict();
+        return asset;
+    }
+
+    //  缓存占用的字节数（映射的文件加上压缩版本）
+    size_t size() const {
+        lock_guard<mutex> lock(cache_mutex);
+        return this->bytes;
+    }
+
+    const FileCacheStats& getStats() const {
+        return this->stats;
+    }
+
+private:
+    struct Entry {
+        shared_ptr<const StaticAsset> asset;
+        uint64_t checked_ms;        //  上次确认文件没有变化的时间
+        ino_t ino;
+        time_t mtime;
+        size_t size;
+        size_t cost;
+        list<string>::iterator position;    //  在LRU链表里的位置
+    };
+
+    //  正在加载的文件，加载它的线程完成后设置finished并唤醒等待的线程
+    struct Pending {
+        condition_variable done;
+        bool finished = false;
+        shared_ptr<const StaticAsset> asset;    //  加载失败时为nullptr
+    };
+
+    //  映射文件并生成压缩版本；文件解析后的真实路径必须在根目录下，防止符号链接指到外面
+    shared_ptr<StaticAsset> load(const string& path) {
+        char real[PATH_MAX];
+        if(realpath(path.c_str(),real) == nullptr) return nullptr;
+        if(string(real).compare(0,root.size() + 1,root + "/") != 0) {
+            LOG_WARNING("refuse to serve %s outside of %s",real,root.c_str());
+            return nullptr;
+        }
+        struct stat st;
+        shared_ptr<MappedFile> file = MappedFile::open(real,st);
+        if(!file) return nullptr;
+        shared_ptr<StaticAsset> asset = make_shared<StaticAsset>();
+        asset->storage = file;
+        string type = MimeTypes::lookup(path);
+        bool compress = Compression::compressible(type) && file->size() <= precompress_limit;
+        asset->load(file->data(),file->size(),st.st_mtime,type,level,compress);
+        return asset;
+    }
+
+    bool sameFile(const Entry& entry,const struct stat& st) const {
+        return entry.ino == st.st_ino && entry.mtime == st.st_mtime && entry.size == static_cast<size_t>(st.st_size);
+    }
+
+    static size_t costOf(const StaticAsset& asset) {
+        size_t cost = asset.body.size();
+        for(int i = Compression::GZIP;i < Compression::ENCODING_COUNT;++i) {
+            cost += asset.body.variantSize(static_cast<Compression::Encoding>(i));
+        }
+        return cost;
+    }
+
+    //  以下函数调用时必须持有cache_mutex
+    void touch(Entry& entry) {
+        lru.splice(lru.begin(),lru,entry.position);
+    }
+
+    void remove(const string& path) {
+        auto it = entries.find(path);
+        if(it == entries.end()) return;
+        bytes -= it->second.cost;
+        lru.erase(it->second.position);
+        entries.erase(it);
+    }
+
+    void evict() {
+        while(bytes > capacity && !lru.empty()) {
+            remove(lru.back());
+            stats.evictions++;
+        }
+    }
+
+    string root;                    //  根目录的真实路径
+    size_t capacity;                //  缓存容量（字节）
+    int revalidate_ms;              //  多久之后重新检查文件
+    size_t precompress_limit;       //  超过这个大小的文件不预压缩
+    int level;                      //  预压缩的级别
+
+    mutable mutex cache_mutex;
+    unordered_map<string,Entry> entries;
+    unordered_map<string,shared_ptr<Pending>> loading;     //  正在加载的文件
+    list<string> lru;               //  最近使用的在前面
+    size_t bytes;
+    FileCacheStats stats;
+};
+
+
+//  静态目录的处理器
+class StaticFiles {
+public:
+    //  把directory目录挂在URL前缀prefix下
+    StaticFiles(const string& directory,const string& prefix,const ServerConfig& config)
+    :root(realRoot(directory)),prefix(prefix),embedded(config.static_embedded),stream_bytes(config.static_stream_bytes),
+     cache(root,config.static_cache_bytes,config.static_revalidate_ms,
+           config.static_stream_bytes,config.compression_level) {}
+
+    //  处理前缀路由匹配到的请求
+    HttpResponse serve(const HttpRequest& request) {
+        const string& url = request.getPath();
+        string relative;
+        if(url.compare(0,prefix.size(),prefix) != 0 || !normalize(url.substr(prefix.size()),relative)) {
+            return HttpResponse::makeErrorResponse(404,"Not Found");
+        }
+        return serveFile(request,relative);
+    }
+
+    //  返回根目录下的某个文件，relative必须已经规范化；以'/'结尾或者为空时返回目录下的index.html
+    HttpResponse serveFile(const HttpRequest& request,string relative) {
+        if(relative.empty() || relative.back() == '/') relative += "index.html";
+        //  先查编译时嵌入的资源
+        if(embedded) {
+            shared_ptr<const StaticAsset> asset = EmbeddedAssets::find(relative);
+            if(asset) return StaticResponse::serve(request,asset,stream_bytes);
+        }
+        string path = root + "/" + relative;
+        shared_ptr<const StaticAsset> asset = cache.get(path);
+        if(!asset) {
+            //  访问目录但没有以'/'结尾，重定向过去，这样页面里的相对路径才正确
+            struct stat st;
+            if(stat(path.c_str(),&st) == 0 && S_ISDIR(st.st_mode)) {
+                HttpResponse response(301);
+                string location = request.getPath();
+                response.setHeader("Location",location.substr(0,location.find('?')) + "/");
+                return response;
+            }
+            return HttpResponse::makeErrorResponse(404,"Not Found");
+        }
+        return StaticResponse::serve(request,asset,stream_bytes);
+    }
+
+    //  把URL路径规范化成相对于根目录的路径：去掉查询参数，解码%XX，处理.和..
+    //  越过根目录、包含'\0'或者访问隐藏文件（以'.'开头）时返回false；保留末尾的'/'
+    static bool normalize(const string& url_path,string& out) {
+        string path = url_path.substr(0,url_path.find_first_of("?#"));
+        string decoded;
+        for(size_t i = 0;i < path.size();++i) {
+            if(path[i] != '%') {
+                decoded += path[i];
+                continue;
+            }
+            if(i + 2 >= path.size() || !isxdigit(static_cast<unsigned char>(path[i + 1]))
+               || !isxdigit(static_cast<unsigned char>(path[i + 2]))) return false;
+            char c = static_cast<char>(strtol(path.substr(i + 1,2).c_str(),nullptr,16));
+            if(c == '\0') return false;
+            decoded += c;
+            i += 2;
+        }
+
+        vector<string> segments;
+        size_t pos = 0;
+        while(pos <= decoded.size()) {
+            size_t end = decoded.find('/',pos);
+            if(end == string::npos) end = decoded.size();
+            string segment = decoded.substr(pos,end - pos);
+            pos = end + 1;
+            if(segment.empty() || segment == ".") continue;
+            if(segment == "..") {
+                if(segments.empty()) return false;
+                segments.pop_back();
+                continue;
+            }
+            if(segment[0] == '.') return false;
+            segments.push_back(segment);
+        }
+        out.clear();
+        for(size_t i = 0;i < segments.size();++i) {
+            if(i > 0) out += '/';
+            out += segments[i];
+        }
+        if(!segments.empty() && !decoded.empty() && decoded.back() == '/') out += '/';
+        return true;
+    }
+
+    //  获取缓存统计
+    const FileCacheStats& getStats() const {
+        return cache.getStats();
+    }
+
+private:
+    //  根目录的真实路径，之后用它判断文件有没有越界
+    static string realRoot(const string& root) {
+        char real[PATH_MAX];
+        if(realpath(root.c_str(),real) == nullptr) {
+            LOG_WARNING("static root %s not found",root.c_str());
+            return root;
+        }
+        return real;
+    }
+
+    string root;            //  根目录的真实路径
+    string prefix;          //  URL前缀
+    bool embedded;          //  是否优先使用编译时嵌入的资源
+    size_t stream_bytes;    //  不小于这个大小的文件流式发送
+    FileCache cache;        //  文件缓存
+};
@@ -1,47 +1,85 @@
 #pragma once
+//  自适应线程池  --  线程数在min_threads和max_threads之间变化：任务排队太久或者排得太多时由管理者线程加线程，
+//  多出来的线程空闲keep_alive_ms之后自己退出；退出的线程由管理者线程回收（join）
+//  处理函数阻塞在数据库上时线程池会变大，负载下来之后再缩回去，不用按峰值固定开很多线程
+//  队列有容量上限，满了之后按queue_policy拒绝新任务、让提交的线程等待或者丢掉最旧的任务，过载时排队时间不会无限增长
+//  每个优先级一个队列，严格按优先级取任务：数据库请求堆积时读连接、静态文件的任务不用排在它们后面；
+//  低优先级队首的任务排队超过starvation_ms后先执行它，高优先级的任务一直很多时低优先级的也不会饿死
+//  任务队列是无锁的环形队列（MpmcQueue），提交和取任务不加锁，空闲的线程睡在futex上（EventCount）
+//  可以把工作线程绑定到指定的CPU上（每个线程一个CPU），每个绑定的CPU再有一个自己的队列：
+//  提交时指定了CPU的高优先级任务放进那个CPU的队列，绑定在那里的线程先取自己队列的任务，闲下来的线程也会去别的CPU的队列里取
+//  指定了low_cpus时低优先级的任务（访问数据库）由一组固定绑定在low_cpus上的执行线程执行，工作线程不取它们
 #include<vector>                        //存储工作线程
-#include<queue>                         //存储待执行的任务
+#include<memory>
+#include<atomic>
+#include<stdexcept>
 #include<thread>                        //引入线程库，用于创建和管理线程
 #include<mutex>                         //引入互斥锁，用于确保线程安全
 #include<condition_variable>            //引入条件变量，用于线程等待和通知
 #include<functional>                    //引入函数对象包装库，用于可调用对象包装器
 #include<future>                        //用于管理异步任务的结果
+#include<chrono>
+#include<cstdint>
+#include<algorithm>
+#include "Logger.hpp"
+#include "Metrics.hpp"                  //队列长度和排队时间
+#include "MpmcQueue.hpp"                //无锁的任务队列
+#include "Affinity.hpp"                 //绑定CPU
+#include "ServerConfig.hpp"             //线程池的参数
 using namespace std;
 
+#define POOL_PROMOTE_EVERY 8            //  等得太久的低优先级任务每取这么多个任务最多插一次队
+#define POOL_RING_CAPACITY 4096         //  queue_capacity为0时的容量，无锁的环形队列必须有界
+#define POOL_LOCAL_CAPACITY 256         //  每个CPU自己的队列的容量，放不下时放进共用的队列
+
 
 
 class ThreadPool {
 public:
-    //构造函数，初始化线程池
-    ThreadPool(size_t threads): stop(false) {
-        //创建指定数量的工作线程
-        for(size_t i = 0; i < threads; ++i) {
-            workers.emplace_back([this]  {
-                while(true) {
-                    function<void()> task;
-                    //  此处并不是单纯指一个代码块，更是指一个作用域，具体作用是让lock在该代码块后就自动销毁，
-                    //  让锁的时间尽可能减少
-                    {
-                        LOG_INFO("Thread%d waiting...",this_thread::get_id());
-                        //  创建互斥锁以保护任务队列
-                        unique_lock<mutex> lock(this->queue_mutex);
-                        LOG_INFO("Thread%d acquired lock",this_thread::get_id());
-                        //  使用条件变量等待任务或停止信号 -- 等待任务中condition.notify_one();去唤醒
-                        /*  此时线程都先释放锁（因此锁在没任务的时候是没人拥有的），然后检验predicate，一开始都是false，因此先阻塞，直到
-                            接收到notify_one 然后重新获得锁，然后检查，此时任务队列不为空因此跳出*/
-                        this->condition.wait(lock,[this]{ return this->stop || !this->tasks.empty(); });
-                        LOG_INFO("thread wake up...");
-                        //  如果线程池停止且任务队列为空，则线程退出
-                        if(this->stop && this->tasks.empty()) return ;
-                        LOG_INFO("Thread%d release exit...",this_thread::get_id());
-                        //  否走就正常获取下一个要执行的任务
-                        task = move(this->tasks.front());
-                        this->tasks.pop();
-                    }
-                    //  执行任务
-                    task();
-                }
-            });
+    //构造函数，固定大小的线程池
+    explicit ThreadPool(size_t threads)
+    :ThreadPool(fixedOptions(threads)) {}
+
+    //构造函数，按参数创建min_threads个线程，最大线程数更多时再创建管理者线程
+    explicit ThreadPool(const ThreadPoolOptions& options)
+    :options(normalize(options)),queued(0),blocked(0),stop(false),alive(0),busy(0),idle(0),
+     queue_depth(MetricsRegistry::global().gauge("threadpool_queue_depth","Tasks waiting in the ThreadPool queue")),
+     alive_threads(MetricsRegistry::global().gauge("threadpool_threads","ThreadPool worker threads",
+                                                   MetricsRegistry::label("state","alive"))),
+     busy_threads(MetricsRegistry::global().gauge("threadpool_threads","ThreadPool worker threads",
+                                                  MetricsRegistry::label("state","busy"))),
+     grown(MetricsRegistry::global().counter("threadpool_resizes_total","Worker threads started or retired",
+                                             MetricsRegistry::label("direction","grow"))),
+     shrunk(MetricsRegistry::global().counter("threadpool_resizes_total","Worker threads started or retired",
+                                              MetricsRegistry::label("direction","shrink"))),
+     rejected(MetricsRegistry::global().counter("threadpool_shed_tasks_total","Tasks refused by a full ThreadPool queue",
+                                                MetricsRegistry::label("action","rejected"))),
+     dropped(MetricsRegistry::global().counter("threadpool_shed_tasks_total","Tasks refused by a full ThreadPool queue",
+                                               MetricsRegistry::label("action","dropped"))),
+     home_tasks(MetricsRegistry::global().counter("threadpool_steered_tasks_total",
+                                                  "Tasks submitted for a CPU, by where they ran",
+                                                  MetricsRegistry::label("ran_on","home"))),
+     stolen_tasks(MetricsRegistry::global().counter("threadpool_steered_tasks_total",
+                                                    "Tasks submitted for a CPU, by where they ran",
+                                                    MetricsRegistry::label("ran_on","other"))) {
+        setupCpus();
+        static const char* names[PRIORITY_CLASSES] = { "high","normal","low" };
+        for(int i = 0; i < PRIORITY_CLASSES; ++i) {
+            queue_wait[i] = &MetricsRegistry::global().histogram("threadpool_queue_wait_seconds",
+                                                                 "Time a task waits in the ThreadPool queue",
+                                                                 MetricsRegistry::label("priority",names[i]));
+            //  容量是所有优先级共用的，每个环形队列都要放得下全部
+            tasks[i].reset(new MpmcQueue<Task>(this->options.queue_capacity));
+        }
+        {
+            lock_guard<mutex> lock(pool_mutex);
+            for(size_t i = 0; i < this->options.min_threads; ++i) spawn();
+        }
+        if(dedicatedLow()) {
+            for(size_t i = 0; i < this->options.low_threads; ++i) executors.emplace_back(&ThreadPool::execute,this);
+        }
+        if(this->options.max_threads > this->options.min_threads) {
+            manager = thread(&ThreadPool::manage,this);
         }
     }
 
@@ -71,7 +109,7 @@ public:
 
     在后续的代码中，return_type将被用来表示异步任务的返回类型，简化代码并提高可读性
     */
-   template<class F,class... Args>                                          //  此时是任务队列无限大因此就没有用Maxqueue,也可以在其中添加判断的逻辑和调度的逻辑                                            
+   template<class F,class... Args>
    auto enqueue(F&& f,Args&& ... args) -> future<typename result_of<F(Args...)>::type> {
         using return_type = typename result_of<F(Args...)>::type;
         //  创建共享任务包装器
@@ -98,41 +136,463 @@ public:
         );
         //  获取与任务关联的  future
         future<return_type> res = task->get_future();
-        {
-            //  使用互斥锁保护任务队列
-            unique_lock<mutex> lock(queue_mutex);
-            //  如果线程池已经停止，则抛出异常
-            if(stop) throw runtime_error("enqueue on stopped ThreadPool");
-            //  将任务添加到队列
-            tasks.emplace([task](){(*task)(); });
-        }
-        //  通知一个等待的线程去执行任务
-        condition.notify_one();
-        LOG_INFO("notify_one");
+        //  队列满了被拒绝时抛出异常；被丢弃的任务不会执行，future得到broken_promise
+        if(!push(Task{ [task](){ (*task)(); },[]{},0 },PRIORITY_NORMAL)) throw runtime_error("ThreadPool queue is full");
         return res;
     }
 
+    //  提交一个任务，返回是否进了队列；队列满时按queue_policy处理：
+    //  REJECT 返回false；BLOCK 等到有空位；DROP_OLDEST 丢掉队列里最旧的、提交时带了on_drop的任务，
+    //  在当前线程里调用它的on_drop，没有可以丢的任务时返回false
+    //  在工作线程里提交时队列满了总是直接返回false：工作线程等空位可能互相等死，别人的on_drop也不应该在工作线程里执行
+    //  容量是所有优先级共用的
+    //  cpu是高优先级的任务最好在哪个CPU上执行（比如处理这个连接收包的CPU），有线程绑定在那个CPU上时放进它的队列，
+    //  只是一个提示：那个线程忙的时候别的线程也会取走
+    bool submit(function<void()> run,function<void()> on_drop = nullptr,TaskPriority priority = PRIORITY_NORMAL,
+                int cpu = -1) {
+        return push(Task{ move(run),move(on_drop),0 },priority,cpu);
+    }
+
     ~ThreadPool(){
         {
-            //  使用互斥锁保护停止标志
-            unique_lock<mutex> lock(queue_mutex);
+            //  在锁里设置停止标志，等空位的提交线程不会错过
+            lock_guard<mutex> lock(pool_mutex);
             stop = true;
         }
-        //  唤醒所有等待的线程
-        condition.notify_all();
-        //  阻塞主线程然后等待所有工作线程退出
+        //  唤醒所有等待的线程，管理者先退出，之后不会再创建线程
+        manager_condition.notify_all();
+        space_condition.notify_all();
+        if(manager.joinable()) manager.join();
+        work_ready.notifyAll();
+        low_ready.notifyAll();
+        //  阻塞主线程然后等待所有工作线程把队列里的任务执行完后退出
         for(thread& worker : workers) {
                 worker.join();
         }
+        for(thread& executor : executors) executor.join();
+    }
+
+    //  获取在忙线程个数
+    size_t getBusyNum() {
+        return busy.load();
+    }
+
+    //  获取活着的线程个数
+    size_t getAliveNum() {
+        return alive.load();
+    }
+
+    //  获取排队的任务个数
+    size_t getQueuedNum() {
+        return queued.load();
     }
 
 private:
+    //  队列里的任务：执行的函数，被丢弃时调用的函数（为空时不能丢弃），入队的时间
+    struct Task {
+        function<void()> run;
+        function<void()> on_drop;
+        uint64_t queued_us;
+    };
+
+    static ThreadPoolOptions fixedOptions(size_t threads) {
+        ThreadPoolOptions options;
+        options.min_threads = options.max_threads = threads;
+        options.queue_capacity = 0;
+        return options;
+    }
+
+    //  当前线程所属的线程池，不是工作线程时为空
+    static ThreadPool*& currentPool() {
+        thread_local ThreadPool* pool = nullptr;
+        return pool;
+    }
+
+    //  占一个排队的位置，队列满了返回false；占到位置之后环形队列一定放得下
+    bool reserve() {
+        size_t n = queued.load();
+        do {
+            if(n >= options.queue_capacity) return false;
+        } while(!queued.compare_exchange_weak(n,n + 1));
+        return true;
+    }
+
+    //  放进环形队列  --  位置已经占好了，放不进去只可能是前一圈这个槽位的消费者还没写完序号，很快就好
+    void pushRing(Task task,int priority) {
+        uint64_t stamp = task.queued_us;
+        while(!tasks[priority]->tryPush(move(task),stamp)) this_thread::yield();
+    }
+
+    //  把任务放进队列，队列满时按策略处理，返回是否放进去了
+    bool push(Task task,TaskPriority priority,int cpu = -1) {
+        //  如果线程池已经停止，则抛出异常
+        if(stop) throw runtime_error("enqueue on stopped ThreadPool");
+        Task victim;
+        if(!reserve()) {
+            bool worker = currentPool() == this;
+            if(options.queue_policy == ThreadPoolOptions::BLOCK && !worker) {
+                unique_lock<mutex> lock(pool_mutex);
+                bool reserved = false;
+                blocked++;
+                space_condition.wait(lock,[this,&reserved]{ return stop || (reserved = reserve()); });
+                blocked--;
+                if(!reserved) throw runtime_error("enqueue on stopped ThreadPool");
+            } else if(options.queue_policy != ThreadPoolOptions::DROP_OLDEST || worker ||
+                      !(dropOldest(victim) || reserve())) {
+                //  队列里暂时没有能丢的任务时（位置被正在放进来或者刚被取走的任务占着）再试一次占位置
+                rejected.add();
+                return false;
+            }
+        }
+        //  将任务添加到队列，开始执行时记录排队的时间
+        task.queued_us = Metrics::nowUs();
+        int local = priority == PRIORITY_HIGH ? localOf(cpu) : -1;
+        uint64_t stamp = task.queued_us;
+        if(local < 0 || !locals[local]->tryPush(move(task),stamp)) pushRing(move(task),priority);
+        queue_depth.inc();
+        //  叫醒一个睡着的线程，没有线程在睡时不进内核
+        if(priority == PRIORITY_LOW && dedicatedLow()) {
+            low_ready.notifyOne();
+        } else {
+            work_ready.notifyOne();
+            //  排队的任务比空闲的线程多出很多时立即叫醒管理者加线程
+            if(alive < options.max_threads && queued > idle + options.grow_depth) manager_condition.notify_one();
+        }
+        if(victim.on_drop) victim.on_drop();
+        return true;
+    }
+
+    //  从最低的优先级开始，取出队列里最旧的可以丢弃的任务，它的位置留给新任务
+    //  途中取出来的不能丢弃的任务放回队尾，它们的顺序会变，只在队列满了的时候发生
+    //  各个CPU自己的队列里都是高优先级的任务，最后找
+    bool dropOldest(Task& victim) {
+        for(int i = PRIORITY_CLASSES - 1; i >= 0; --i) {
+            if(dropFrom(*tasks[i],i,victim)) return true;
+        }
+        for(auto& ring : locals) {
+            if(dropFrom(*ring,PRIORITY_HIGH,victim)) return true;
+        }
+        return false;
+    }
+
+    bool dropFrom(MpmcQueue<Task>& ring,int priority,Task& victim) {
+        size_t n = ring.sizeApprox();
+        Task task;
+        for(size_t k = 0; k < n && ring.tryPop(task); ++k) {
+            if(task.on_drop) {
+                victim = move(task);
+                queue_depth.dec();
+                dropped.add();
+                return true;
+            }
+            uint64_t stamp = task.queued_us;
+            if(!ring.tryPush(move(task),stamp)) pushRing(move(task),priority);
+        }
+        return false;
+    }
+
+    //  解析要绑定的CPU，每个CPU建一个队列
+    void setupCpus() {
+        if(!options.cpus.empty() && !Affinity::parseCpuList(options.cpus,cpus)) {
+            LOG_WARNING("invalid worker cpu list %s",options.cpus.c_str());
+        }
+        if(!options.low_cpus.empty() && !Affinity::parseCpuList(options.low_cpus,low_cpus)) {
+            LOG_WARNING("invalid db cpu list %s",options.low_cpus.c_str());
+        }
+        sort(cpus.begin(),cpus.end());
+        cpus.erase(unique(cpus.begin(),cpus.end()),cpus.end());
+        for(size_t i = 0; i < cpus.size(); ++i) {
+            if(static_cast<size_t>(cpus[i]) >= local_of_cpu.size()) local_of_cpu.resize(cpus[i] + 1,-1);
+            local_of_cpu[cpus[i]] = static_cast<int>(i);
+            size_t capacity = options.queue_capacity == 0 ? POOL_LOCAL_CAPACITY
+                                                           : min<size_t>(options.queue_capacity,POOL_LOCAL_CAPACITY);
+            locals.emplace_back(new MpmcQueue<Task>(capacity));
+        }
+        pinned.assign(cpus.size(),0);
+    }
+
+    //  低优先级的任务是不是只由low_cpus上的执行线程执行
+    bool dedicatedLow() const {
+        return !low_cpus.empty() && options.low_threads > 0;
+    }
+
+    //  工作线程取哪几个优先级的共用队列：[0,workerClasses())
+    int workerClasses() const {
+        return dedicatedLow() ? PRIORITY_LOW : PRIORITY_CLASSES;
+    }
+
+    //  CPU对应的队列下标，没有线程绑定在这个CPU上时返回-1
+    int localOf(int cpu) const {
+        if(cpu < 0 || static_cast<size_t>(cpu) >= local_of_cpu.size()) return -1;
+        return local_of_cpu[cpu];
+    }
+
+    //  取下一个任务：一般取最高的优先级；低优先级的任务等得太久时插队，取等得最久的那个，
+    //  但是每个线程每取POOL_PROMOTE_EVERY个任务最多插一次，低优先级一直过载（队首总是等得太久）时高优先级的任务仍然优先
+    //  绑定了CPU的线程先取自己CPU的队列，共用的高优先级队列空了再去别的CPU的队列里取
+    bool popTask(Task& task,int& priority,size_t& picks,int slot) {
+        if(options.starvation_ms > 0 && ++picks >= POOL_PROMOTE_EVERY) {
+            int next = starvingQueue();
+            if(next != -1 && tasks[next]->tryPop(task)) {
+                picks = 0;
+                priority = next;
+                return true;
+            }
+        }
+        priority = PRIORITY_HIGH;
+        if(slot >= 0 && locals[slot]->tryPop(task)) {
+            home_tasks.add();
+            return true;
+        }
+        for(int i = 0; i < workerClasses(); ++i) {
+            if(tasks[i]->tryPop(task)) {
+                priority = i;
+                return true;
+            }
+            //  别的CPU的队列里也是高优先级的任务，要在普通和低优先级之前取
+            if(i == PRIORITY_HIGH && stealLocal(task,slot)) return true;
+        }
+        return false;
+    }
+
+    bool stealLocal(Task& task,int slot) {
+        for(size_t i = 0; i < locals.size(); ++i) {
+            if(static_cast<int>(i) != slot && locals[i]->tryPop(task)) {
+                stolen_tasks.add();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //  队首等待超过starvation_ms的低优先级队列里等得最久的那个，没有时返回-1
+    int starvingQueue() const {
+        uint64_t now = Metrics::nowUs();
+        uint64_t limit_us = static_cast<uint64_t>(options.starvation_ms) * 1000;
+        uint64_t oldest = 0;
+        int next = -1;
+        for(int i = 1; i < workerClasses(); ++i) {
+            uint64_t stamp;
+            if(!tasks[i]->frontStamp(stamp) || stamp > now || now - stamp < limit_us) continue;
+            if(next == -1 || stamp < oldest) {
+                next = i;
+                oldest = stamp;
+            }
+        }
+        return next;
+    }
+
+    //  工作线程能取的任务里排队最久的那个的入队时间，队列都空时返回UINT64_MAX
+    uint64_t oldestQueuedUs() const {
+        uint64_t oldest = UINT64_MAX;
+        for(int i = 0; i < workerClasses(); ++i) {
+            uint64_t stamp;
+            if(tasks[i]->frontStamp(stamp)) oldest = min(oldest,stamp);
+        }
+        for(auto& ring : locals) {
+            uint64_t stamp;
+            if(ring->frontStamp(stamp)) oldest = min(oldest,stamp);
+        }
+        return oldest;
+    }
+
+    static ThreadPoolOptions normalize(ThreadPoolOptions options) {
+        options.min_threads = max<size_t>(options.min_threads,1);
+        options.max_threads = max(options.max_threads,options.min_threads);
+        options.manage_ms = max(options.manage_ms,1);
+        if(options.queue_capacity == 0) options.queue_capacity = POOL_RING_CAPACITY;
+        return options;
+    }
+
+    //  创建一个工作线程，绑定CPU时放在线程最少的CPU上；调用时必须持有pool_mutex
+    void spawn() {
+        int slot = -1;
+        if(!cpus.empty()) {
+            slot = static_cast<int>(min_element(pinned.begin(),pinned.end()) - pinned.begin());
+            pinned[slot]++;
+        }
+        workers.emplace_back(&ThreadPool::work,this,slot);
+        alive++;
+        alive_threads.inc();
+    }
+
+    //  工作线程：取任务执行，取不到时睡在work_ready上；多出min_threads的线程空闲超过keep_alive_ms就退出
+    //  取任务和交任务都不加锁，锁只在线程退出和叫醒等空位的提交线程时用
+    //  slot是绑定的CPU在cpus里的下标，不绑定时为-1
+    void work(int slot) {
+        currentPool() = this;
+        if(slot >= 0) Affinity::pinCurrentThread(cpus[slot]);
+        size_t picks = 0;
+        while(true) {
+            Task task;
+            int priority;
+            if(popTask(task,priority,picks,slot)) {
+                runTask(task,priority);
+                continue;
+            }
+            //  睡下之前再检查一次，提交的线程在prepareWait之后放进的任务一定会叫醒这里
+            uint32_t key = work_ready.prepareWait();
+            size_t pending = workerQueued();
+            if(pending > 0 || stop) {
+                work_ready.cancelWait();
+                //  如果线程池停止且任务都执行完了，则线程退出
+                if(stop && pending == 0) break;
+                //  位置占了但任务还没放进环形队列，让一下提交的线程
+                this_thread::yield();
+                continue;
+            }
+            //  只有多出来的线程才带超时等待，固定的线程不会被定期唤醒
+            idle++;
+            bool woken = work_ready.wait(key,alive > options.min_threads ? options.keep_alive_ms : -1);
+            idle--;
+            //  空闲太久，线程数还多于最小值就退出
+            if(!woken && retire(slot)) return;
+        }
+        lock_guard<mutex> lock(pool_mutex);
+        leave(slot);
+    }
+
+    //  低优先级任务的执行线程：一开始绑定到low_cpus上，之后只取低优先级的队列，数量固定，不随负载增减
+    void execute() {
+        currentPool() = this;
+        Affinity::pinCurrentThread(low_cpus);
+        MpmcQueue<Task>& ring = *tasks[PRIORITY_LOW];
+        while(true) {
+            Task task;
+            if(ring.tryPop(task)) {
+                runTask(task,PRIORITY_LOW);
+                continue;
+            }
+            uint32_t key = low_ready.prepareWait();
+            if(ring.sizeApprox() > 0 || stop) {
+                low_ready.cancelWait();
+                if(stop && ring.sizeApprox() == 0) break;
+                this_thread::yield();
+                continue;
+            }
+            low_ready.wait(key,-1);
+        }
+    }
+
+    //  执行一个取出来的任务，先让出它占的排队位置
+    void runTask(Task& task,int priority) {
+        queued--;
+        queue_depth.dec();
+        if(blocked > 0) {
+            //  在锁里通知，等空位的线程检查完条件、还没睡下时不会错过
+            lock_guard<mutex> lock(pool_mutex);
+            space_condition.notify_one();
+        }
+        busy++;
+        busy_threads.inc();
+        queue_wait[priority]->record(Metrics::nowUs() - task.queued_us);
+        //  执行任务
+        task.run();
+        busy_threads.dec();
+        busy--;
+    }
+
+    //  工作线程能取的任务数（包括占了位置还没放进队列的）：低优先级的任务交给执行线程时不算它们
+    size_t workerQueued() const {
+        size_t n = queued;
+        if(!dedicatedLow()) return n;
+        size_t low = tasks[PRIORITY_LOW]->sizeApprox();
+        return n > low ? n - low : 0;
+    }
+
+    //  空闲超时的线程是否退出，退出时在锁里登记，两个线程同时超时也不会减到min_threads以下
+    bool retire(int slot) {
+        lock_guard<mutex> lock(pool_mutex);
+        if(stop || alive <= options.min_threads || workerQueued() > 0) return false;
+        shrunk.add();
+        leave(slot);
+        LOG_INFO("ThreadPool shrinks to %zu threads",alive.load());
+        return true;
+    }
+
+    //  退出前登记一下，管理者线程（或者析构函数）负责join；调用时必须持有pool_mutex
+    void leave(int slot) {
+        if(slot >= 0) pinned[slot]--;
+        alive--;
+        alive_threads.dec();
+        exited.push_back(this_thread::get_id());
+        manager_condition.notify_one();
+    }
+
+    //  管理者线程：每manage_ms检查一次，任务排队太久或者排得太多时加线程，顺便回收退出的线程
+    void manage() {
+        unique_lock<mutex> lock(pool_mutex);
+        while(!stop) {
+            manager_condition.wait_for(lock,chrono::milliseconds(options.manage_ms));
+            if(stop) break;
+            reapExited(lock);
+            size_t add = wanted();
+            for(size_t i = 0; i < add; ++i) spawn();
+            if(add > 0) {
+                grown.add(add);
+                LOG_INFO("ThreadPool grows to %zu threads, %zu tasks queued",alive.load(),queued.load());
+            }
+        }
+    }
+
+    //  需要加几个线程：没被空闲线程接走的任务数，不超过最大线程数
+    size_t wanted() const {
+        size_t waiting_tasks = workerQueued(),idle_threads = idle,alive_threads_now = alive;
+        if(waiting_tasks <= idle_threads || alive_threads_now >= options.max_threads) return 0;
+        size_t waiting = waiting_tasks - idle_threads;
+        uint64_t now = Metrics::nowUs();
+        uint64_t oldest = oldestQueuedUs();
+        uint64_t waited_us = oldest < now ? now - oldest : 0;
+        if(waiting <= options.grow_depth && waited_us < static_cast<uint64_t>(options.grow_wait_ms) * 1000) return 0;
+        return min(waiting,options.max_threads - alive_threads_now);
+    }
+
+    //  join已经退出的线程，join时不持有锁
+    void reapExited(unique_lock<mutex>& lock) {
+        if(exited.empty()) return;
+        vector<thread> done;
+        for(thread::id id : exited) {
+            auto it = find_if(workers.begin(),workers.end(),[id](const thread& t){ return t.get_id() == id; });
+            if(it == workers.end()) continue;
+            done.push_back(move(*it));
+            workers.erase(it);
+        }
+        exited.clear();
+        lock.unlock();
+        for(thread& t : done) t.join();
+        lock.lock();
+    }
+
+    const ThreadPoolOptions options;    //线程池的参数
     vector<thread> workers;             //存储工作线程
-    queue<function<void()>> tasks;      //存储任务队列
-    mutex queue_mutex;                  //任务队列的互斥锁
-    condition_variable condition;       //条件变量用于线程等待
-    bool stop;                          //停止标志，用于控制线程池的生命周期
-    //size_t Maxqueue;                    //最大进队数量
+    vector<thread::id> exited;          //已经退出、等待回收的工作线程
+    thread manager;                     //管理者线程，线程数固定时不创建
+    unique_ptr<MpmcQueue<Task>> tasks[PRIORITY_CLASSES];    //每个优先级一个无锁的任务队列
+    vector<int> cpus;                   //工作线程绑定的CPU，为空时不绑定
+    vector<int> low_cpus;               //低优先级任务的执行线程绑定的CPU，为空时低优先级的任务也由工作线程执行
+    vector<thread> executors;           //低优先级任务的执行线程
+    vector<int> local_of_cpu;           //CPU编号到locals的下标，没有线程绑定的CPU是-1
+    vector<unique_ptr<MpmcQueue<Task>>> locals; //每个绑定的CPU一个队列，和cpus一一对应
+    vector<size_t> pinned;              //每个CPU上的工作线程数，调用时必须持有pool_mutex
+    atomic<size_t> queued;              //占了位置的任务数（在队列里的和正要放进去的）
+    EventCount work_ready;              //没有任务时工作线程睡在这里
+    EventCount low_ready;               //没有低优先级任务时执行线程睡在这里
+    mutex pool_mutex;                   //线程列表和BLOCK策略等空位用的互斥锁，取任务和交任务不用
+    condition_variable manager_condition;   //唤醒管理者线程
+    condition_variable space_condition; //BLOCK策略下等空位的提交线程
+    atomic<size_t> blocked;             //正在等空位的提交线程数
+    atomic<bool> stop;                  //停止标志，用于控制线程池的生命周期
+    atomic<size_t> alive;               //活着的线程数
+    atomic<size_t> busy;                //正在执行任务的线程数
+    atomic<size_t> idle;                //睡着等任务的线程数
+    Gauge& queue_depth;                 //队列里等待的任务数
+    Histogram* queue_wait[PRIORITY_CLASSES];    //每个优先级的任务从入队到开始执行的时间
+    Gauge& alive_threads;               //活着的线程数
+    Gauge& busy_threads;                //正在执行任务的线程数
+    Counter& grown;                     //管理者创建的线程数
+    Counter& shrunk;                    //空闲退出的线程数
+    Counter& rejected;                  //队列满了被拒绝的任务数
+    Counter& dropped;                   //队列满了被丢弃的旧任务数
+    Counter& home_tasks;                //指定了CPU、在那个CPU上执行的任务数
+    Counter& stolen_tasks;              //指定了CPU、被别的线程取走的任务数
 };
-   
-//  对于模板类来说，如果声明和定义在两个文件里，那main.cpp中应该两个头文件都包含
\ No newline at end of file
@@ -0,0 +1,163 @@
+#pragma once
+//  分层时间轮  --  用于连接的空闲超时，请求头读取超时以及请求超时
+//  插入和取消都是O(1)：定时器节点是侵入式双向链表节点，直接挂在对应的槽上
+//  四层，每层64个槽，精度为tick_ms，最大可表示 64^4 个tick（10ms精度约46小时）
+#include <chrono>
+#include <cstdint>
+#include <functional>
+using namespace std;
+
+
+//  定时器节点，嵌入到需要超时的对象里（比如Connection），避免每次加定时器都要申请内存
+struct TimerNode {
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    uint64_t expire = 0;            //  到期的tick
+    function<void()> callback;      //  到期时的回调
+
+    //  是否已经挂在时间轮上
+    bool pending() const {
+        return this->prev != nullptr;
+    }
+};
+
+
+class TimerWheel {
+public:
+    TimerWheel(uint32_t tick_ms = 10)
+    :tick_ms(tick_ms == 0 ? 1 : tick_ms),current(nowMs() / this->tick_ms),count(0) {
+        //  每个槽都是一个带哨兵的环形链表
+        for(int level = 0;level < LEVELS;++level) {
+            for(int slot = 0;slot < SLOTS;++slot) {
+                TimerNode& head = wheel[level][slot];
+                head.prev = head.next = &head;
+            }
+        }
+    }
+
+    //  获取单调时钟的毫秒数
+    static uint64_t nowMs() {
+        return chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //  添加定时器，delay_ms毫秒后到期；如果节点已经在轮上则先取消
+    void add(TimerNode* node,uint64_t delay_ms) {
+        if(node->pending()) {
+            cancel(node);
+        }
+        //  向上取整，保证不会提前到期；以真实时间为基准，因为current可能还没推进到现在
+        uint64_t ticks = (delay_ms + tick_ms - 1) / tick_ms;
+        uint64_t now = nowMs() / tick_ms;
+        node->expire = (now > current ? now : current) + (ticks == 0 ? 1 : ticks);
+        place(node);
+        ++count;
+    }
+
+    //  取消定时器，不在轮上时什么也不做
+    void cancel(TimerNode* node) {
+        if(!node->pending()) return;
+        unlink(node);
+        --count;
+    }
+
+    //  推进时间轮到now_ms，执行所有到期的回调
+    void advance(uint64_t now_ms) {
+        uint64_t target = now_ms / tick_ms;
+        //  没有定时器时直接跳到当前时间，不用一格一格地走
+        if(count == 0) {
+            if(target > current) current = target;
+            return;
+        }
+        while(current < target) {
+            ++current;
+            //  低层转完一圈，就把上一层对应槽里的定时器重新分配下来
+            for(int level = 1;level < LEVELS;++level) {
+                if(((current >> ((level - 1) * BITS)) & MASK) != 0) break;
+                cascade(level,(current >> (level * BITS)) & MASK);
+            }
+            runSlot(wheel[0][current & MASK]);
+        }
+    }
+
+    //  距离下一次需要推进的毫秒数，作为epoll_wait的超时时间，没有定时器时返回-1
+    int nextTimeoutMs(uint64_t now_ms) const {
+        if(count == 0) return -1;
+        //  只在第0层里找，找不到就等到第0层转完这一圈（需要级联）
+        uint64_t ticks = SLOTS - (current & MASK);
+        for(uint64_t i = 1;i <= ticks;++i) {
+            const TimerNode& head = wheel[0][(current + i) & MASK];
+            if(head.next != &head) {
+                ticks = i;
+                break;
+            }
+        }
+        uint64_t deadline = (current + ticks) * tick_ms;
+        return deadline > now_ms ? static_cast<int>(deadline - now_ms) : 0;
+    }
+
+    //  当前挂着的定时器数量
+    size_t size() const {
+        return count;
+    }
+
+private:
+    static const int LEVELS = 4;
+    static const int BITS = 6;
+    static const int SLOTS = 1 << BITS;
+    static const uint64_t MASK = SLOTS - 1;
+
+    //  根据到期时间把节点放到对应层的槽里
+    void place(TimerNode* node) {
+        uint64_t ticks = node->expire > current ? node->expire - current : 0;
+        int level = 0;
+        while(level < LEVELS - 1 && ticks >= (1ULL << ((level + 1) * BITS))) {
+            ++level;
+        }
+        uint64_t expire = node->expire;
+        //  超过最大范围的放到最高层的最远处，之后级联时再重新计算
+        if(level == LEVELS - 1 && ticks >= (1ULL << (LEVELS * BITS))) {
+            expire = current + (1ULL << (LEVELS * BITS)) - 1;
+        }
+        TimerNode& head = wheel[level][(expire >> (level * BITS)) & MASK];
+        node->prev = head.prev;
+        node->next = &head;
+        head.prev->next = node;
+        head.prev = node;
+    }
+
+    void unlink(TimerNode* node) {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = node->next = nullptr;
+    }
+
+    //  把高层某个槽里的节点重新放回低层
+    //  先整体摘下来，避免超出范围的节点被放回同一个槽里导致死循环
+    void cascade(int level,uint64_t slot) {
+        TimerNode& head = wheel[level][slot];
+        TimerNode* node = head.next;
+        head.prev = head.next = &head;
+        while(node != &head) {
+            TimerNode* next = node->next;
+            place(node);
+            node = next;
+        }
+    }
+
+    //  执行一个槽里所有的定时器
+    //  回调里可能会添加或取消其他定时器，因此每次都只摘下链表头再执行
+    void runSlot(TimerNode& head) {
+        while(head.next != &head) {
+            TimerNode* node = head.next;
+            unlink(node);
+            --count;
+            if(node->callback) node->callback();
+        }
+    }
+
+    uint32_t tick_ms;                       //  时间轮精度
+    uint64_t current;                       //  当前的tick
+    size_t count;                           //  挂着的定时器数量
+    TimerNode wheel[LEVELS][SLOTS];         //  各层的槽
+};
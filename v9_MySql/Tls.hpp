@@ -0,0 +1,237 @@
+#pragma once
+//  TLS终止  --  用OpenSSL直接在服务器里支持HTTPS，不再需要前面的nginx
+//  握手是非阻塞的：和读写一样在工作线程里推进，需要等数据时把连接交还主循环，epoll通知之后再继续
+//  会话恢复：服务端会话缓存（session id）和会话票据，恢复的握手省掉证书验证和密钥交换的大部分计算
+//  kTLS：握手完成后把对称加密交给内核，之后的响应直接writev明文，由内核加密，不再经过SSL_write复制一遍
+//  只有用USE_TLS构建（CMake找到了OpenSSL）时才有
+#ifdef USE_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <errno.h>
+#include <climits>
+#include <atomic>
+#include <memory>
+#include <string>
+#include "ServerConfig.hpp"
+#include "Logger.hpp"
+using namespace std;
+
+
+//  TLS的统计
+struct TlsStats {
+    atomic<uint64_t> handshakes{0};     //  完整握手的次数
+    atomic<uint64_t> resumed{0};        //  会话恢复的次数（缓存或者票据）
+    atomic<uint64_t> failed{0};         //  握手失败的次数
+    atomic<uint64_t> ktls_send{0};      //  握手后启用了内核发送加密的连接数
+    atomic<uint64_t> alpn_h2{0};        //  通过ALPN协商成HTTP/2的连接数
+};
+
+
+//  服务器的TLS配置：证书、私钥、会话缓存和票据，所有连接共享
+class TlsContext {
+public:
+    //  按配置创建，证书或私钥加载失败时返回nullptr
+    static shared_ptr<TlsContext> create(const ServerConfig& config) {
+        SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+        if(ctx == nullptr) return nullptr;
+        shared_ptr<TlsContext> context(new TlsContext(ctx,config.http2));
+        SSL_CTX_set_min_proto_version(ctx,TLS1_2_VERSION);
+        if(SSL_CTX_use_certificate_chain_file(ctx,config.tls_cert.c_str()) != 1
+           || SSL_CTX_use_PrivateKey_file(ctx,config.tls_key.c_str(),SSL_FILETYPE_PEM) != 1
+           || SSL_CTX_check_private_key(ctx) != 1) {
+            LOG_ERROR("cannot load tls certificate %s / key %s: %s",config.tls_cert.c_str(),
+                      config.tls_key.c_str(),ERR_error_string(ERR_get_error(),nullptr));
+            return nullptr;
+        }
+
+        //  不支持重协商：它能被用来放大握手的计算量，HTTP/2也禁止
+        long options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+        if(!config.tls_tickets) options |= SSL_OP_NO_TICKET;
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+        //  很多客户端不发close_notify就断开，当作正常关闭
+        options |= SSL_OP_IGNORE_UNEXPECTED_EOF;
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+        if(config.tls_ktls) options |= SSL_OP_ENABLE_KTLS;
+#endif
+        SSL_CTX_set_options(ctx,options);
+        //  SSL_write可以只写一部分，并且重试时数据可以在别的地址（输出缓冲区的块会被消费和归还）
+        SSL_CTX_set_mode(ctx,SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+                             | SSL_MODE_RELEASE_BUFFERS);
+
+        //  会话缓存：TLS 1.2用session id恢复，关闭票据时TLS 1.3也用它（有状态的票据）
+        static const unsigned char session_context[] = "http_webserver";
+        SSL_CTX_set_session_id_context(ctx,session_context,sizeof(session_context) - 1);
+        if(config.tls_session_cache > 0) {
+            SSL_CTX_set_session_cache_mode(ctx,SSL_SESS_CACHE_SERVER);
+            SSL_CTX_sess_set_cache_size(ctx,config.tls_session_cache);
+        } else {
+            SSL_CTX_set_session_cache_mode(ctx,SSL_SESS_CACHE_OFF);
+        }
+        SSL_CTX_set_timeout(ctx,config.tls_session_timeout_s);
+        //  TLS 1.3握手后默认发两张票据，浏览器一次只用一张，发一张就够了；
+        //  关闭票据（SSL_OP_NO_TICKET）时发的是指向会话缓存的有状态票据，缓存也关闭时就不发
+        SSL_CTX_set_num_tickets(ctx,config.tls_tickets || config.tls_session_cache > 0 ? 1 : 0);
+
+        SSL_CTX_set_alpn_select_cb(ctx,selectAlpn,context.get());
+        return context;
+    }
+
+    ~TlsContext() {
+        SSL_CTX_free(ctx);
+    }
+
+    //  为新接受的连接创建TLS状态，之后由工作线程完成握手
+    SSL* accept(int fd) {
+        SSL* ssl = SSL_new(ctx);
+        if(ssl == nullptr) return nullptr;
+        SSL_set_fd(ssl,fd);
+        SSL_set_accept_state(ssl);
+        return ssl;
+    }
+
+    TlsStats& getStats() {
+        return this->stats;
+    }
+
+private:
+    TlsContext(SSL_CTX* ctx,bool http2): ctx(ctx),http2(http2) {}
+
+    //  ALPN：客户端支持并且服务器开启了HTTP/2时选h2，否则http/1.1；都不支持时不协商，按HTTP/1.1处理
+    static int selectAlpn(SSL*,const unsigned char** out,unsigned char* outlen,
+                          const unsigned char* in,unsigned int inlen,void* arg) {
+        TlsContext* self = static_cast<TlsContext*>(arg);
+        static const unsigned char with_h2[] = "\x02h2\x08http/1.1";
+        static const unsigned char http1[] = "\x08http/1.1";
+        const unsigned char* protos = self->http2 ? with_h2 : http1;
+        unsigned int len = self->http2 ? sizeof(with_h2) - 1 : sizeof(http1) - 1;
+        unsigned char* selected = nullptr;
+        if(SSL_select_next_proto(&selected,outlen,protos,len,in,inlen) != OPENSSL_NPN_NEGOTIATED) {
+            return SSL_TLSEXT_ERR_NOACK;
+        }
+        *out = selected;
+        return SSL_TLSEXT_ERR_OK;
+    }
+
+    SSL_CTX* ctx;
+    bool http2;         //  ALPN是否提供h2
+    TlsStats stats;
+};
+
+
+//  一个连接上的TLS状态，读写的返回值和errno的约定同read/write系统调用，可以直接用在ChainBuffer上
+class TlsStream {
+public:
+    //  握手的进度
+    enum HandshakeResult {
+        HANDSHAKE_DONE,
+        HANDSHAKE_WANT_READ,    //  等客户端的数据
+        HANDSHAKE_WANT_WRITE,   //  等套接字可写
+        HANDSHAKE_FAILED
+    };
+
+    TlsStream(SSL* ssl,TlsStats& stats): ssl(ssl),stats(stats),done(false),kernel_send(false) {}
+
+    ~TlsStream() {
+        SSL_free(ssl);
+    }
+
+    TlsStream(const TlsStream&) = delete;
+    TlsStream& operator=(const TlsStream&) = delete;
+
+    //  推进握手，完成时记录是否恢复了会话、是否启用了kTLS
+    int handshake() {
+        ERR_clear_error();
+        int ret = SSL_do_handshake(ssl);
+        if(ret == 1) {
+            done = true;
+            if(SSL_session_reused(ssl)) stats.resumed++;
+            else stats.handshakes++;
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+            kernel_send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+            if(kernel_send) stats.ktls_send++;
+#endif
+            if(negotiatedHttp2()) stats.alpn_h2++;
+            return HANDSHAKE_DONE;
+        }
+        int error = SSL_get_error(ssl,ret);
+        if(error == SSL_ERROR_WANT_READ) return HANDSHAKE_WANT_READ;
+        if(error == SSL_ERROR_WANT_WRITE) return HANDSHAKE_WANT_WRITE;
+        stats.failed++;
+        LOG_INFO("tls handshake failed: %s",ERR_error_string(ERR_get_error(),nullptr));
+        return HANDSHAKE_FAILED;
+    }
+
+    bool handshakeDone() const {
+        return this->done;
+    }
+
+    //  握手后发送方向是否已经交给内核，此时可以直接对fd用write/writev发明文
+    bool kernelSend() const {
+        return this->kernel_send;
+    }
+
+    //  ALPN是否选了h2
+    bool negotiatedHttp2() const {
+        const unsigned char* proto = nullptr;
+        unsigned int len = 0;
+        SSL_get0_alpn_selected(ssl,&proto,&len);
+        return len == 2 && proto[0] == 'h' && proto[1] == '2';
+    }
+
+    //  读解密后的数据：>0为字节数，0为对端关闭（close_notify或者直接断开），-1时errno为EAGAIN或者EIO
+    ssize_t read(char* buf,size_t len) {
+        ERR_clear_error();
+        int ret = SSL_read(ssl,buf,static_cast<int>(min(len,static_cast<size_t>(INT_MAX))));
+        if(ret > 0) return ret;
+        return failure(ret);
+    }
+
+    //  是否还有已经从套接字读进来、没有交给调用者的数据，这些数据不会再触发epoll事件
+    bool hasPending() const {
+        return SSL_has_pending(ssl) == 1;
+    }
+
+    //  加密并发送：>0为写出的明文字节数，-1时errno为EAGAIN或者EIO
+    ssize_t write(const char* buf,size_t len) {
+        ERR_clear_error();
+        int ret = SSL_write(ssl,buf,static_cast<int>(min(len,static_cast<size_t>(INT_MAX))));
+        if(ret > 0) return ret;
+        ssize_t n = failure(ret);
+        //  写的时候读到EOF也是出错
+        if(n == 0) errno = EPIPE;
+        return n == 0 ? -1 : n;
+    }
+
+    //  尽量发送close_notify，不等待对端的回应
+    void shutdown() {
+        if(done) SSL_shutdown(ssl);
+    }
+
+private:
+    ssize_t failure(int ret) {
+        switch(SSL_get_error(ssl,ret)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            //  没有发close_notify就断开了，当作对端关闭
+            if(ERR_peek_error() == 0 && (ret == 0 || errno == 0)) return 0;
+            if(errno == 0) errno = EIO;
+            return -1;
+        default:
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    SSL* ssl;
+    TlsStats& stats;
+    bool done;          //  握手已经完成
+    bool kernel_send;   //  发送方向已经交给内核加密
+};
+
+#endif
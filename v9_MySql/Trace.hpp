@@ -0,0 +1,192 @@
+#pragma once
+//  请求的阶段计时  --  每个请求记下经过各个阶段的时间（单调时钟，微秒）：主循环分派、工作线程开始处理、解析完、
+//  交给其他工作线程、开始执行、处理函数、数据库调用、发送
+//  时间戳跟着PipelineItem走；处理函数和数据库在同一个工作线程里执行，通过线程局部的当前请求记录，不用改它们的接口
+//  按比例采样的请求和超过阈值的慢请求保存在环形缓冲区里，可以导出成Chrome的trace event JSON，
+//  用chrome://tracing或者Perfetto打开，每个请求一行
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Metrics.hpp"
+using namespace std;
+
+
+//  一个请求各阶段的时间，为0表示没有经过该阶段
+struct RequestTrace {
+    enum Stage {
+        DISPATCH,   //  主循环把连接交给线程池
+        READ,       //  工作线程开始处理连接
+        PARSE,      //  请求解析完
+        ENQUEUE,    //  耗时的流水线请求交给其他工作线程
+        DEQUEUE,    //  其他工作线程开始执行它
+        HANDLER,    //  开始执行路由的处理函数
+        DB_BEGIN,   //  开始调用数据库
+        DB_END,     //  数据库调用返回
+        HANDLED,    //  处理函数和压缩都完成了
+        SENT,       //  响应写进了套接字，或者发送缓冲区满了开始等可写
+        STAGES
+    };
+
+    RequestTrace(): active(false),reader(-1),worker(-1) {
+        for(uint64_t& t : at) t = 0;
+    }
+
+    void mark(Stage stage) {
+        if(active) at[stage] = Metrics::nowUs();
+    }
+
+    bool active;            //  是否在计时，没有启用时所有mark都不读时钟
+    uint64_t at[STAGES];
+    int reader;             //  解析请求的线程
+    int worker;             //  执行处理函数的线程
+};
+
+
+//  采样和导出
+class Tracer {
+public:
+    //  每sample_every个请求保存一个（为0不采样），超过slow_ms的请求总是保存（为0不保存），最多保存capacity个
+    Tracer(size_t sample_every,int slow_ms,size_t capacity)
+    :sample_every(sample_every),slow_us(slow_ms > 0 ? slow_ms * 1000ULL : 0),
+     ring(capacity == 0 ? 1 : capacity),written(0),seq(0) {}
+
+    //  是否需要记录时间戳
+    bool enabled() const {
+        return sample_every > 0 || slow_us > 0;
+    }
+
+    //  当前线程正在处理的请求，数据库等下层通过它记录阶段
+    static RequestTrace*& current() {
+        thread_local RequestTrace* trace = nullptr;
+        return trace;
+    }
+
+    static void mark(RequestTrace::Stage stage) {
+        RequestTrace* trace = current();
+        if(trace != nullptr) trace->mark(stage);
+    }
+
+    //  线程的编号，按第一次用到的顺序
+    static int threadIndex() {
+        static atomic<int> next{0};
+        thread_local int index = next.fetch_add(1,memory_order_relaxed);
+        return index;
+    }
+
+    //  在作用域内把trace设为当前线程的请求
+    class Scope {
+    public:
+        explicit Scope(RequestTrace& trace): previous(current()) {
+            if(trace.active) current() = &trace;
+        }
+
+        ~Scope() {
+            current() = previous;
+        }
+
+    private:
+        RequestTrace* previous;
+    };
+
+    //  请求发送完之后调用，返回是否需要保存（采样到了或者是慢请求）
+    bool sampled(const RequestTrace& trace) {
+        if(!trace.active || trace.at[RequestTrace::SENT] == 0) return false;
+        uint64_t n = seq.fetch_add(1,memory_order_relaxed) + 1;
+        if(sample_every > 0 && n % sample_every == 0) return true;
+        return slow_us > 0 && trace.at[RequestTrace::SENT] - trace.at[RequestTrace::DISPATCH] >= slow_us;
+    }
+
+    //  保存一个请求，缓冲区满了覆盖最旧的
+    void record(const RequestTrace& trace,const string& method,const string& path,int status) {
+        lock_guard<mutex> lock(ring_mutex);
+        Record& slot = ring[written % ring.size()];
+        slot.id = written++;
+        slot.trace = trace;
+        slot.method = method;
+        slot.path = path;
+        slot.status = status;
+    }
+
+    //  把保存的请求导出成Chrome trace event JSON：每个请求一个tid，整个请求是一个事件，各阶段是嵌套在里面的事件
+    string chromeTrace() const {
+        static const struct { const char* name; int begin; int end; } spans[] = {
+            { "queue",      RequestTrace::DISPATCH, RequestTrace::READ },
+            { "read+parse", RequestTrace::READ,     RequestTrace::PARSE },
+            { "pool queue", RequestTrace::ENQUEUE,  RequestTrace::DEQUEUE },
+            { "handler",    RequestTrace::HANDLER,  RequestTrace::HANDLED },
+            { "db",         RequestTrace::DB_BEGIN, RequestTrace::DB_END },
+        };
+        lock_guard<mutex> lock(ring_mutex);
+        string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        size_t count = min(written,static_cast<uint64_t>(ring.size()));
+        for(size_t i = written - count;i < written;++i) {
+            const Record& r = ring[i % ring.size()];
+            const RequestTrace& t = r.trace;
+            char buf[256];
+            snprintf(buf,sizeof(buf),"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%llu,\"args\":{\"name\":\"",
+                     static_cast<unsigned long long>(r.id));
+            out += first ? "" : ",";
+            first = false;
+            out += buf + escape(r.method + " " + r.path) + "\"}}";
+            snprintf(buf,sizeof(buf),",\"args\":{\"status\":%d,\"reader\":%d,\"worker\":%d}",r.status,t.reader,t.worker);
+            appendSpan(out,"request",r.id,t.at[RequestTrace::DISPATCH],t.at[RequestTrace::SENT],buf);
+            for(const auto& span : spans) {
+                appendSpan(out,span.name,r.id,t.at[span.begin],t.at[span.end],"");
+            }
+            //  处理函数结束（没有执行处理函数的错误响应从解析完开始）到发送
+            uint64_t ready = t.at[RequestTrace::HANDLED] != 0 ? t.at[RequestTrace::HANDLED] : t.at[RequestTrace::PARSE];
+            appendSpan(out,"send",r.id,ready,t.at[RequestTrace::SENT],"");
+        }
+        return out + "]}";
+    }
+
+private:
+    struct Record {
+        uint64_t id;
+        RequestTrace trace;
+        string method;
+        string path;
+        int status;
+    };
+
+    //  一个完整事件（ph为X），两端都有时间时才输出
+    static void appendSpan(string& out,const char* name,uint64_t tid,uint64_t begin,uint64_t end,const char* args) {
+        if(begin == 0 || end < begin) return;
+        char buf[192];
+        snprintf(buf,sizeof(buf),",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%llu,\"ts\":%llu,\"dur\":%llu",
+                 name,static_cast<unsigned long long>(tid),static_cast<unsigned long long>(begin),
+                 static_cast<unsigned long long>(end - begin));
+        out += buf;
+        out += args;
+        out += "}";
+    }
+
+    static string escape(const string& s) {
+        string out;
+        for(unsigned char c : s) {
+            if(c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if(c < 0x20) {
+                char buf[8];
+                snprintf(buf,sizeof(buf),"\\u%04x",c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+        return out;
+    }
+
+    size_t sample_every;
+    uint64_t slow_us;
+    mutable mutex ring_mutex;
+    vector<Record> ring;        //  环形缓冲区
+    uint64_t written;           //  一共保存过的数量
+    atomic<uint64_t> seq;       //  完成的请求数，用来采样
+};
@@ -0,0 +1,57 @@
+#!/bin/bash
+#   比较绑定CPU前后的吞吐、尾延迟、线程在核之间的迁移次数和上下文切换次数（有perf时再加上缓存未命中）
+#   用法：bench/affinity.sh [server路径] [loadgen路径] [秒数] [请求组合]
+#   默认把主循环绑在CPU 0上，工作线程绑在1到N-1上，数据库请求由绑定在最后一个CPU上的执行线程执行；
+#   可以用REACTOR_CPUS、WORKER_CPUS、DB_CPUS改，只有一个CPU时全部绑在0上
+#   每个场景都会重新启动一次服务器，服务器需要能连上数据库
+SERVER=${1:-./server}
+LOADGEN=${2:-./loadgen}
+SECONDS_PER_RUN=${3:-10}
+MIX=${4:-get=8,login=1,register=1}
+PORT=${PORT:-18082}
+CONNS=${CONNS:-64}
+THREADS=${THREADS:-2}
+
+last=$(($(nproc) - 1))
+if [ $last -eq 0 ]; then
+    REACTOR_CPUS=${REACTOR_CPUS:-0}; WORKER_CPUS=${WORKER_CPUS:-0}; DB_CPUS=${DB_CPUS:-0}
+else
+    REACTOR_CPUS=${REACTOR_CPUS:-0}; WORKER_CPUS=${WORKER_CPUS:-1-$last}; DB_CPUS=${DB_CPUS:-$last}
+fi
+
+#   进程所有线程的计数之和：se.nr_migrations在/proc/PID/task/TID/sched里，上下文切换在status里
+sumSched() {
+    cat /proc/$1/task/*/sched 2>/dev/null | awk '/se.nr_migrations/ { n += $3 } END { print n + 0 }'
+}
+sumSwitches() {
+    cat /proc/$1/task/*/status 2>/dev/null | awk '/ctxt_switches/ { n += $2 } END { print n + 0 }'
+}
+
+run() {
+    local name=$1; shift
+    "$SERVER" $PORT "$@" > /dev/null 2>&1 &
+    local pid=$!
+    sleep 0.5
+    echo "=== $name  (server: $*)"
+    local migrations=$(sumSched $pid)
+    local switches=$(sumSwitches $pid)
+    local perf_pid=""
+    if command -v perf > /dev/null; then
+        perf stat -e cache-misses,LLC-load-misses,cpu-migrations -p $pid -o /tmp/affinity_perf.txt &
+        perf_pid=$!
+    fi
+    "$LOADGEN" -p $PORT -c $CONNS -n $THREADS -t $SECONDS_PER_RUN -m "$MIX" | grep -E "throughput|latency"
+    #   线程退出之后它的计数就读不到了，所以在停服务器之前读
+    echo "migrations $(($(sumSched $pid) - migrations))  context switches $(($(sumSwitches $pid) - switches))"
+    if [ -n "$perf_pid" ]; then
+        kill -INT $perf_pid
+        wait $perf_pid 2>/dev/null
+        grep -E "cache-misses|LLC-load-misses|cpu-migrations" /tmp/affinity_perf.txt
+    fi
+    kill $pid
+    wait $pid 2>/dev/null
+}
+
+run "unpinned"
+run "pinned"                --reactor_cpus=$REACTOR_CPUS --worker_cpus=$WORKER_CPUS --db_cpus=$DB_CPUS
+run "pinned + incoming cpu" --reactor_cpus=$REACTOR_CPUS --worker_cpus=$WORKER_CPUS --db_cpus=$DB_CPUS --incoming_cpu=1
@@ -0,0 +1,21 @@
+#!/bin/bash
+#   比较HTTP/1.1（keep-alive和流水线）和HTTP/2（h2c多路复用）在相同在途请求数下的吞吐和延迟
+#   用法：bench/http2.sh [server路径] [loadgen路径] [秒数] [路径]
+SERVER=${1:-./server}
+LOADGEN=${2:-./loadgen}
+SECONDS_PER_RUN=${3:-10}
+URL=${4:-/}
+PORT=${PORT:-18082}
+CONNS=${CONNS:-32}
+
+"$SERVER" $PORT > /dev/null 2>&1 &
+pid=$!
+sleep 0.5
+for depth in 1 8 32; do
+    echo "=== HTTP/1.1, pipeline depth $depth"
+    "$LOADGEN" -p $PORT -c $CONNS -d $depth -t $SECONDS_PER_RUN -u "$URL"
+    echo "=== h2c, $depth concurrent streams"
+    "$LOADGEN" -p $PORT -c $CONNS -d $depth -t $SECONDS_PER_RUN -u "$URL" -2
+done
+kill $pid
+wait $pid 2>/dev/null
@@ -0,0 +1,24 @@
+#!/bin/bash
+#   同一个请求组合下比较闭环和开环：闭环测出最大吞吐，开环按最大吞吐的一定比例发请求，看排队造成的尾延迟
+#   用法：bench/load.sh [server路径] [loadgen路径] [秒数] [请求组合]
+SERVER=${1:-./server}
+LOADGEN=${2:-./loadgen}
+SECONDS_PER_RUN=${3:-10}
+MIX=${4:-get=8,login=1,register=1}
+PORT=${PORT:-18081}
+CONNS=${CONNS:-64}
+THREADS=${THREADS:-4}
+
+"$SERVER" $PORT > /dev/null 2>&1 &
+pid=$!
+sleep 0.5
+echo "=== closed loop"
+"$LOADGEN" -p $PORT -c $CONNS -n $THREADS -t $SECONDS_PER_RUN -m "$MIX" | tee /tmp/load_closed.txt
+max=$(awk '/throughput/ { print int($6) }' /tmp/load_closed.txt)
+for percent in 50 80 95; do
+    rate=$((max * percent / 100))
+    echo "=== open loop ${percent}% ($rate req/s)"
+    "$LOADGEN" -p $PORT -c $CONNS -n $THREADS -t $SECONDS_PER_RUN -m "$MIX" -r $rate
+done
+kill $pid
+wait $pid 2>/dev/null
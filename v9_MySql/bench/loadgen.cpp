@@ -0,0 +1,643 @@
+//  HTTP压测工具  --  基于epoll的多线程负载生成器，支持keep-alive、流水线和HTTP/2（h2c）
+//  闭环（默认）：每个连接上始终保持depth个请求在途，收到一个响应就立即补发一个请求
+//  开环（-r 每秒请求数）：按固定的到达速率产生请求，和响应的快慢无关；延迟从请求本该发出的时间算起，
+//  连接都占满时请求在本地排队，排队的时间也算进延迟，不会因为协调遗漏（coordinated omission）把变慢的那段时间藏起来
+//  请求组合（-m）：get（-u指定的路径）、login（POST /login）、register（POST /register，每次用新的用户名）按权重随机选
+//  -2 用HTTP/2（h2c，直接发连接前言），depth是每个连接上同时打开的流的数量
+//  -j 输出JSON，方便脚本比较
+//  用法：loadgen [-h host] [-p port] [-c 连接数] [-d 流水线深度] [-t 秒数] [-u 路径] [-2]
+//               [-n 线程数] [-r 每秒请求数] [-m get=8,login=1,register=1] [-j]
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+
+static double nowUs() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+
+//  请求的种类
+enum Kind {
+    GET,
+    LOGIN,
+    REGISTER,
+    KINDS
+};
+
+static const char* kind_names[KINDS] = { "get","login","register" };
+
+
+struct Options {
+    string host = "127.0.0.1";
+    int port = 8080;
+    int conns = 16;
+    int depth = 1;
+    double seconds = 10;
+    string path = "/";
+    bool http2 = false;
+    int threads = 1;
+    double rate = 0;                //  开环的总到达速率，为0时闭环
+    int weights[KINDS] = { 1,0,0 }; //  请求组合的权重
+    bool json = false;
+};
+
+#define TIMER_ID 0xffffffffu         //  epoll事件里timerfd的编号，连接用下标
+
+static Options opt;
+static struct sockaddr_in server_addr;
+
+
+//  一个请求：本该发出的时间（闭环时就是发出的时间）和种类
+struct Pending {
+    double start;
+    int kind;
+};
+
+
+//  一个压测连接
+struct Client {
+    int fd = -1;
+    string out;                 //  待发送的数据
+    size_t out_off = 0;
+    string in;                  //  收到但还没解析完的数据
+    deque<Pending> sent;        //  在途的请求，按顺序对应响应
+    unordered_map<uint32_t,pair<Pending,int>> streams;  //  HTTP/2在途的流，和已经收到的状态码
+    uint32_t next_stream = 1;   //  下一个流的编号
+    size_t unacked = 0;         //  收到之后还没有用WINDOW_UPDATE还给服务器的字节数
+
+    size_t inflight() const {
+        return opt.http2 ? streams.size() : sent.size();
+    }
+};
+
+
+//  一个压测线程，负责一部分连接，有自己的epoll和统计
+struct Worker {
+    int index = 0;
+    int epfd = -1;
+    int timer = -1;                 //  开环时在下一个请求的到达时间唤醒epoll
+    vector<Client> clients;
+    deque<Pending> backlog;         //  开环时已经到了发送时间、但是连接都占满了的请求
+    vector<double> latencies[KINDS];
+    long status[6] = { 0 };         //  按状态码类别计数，下标0为无法识别的
+    long errors = 0;                //  连接断开时丢失的请求
+    long reconnects = 0;
+    uint64_t users = 0;             //  注册用的用户名序号
+    mt19937 rng;
+};
+
+
+//  HTTP/2帧头
+static void appendFrame(string& out,size_t len,uint8_t type,uint8_t flags,uint32_t stream) {
+    char head[9] = {static_cast<char>(len >> 16),static_cast<char>(len >> 8),static_cast<char>(len),
+                    static_cast<char>(type),static_cast<char>(flags),static_cast<char>(stream >> 24),
+                    static_cast<char>(stream >> 16),static_cast<char>(stream >> 8),static_cast<char>(stream)};
+    out.append(head,sizeof(head));
+}
+
+static void appendUint32(string& out,uint32_t v) {
+    char buf[4] = {static_cast<char>(v >> 24),static_cast<char>(v >> 16),static_cast<char>(v >> 8),static_cast<char>(v)};
+    out.append(buf,sizeof(buf));
+}
+
+
+//  连接前言：SETTINGS里把流的初始窗口设到最大，再把连接的窗口也调大，服务器发响应体不用等WINDOW_UPDATE
+static string h2Preface() {
+    string out = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    appendFrame(out,6,4,0,0);
+    out += string("\x00\x04",2);
+    appendUint32(out,0x7fffffff);
+    appendFrame(out,4,8,0,0);
+    appendUint32(out,0x7fffffff - 65535);
+    return out;
+}
+
+
+//  不索引的字面量，值不用Huffman编码（长度小于127）
+static void h2Literal(string& block,const string& name_index,const string& value) {
+    block += name_index;
+    block += static_cast<char>(min<size_t>(value.size(),126));
+    block += value.substr(0,126);
+}
+
+
+//  请求的头部块：:method和:scheme http用静态表索引，:path和:authority用不索引的字面量
+static string h2RequestBlock(bool post,const string& path,const string& host) {
+    string block = post ? "\x83\x86" : "\x82\x86";
+    if(path == "/") {
+        block += '\x84';
+    } else {
+        h2Literal(block,"\x04",path);
+    }
+    h2Literal(block,"\x01",host);
+    //  content-type的静态表索引是31，4位前缀放不下，写成15加16
+    if(post) h2Literal(block,"\x0f\x10","application/x-www-form-urlencoded");
+    return block;
+}
+
+
+//  HTTP/2响应头部块里的状态码：跳过动态表大小更新，只认静态表索引和名字是:status的字面量（服务器的编码方式）
+static int h2Status(const string& block) {
+    size_t i = 0;
+    while(i < block.size() && (static_cast<unsigned char>(block[i]) & 0xe0) == 0x20) ++i;
+    if(i >= block.size()) return 0;
+    unsigned char b = block[i];
+    static const int indexed[] = { 200,204,206,304,400,404,500 };
+    if((b & 0x80) && (b & 0x7f) >= 8 && (b & 0x7f) <= 14) return indexed[(b & 0x7f) - 8];
+    if((b & 0xc0) == 0x40 || (b & 0xf0) == 0 || (b & 0xf0) == 0x10) {
+        if((b & 0x0f) == 8 && i + 5 <= block.size() && block[i + 1] == 3) return atoi(block.substr(i + 2,3).c_str());
+    }
+    return 0;
+}
+
+
+//  请求体：登录用固定的用户，注册每次用新的用户名（用户名最长15个字符）
+static string formBody(Worker& w,int kind) {
+    if(kind == LOGIN) return "username=bench&password=bench";
+    char name[32];
+    snprintf(name,sizeof(name),"b%x_%llx",w.index,static_cast<unsigned long long>(w.users++ % 0xffffffffULL));
+    return string("username=") + name + "&password=bench";
+}
+
+
+//  按权重选一种请求
+static int pickKind(Worker& w) {
+    int total = 0;
+    for(int weight : opt.weights) total += weight;
+    int r = uniform_int_distribution<int>(0,total - 1)(w.rng);
+    for(int k = 0;k < KINDS;++k) {
+        if(r < opt.weights[k]) return k;
+        r -= opt.weights[k];
+    }
+    return GET;
+}
+
+
+//  把一个请求写进连接的发送缓冲区
+static void sendRequest(Worker& w,Client& c,Pending p) {
+    bool post = p.kind != GET;
+    const string& path = p.kind == LOGIN ? "/login" : p.kind == REGISTER ? "/register" : opt.path;
+    string body = post ? formBody(w,p.kind) : string();
+    if(opt.http2) {
+        string block = h2RequestBlock(post,path,opt.host);
+        //  GET的HEADERS带END_HEADERS和END_STREAM，POST的请求体放在一个带END_STREAM的DATA帧里
+        appendFrame(c.out,block.size(),1,post ? 0x4 : 0x5,c.next_stream);
+        c.out += block;
+        if(post) {
+            appendFrame(c.out,body.size(),0,0x1,c.next_stream);
+            c.out += body;
+        }
+        c.streams[c.next_stream] = make_pair(p,0);
+        c.next_stream += 2;
+        return;
+    }
+    c.out += (post ? "POST " : "GET ") + path + " HTTP/1.1\r\nHost: " + opt.host + "\r\n";
+    if(post) {
+        c.out += "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: " + to_string(body.size()) + "\r\n";
+    }
+    c.out += "\r\n";
+    c.out += body;
+    c.sent.push_back(p);
+}
+
+
+//  一个请求完成
+static void complete(Worker& w,const Pending& p,int status,double now) {
+    w.latencies[p.kind].push_back(now - p.start);
+    w.status[status >= 100 && status < 600 ? status / 100 : 0]++;
+}
+
+
+//  连接到服务器，HTTP/2连接先放好连接前言
+//  开始时阻塞地连接，连不上直接报错；重连是非阻塞的，服务器的监听队列满了（早期版本backlog只有5）也不会卡住整个线程
+static bool connectClient(Worker& w,Client& c,uint32_t id,bool blocking) {
+    c = Client();
+    c.fd = socket(AF_INET,SOCK_STREAM,0);
+    int one = 1;
+    setsockopt(c.fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+    if(!blocking) fcntl(c.fd,F_SETFL,fcntl(c.fd,F_GETFL) | O_NONBLOCK);
+    if(connect(c.fd,(struct sockaddr*)&server_addr,sizeof(server_addr)) < 0 && (blocking || errno != EINPROGRESS)) {
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    if(blocking) fcntl(c.fd,F_SETFL,fcntl(c.fd,F_GETFL) | O_NONBLOCK);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u32 = id;
+    epoll_ctl(w.epfd,EPOLL_CTL_ADD,c.fd,&ev);
+    if(opt.http2) c.out = h2Preface();
+    return true;
+}
+
+
+//  连接断开或者出错：在途的请求记为错误，重新连接
+static void reconnect(Worker& w,uint32_t id) {
+    Client& c = w.clients[id];
+    w.errors += c.inflight();
+    close(c.fd);
+    w.reconnects++;
+    connectClient(w,c,id,false);
+}
+
+
+//  解析收到的HTTP/2帧，连接出错（GOAWAY，RST_STREAM）时返回false
+static bool h2Receive(Worker& w,Client& c,double now,vector<uint32_t>& done) {
+    size_t off = 0;
+    bool ok = true;
+    while(c.in.size() - off >= 9) {
+        const unsigned char* h = reinterpret_cast<const unsigned char*>(c.in.data() + off);
+        size_t len = (h[0] << 16) | (h[1] << 8) | h[2];
+        uint8_t type = h[3];
+        uint8_t flags = h[4];
+        uint32_t stream = ((h[5] & 0x7f) << 24) | (h[6] << 16) | (h[7] << 8) | h[8];
+        if(c.in.size() - off < 9 + len) break;
+        if(type == 1) {
+            auto it = c.streams.find(stream);
+            if(it != c.streams.end()) it->second.second = h2Status(c.in.substr(off + 9,len));
+        }
+        off += 9 + len;
+        if(type == 4 && (flags & 0x1) == 0) {
+            //  服务器的SETTINGS，确认
+            appendFrame(c.out,0,4,0x1,0);
+        } else if(type == 7 || type == 3) {
+            ok = false;
+            break;
+        } else if(type == 0) {
+            c.unacked += len;
+        }
+        if((type == 0 || type == 1) && (flags & 0x1)) {
+            auto it = c.streams.find(stream);
+            if(it != c.streams.end()) {
+                complete(w,it->second.first,it->second.second,now);
+                c.streams.erase(it);
+                done.push_back(stream);
+            }
+        }
+    }
+    c.in.erase(0,off);
+    if(c.unacked >= (1u << 24)) {
+        appendFrame(c.out,4,8,0,0);
+        appendUint32(c.out,c.unacked);
+        c.unacked = 0;
+    }
+    return ok;
+}
+
+
+//  从in的off处解析出一个完整的响应，返回它的长度，不完整时返回0，格式错误时返回-1
+//  支持Content-Length和分块编码的响应体
+static long parseResponse(const string& in,size_t off,int& status) {
+    size_t header_end = in.find("\r\n\r\n",off);
+    if(header_end == string::npos) return 0;
+    if(in.compare(off,5,"HTTP/") != 0) return -1;
+    status = atoi(in.c_str() + off + 9);
+    size_t body = 0;
+    bool chunked = false;
+    size_t pos = off;
+    while((pos = in.find("\r\n",pos)) != string::npos && pos < header_end) {
+        pos += 2;
+        if(strncasecmp(in.c_str() + pos,"Content-Length:",15) == 0) {
+            body = strtoul(in.c_str() + pos + 15,nullptr,10);
+        } else if(strncasecmp(in.c_str() + pos,"Transfer-Encoding:",18) == 0) {
+            size_t line_end = in.find("\r\n",pos);
+            chunked = in.substr(pos,line_end - pos).find("chunked") != string::npos;
+        }
+    }
+    if(!chunked) {
+        size_t total = header_end + 4 + body;
+        return in.size() >= total ? static_cast<long>(total - off) : 0;
+    }
+    pos = header_end + 4;
+    while(1) {
+        size_t line_end = in.find("\r\n",pos);
+        if(line_end == string::npos) return 0;
+        size_t size = strtoul(in.c_str() + pos,nullptr,16);
+        pos = line_end + 2;
+        if(size == 0) {
+            //  没有尾部头时紧跟一个空行
+            size_t end = in.find("\r\n",pos);
+            if(end == string::npos) return 0;
+            if(end != pos) {
+                end = in.find("\r\n\r\n",pos);
+                if(end == string::npos) return 0;
+                return static_cast<long>(end + 4 - off);
+            }
+            return static_cast<long>(end + 2 - off);
+        }
+        if(in.size() < pos + size + 2) return 0;
+        pos += size + 2;
+    }
+}
+
+
+//  开环时把到了时间的请求分给有空位的连接
+static void dispatchBacklog(Worker& w) {
+    for(size_t i = 0;i < w.clients.size() && !w.backlog.empty();++i) {
+        Client& c = w.clients[i];
+        while(c.fd != -1 && c.inflight() < static_cast<size_t>(opt.depth) && !w.backlog.empty()) {
+            sendRequest(w,c,w.backlog.front());
+            w.backlog.pop_front();
+        }
+    }
+}
+
+
+//  尽量发出发送缓冲区里的数据
+static void flushClient(Client& c) {
+    while(c.out_off < c.out.size()) {
+        ssize_t n = write(c.fd,c.out.data() + c.out_off,c.out.size() - c.out_off);
+        if(n <= 0) break;
+        c.out_off += n;
+    }
+    if(c.out_off == c.out.size()) {
+        c.out.clear();
+        c.out_off = 0;
+    }
+}
+
+
+static void runWorker(Worker& w,double start,double end) {
+    //  闭环一开始就把流水线填满；开环每个线程承担总速率的一部分
+    bool open_loop = opt.rate > 0;
+    double interval = open_loop ? 1e6 * opt.threads / opt.rate : 0;
+    double next_arrival = start + interval * w.index / opt.threads;
+    double armed = 0;
+    if(open_loop) {
+        //  到达间隔可能远小于1毫秒，epoll_wait的毫秒超时不够精确，用绝对时间的timerfd
+        w.timer = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = TIMER_ID;
+        epoll_ctl(w.epfd,EPOLL_CTL_ADD,w.timer,&ev);
+    } else {
+        double now = nowUs();
+        for(Client& c : w.clients) {
+            for(int d = 0;d < opt.depth;++d) sendRequest(w,c,Pending{ now,pickKind(w) });
+        }
+    }
+    for(size_t i = 0;i < w.clients.size();++i) flushClient(w.clients[i]);
+
+    vector<struct epoll_event> events(w.clients.size() + 1);
+    vector<uint32_t> done;
+    char buf[65536];
+    while(1) {
+        double now = nowUs();
+        if(now >= end) break;
+        if(open_loop) {
+            while(next_arrival <= now && next_arrival < end) {
+                w.backlog.push_back(Pending{ next_arrival,pickKind(w) });
+                next_arrival += interval;
+            }
+            dispatchBacklog(w);
+            for(Client& c : w.clients) {
+                if(c.fd != -1 && !c.out.empty()) flushClient(c);
+            }
+            if(next_arrival != armed && next_arrival < end) {
+                uint64_t ns = static_cast<uint64_t>(next_arrival * 1000);
+                struct itimerspec when = {{ 0,0 },{ static_cast<time_t>(ns / 1000000000),static_cast<long>(ns % 1000000000) }};
+                timerfd_settime(w.timer,TFD_TIMER_ABSTIME,&when,nullptr);
+                armed = next_arrival;
+            }
+        }
+        int n = epoll_wait(w.epfd,events.data(),events.size(),min(100,static_cast<int>((end - now) / 1000) + 1));
+        now = nowUs();
+        for(int e = 0;e < n;++e) {
+            uint32_t id = events[e].data.u32;
+            if(id == TIMER_ID) {
+                uint64_t expirations;
+                while(read(w.timer,&expirations,sizeof(expirations)) > 0) {}
+                continue;
+            }
+            Client& c = w.clients[id];
+            if(c.fd == -1) continue;
+            //  读响应
+            bool broken = false;
+            bool eof = false;
+            while(1) {
+                ssize_t r = read(c.fd,buf,sizeof(buf));
+                if(r > 0) {
+                    c.in.append(buf,r);
+                    continue;
+                }
+                eof = r == 0;
+                broken = eof || (errno != EAGAIN && errno != EWOULDBLOCK);
+                break;
+            }
+            long completed = 0;
+            if(opt.http2) {
+                done.clear();
+                if(!h2Receive(w,c,now,done)) broken = true;
+                completed = done.size();
+            } else {
+                long len = 0;
+                size_t consumed = 0;
+                int status = 0;
+                while(!c.sent.empty() && (len = parseResponse(c.in,consumed,status)) > 0) {
+                    consumed += len;
+                    complete(w,c.sent.front(),status,now);
+                    c.sent.pop_front();
+                    ++completed;
+                }
+                c.in.erase(0,consumed);
+                if(len < 0) broken = true;
+                //  早期版本的服务器不发Content-Length，发完响应就关闭连接，响应到连接关闭为止
+                if(eof && !c.sent.empty() && c.in.compare(0,5,"HTTP/") == 0) {
+                    complete(w,c.sent.front(),atoi(c.in.c_str() + 9),now);
+                    c.sent.pop_front();
+                    c.in.clear();
+                }
+            }
+            if(broken) {
+                reconnect(w,id);
+                if(c.fd == -1) continue;
+                //  闭环时把连接重新填满
+                if(!open_loop) {
+                    for(int d = 0;d < opt.depth;++d) sendRequest(w,c,Pending{ now,pickKind(w) });
+                }
+            } else if(!open_loop) {
+                //  闭环：完成一个就补发一个
+                for(long i = 0;i < completed;++i) sendRequest(w,c,Pending{ now,pickKind(w) });
+            }
+            if(open_loop) dispatchBacklog(w);
+            flushClient(c);
+        }
+    }
+    for(Client& c : w.clients) {
+        if(c.fd != -1) close(c.fd);
+    }
+    if(w.timer != -1) close(w.timer);
+    close(w.epfd);
+}
+
+
+//  延迟的百分位（毫秒），latencies已经排好序
+static double percentile(const vector<double>& latencies,double p) {
+    if(latencies.empty()) return 0.0;
+    return latencies[static_cast<size_t>(p / 100.0 * (latencies.size() - 1) + 0.5)] / 1000.0;
+}
+
+
+static bool parseMix(const string& mix) {
+    for(int& weight : opt.weights) weight = 0;
+    size_t pos = 0;
+    while(pos < mix.size()) {
+        size_t end = mix.find(',',pos);
+        if(end == string::npos) end = mix.size();
+        string item = mix.substr(pos,end - pos);
+        pos = end + 1;
+        size_t eq = item.find('=');
+        string name = item.substr(0,eq);
+        int weight = eq == string::npos ? 1 : atoi(item.c_str() + eq + 1);
+        int k = 0;
+        while(k < KINDS && name != kind_names[k]) ++k;
+        if(k == KINDS || weight < 0) return false;
+        opt.weights[k] = weight;
+    }
+    int total = 0;
+    for(int weight : opt.weights) total += weight;
+    return total > 0;
+}
+
+
+int main(int argc,char* argv[]) {
+    for(int i = 1;i < argc;++i) {
+        string arg = argv[i];
+        if(arg == "-h" && i + 1 < argc) opt.host = argv[++i];
+        else if(arg == "-p" && i + 1 < argc) opt.port = atoi(argv[++i]);
+        else if(arg == "-c" && i + 1 < argc) opt.conns = max(1,atoi(argv[++i]));
+        else if(arg == "-d" && i + 1 < argc) opt.depth = max(1,atoi(argv[++i]));
+        else if(arg == "-t" && i + 1 < argc) opt.seconds = atof(argv[++i]);
+        else if(arg == "-u" && i + 1 < argc) opt.path = argv[++i];
+        else if(arg == "-2") opt.http2 = true;
+        else if(arg == "-n" && i + 1 < argc) opt.threads = max(1,atoi(argv[++i]));
+        else if(arg == "-r" && i + 1 < argc) opt.rate = atof(argv[++i]);
+        else if(arg == "-m" && i + 1 < argc && parseMix(argv[i + 1])) ++i;
+        else if(arg == "-j") opt.json = true;
+        else {
+            fprintf(stderr,"usage: %s [-h host] [-p port] [-c conns] [-d depth] [-t seconds] [-u path] [-2]\n"
+                           "       [-n threads] [-r requests/s] [-m get=8,login=1,register=1] [-j]\n",argv[0]);
+            return 1;
+        }
+    }
+    opt.threads = min(opt.threads,opt.conns);
+
+    memset(&server_addr,0,sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(opt.port);
+    inet_pton(AF_INET,opt.host.c_str(),&server_addr.sin_addr);
+
+    //  连接平均分给各个线程
+    vector<Worker> workers(opt.threads);
+    for(int t = 0;t < opt.threads;++t) {
+        workers[t].index = t;
+        workers[t].rng.seed(t + 1);
+        workers[t].clients.resize(opt.conns / opt.threads + (t < opt.conns % opt.threads ? 1 : 0));
+        for(auto& v : workers[t].latencies) v.reserve(1 << 18);
+    }
+    //  先建立好所有连接再开始计时，服务器的监听队列很短时建连接可能要等SYN重传
+    for(Worker& w : workers) {
+        w.epfd = epoll_create1(0);
+        for(size_t i = 0;i < w.clients.size();++i) {
+            if(!connectClient(w,w.clients[i],i,true)) {
+                perror("connect");
+                return 1;
+            }
+        }
+    }
+    double start = nowUs();
+    double end = start + opt.seconds * 1e6;
+    vector<thread> threads;
+    for(Worker& w : workers) threads.emplace_back(runWorker,ref(w),start,end);
+    for(thread& t : threads) t.join();
+    //  结束时间之后收到的响应不计，吞吐按设定的时长算
+    double elapsed = min((nowUs() - start) / 1e6,opt.seconds);
+
+    //  合并各线程的结果
+    vector<double> by_kind[KINDS];
+    vector<double> all;
+    long status[6] = { 0 };
+    long errors = 0;
+    long reconnects = 0;
+    size_t backlog = 0;
+    for(Worker& w : workers) {
+        for(int k = 0;k < KINDS;++k) {
+            by_kind[k].insert(by_kind[k].end(),w.latencies[k].begin(),w.latencies[k].end());
+            all.insert(all.end(),w.latencies[k].begin(),w.latencies[k].end());
+        }
+        for(int s = 0;s < 6;++s) status[s] += w.status[s];
+        errors += w.errors;
+        reconnects += w.reconnects;
+        backlog += w.backlog.size();
+    }
+    sort(all.begin(),all.end());
+    for(auto& v : by_kind) sort(v.begin(),v.end());
+    static const double points[] = { 50,90,99,99.9,100 };
+    static const char* point_names[] = { "p50","p90","p99","p99.9","max" };
+    const char* mode = opt.rate > 0 ? "open" : "closed";
+
+    if(opt.json) {
+        printf("{\"mode\":\"%s\",\"protocol\":\"%s\",\"threads\":%d,\"connections\":%d,\"depth\":%d,"
+               "\"rate\":%.0f,\"duration_s\":%.3f,\"requests\":%zu,\"errors\":%ld,\"reconnects\":%ld,"
+               "\"backlog\":%zu,\"throughput\":%.1f,",mode,opt.http2 ? "h2c" : "http/1.1",opt.threads,opt.conns,
+               opt.depth,opt.rate,elapsed,all.size(),errors,reconnects,backlog,all.size() / elapsed);
+        printf("\"status\":{\"1xx\":%ld,\"2xx\":%ld,\"3xx\":%ld,\"4xx\":%ld,\"5xx\":%ld,\"other\":%ld},",
+               status[1],status[2],status[3],status[4],status[5],status[0]);
+        printf("\"latency_ms\":{");
+        for(int p = 0;p < 5;++p) printf("%s\"%s\":%.3f",p ? "," : "",point_names[p],percentile(all,points[p]));
+        printf("},\"mix\":{");
+        bool first = true;
+        for(int k = 0;k < KINDS;++k) {
+            if(opt.weights[k] == 0) continue;
+            printf("%s\"%s\":{\"requests\":%zu,\"latency_ms\":{",first ? "" : ",",kind_names[k],by_kind[k].size());
+            for(int p = 0;p < 5;++p) printf("%s\"%s\":%.3f",p ? "," : "",point_names[p],percentile(by_kind[k],points[p]));
+            printf("}}");
+            first = false;
+        }
+        printf("}}\n");
+        return 0;
+    }
+
+    printf("%d connections, %s %d, %d threads, %s loop",opt.conns,opt.http2 ? "h2c streams" : "pipeline depth",
+           opt.depth,opt.threads,mode);
+    if(opt.rate > 0) printf(" at %.0f req/s",opt.rate);
+    printf(", %.1fs\n",elapsed);
+    printf("requests %zu  errors %ld  throughput %.0f req/s\n",all.size(),errors,all.size() / elapsed);
+    printf("latency(ms) p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",percentile(all,50),percentile(all,90),
+           percentile(all,99),percentile(all,99.9),percentile(all,100));
+    printf("status 2xx %ld  3xx %ld  4xx %ld  5xx %ld  other %ld",status[2],status[3],status[4],status[5],
+           status[0] + status[1]);
+    if(reconnects > 0) printf("  reconnects %ld",reconnects);
+    if(backlog > 0) printf("  not sent %zu",backlog);
+    printf("\n");
+    for(int k = 0;k < KINDS;++k) {
+        if(opt.weights[k] == 0) continue;
+        //  只有一种请求时和总的一样，不重复输出
+        bool only = true;
+        for(int j = 0;j < KINDS;++j) if(j != k && opt.weights[j] > 0) only = false;
+        if(only) continue;
+        printf("  %-9s %8zu  p50 %.3f  p99 %.3f  p99.9 %.3f\n",kind_names[k],by_kind[k].size(),
+               percentile(by_kind[k],50),percentile(by_kind[k],99),percentile(by_kind[k],99.9));
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+//  热点组件的微基准  --  每个组件单独测，输出ns/op和每次操作的内存分配次数（allocs/op）、分配字节数（bytes/op）
+//  用Google Benchmark：HttpRequest::parse（不同的请求头数量和请求体大小）、parseFromBody、Router::routeRequest
+//  （精确命中、前缀命中、未命中）、HttpResponse::toString（小的和大的响应体）、Logger::logMessage、ThreadPool::enqueue往返
+//  Logger会写server.log，在临时目录里运行，结束后删掉
+//  用法：micro_bench [--benchmark_filter=正则] [--benchmark_format=json] ...（Google Benchmark的参数）
+#include <benchmark/benchmark.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include "../Router.hpp"          //  HttpRequest.hpp和Router.hpp互相包含，要先包含Router.hpp
+#include "../HttpRequest.hpp"
+#include "../HttpResponse.hpp"
+#include "../Logger.hpp"
+#include "../ThreadPool.hpp"
+using namespace std;
+
+
+//  替换全局的operator new，统计所有线程的分配次数和字节数（线程池的往返包括工作线程里的分配）
+static atomic<uint64_t> alloc_count{0};
+static atomic<uint64_t> alloc_bytes{0};
+
+void* operator new(size_t size) {
+    alloc_count.fetch_add(1,memory_order_relaxed);
+    alloc_bytes.fetch_add(size,memory_order_relaxed);
+    void* p = malloc(size == 0 ? 1 : size);
+    if(p == nullptr) throw bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p,size_t) noexcept {
+    free(p);
+}
+
+
+//  在一个基准的计时循环前后取分配计数，算出每次操作的平均值
+class AllocCounter {
+public:
+    explicit AllocCounter(benchmark::State& state)
+    :state(state),count(alloc_count.load(memory_order_relaxed)),bytes(alloc_bytes.load(memory_order_relaxed)) {}
+
+    ~AllocCounter() {
+        state.counters["allocs/op"] = benchmark::Counter(alloc_count.load(memory_order_relaxed) - count,
+                                                         benchmark::Counter::kAvgIterations);
+        state.counters["bytes/op"] = benchmark::Counter(alloc_bytes.load(memory_order_relaxed) - bytes,
+                                                        benchmark::Counter::kAvgIterations);
+    }
+
+private:
+    benchmark::State& state;
+    uint64_t count;
+    uint64_t bytes;
+};
+
+
+//  一个请求：headers个请求头，有请求体时是POST
+static string makeRequest(int headers,int body) {
+    string request = string(body > 0 ? "POST" : "GET") + " /static/app/main.js HTTP/1.1\r\nHost: localhost:8080\r\n";
+    for(int i = 0;i < headers;++i) {
+        request += "X-Header-" + to_string(i) + ": value-" + to_string(i) + "-abcdefghijklmnop\r\n";
+    }
+    if(body > 0) {
+        request += "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: " + to_string(body) + "\r\n";
+    }
+    return request + "\r\n" + string(body,'a');
+}
+
+
+//  参数：请求头数量，请求体字节数
+static void BM_HttpRequestParse(benchmark::State& state) {
+    string request = makeRequest(state.range(0),state.range(1));
+    AllocCounter allocs(state);
+    for(auto _ : state) {
+        HttpRequest parsed;
+        bool ok = parsed.parse(request);
+        benchmark::DoNotOptimize(ok);
+    }
+    state.SetBytesProcessed(state.iterations() * request.size());
+}
+BENCHMARK(BM_HttpRequestParse)->ArgNames({"headers","body"})
+    ->Args({0,0})->Args({4,0})->Args({16,0})->Args({64,0})->Args({4,64})->Args({4,4096})->Args({16,65536});
+
+
+//  参数：表单字段数量，每个字段都会记一条日志
+static void BM_HttpRequestParseFromBody(benchmark::State& state) {
+    string body;
+    for(int i = 0;i < state.range(0);++i) {
+        body += (i > 0 ? "&" : "") + string("field") + to_string(i) + "=value" + to_string(i);
+    }
+    HttpRequest request;
+    request.parse(makeRequest(2,body.size()));
+    request.setBody(body);
+    AllocCounter allocs(state);
+    for(auto _ : state) {
+        auto params = request.parseFromBody();
+        benchmark::DoNotOptimize(params);
+    }
+}
+BENCHMARK(BM_HttpRequestParseFromBody)->ArgName("fields")->Arg(2)->Arg(16);
+
+
+//  和服务器规模相当的路由表：一些精确路由和一个静态文件的前缀路由
+static Router& benchRouter() {
+    static Router router;
+    static bool initialized = false;
+    if(!initialized) {
+        initialized = true;
+        auto handler = [](const HttpRequest&) {
+            HttpResponse response;
+            response.setBody("Hello World!");
+            response.setHeader("Content-Type","text/plain");
+            return response;
+        };
+        const char* paths[] = { "/","/index.html","/login","/register","/metrics","/debug/trace","/stream","/echo",
+                                "/api/users","/api/orders","/api/items","/health" };
+        for(const char* path : paths) router.addRoute("GET",path,handler);
+        router.addPrefixRoute("GET","/static/",handler);
+    }
+    return router;
+}
+
+//  参数：0 精确命中，1 前缀命中，2 未命中（404）
+static void BM_RouterRouteRequest(benchmark::State& state) {
+    static const char* paths[] = { "/index.html","/static/app/main.js","/no/such/page" };
+    Router& router = benchRouter();
+    HttpRequest request;
+    request.parse(string("GET ") + paths[state.range(0)] + " HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    AllocCounter allocs(state);
+    for(auto _ : state) {
+        HttpResponse response = router.routeRequest(request);
+        benchmark::DoNotOptimize(response);
+    }
+}
+BENCHMARK(BM_RouterRouteRequest)->ArgName("hit_prefix_miss")->Arg(0)->Arg(1)->Arg(2);
+
+
+//  参数：响应体字节数
+static void BM_HttpResponseToString(benchmark::State& state) {
+    HttpResponse response;
+    response.setHeader("Content-Type","text/html");
+    response.setHeader("Cache-Control","max-age=3600");
+    response.setHeader("ETag","\"5f3c-1a2b3c4d\"");
+    response.setBody(string(state.range(0),'x'));
+    AllocCounter allocs(state);
+    for(auto _ : state) {
+        string out = response.toString();
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_HttpResponseToString)->ArgName("body")->Arg(16)->Arg(1024)->Arg(65536)->Arg(1 << 20);
+
+
+static void BM_LoggerLogMessage(benchmark::State& state) {
+    AllocCounter allocs(state);
+    for(auto _ : state) {
+        LOG_INFO("Handling HTTP request for URL: %s from %d","/index.html",42);
+    }
+}
+BENCHMARK(BM_LoggerLogMessage);
+
+
+//  提交一个空任务并等它执行完；参数：工作线程数
+static void BM_ThreadPoolRoundTrip(benchmark::State& state) {
+    ThreadPool pool(state.range(0));
+    AllocCounter allocs(state);
+    for(auto _ : state) {
+        pool.enqueue([] { return 1; }).get();
+    }
+}
+BENCHMARK(BM_ThreadPoolRoundTrip)->ArgName("threads")->Arg(1)->Arg(4)->UseRealTime();
+
+
+int main(int argc,char** argv) {
+    char dir[] = "/tmp/micro_bench.XXXXXX";
+    if(mkdtemp(dir) == nullptr || chdir(dir) != 0) {
+        perror("mkdtemp");
+        return 1;
+    }
+    benchmark::Initialize(&argc,argv);
+    if(benchmark::ReportUnrecognizedArguments(argc,argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    unlink("server.log");
+    rmdir(dir);
+    return 0;
+}
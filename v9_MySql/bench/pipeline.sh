@@ -0,0 +1,19 @@
+#!/bin/bash
+#   比较不同流水线深度下的吞吐和延迟
+#   用法：bench/pipeline.sh [server路径] [loadgen路径] [秒数] [路径]
+SERVER=${1:-./server}
+LOADGEN=${2:-./loadgen}
+SECONDS_PER_RUN=${3:-10}
+URL=${4:-/}
+PORT=${PORT:-18081}
+CONNS=${CONNS:-32}
+
+"$SERVER" $PORT > /dev/null 2>&1 &
+pid=$!
+sleep 0.5
+for depth in 1 8 16; do
+    echo "=== depth $depth"
+    "$LOADGEN" -p $PORT -c $CONNS -d $depth -t $SECONDS_PER_RUN -u "$URL"
+done
+kill $pid
+wait $pid 2>/dev/null
@@ -0,0 +1,239 @@
+//  任务队列的争用测试  --  比较线程池用的无锁环形队列（MpmcQueue + EventCount）和互斥锁 + 条件变量的有界队列
+//  一半线程做生产者、一半做消费者，传递和线程池任务一样的元素（一个function和入队时间），消费者执行它
+//  队列满了生产者睡下，队列空了消费者睡下（无锁队列睡在futex上，加锁队列等条件变量）
+//  输出每种队列在每个线程数下的吞吐、交接延迟（入队到出队）的分位数和每千次操作的上下文切换次数
+//  用法：queue_bench [-n 每轮元素数] [-t 2,4,8,16,32,64] [-c 容量] [-j]
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../MpmcQueue.hpp"
+using namespace std;
+
+
+struct Options {
+    size_t items = 2000000;
+    vector<int> threads = { 2,4,8,16,32,64 };
+    size_t capacity = 1024;
+    bool json = false;
+};
+
+static Options opt;
+
+//  和ThreadPool的任务差不多大的元素；run为空表示消费者可以退出
+struct Item {
+    function<void()> run;
+    uint64_t pushed_ns;
+};
+
+static uint64_t nowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+//  无锁队列：消费者取不到时在EventCount上睡，和ThreadPool的工作线程一样；生产者放不进去时睡在另一个EventCount上
+class LockFreeQueue {
+public:
+    explicit LockFreeQueue(size_t capacity): ring(capacity) {}
+
+    void push(Item&& item) {
+        while(!ring.tryPush(move(item))) {
+            uint32_t key = space.prepareWait();
+            if(ring.tryPush(move(item))) {
+                space.cancelWait();
+                break;
+            }
+            space.wait(key,-1);
+        }
+        ready.notifyOne();
+    }
+
+    void pop(Item& item) {
+        while(1) {
+            if(ring.tryPop(item)) break;
+            uint32_t key = ready.prepareWait();
+            if(ring.tryPop(item)) {
+                ready.cancelWait();
+                break;
+            }
+            ready.wait(key,-1);
+        }
+        space.notifyOne();
+    }
+
+private:
+    MpmcQueue<Item> ring;
+    EventCount ready;           //  消费者等元素
+    EventCount space;           //  生产者等空位
+};
+
+
+//  加锁的有界队列：原来ThreadPool的做法
+class LockedQueue {
+public:
+    explicit LockedQueue(size_t capacity): capacity(capacity) {}
+
+    void push(Item&& item) {
+        {
+            unique_lock<mutex> lock(mtx);
+            not_full.wait(lock,[this]{ return items.size() < capacity; });
+            items.push_back(move(item));
+        }
+        not_empty.notify_one();
+    }
+
+    void pop(Item& item) {
+        {
+            unique_lock<mutex> lock(mtx);
+            not_empty.wait(lock,[this]{ return !items.empty(); });
+            item = move(items.front());
+            items.pop_front();
+        }
+        not_full.notify_one();
+    }
+
+private:
+    size_t capacity;
+    deque<Item> items;
+    mutex mtx;
+    condition_variable not_empty;
+    condition_variable not_full;
+};
+
+
+struct Result {
+    double seconds;
+    double mops;
+    double p50_us;
+    double p99_us;
+    double p999_us;
+    double switches_per_kop;
+};
+
+static double percentile(vector<uint64_t>& v,double p) {
+    if(v.empty()) return 0;
+    size_t i = min(v.size() - 1,static_cast<size_t>(p / 100 * v.size()));
+    return v[i] / 1000.0;
+}
+
+static long contextSwitches() {
+    rusage usage;
+    getrusage(RUSAGE_SELF,&usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+static thread_local uint64_t sink = 0;
+
+//  threads个线程，一半生产一半消费，一共传递opt.items个元素
+template<typename Queue>
+static Result run(int threads) {
+    Queue queue(opt.capacity);
+    int producers = max(1,threads / 2);
+    int consumers = max(1,threads - producers);
+    size_t per_producer = opt.items / producers;
+    vector<vector<uint64_t>> latencies(consumers);
+    vector<thread> pool;
+    long switches = contextSwitches();
+    uint64_t start = nowNs();
+    for(int c = 0;c < consumers;++c) {
+        pool.emplace_back([&queue,&latencies,c]{
+            vector<uint64_t>& samples = latencies[c];
+            samples.reserve(opt.items / 16 + 16);
+            size_t n = 0;
+            while(1) {
+                Item item;
+                queue.pop(item);
+                if(!item.run) return;
+                //  每16个元素采样一次交接延迟，取时间的开销不影响吞吐
+                if(++n % 16 == 0) samples.push_back(nowNs() - item.pushed_ns);
+                item.run();
+            }
+        });
+    }
+    vector<thread> producing;
+    for(int p = 0;p < producers;++p) {
+        producing.emplace_back([&queue,per_producer,p]{
+            for(size_t i = 0;i < per_producer;++i) {
+                size_t value = i + p;
+                queue.push(Item{ [value]{ sink += value; },nowNs() });
+            }
+        });
+    }
+    for(thread& t : producing) t.join();
+    for(int c = 0;c < consumers;++c) queue.push(Item{ nullptr,0 });
+    for(thread& t : pool) t.join();
+    double seconds = (nowNs() - start) / 1e9;
+    switches = contextSwitches() - switches;
+
+    vector<uint64_t> all;
+    for(auto& v : latencies) all.insert(all.end(),v.begin(),v.end());
+    sort(all.begin(),all.end());
+    size_t total = per_producer * producers;
+    return Result{ seconds,total / seconds / 1e6,percentile(all,50),percentile(all,99),percentile(all,99.9),
+                   switches * 1000.0 / total };
+}
+
+
+static bool parseThreads(const char* arg) {
+    vector<int> list;
+    string s = arg;
+    size_t pos = 0;
+    while(pos <= s.size()) {
+        size_t comma = s.find(',',pos);
+        if(comma == string::npos) comma = s.size();
+        int n = atoi(s.substr(pos,comma - pos).c_str());
+        if(n < 2) return false;
+        list.push_back(n);
+        pos = comma + 1;
+    }
+    opt.threads = list;
+    return !list.empty();
+}
+
+
+int main(int argc,char* argv[]) {
+    for(int i = 1;i < argc;++i) {
+        string arg = argv[i];
+        if(arg == "-n" && i + 1 < argc) opt.items = max(1000L,atol(argv[++i]));
+        else if(arg == "-t" && i + 1 < argc && parseThreads(argv[i + 1])) ++i;
+        else if(arg == "-c" && i + 1 < argc) opt.capacity = max(2,atoi(argv[++i]));
+        else if(arg == "-j") opt.json = true;
+        else {
+            fprintf(stderr,"usage: %s [-n items] [-t 2,4,8,16,32,64] [-c capacity] [-j]\n",argv[0]);
+            return 1;
+        }
+    }
+
+    static const char* names[] = { "lockfree","mutex" };
+    if(opt.json) printf("{\"items\":%zu,\"capacity\":%zu,\"cpus\":%u,\"runs\":[",opt.items,opt.capacity,
+                        thread::hardware_concurrency());
+    else printf("%zu items per run, capacity %zu, %u cpus\n%-9s %7s %9s %9s %9s %9s %9s\n",opt.items,opt.capacity,
+                thread::hardware_concurrency(),"queue","threads","Mops/s","p50(us)","p99(us)","p99.9(us)","csw/kop");
+    bool first = true;
+    for(int threads : opt.threads) {
+        Result results[2] = { run<LockFreeQueue>(threads),run<LockedQueue>(threads) };
+        for(int k = 0;k < 2;++k) {
+            const Result& r = results[k];
+            if(opt.json) {
+                printf("%s{\"queue\":\"%s\",\"threads\":%d,\"seconds\":%.3f,\"mops\":%.3f,\"handoff_us\":{\"p50\":%.2f,"
+                       "\"p99\":%.2f,\"p99.9\":%.2f},\"switches_per_kop\":%.2f}",first ? "" : ",",names[k],threads,
+                       r.seconds,r.mops,r.p50_us,r.p99_us,r.p999_us,r.switches_per_kop);
+                first = false;
+            } else {
+                printf("%-9s %7d %9.3f %9.2f %9.2f %9.2f %9.2f\n",names[k],threads,r.mops,r.p50_us,r.p99_us,r.p999_us,
+                       r.switches_per_kop);
+            }
+        }
+    }
+    if(opt.json) printf("]}\n");
+    return 0;
+}
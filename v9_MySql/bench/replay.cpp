@@ -0,0 +1,512 @@
+//  流量回放  --  读服务器录制的文件（--capture_path=文件，格式见Capture.hpp），按录制时的连接和时间间隔
+//  把原始请求字节重新发给目标服务器，记录每个请求的延迟
+//  -s 速度倍数：1 按原来的时间回放（默认），2 快一倍，0.5 慢一倍；0 全速：每个连接上前面的响应都收到了就立即发下一段，
+//  同时打开的连接数默认和录制时的峰值相同（-c 修改）
+//  按时间回放时延迟从这段数据本该发出的时间算起，服务器变慢时排队的时间也算进延迟（不受协调遗漏影响）；
+//  全速回放时从实际发出的时间算起
+//  只回放HTTP/1.1的连接，以HTTP/2连接前言开头的连接跳过
+//  用法：replay -f 录制文件 [-h host] [-p port] [-s 倍数] [-c 连接数] [-j]
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#define TIMER_ID 0xffffffffffffffffULL
+#define DRAIN_S 10          //  最后一段数据发出之后，最多再等这么久的响应
+
+
+static double nowUs() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+
+struct Options {
+    string file;
+    string host = "127.0.0.1";
+    int port = 8080;
+    double speed = 1;       //  为0时全速
+    int conns = 0;          //  全速回放时同时打开的连接数，为0时用录制时的峰值
+    bool json = false;
+};
+
+static Options opt;
+static struct sockaddr_in server_addr;
+
+
+//  录制的一次读：相对开始录制的时间和数据，以及在这段数据里结束的请求（是不是HEAD，响应没有响应体）
+struct Segment {
+    double at_us;
+    string data;
+    vector<bool> heads;
+};
+
+
+//  等响应的请求：延迟从start算起
+struct Pending {
+    double start;
+    bool head;
+};
+
+
+//  一个录制的连接
+struct Conn {
+    Conn(): close_us(-1),next(0),fd(-1),started(false),closing(false),done(false),out_off(0) {}
+
+    vector<Segment> segs;
+    double close_us;        //  录制里关闭连接的时间，没有关闭记录时为-1
+    size_t next;            //  下一段要发的数据
+    int fd;
+    bool started;
+    bool closing;           //  到了关闭的时间，等在途的响应收完再关
+    bool done;
+    string out;
+    size_t out_off;
+    string in;
+    deque<Pending> inflight;
+};
+
+
+struct Stats {
+    vector<double> latencies;
+    long status[6] = { 0 };
+    long errors = 0;        //  连接断开时还没收到响应的请求
+    long unsent = 0;        //  服务器提前关闭连接，没有发出去的请求
+    long skipped = 0;       //  跳过的HTTP/2连接
+    double max_lag_us = 0;  //  按时间回放时实际发出比计划晚了多久，太大说明回放工具自己跟不上
+};
+
+static vector<Conn> conns;
+static Stats stats;
+static int epfd = -1;
+static int open_conns = 0;
+
+
+//  消息头在header_end处结束，从off开始解析，返回整个消息的长度（包括Content-Length或分块编码的消息体），不完整时返回0
+static size_t messageLength(const string& in,size_t off,size_t header_end,bool no_body) {
+    size_t body = 0;
+    bool chunked = false;
+    size_t pos = off;
+    while(!no_body && (pos = in.find("\r\n",pos)) != string::npos && pos < header_end) {
+        pos += 2;
+        if(strncasecmp(in.c_str() + pos,"Content-Length:",15) == 0) {
+            body = strtoul(in.c_str() + pos + 15,nullptr,10);
+        } else if(strncasecmp(in.c_str() + pos,"Transfer-Encoding:",18) == 0) {
+            size_t line_end = in.find("\r\n",pos);
+            chunked = in.substr(pos,line_end - pos).find("chunked") != string::npos;
+        }
+    }
+    if(!chunked) {
+        size_t total = header_end + 4 + body;
+        return in.size() >= total ? total - off : 0;
+    }
+    pos = header_end + 4;
+    while(1) {
+        size_t line_end = in.find("\r\n",pos);
+        if(line_end == string::npos) return 0;
+        size_t size = strtoul(in.c_str() + pos,nullptr,16);
+        pos = line_end + 2;
+        if(size == 0) {
+            //  没有尾部头时紧跟一个空行
+            size_t end = in.find("\r\n",pos);
+            if(end == string::npos) return 0;
+            if(end != pos) {
+                end = in.find("\r\n\r\n",pos);
+                if(end == string::npos) return 0;
+                return end + 4 - off;
+            }
+            return end + 2 - off;
+        }
+        if(in.size() < pos + size + 2) return 0;
+        pos += size + 2;
+    }
+}
+
+
+//  把一个连接录下来的字节流切成请求，记下每个请求在哪一段数据里结束
+static void splitRequests(Conn& c) {
+    string stream;
+    size_t off = 0;
+    for(Segment& seg : c.segs) {
+        stream += seg.data;
+        while(1) {
+            //  请求之间多余的空行
+            while(stream.compare(off,2,"\r\n") == 0) off += 2;
+            size_t header_end = stream.find("\r\n\r\n",off);
+            if(header_end == string::npos) break;
+            size_t len = messageLength(stream,off,header_end,false);
+            if(len == 0) break;
+            seg.heads.push_back(stream.compare(off,5,"HEAD ") == 0);
+            off += len;
+        }
+    }
+}
+
+
+//  读录制文件，按连接编号分组
+static bool load(const string& path) {
+    ifstream file(path,ios::binary);
+    if(!file) {
+        perror(path.c_str());
+        return false;
+    }
+    string data((istreambuf_iterator<char>(file)),istreambuf_iterator<char>());
+    uint32_t version = 0;
+    if(data.size() < 16 || data.compare(0,4,"HCAP") != 0) {
+        fprintf(stderr,"%s: not a capture file\n",path.c_str());
+        return false;
+    }
+    memcpy(&version,data.data() + 4,4);
+    if(version != 1) {
+        fprintf(stderr,"%s: unsupported capture version %u\n",path.c_str(),version);
+        return false;
+    }
+    unordered_map<uint32_t,size_t> index;
+    size_t pos = 16;
+    while(pos + 16 <= data.size()) {
+        uint64_t at_us;
+        uint32_t id,len;
+        memcpy(&at_us,data.data() + pos,8);
+        memcpy(&id,data.data() + pos + 8,4);
+        memcpy(&len,data.data() + pos + 12,4);
+        pos += 16;
+        //  进程被杀时最后一条记录可能不完整
+        if(pos + len > data.size()) break;
+        auto it = index.find(id);
+        if(it == index.end()) {
+            it = index.emplace(id,conns.size()).first;
+            conns.emplace_back();
+        }
+        Conn& c = conns[it->second];
+        if(len == 0) {
+            c.close_us = at_us;
+        } else {
+            Segment seg;
+            seg.at_us = at_us;
+            seg.data.assign(data,pos,len);
+            c.segs.push_back(move(seg));
+        }
+        pos += len;
+    }
+    for(Conn& c : conns) {
+        if(c.segs.empty() || c.segs[0].data.compare(0,14,"PRI * HTTP/2.0") == 0) {
+            if(!c.segs.empty()) stats.skipped++;
+            c.done = true;
+            continue;
+        }
+        splitRequests(c);
+        //  录制结束时还开着的连接，发完最后一段就关
+        if(c.close_us < 0) c.close_us = c.segs.back().at_us;
+    }
+    return true;
+}
+
+
+//  录制时同时打开的连接数的峰值
+static int peakConcurrency() {
+    vector<pair<double,int>> edges;
+    for(const Conn& c : conns) {
+        if(c.done) continue;
+        edges.emplace_back(c.segs[0].at_us,1);
+        edges.emplace_back(c.close_us,-1);
+    }
+    sort(edges.begin(),edges.end());
+    int open = 0,peak = 0;
+    for(auto& e : edges) peak = max(peak,open += e.second);
+    return max(peak,1);
+}
+
+
+//  非阻塞地连接，连接建立之前写的数据留在发送缓冲区里，可写时再发
+static bool connectConn(Conn& c,size_t id) {
+    c.fd = socket(AF_INET,SOCK_STREAM | SOCK_NONBLOCK,0);
+    int one = 1;
+    setsockopt(c.fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+    if(connect(c.fd,reinterpret_cast<struct sockaddr*>(&server_addr),sizeof(server_addr)) == -1 &&
+       errno != EINPROGRESS) {
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u64 = id;
+    epoll_ctl(epfd,EPOLL_CTL_ADD,c.fd,&ev);
+    open_conns++;
+    return true;
+}
+
+
+//  尽量发出发送缓冲区里的数据
+static void flushConn(Conn& c) {
+    while(c.out_off < c.out.size()) {
+        ssize_t n = write(c.fd,c.out.data() + c.out_off,c.out.size() - c.out_off);
+        if(n <= 0) break;
+        c.out_off += n;
+    }
+    if(c.out_off == c.out.size()) {
+        c.out.clear();
+        c.out_off = 0;
+    }
+}
+
+
+//  结束一个连接：在途的请求记为错误，没发的请求记为未发送
+static void finishConn(Conn& c) {
+    if(c.fd != -1) {
+        close(c.fd);
+        open_conns--;
+    }
+    c.fd = -1;
+    c.done = true;
+    stats.errors += c.inflight.size();
+    c.inflight.clear();
+    for(size_t i = c.next;i < c.segs.size();++i) stats.unsent += c.segs[i].heads.size();
+    c.next = c.segs.size();
+}
+
+
+//  发出下一段数据，在这段数据里结束的请求从start开始计时
+static void sendSegment(Conn& c,double start) {
+    Segment& seg = c.segs[c.next++];
+    c.out += seg.data;
+    flushConn(c);
+    for(bool head : seg.heads) c.inflight.push_back(Pending{ start,head });
+}
+
+
+//  全速回放：前面的响应都收到了就发下一段，都发完了就关闭
+static void advance(Conn& c) {
+    while(!c.done && c.inflight.empty()) {
+        if(c.next == c.segs.size()) {
+            finishConn(c);
+            return;
+        }
+        sendSegment(c,nowUs());
+    }
+}
+
+
+//  解析收到的响应，连接关闭、出错或者格式错误时返回false（关闭之前收到的响应照常统计）
+static bool receive(Conn& c) {
+    char buf[65536];
+    bool ok = true;
+    while(1) {
+        ssize_t n = read(c.fd,buf,sizeof(buf));
+        if(n > 0) {
+            c.in.append(buf,n);
+            continue;
+        }
+        ok = n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        break;
+    }
+    double now = nowUs();
+    size_t off = 0;
+    while(!c.inflight.empty()) {
+        size_t header_end = c.in.find("\r\n\r\n",off);
+        if(header_end == string::npos) break;
+        if(c.in.compare(off,5,"HTTP/") != 0) return false;
+        int status = atoi(c.in.c_str() + off + 9);
+        bool no_body = c.inflight.front().head || status == 204 || status == 304 || (status >= 100 && status < 200);
+        size_t len = messageLength(c.in,off,header_end,no_body);
+        if(len == 0) break;
+        off += len;
+        //  100 Continue之类的中间响应后面还有最终的响应
+        if(status >= 100 && status < 200 && status != 101) continue;
+        stats.latencies.push_back(now - c.inflight.front().start);
+        stats.status[status >= 100 && status < 600 ? status / 100 : 0]++;
+        c.inflight.pop_front();
+    }
+    c.in.erase(0,off);
+    return ok;
+}
+
+
+//  延迟的百分位（毫秒），latencies已经排好序
+static double percentile(const vector<double>& latencies,double p) {
+    if(latencies.empty()) return 0.0;
+    return latencies[static_cast<size_t>(p / 100.0 * (latencies.size() - 1) + 0.5)] / 1000.0;
+}
+
+
+int main(int argc,char* argv[]) {
+    for(int i = 1;i < argc;++i) {
+        string arg = argv[i];
+        if(arg == "-f" && i + 1 < argc) opt.file = argv[++i];
+        else if(arg == "-h" && i + 1 < argc) opt.host = argv[++i];
+        else if(arg == "-p" && i + 1 < argc) opt.port = atoi(argv[++i]);
+        else if(arg == "-s" && i + 1 < argc) opt.speed = max(0.0,atof(argv[++i]));
+        else if(arg == "-c" && i + 1 < argc) opt.conns = max(1,atoi(argv[++i]));
+        else if(arg == "-j") opt.json = true;
+        else {
+            fprintf(stderr,"usage: %s -f capture [-h host] [-p port] [-s speed, 0 = max] [-c conns] [-j]\n",argv[0]);
+            return 1;
+        }
+    }
+    if(opt.file.empty() || !load(opt.file)) {
+        if(opt.file.empty()) fprintf(stderr,"usage: %s -f capture [-h host] [-p port] [-s speed] [-c conns] [-j]\n",argv[0]);
+        return 1;
+    }
+    bool max_speed = opt.speed == 0;
+    if(opt.conns == 0) opt.conns = peakConcurrency();
+
+    memset(&server_addr,0,sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(opt.port);
+    inet_pton(AF_INET,opt.host.c_str(),&server_addr.sin_addr);
+
+    epfd = epoll_create1(0);
+    int timer = timerfd_create(CLOCK_MONOTONIC,0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = TIMER_ID;
+    epoll_ctl(epfd,EPOLL_CTL_ADD,timer,&ev);
+
+    //  按时间回放：每个连接的下一个动作（发一段数据或者关闭）按计划时间排在堆里
+    typedef pair<double,size_t> Event;
+    priority_queue<Event,vector<Event>,greater<Event>> events;
+    size_t next_conn = 0;       //  全速回放时下一个要打开的连接
+    long requests = 0;
+    for(const Conn& c : conns) {
+        for(const Segment& seg : c.segs) requests += seg.heads.size();
+    }
+
+    double start = nowUs();
+    if(!max_speed) {
+        for(size_t i = 0;i < conns.size();++i) {
+            if(!conns[i].done) events.push(Event(start + conns[i].segs[0].at_us / opt.speed,i));
+        }
+    }
+    //  发完最后一段数据之后，最多等DRAIN_S秒
+    double drain_end = 0;
+    struct epoll_event ready[256];
+    while(1) {
+        double now = nowUs();
+        if(max_speed) {
+            while(next_conn < conns.size() && open_conns < opt.conns) {
+                Conn& c = conns[next_conn];
+                if(!c.done) {
+                    c.started = true;
+                    if(connectConn(c,next_conn)) advance(c);
+                    else finishConn(c);
+                }
+                next_conn++;
+            }
+        }
+        while(!events.empty() && events.top().first <= now) {
+            double due = events.top().first;
+            Conn& c = conns[events.top().second];
+            size_t id = events.top().second;
+            events.pop();
+            if(c.done) continue;
+            if(!c.started) {
+                c.started = true;
+                if(!connectConn(c,id)) {
+                    finishConn(c);
+                    continue;
+                }
+            }
+            if(c.next < c.segs.size()) {
+                stats.max_lag_us = max(stats.max_lag_us,now - due);
+                sendSegment(c,due);
+                double at = c.next < c.segs.size() ? c.segs[c.next].at_us : c.close_us;
+                events.push(Event(start + at / opt.speed,id));
+            } else {
+                c.closing = true;
+                if(c.inflight.empty()) finishConn(c);
+            }
+        }
+
+        bool pending = max_speed ? next_conn < conns.size() : !events.empty();
+        if(!pending && open_conns == 0) break;
+        if(!pending) {
+            if(drain_end == 0) drain_end = now + DRAIN_S * 1e6;
+            if(now >= drain_end) break;
+        }
+
+        //  定时器定到下一个动作的时间，没有动作时定到等待响应的截止时间
+        double wake = !events.empty() ? events.top().first : drain_end;
+        struct itimerspec its;
+        memset(&its,0,sizeof(its));
+        if(wake > 0) {
+            its.it_value.tv_sec = static_cast<time_t>(wake / 1e6);
+            its.it_value.tv_nsec = static_cast<long>((wake - its.it_value.tv_sec * 1e6) * 1000);
+            if(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) its.it_value.tv_nsec = 1;
+        }
+        timerfd_settime(timer,TFD_TIMER_ABSTIME,&its,nullptr);
+        int n = epoll_wait(epfd,ready,256,max_speed && wake == 0 ? 1000 : -1);
+        for(int i = 0;i < n;++i) {
+            if(ready[i].data.u64 == TIMER_ID) {
+                uint64_t expirations;
+                ssize_t ignored = read(timer,&expirations,sizeof(expirations));
+                (void)ignored;
+                continue;
+            }
+            Conn& c = conns[ready[i].data.u64];
+            if(c.fd == -1) continue;
+            if(ready[i].events & EPOLLOUT) flushConn(c);
+            if(!(ready[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) continue;
+            if(!receive(c)) {
+                finishConn(c);
+                continue;
+            }
+            if(max_speed) advance(c);
+            else if(c.closing && c.inflight.empty()) finishConn(c);
+        }
+    }
+    for(Conn& c : conns) if(!c.done) finishConn(c);
+    double elapsed = (nowUs() - start) / 1e6;
+
+    vector<double>& all = stats.latencies;
+    sort(all.begin(),all.end());
+    static const double points[] = { 50,90,99,99.9,100 };
+    static const char* point_names[] = { "p50","p90","p99","p99.9","max" };
+
+    if(opt.json) {
+        printf("{\"file\":\"%s\",\"speed\":%g,\"connections\":%zu,\"skipped\":%ld,\"concurrency\":%d,"
+               "\"duration_s\":%.3f,\"captured_requests\":%ld,\"requests\":%zu,\"errors\":%ld,\"unsent\":%ld,"
+               "\"throughput\":%.1f,\"max_lag_ms\":%.3f,",opt.file.c_str(),opt.speed,conns.size(),stats.skipped,
+               max_speed ? opt.conns : 0,elapsed,requests,all.size(),stats.errors,stats.unsent,all.size() / elapsed,
+               stats.max_lag_us / 1000);
+        printf("\"status\":{\"1xx\":%ld,\"2xx\":%ld,\"3xx\":%ld,\"4xx\":%ld,\"5xx\":%ld,\"other\":%ld},",
+               stats.status[1],stats.status[2],stats.status[3],stats.status[4],stats.status[5],stats.status[0]);
+        printf("\"latency_ms\":{");
+        for(int p = 0;p < 5;++p) printf("%s\"%s\":%.3f",p ? "," : "",point_names[p],percentile(all,points[p]));
+        printf("}}\n");
+        return 0;
+    }
+
+    printf("%s: %zu connections (%ld HTTP/2 skipped), %ld requests, ",opt.file.c_str(),conns.size(),stats.skipped,
+           requests);
+    if(max_speed) printf("max speed with %d connections",opt.conns);
+    else printf("speed x%g",opt.speed);
+    printf(", %.1fs\n",elapsed);
+    printf("requests %zu  errors %ld  unsent %ld  throughput %.0f req/s\n",all.size(),stats.errors,stats.unsent,
+           all.size() / elapsed);
+    printf("latency(ms) p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",percentile(all,50),percentile(all,90),
+           percentile(all,99),percentile(all,99.9),percentile(all,100));
+    printf("status 2xx %ld  3xx %ld  4xx %ld  5xx %ld  other %ld",stats.status[2],stats.status[3],stats.status[4],
+           stats.status[5],stats.status[0] + stats.status[1]);
+    if(!max_speed) printf("  max lag %.3f ms",stats.max_lag_us / 1000);
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,28 @@
+#!/bin/bash
+#   比较各个套接字选项对连接到首字节延迟的影响（回环地址）
+#   用法：bench/socket_options.sh [server路径] [ttfb_bench路径] [次数]
+#   每个场景都会重新启动一次服务器，服务器需要能连上数据库
+SERVER=${1:-./server}
+BENCH=${2:-./ttfb_bench}
+COUNT=${3:-2000}
+PORT=${PORT:-18080}
+
+run() {
+    local name=$1; shift
+    local client_args=$1; shift
+    "$SERVER" $PORT "$@" > /dev/null 2>&1 &
+    local pid=$!
+    sleep 0.5
+    echo "=== $name  (server: $*  client: $client_args)"
+    "$BENCH" -p $PORT -n $COUNT $client_args | tail -2
+    kill $pid
+    wait $pid 2>/dev/null
+}
+
+run "defaults"          ""            
+run "no TCP_NODELAY"    ""            --tcp_nodelay=0
+run "TCP_DEFER_ACCEPT"  ""            --defer_accept_s=5
+run "TCP_QUICKACK"      ""            --quickack=1
+run "TCP_FASTOPEN"      "--fastopen"  --fastopen_qlen=256
+run "small buffers"     ""            --rcvbuf=4096 --sndbuf=4096
+run "SO_KEEPALIVE"      ""            --keepalive=1 --keepalive_idle_s=30
@@ -0,0 +1,43 @@
+#!/bin/bash
+#   TLS握手速率（完整握手/会话恢复，TLS 1.2/1.3）和大响应吞吐（kTLS开/关）
+#   用法：bench/tls.sh [server路径] [tls_bench路径] [秒数] [大文件路径]
+#   证书是临时生成的自签名证书
+SERVER=${1:-./server}
+TLS_BENCH=${2:-./tls_bench}
+SECONDS_PER_RUN=${3:-10}
+BIG_URL=${4:-/}
+PORT=${PORT:-18443}
+THREADS=${THREADS:-4}
+
+dir=$(mktemp -d)
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 1 -subj /CN=localhost \
+    -keyout $dir/key.pem -out $dir/cert.pem 2> /dev/null
+
+run_server() {
+    "$SERVER" $PORT --tls --tls_cert=$dir/cert.pem --tls_key=$dir/key.pem "$@" > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+}
+
+stop_server() {
+    kill $pid
+    wait $pid 2>/dev/null
+}
+
+run_server
+for version in "" "-2"; do
+    echo "=== full handshakes $version"
+    "$TLS_BENCH" -p $PORT -n $THREADS -t $SECONDS_PER_RUN -m handshake $version
+    echo "=== resumed handshakes $version"
+    "$TLS_BENCH" -p $PORT -n $THREADS -t $SECONDS_PER_RUN -m handshake -r $version
+done
+stop_server
+
+#   kTLS需要内核的tls模块（modprobe tls），没有时两次结果应该相同
+for ktls in 1 0; do
+    run_server --tls_ktls=$ktls
+    echo "=== bulk $BIG_URL, ktls=$ktls"
+    "$TLS_BENCH" -p $PORT -n $THREADS -t $SECONDS_PER_RUN -m bulk -u "$BIG_URL"
+    stop_server
+done
+rm -rf $dir
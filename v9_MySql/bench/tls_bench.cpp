@@ -0,0 +1,278 @@
+//  TLS压测工具  --  握手速率和大响应吞吐
+//  handshake模式：每次新建连接，握手后发一个Connection: close的请求并读完响应；-r时复用上一次的会话（恢复握手）
+//  bulk模式：每个线程一个keep-alive连接，反复GET同一个路径，统计解密后的响应体吞吐
+//  用法：tls_bench [-h host] [-p port] [-n 线程数] [-t 秒数] [-u 路径] [-m handshake|bulk] [-r] [-2 只用TLS 1.2]
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+
+static double nowUs() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+
+struct Options {
+    string host = "127.0.0.1";
+    int port = 8443;
+    int threads = 4;
+    double seconds = 10;
+    string path = "/";
+    string mode = "handshake";
+    bool resume = false;
+    bool tls12 = false;
+};
+
+
+//  一个线程的结果
+struct Result {
+    long handshakes = 0;
+    long resumed = 0;
+    long errors = 0;
+    long requests = 0;
+    double body_bytes = 0;
+    vector<double> handshake_us;
+};
+
+
+static int connectTo(const Options& opt) {
+    int fd = socket(AF_INET,SOCK_STREAM,0);
+    int one = 1;
+    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    inet_pton(AF_INET,opt.host.c_str(),&addr.sin_addr);
+    if(connect(fd,(struct sockaddr*)&addr,sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+//  带缓冲的读，解析响应用
+class Reader {
+public:
+    explicit Reader(SSL* ssl): ssl(ssl) {}
+
+    //  读一行（不含\r\n），连接断开时返回false
+    bool line(string& out) {
+        while(1) {
+            size_t pos = buf.find("\r\n");
+            if(pos != string::npos) {
+                out = buf.substr(0,pos);
+                buf.erase(0,pos + 2);
+                return true;
+            }
+            if(!fill()) return false;
+        }
+    }
+
+    //  读掉n个字节
+    bool skip(size_t n) {
+        while(buf.size() < n) {
+            n -= buf.size();
+            buf.clear();
+            if(!fill()) return false;
+        }
+        buf.erase(0,n);
+        return true;
+    }
+
+private:
+    bool fill() {
+        char tmp[65536];
+        int n = SSL_read(ssl,tmp,sizeof(tmp));
+        if(n <= 0) return false;
+        buf.append(tmp,n);
+        return true;
+    }
+
+    SSL* ssl;
+    string buf;
+};
+
+
+//  读一个响应，返回响应体的长度，出错时返回-1；支持Content-Length和分块编码
+static long readResponse(Reader& reader) {
+    string line;
+    if(!reader.line(line) || line.compare(0,5,"HTTP/") != 0) return -1;
+    long length = 0;
+    bool chunked = false;
+    while(reader.line(line) && !line.empty()) {
+        if(strncasecmp(line.c_str(),"Content-Length:",15) == 0) length = atol(line.c_str() + 15);
+        if(strncasecmp(line.c_str(),"Transfer-Encoding:",18) == 0 && line.find("chunked") != string::npos) chunked = true;
+    }
+    if(!chunked) return reader.skip(length) ? length : -1;
+    long total = 0;
+    while(reader.line(line)) {
+        long size = strtol(line.c_str(),nullptr,16);
+        if(size == 0) return reader.line(line) ? total : -1;
+        if(!reader.skip(size + 2)) return -1;
+        total += size;
+    }
+    return -1;
+}
+
+
+static void handshakeLoop(SSL_CTX* ctx,const Options& opt,double end,Result& result) {
+    SSL_SESSION* session = nullptr;
+    string request = "GET " + opt.path + " HTTP/1.1\r\nHost: " + opt.host + "\r\nConnection: close\r\n\r\n";
+    while(nowUs() < end) {
+        int fd = connectTo(opt);
+        if(fd < 0) {
+            ++result.errors;
+            continue;
+        }
+        SSL* ssl = SSL_new(ctx);
+        SSL_set_fd(ssl,fd);
+        if(opt.resume && session != nullptr) SSL_set_session(ssl,session);
+        double start = nowUs();
+        if(SSL_connect(ssl) != 1) {
+            ++result.errors;
+        } else {
+            result.handshake_us.push_back(nowUs() - start);
+            ++result.handshakes;
+            if(SSL_session_reused(ssl)) ++result.resumed;
+            Reader reader(ssl);
+            if(SSL_write(ssl,request.data(),request.size()) <= 0 || readResponse(reader) < 0) {
+                ++result.errors;
+            } else {
+                ++result.requests;
+            }
+            //  TLS 1.3的票据在握手之后才到，读完响应再取会话
+            if(opt.resume) {
+                SSL_SESSION* next = SSL_get1_session(ssl);
+                if(next != nullptr) {
+                    if(session != nullptr) SSL_SESSION_free(session);
+                    session = next;
+                }
+            }
+            SSL_shutdown(ssl);
+        }
+        SSL_free(ssl);
+        close(fd);
+    }
+    if(session != nullptr) SSL_SESSION_free(session);
+}
+
+
+static void bulkLoop(SSL_CTX* ctx,const Options& opt,double end,Result& result) {
+    string request = "GET " + opt.path + " HTTP/1.1\r\nHost: " + opt.host + "\r\n\r\n";
+    int fd = connectTo(opt);
+    if(fd < 0) {
+        ++result.errors;
+        return;
+    }
+    SSL* ssl = SSL_new(ctx);
+    SSL_set_fd(ssl,fd);
+    if(SSL_connect(ssl) != 1) {
+        ++result.errors;
+    } else {
+        ++result.handshakes;
+        Reader reader(ssl);
+        while(nowUs() < end) {
+            if(SSL_write(ssl,request.data(),request.size()) <= 0) {
+                ++result.errors;
+                break;
+            }
+            long n = readResponse(reader);
+            if(n < 0) {
+                ++result.errors;
+                break;
+            }
+            ++result.requests;
+            result.body_bytes += n;
+        }
+        SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+    close(fd);
+}
+
+
+int main(int argc,char* argv[]) {
+    Options opt;
+    for(int i = 1;i < argc;++i) {
+        string arg = argv[i];
+        if(arg == "-h" && i + 1 < argc) opt.host = argv[++i];
+        else if(arg == "-p" && i + 1 < argc) opt.port = atoi(argv[++i]);
+        else if(arg == "-n" && i + 1 < argc) opt.threads = max(1,atoi(argv[++i]));
+        else if(arg == "-t" && i + 1 < argc) opt.seconds = atof(argv[++i]);
+        else if(arg == "-u" && i + 1 < argc) opt.path = argv[++i];
+        else if(arg == "-m" && i + 1 < argc) opt.mode = argv[++i];
+        else if(arg == "-r") opt.resume = true;
+        else if(arg == "-2") opt.tls12 = true;
+        else {
+            fprintf(stderr,"usage: %s [-h host] [-p port] [-n threads] [-t seconds] [-u path] "
+                           "[-m handshake|bulk] [-r] [-2]\n",argv[0]);
+            return 1;
+        }
+    }
+    if(opt.mode != "handshake" && opt.mode != "bulk") {
+        fprintf(stderr,"unknown mode %s\n",opt.mode.c_str());
+        return 1;
+    }
+
+    //  只测服务器的开销，不验证证书（测试时一般是自签名的）
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(ctx,SSL_VERIFY_NONE,nullptr);
+    if(opt.tls12) SSL_CTX_set_max_proto_version(ctx,TLS1_2_VERSION);
+    SSL_CTX_set_session_cache_mode(ctx,SSL_SESS_CACHE_CLIENT);
+
+    vector<Result> results(opt.threads);
+    vector<thread> threads;
+    double start = nowUs();
+    double end = start + opt.seconds * 1e6;
+    for(int i = 0;i < opt.threads;++i) {
+        threads.emplace_back([&,i] {
+            if(opt.mode == "handshake") handshakeLoop(ctx,opt,end,results[i]);
+            else bulkLoop(ctx,opt,end,results[i]);
+        });
+    }
+    for(thread& t : threads) t.join();
+    double elapsed = (nowUs() - start) / 1e6;
+
+    Result total;
+    for(Result& r : results) {
+        total.handshakes += r.handshakes;
+        total.resumed += r.resumed;
+        total.errors += r.errors;
+        total.requests += r.requests;
+        total.body_bytes += r.body_bytes;
+        total.handshake_us.insert(total.handshake_us.end(),r.handshake_us.begin(),r.handshake_us.end());
+    }
+    printf("%s, %d threads, %.1fs, %s\n",opt.mode.c_str(),opt.threads,elapsed,opt.tls12 ? "TLS 1.2" : "TLS 1.2/1.3");
+    if(opt.mode == "handshake") {
+        sort(total.handshake_us.begin(),total.handshake_us.end());
+        auto pct = [&](double p) {
+            const vector<double>& v = total.handshake_us;
+            return v.empty() ? 0.0 : v[static_cast<size_t>(p / 100.0 * (v.size() - 1))] / 1000.0;
+        };
+        printf("handshakes %ld (%.0f/s)  resumed %ld  errors %ld\n",total.handshakes,total.handshakes / elapsed,
+               total.resumed,total.errors);
+        printf("handshake(ms) p50 %.3f  p99 %.3f\n",pct(50),pct(99));
+    } else {
+        printf("requests %ld (%.0f/s)  errors %ld  throughput %.1f MB/s\n",total.requests,total.requests / elapsed,
+               total.errors,total.body_bytes / elapsed / 1e6);
+    }
+    SSL_CTX_free(ctx);
+    return 0;
+}
@@ -0,0 +1,119 @@
+//  连接到首字节延迟测试  --  每次新建一个TCP连接，发送一个请求，测量从connect到收到响应第一个字节的时间
+//  用来比较服务器各个套接字选项（TCP_NODELAY，TCP_DEFER_ACCEPT，TCP_FASTOPEN等）的效果
+//  用法：ttfb_bench [-h host] [-p port] [-n 次数] [-u 路径] [--fastopen] [--nodelay]
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+#ifndef MSG_FASTOPEN
+#define MSG_FASTOPEN 0x20000000
+#endif
+
+
+static double nowUs() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count() / 1000.0;
+}
+
+static double percentile(vector<double>& v,double p) {
+    if(v.empty()) return 0;
+    size_t idx = static_cast<size_t>(p / 100.0 * (v.size() - 1) + 0.5);
+    return v[idx];
+}
+
+static void report(const char* name,vector<double>& v) {
+    sort(v.begin(),v.end());
+    double sum = 0;
+    for(double x : v) sum += x;
+    printf("%-10s mean %8.1f  p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f  (us)\n",name,
+           v.empty() ? 0 : sum / v.size(),percentile(v,50),percentile(v,90),percentile(v,99),v.empty() ? 0 : v.back());
+}
+
+int main(int argc,char* argv[]) {
+    string host = "127.0.0.1";
+    int port = 8080;
+    int count = 2000;
+    string path = "/";
+    bool fastopen = false;
+    bool nodelay = false;
+    for(int i = 1;i < argc;++i) {
+        string arg = argv[i];
+        if(arg == "-h" && i + 1 < argc) host = argv[++i];
+        else if(arg == "-p" && i + 1 < argc) port = atoi(argv[++i]);
+        else if(arg == "-n" && i + 1 < argc) count = atoi(argv[++i]);
+        else if(arg == "-u" && i + 1 < argc) path = argv[++i];
+        else if(arg == "--fastopen") fastopen = true;
+        else if(arg == "--nodelay") nodelay = true;
+        else {
+            fprintf(stderr,"usage: %s [-h host] [-p port] [-n count] [-u path] [--fastopen] [--nodelay]\n",argv[0]);
+            return 1;
+        }
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET,host.c_str(),&addr.sin_addr);
+    string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+
+    vector<double> connect_us,ttfb_us;
+    int failures = 0;
+    char buf[4096];
+    for(int i = 0;i < count;++i) {
+        int fd = socket(AF_INET,SOCK_STREAM,0);
+        if(nodelay) {
+            int one = 1;
+            setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+        }
+        double start = nowUs();
+        double connected;
+        if(fastopen) {
+            //  SYN里直接带上请求，connect和send合成一步
+            if(sendto(fd,request.data(),request.size(),MSG_FASTOPEN,(struct sockaddr*)&addr,sizeof(addr)) < 0) {
+                ++failures;
+                close(fd);
+                continue;
+            }
+            connected = nowUs();
+        } else {
+            if(connect(fd,(struct sockaddr*)&addr,sizeof(addr)) < 0) {
+                ++failures;
+                close(fd);
+                continue;
+            }
+            connected = nowUs();
+            if(send(fd,request.data(),request.size(),0) < 0) {
+                ++failures;
+                close(fd);
+                continue;
+            }
+        }
+        ssize_t n = recv(fd,buf,sizeof(buf),0);
+        double first_byte = nowUs();
+        if(n <= 0) {
+            ++failures;
+        } else {
+            connect_us.push_back(connected - start);
+            ttfb_us.push_back(first_byte - start);
+        }
+        //  读完剩下的数据再关闭，避免RST影响下一次连接
+        while(recv(fd,buf,sizeof(buf),0) > 0) {}
+        close(fd);
+    }
+
+    printf("%d connections to %s:%d%s, %d failed\n",count,host.c_str(),port,fastopen ? " (TCP Fast Open)" : "",failures);
+    report("connect",connect_us);
+    report("ttfb",ttfb_us);
+    return failures == count ? 1 : 0;
+}
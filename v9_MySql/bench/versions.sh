@@ -0,0 +1,202 @@
+#!/bin/bash
+#   各个版本的性能对比：编译v4_epoll到v9_MySql的服务器，用同样的负载（loadgen的请求组合）依次压测，
+#   输出吞吐、延迟百分位、服务器的CPU占用和峰值内存的对比表，以及吞吐的柱状图
+#   login用的用户bench没有注册过，每个版本走的都是查询失败的路径，工作量相同
+#   v4到v8用SQLite，每个版本在自己的工作目录里用新的user.db；v9需要MySQL，没有设置MYSQL_UNIX_PORT时
+#   如果装了MariaDB就在工作目录里临时起一个（用户root密码1234，库webserver，和Database.hpp一致），否则跳过v9
+#   早期版本的CMakeLists不完整（v4先链接后定义目标，v6列的是不存在的server.cpp），所以直接用g++编译
+#   用法：bench/versions.sh [秒数] [请求组合]
+#   环境变量：VERSIONS 要比较的版本  CONNS 连接数  THREADS loadgen线程数  RATE 开环速率（默认闭环）
+#            WORK 工作目录  GATE 吞吐比前一个版本下降超过这个百分比时返回非0（用于回归检查）
+SECONDS_PER_RUN=${1:-10}
+MIX=${2:-get=8,login=1,register=1}
+ROOT=$(cd "$(dirname "$0")/../.." && pwd)
+WORK=${WORK:-/tmp/http_versions}
+VERSIONS=${VERSIONS:-"v4_epoll v5_threadpool v6_demo v7_demo v8_nginx v9_MySql"}
+CONNS=${CONNS:-32}
+THREADS=${THREADS:-2}
+PORT=${PORT:-18090}
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-O2"}
+MYSQL_CFLAGS=${MYSQL_CFLAGS:-$(mysql_config --cflags 2>/dev/null || echo "-I/usr/include/mysql")}
+MYSQL_LIBS=${MYSQL_LIBS:-$(mysql_config --libs 2>/dev/null || echo "-L/usr/lib64/mysql -lmysqlclient")}
+
+mkdir -p "$WORK"
+CSV="$WORK/results.csv"
+echo "version,requests_per_s,p50_ms,p90_ms,p99_ms,p999_ms,errors,cpu_percent,rss_mb,status" > "$CSV"
+
+#   压测工具
+"$CXX" -std=c++11 -O2 "$ROOT/v9_MySql/bench/loadgen.cpp" -pthread -o "$WORK/loadgen" || exit 1
+
+
+#   编译一个版本，输出到$WORK/<版本>/server
+build() {
+    local v=$1 dir="$ROOT/$1" out="$WORK/$1"
+    local src=$dir/main.cpp libs="-lsqlite3 -pthread" flags=""
+    [ -f "$dir/main.cpp" ] || src=$dir/server.cpp
+    if [ "$v" = v9_MySql ]; then
+        libs="$MYSQL_LIBS -pthread -lz"
+        flags="$MYSQL_CFLAGS"
+        if "$CXX" -E -x c++ - <<< "#include <openssl/ssl.h>" > /dev/null 2>&1; then
+            flags="$flags -DUSE_TLS"
+            libs="$libs -lssl -lcrypto"
+        fi
+    fi
+    #   v4用了结构化绑定，统一按C++17编译
+    "$CXX" -std=c++17 $CXXFLAGS -w -I"$dir" $flags "$src" $libs -o "$out/server"
+}
+
+
+#   v9用的MySQL：在工作目录里临时启动MariaDB，只监听unix socket
+MYSQLD_PID=""
+startMysql() {
+    [ -n "$MYSQL_UNIX_PORT" ] && return 0
+    local mysqld=$(command -v mariadbd || command -v mysqld)
+    local install=$(command -v mariadb-install-db || command -v mysql_install_db)
+    local client=$(command -v mariadb || command -v mysql)
+    [ -n "$mysqld" ] && [ -n "$install" ] && [ -n "$client" ] || return 1
+    local data="$WORK/mysql"
+    rm -rf "$data"
+    mkdir -p "$data"
+    "$install" --datadir="$data" --auth-root-authentication-method=normal > "$WORK/mysql_install.log" 2>&1 || return 1
+    "$mysqld" --no-defaults --datadir="$data" --socket="$data/mysql.sock" --skip-networking \
+              --pid-file="$data/mysqld.pid" --user=$(id -un) > "$WORK/mysqld.log" 2>&1 &
+    MYSQLD_PID=$!
+    for i in $(seq 50); do
+        [ -S "$data/mysql.sock" ] && break
+        sleep 0.2
+    done
+    "$client" -uroot --socket="$data/mysql.sock" -e \
+        "CREATE DATABASE IF NOT EXISTS webserver; ALTER USER 'root'@'localhost' IDENTIFIED BY '1234';" || return 1
+    export MYSQL_UNIX_PORT="$data/mysql.sock"
+}
+
+
+#   等服务器开始监听，输出它监听的端口（v6忽略命令行参数，固定用8080）
+#   查/proc/net/tcp里属于这个进程的套接字的LISTEN状态（0A），不能连上去试，v4收到空请求会崩溃
+listenPort() {
+    for i in $(seq 50); do
+        local inodes=$(ls -l /proc/$1/fd 2>/dev/null | sed -n 's/.*socket:\[\([0-9]*\)\]/\1/p' | tr '\n' ' ')
+        local port=$(awk -v inodes=" $inodes" '$4 == "0A" && index(inodes, " " $10 " ") {
+                                                   split($2, a, ":"); print a[2]; exit }' \
+                         /proc/net/tcp /proc/net/tcp6 2>/dev/null)
+        [ -n "$port" ] && echo $((16#$port)) && return 0
+        kill -0 $1 2>/dev/null || return 1
+        sleep 0.1
+    done
+    return 1
+}
+
+
+#   从PORT开始找一个没有任何套接字用过的端口：早期版本没有设置SO_REUSEADDR，端口上还有TIME_WAIT时bind会失败
+freePort() {
+    while awk -v p=$(printf ":%04X" $PORT) '$2 ~ p"$" { found = 1 } END { exit !found }' /proc/net/tcp /proc/net/tcp6 \
+              2>/dev/null; do
+        PORT=$((PORT + 1))
+    done
+}
+
+
+#   进程的CPU时间（时钟滴答）
+cpuTicks() {
+    awk '{ print $14 + $15 }' "/proc/$1/stat"
+}
+
+
+#   从loadgen的JSON输出里取一个字段（第一次出现的，也就是总的统计）
+field() {
+    grep -o "\"$2\":[0-9.]*" "$1" | head -1 | cut -d: -f2
+}
+
+
+for v in $VERSIONS; do
+    echo "=== $v"
+    out="$WORK/$v"
+    rm -rf "$out"
+    mkdir -p "$out/run"
+    #   服务器按相对路径读../static_rc和../index.html，在run/里启动
+    for f in static_rc index.html; do
+        [ -e "$ROOT/$v/$f" ] && ln -s "$ROOT/$v/$f" "$out/$f"
+    done
+    if ! build $v; then
+        echo "$v: build failed, skipped"
+        continue
+    fi
+    if [ "$v" = v9_MySql ] && ! startMysql; then
+        echo "$v: no MySQL (set MYSQL_UNIX_PORT or install MariaDB), skipped"
+        continue
+    fi
+    freePort
+    #   早期版本没有忽略SIGPIPE，客户端先关闭连接时写响应会杀死进程；忽略的信号在exec之后仍然忽略
+    (trap '' PIPE; cd "$out/run" && exec "$out/server" $PORT > "$out/server.out" 2>&1) &
+    pid=$!
+    if ! port=$(listenPort $pid); then
+        echo "$v: server did not start, see $out/server.out"
+        kill $pid 2>/dev/null
+        echo "$v,0,0,0,0,0,0,0,0,failed" >> "$CSV"
+        continue
+    fi
+    before=$(cpuTicks $pid)
+    "$WORK/loadgen" -p $port -c $CONNS -n $THREADS -t $SECONDS_PER_RUN -m "$MIX" ${RATE:+-r $RATE} -j > "$out/result.json"
+    #   早期版本遇到读错误会直接exit，这种情况只记为崩溃，不记吞吐
+    if ! kill -0 $pid 2>/dev/null; then
+        echo "$v: server exited during the run, see $out/server.out"
+        wait $pid 2>/dev/null
+        echo "$v,0,0,0,0,0,0,0,0,crashed" >> "$CSV"
+        continue
+    fi
+    after=$(cpuTicks $pid)
+    rss_kb=$(awk '/VmHWM/ { print $2 }' "/proc/$pid/status")
+    kill $pid
+    wait $pid 2>/dev/null
+    json="$out/result.json"
+    cpu=$(awk -v t=$((after - before)) -v hz=$(getconf CLK_TCK) -v s=$(field "$json" duration_s) \
+              'BEGIN { printf "%.0f", t / hz / s * 100 }')
+    echo "$v,$(field "$json" throughput),$(field "$json" p50),$(field "$json" p90),$(field "$json" p99),$(field "$json" p99.9),$(field "$json" errors),$cpu,$(awk -v k=$rss_kb 'BEGIN { printf "%.1f", k / 1024 }'),ok" >> "$CSV"
+done
+
+[ -n "$MYSQLD_PID" ] && kill $MYSQLD_PID && wait $MYSQLD_PID 2>/dev/null
+
+#   对比表
+echo
+echo "mix $MIX, $CONNS connections, ${RATE:+open loop $RATE req/s, }${SECONDS_PER_RUN}s per version"
+awk -F, 'NR == 1 { printf "%-14s %10s %9s %9s %9s %9s %8s %6s %8s\n", "version", "req/s", "p50(ms)", "p90(ms)",
+                          "p99(ms)", "p99.9(ms)", "errors", "cpu%", "rss(MB)"; next }
+         $10 != "ok" { printf "%-14s %10s\n", $1, $10; next }
+         { printf "%-14s %10.0f %9.3f %9.3f %9.3f %9.3f %8d %6d %8.1f\n", $1, $2, $3, $4, $5, $6, $7, $8, $9 }' "$CSV"
+
+#   吞吐柱状图
+echo
+awk -F, 'NR > 1 { name[NR] = $1; rps[NR] = $2; if($2 > max) max = $2; n = NR }
+         END { for(i = 2; i <= n; ++i) {
+                   bar = max > 0 ? int(rps[i] / max * 50 + 0.5) : 0
+                   line = ""
+                   for(j = 0; j < bar; ++j) line = line "#"
+                   printf "%-14s %-50s %.0f\n", name[i], line, rps[i]
+               } }' "$CSV"
+
+#   有gnuplot时再画一张吞吐和p99的图
+if command -v gnuplot > /dev/null; then
+    gnuplot <<EOF
+set terminal svg size 800,400
+set output "$WORK/results.svg"
+set datafile separator ","
+set style data histograms
+set style fill solid 0.8
+set ylabel "req/s"
+set y2label "p99 (ms)"
+set y2tics
+set ytics nomirror
+plot "$CSV" using 2:xtic(1) title "req/s" axes x1y1, "" using 5 title "p99" axes x1y2
+EOF
+    echo "chart: $WORK/results.svg"
+fi
+echo "csv: $CSV"
+
+#   回归检查：相邻两个版本的吞吐下降超过GATE%时失败
+if [ -n "$GATE" ]; then
+    awk -F, -v gate=$GATE 'NR > 2 && prev > 0 && $2 < prev * (1 - gate / 100) {
+                               printf "regression: %s %.0f req/s, %s %.0f req/s\n", prev_name, prev, $1, $2; bad = 1 }
+                           NR > 1 { prev = $2; prev_name = $1 }
+                           END { exit bad }' "$CSV" || exit 1
+fi
@@ -1,13 +1,23 @@
 #include "HttpServer.hpp"
 #include "Database.hpp"
 
+//  用法：server [port] [--name=value ...]，可用的name见ServerConfig.hpp
 int main(int argc,char* argv[] ) {
     int port = 8080;
-    if(argc > 1) {
-        port = stoi(argv[1]);
+    ServerConfig config;
+    for(int i = 1;i < argc;++i) {
+        string arg = argv[i];
+        if(arg.compare(0,2,"--") == 0) {
+            if(!config.parseOption(arg.substr(2))) {
+                cerr << "unknown or invalid option: " << arg << endl;
+                return 1;
+            }
+        } else {
+            port = stoi(arg);
+        }
     }
     Database db;
-    HttpServer server(port,10,db);
+    HttpServer server(port,10,db,config);
     server.start();
     return 0;
-}
\ No newline at end of file
+}
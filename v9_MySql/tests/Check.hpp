@@ -0,0 +1,30 @@
+#pragma once
+//  单元测试用的断言  --  不依赖测试框架，每个测试是一个可执行文件，由ctest运行
+//  CHECK失败时打印位置并记下失败，继续执行后面的检查；main最后返回testResult()，有失败时ctest报告这个测试失败
+#include <cstdio>
+using namespace std;
+
+
+inline int& testFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond) do { \
+        if(!(cond)) { \
+            fprintf(stderr,"%s:%d: CHECK failed: %s\n",__FILE__,__LINE__,#cond); \
+            ++testFailures(); \
+        } \
+    } while(0)
+
+#define CHECK_EQ(a,b) CHECK((a) == (b))
+
+//  打印结果，返回main的退出码
+inline int testResult(const char* name) {
+    if(testFailures() == 0) {
+        printf("%s: OK\n",name);
+        return 0;
+    }
+    printf("%s: %d checks failed\n",name,testFailures());
+    return 1;
+}
@@ -0,0 +1,171 @@
+//  链式缓冲区的测试  --  跨块的find（needle跨两块、三块，块边界上的部分匹配），consume之后的下标，
+//  consume整块时把块还回去，copyOut和visit，以及readFd、writeFd
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "../Buffer.hpp"
+#include "Check.hpp"
+using namespace std;
+
+
+//  长度为n、不含'\r'、'\n'和'#'的数据
+static string filler(size_t n) {
+    string s(n,'a');
+    for(size_t i = 0; i < n; ++i) s[i] = 'a' + i % 26;
+    return s;
+}
+
+static void testAppendAndCopy() {
+    const size_t slab = BufferSlab::SIZE;
+    string data = filler(3 * slab + 100);
+    ChainBuffer buf;
+    CHECK(buf.empty());
+    //  分几次追加，中间的一次正好填满一块
+    buf.append(data.substr(0,10));
+    buf.append(data.substr(10,slab - 10));
+    buf.append(data.substr(slab));
+    CHECK_EQ(buf.size(),data.size());
+    CHECK_EQ(buf.slabCount(),4u);
+    CHECK(buf.copyOut(0,data.size()) == data);
+    CHECK(buf.copyOut(slab - 5,10) == data.substr(slab - 5,10));
+    CHECK(buf.copyOut(data.size() - 3,100) == data.substr(data.size() - 3));
+    CHECK(buf.copyOut(data.size(),1).empty());
+
+    //  visit按块交出数据，拼起来和copyOut一样
+    string visited;
+    int pieces = 0;
+    buf.visit(slab - 5,slab + 10,[&](const char* p,size_t n){
+        visited.append(p,n);
+        ++pieces;
+    });
+    CHECK(visited == data.substr(slab - 5,slab + 10));
+    CHECK_EQ(pieces,3);
+}
+
+static void testFindAcrossSlabs() {
+    const size_t slab = BufferSlab::SIZE;
+    //  "\r\n\r\n"的每一种跨块切法
+    for(size_t split = 1; split < 4; ++split) {
+        ChainBuffer buf;
+        buf.append(filler(slab - split));
+        buf.append("\r\n\r\n");
+        buf.append(filler(100));
+        CHECK_EQ(buf.slabCount(),2u);
+        CHECK_EQ(buf.find("\r\n\r\n",4),slab - split);
+        CHECK_EQ(buf.find("\r\n\r\n",4,slab - split),slab - split);
+        CHECK_EQ(buf.find("\r\n\r\n",4,slab - split + 1),string::npos);
+    }
+
+    //  块边界上只匹配了一部分（"\r\n\r"后面不是"\n"），真正的匹配在后面
+    {
+        ChainBuffer buf;
+        buf.append(filler(slab - 2));
+        buf.append("\r\n\rx");
+        buf.append(filler(50));
+        buf.append("\r\n\r\n");
+        CHECK_EQ(buf.find("\r\n\r\n",4),slab - 2 + 4 + 50);
+    }
+
+    //  needle比一块还长，跨三块
+    {
+        string needle = "#" + filler(slab + 10) + "#";
+        ChainBuffer buf;
+        buf.append(filler(slab - 5));
+        buf.append(needle);
+        buf.append(filler(slab));
+        CHECK_EQ(buf.slabCount(),4u);
+        CHECK_EQ(buf.find(needle.data(),needle.size()),slab - 5);
+        CHECK_EQ(buf.find(needle.data(),needle.size(),slab - 4),string::npos);
+    }
+
+    //  找不到、needle比数据长、空needle
+    {
+        ChainBuffer buf;
+        buf.append(filler(slab + 10));
+        CHECK_EQ(buf.find("\r\n",2),string::npos);
+        CHECK_EQ(buf.find("ab",2,slab + 9),string::npos);
+        CHECK_EQ(buf.find("",0),string::npos);
+        ChainBuffer small;
+        small.append("ab");
+        CHECK_EQ(small.find("abc",3),string::npos);
+    }
+}
+
+static void testConsume() {
+    const size_t slab = BufferSlab::SIZE;
+    string data = filler(2 * slab + 20);
+    ChainBuffer buf;
+    buf.append(data);
+    CHECK_EQ(buf.slabCount(),3u);
+
+    //  在块里消费只移动下标，之后的find和copyOut都从新的开头算
+    buf.consume(100);
+    CHECK_EQ(buf.size(),data.size() - 100);
+    CHECK_EQ(buf.slabCount(),3u);
+    CHECK(buf.copyOut(0,10) == data.substr(100,10));
+    string needle = data.substr(slab - 3,6);
+    CHECK_EQ(buf.find(needle.data(),needle.size(),slab - 110),slab - 103);
+
+    //  消费到块的结尾时块还回去
+    buf.consume(slab - 100);
+    CHECK_EQ(buf.slabCount(),2u);
+    CHECK(buf.copyOut(0,slab + 20) == data.substr(slab));
+
+    //  跨块消费
+    buf.consume(slab + 10);
+    CHECK_EQ(buf.slabCount(),1u);
+    CHECK(buf.copyOut(0,100) == data.substr(2 * slab + 10));
+
+    //  超过剩下的字节数时全部消费，块都还回去
+    buf.consume(1000);
+    CHECK(buf.empty());
+    CHECK_EQ(buf.slabCount(),0u);
+    buf.consume(1);
+    CHECK(buf.empty());
+
+    //  清空之后还能继续用
+    buf.append("GET / HTTP/1.1\r\n\r\n");
+    CHECK_EQ(buf.find("\r\n\r\n",4),14u);
+}
+
+//  从管道读进来再写到另一个管道里，数据不变，写出去的部分消费掉
+static void testFd() {
+    int in[2],out[2];
+    if(pipe(in) != 0 || pipe(out) != 0) {
+        CHECK(!"pipe");
+        return;
+    }
+    fcntl(in[0],F_SETFL,O_NONBLOCK);
+    string data = filler(20000);
+    CHECK_EQ(write(in[1],data.data(),data.size()),static_cast<ssize_t>(data.size()));
+    ChainBuffer buf;
+    buf.append("x");
+    while(buf.readFd(in[0]) > 0) {}
+    CHECK_EQ(buf.size(),data.size() + 1);
+    CHECK(buf.copyOut(1,data.size()) == data);
+    buf.consume(1);
+    CHECK_EQ(buf.writeFd(out[1]),static_cast<ssize_t>(data.size()));
+    CHECK(buf.empty());
+    string echoed(data.size(),'\0');
+    size_t got = 0;
+    while(got < echoed.size()) {
+        ssize_t n = read(out[0],&echoed[got],echoed.size() - got);
+        if(n <= 0) break;
+        got += n;
+    }
+    CHECK(echoed == data);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+}
+
+
+int main() {
+    testAppendAndCopy();
+    testFindAcrossSlabs();
+    testConsume();
+    testFd();
+    return testResult("chain_buffer_test");
+}
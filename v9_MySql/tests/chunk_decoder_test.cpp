@@ -0,0 +1,135 @@
+//  分块编码解码器的测试  --  数据分成任意段到达（一次一个字节），块扩展，尾部头，
+//  格式不对的长度行（空白、正负号、0x前缀、后面跟着别的东西）、超过max_body和格式本身太多
+#include <string>
+#include "../ChunkDecoder.hpp"
+#include "Check.hpp"
+using namespace std;
+
+
+#define MAX_BODY 4096
+#define MAX_TRAILER 256
+
+//  一次交给解码器step个字节，返回最后一次的结果；body是解出来的请求体，rest是没用掉的数据
+static int decodeAll(const string& data,size_t step,string* body = nullptr,string* rest = nullptr) {
+    ChunkDecoder decoder;
+    decoder.start(MAX_BODY,MAX_TRAILER);
+    ChainBuffer in;
+    int result = ChunkDecoder::PARTIAL;
+    size_t pos = 0;
+    while(result == ChunkDecoder::PARTIAL && pos < data.size()) {
+        in.append(data.substr(pos,step));
+        pos += step;
+        result = decoder.decode(in);
+    }
+    if(result == ChunkDecoder::COMPLETE) {
+        CHECK(!decoder.active());
+        if(body != nullptr) *body = decoder.takeBody();
+        if(rest != nullptr) *rest = in.copyOut(0,in.size()) + (pos < data.size() ? data.substr(pos) : string());
+    }
+    return result;
+}
+
+static int decodeAll(const string& data) {
+    return decodeAll(data,data.size());
+}
+
+static void testSplit() {
+    const string data = "5\r\nhello\r\n7\r\n, world\r\n0\r\n\r\nGET / HTTP/1.1\r\n";
+    for(size_t step = 1; step <= data.size(); ++step) {
+        string body,rest;
+        CHECK_EQ(decodeAll(data,step,&body,&rest),ChunkDecoder::COMPLETE);
+        CHECK(body == "hello, world");
+        //  后面的请求留在输入缓冲区里
+        CHECK(rest == "GET / HTTP/1.1\r\n");
+    }
+    //  没有数据的请求体
+    string body;
+    CHECK_EQ(decodeAll("0\r\n\r\n",1,&body),ChunkDecoder::COMPLETE);
+    CHECK(body.empty());
+    //  还没结束
+    CHECK_EQ(decodeAll("5\r\nhel"),ChunkDecoder::PARTIAL);
+    CHECK_EQ(decodeAll("5\r\nhello\r\n0\r\n"),ChunkDecoder::PARTIAL);
+}
+
+static void testSizes() {
+    string body;
+    CHECK_EQ(decodeAll("A\r\n0123456789\r\n0\r\n\r\n",3,&body),ChunkDecoder::COMPLETE);
+    CHECK(body == "0123456789");
+    CHECK_EQ(decodeAll("00a\r\n0123456789\r\n0000\r\n\r\n",3,&body),ChunkDecoder::COMPLETE);
+    CHECK(body == "0123456789");
+}
+
+//  扩展在分号后面，分号前面可以有空白，内容忽略
+static void testExtensions() {
+    string body;
+    CHECK_EQ(decodeAll("5;name=value\r\nhello\r\n0;last\r\n\r\n",2,&body),ChunkDecoder::COMPLETE);
+    CHECK(body == "hello");
+    CHECK_EQ(decodeAll("5 ;a\r\nhello\r\n0\t;b=\"c\"\r\n\r\n",2,&body),ChunkDecoder::COMPLETE);
+    CHECK(body == "hello");
+}
+
+static void testTrailers() {
+    string body,rest;
+    CHECK_EQ(decodeAll("5\r\nhello\r\n0\r\nX-Checksum: 1234\r\nX-Other: a\r\n\r\nnext",4,&body,&rest),
+             ChunkDecoder::COMPLETE);
+    CHECK(body == "hello");
+    CHECK(rest == "next");
+    //  尾部头超过max_trailer
+    CHECK_EQ(decodeAll("0\r\nX-Big: " + string(MAX_TRAILER,'a') + "\r\n\r\n"),ChunkDecoder::INVALID);
+}
+
+static void testMalformed() {
+    const char* invalid[] = {
+        "\r\nhello\r\n0\r\n\r\n",           //  没有长度
+        " 5\r\nhello\r\n0\r\n\r\n",         //  前面有空白
+        "+5\r\nhello\r\n0\r\n\r\n",         //  正负号
+        "-5\r\nhello\r\n0\r\n\r\n",
+        "0x5\r\nhello\r\n0\r\n\r\n",        //  0x前缀
+        "5 garbage\r\nhello\r\n0\r\n\r\n",  //  空白后面不是分号
+        "5 \r\nhello\r\n0\r\n\r\n",         //  只有空白没有扩展
+        "5g\r\nhello\r\n0\r\n\r\n",
+        "5\r\nhelloXX0\r\n\r\n",            //  数据后面不是\r\n
+    };
+    for(const char* data : invalid) {
+        CHECK_EQ(decodeAll(data),ChunkDecoder::INVALID);
+        CHECK_EQ(decodeAll(data,1),ChunkDecoder::INVALID);
+    }
+    //  长度行太长
+    CHECK_EQ(decodeAll("5;" + string(MAX_CHUNK_LINE + 10,'a')),ChunkDecoder::INVALID);
+    //  1字节的块配上很长的扩展，格式本身超过数据太多
+    string chatty;
+    for(int i = 0; i < MAX_CHUNK_OVERHEAD / 512 + 2; ++i) chatty += "1;" + string(1000,'x') + "\r\na\r\n";
+    ChunkDecoder decoder;
+    decoder.start(SIZE_MAX,MAX_TRAILER);
+    ChainBuffer in;
+    in.append(chatty);
+    CHECK_EQ(decoder.decode(in),ChunkDecoder::INVALID);
+    CHECK(!decoder.active());
+}
+
+static void testTooLarge() {
+    //  一块就超过
+    CHECK_EQ(decodeAll("1001\r\n"),ChunkDecoder::TOO_LARGE);
+    //  加起来超过
+    string data;
+    for(int i = 0; i < 5; ++i) data += "400\r\n" + string(0x400,'a') + "\r\n";
+    CHECK_EQ(decodeAll(data + "0\r\n\r\n",100),ChunkDecoder::TOO_LARGE);
+    //  正好等于
+    string body;
+    CHECK_EQ(decodeAll(data.substr(0,4 * (5 + 0x400 + 2)) + "0\r\n\r\n",100,&body),ChunkDecoder::COMPLETE);
+    CHECK_EQ(body.size(),static_cast<size_t>(MAX_BODY));
+    //  溢出size_t的长度
+    CHECK_EQ(decodeAll("fffffffffffffffff\r\n"),ChunkDecoder::TOO_LARGE);
+    CHECK_EQ(decodeAll("10000000000000000\r\n"),ChunkDecoder::TOO_LARGE);
+}
+
+
+int main() {
+    testSplit();
+    testSizes();
+    testExtensions();
+    testTrailers();
+    testMalformed();
+    testTooLarge();
+    return testResult("chunk_decoder_test");
+}
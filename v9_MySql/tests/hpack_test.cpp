@@ -0,0 +1,167 @@
+//  HPACK的测试  --  RFC 7541附录C的例子：C.1整数，C.3和C.4三个连续的请求（不用和用Huffman），
+//  C.5三个连续的响应（动态表256字节，会淘汰），每一步检查解出来的头和动态表的大小；再加上各种格式错误
+#include <string>
+#include <utility>
+#include <vector>
+#include "../Router.hpp"          //  HttpRequest.hpp和Router.hpp互相包含，要先包含Router.hpp
+#include "../Http2.hpp"
+#include "Check.hpp"
+using namespace std;
+
+
+//  "8286 8441"这样的十六进制转成字节，空格忽略
+static string hex(const string& text) {
+    string out;
+    int high = -1;
+    for(char c : text) {
+        int v;
+        if(c >= '0' && c <= '9') v = c - '0';
+        else if(c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else continue;
+        if(high < 0) {
+            high = v;
+        } else {
+            out += static_cast<char>(high * 16 + v);
+            high = -1;
+        }
+    }
+    return out;
+}
+
+static string integer(uint64_t value,int prefix_bits) {
+    string out;
+    Hpack::encodeInteger(value,prefix_bits,0,out);
+    return out;
+}
+
+static bool decodeInteger(const string& data,int prefix_bits,uint64_t& value) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data.data());
+    return Hpack::decodeInteger(p,p + data.size(),prefix_bits,value) &&
+           p == reinterpret_cast<const uint8_t*>(data.data()) + data.size();
+}
+
+//  C.1
+static void testInteger() {
+    CHECK(integer(10,5) == hex("0a"));
+    CHECK(integer(1337,5) == hex("1f9a0a"));
+    CHECK(integer(42,8) == hex("2a"));
+    uint64_t value = 0;
+    CHECK(decodeInteger(hex("0a"),5,value) && value == 10);
+    CHECK(decodeInteger(hex("1f9a0a"),5,value) && value == 1337);
+    CHECK(decodeInteger(hex("2a"),8,value) && value == 42);
+    //  正好等于前缀的最大值时后面要跟一个0
+    CHECK(integer(31,5) == hex("1f00"));
+    CHECK(decodeInteger(hex("1f00"),5,value) && value == 31);
+    //  没有结束、超过32位
+    CHECK(!decodeInteger(hex("1f9a"),5,value));
+    CHECK(!decodeInteger(hex("1fffffffff7f"),5,value));
+}
+
+static void testHuffman() {
+    string data = hex("f1e3 c2e5 f23a 6ba0 ab90 f4ff");
+    string out;
+    CHECK(Huffman::decode(reinterpret_cast<const uint8_t*>(data.data()),data.size(),out));
+    CHECK(out == "www.example.com");
+    //  填充不全是1
+    data[data.size() - 1] = '\xfe';
+    out.clear();
+    CHECK(!Huffman::decode(reinterpret_cast<const uint8_t*>(data.data()),data.size(),out));
+    //  填充超过7位（整个EOS）
+    data = hex("ffffffff");
+    out.clear();
+    CHECK(!Huffman::decode(reinterpret_cast<const uint8_t*>(data.data()),data.size(),out));
+}
+
+typedef vector<pair<string,string>> Headers;
+
+static void expectBlock(HpackDecoder& decoder,const string& block,const Headers& expected,size_t table_size) {
+    Hpack::HeaderList headers;
+    CHECK_EQ(decoder.decode(hex(block),headers,65536),HpackDecoder::DECODE_OK);
+    CHECK(headers == expected);
+    CHECK_EQ(decoder.tableSize(),table_size);
+}
+
+//  C.3（huffman为false）和C.4（为true）：同一组请求，解出来的头和动态表一样
+static void testRequests(bool huffman) {
+    HpackDecoder decoder;
+    Headers first = { {":method","GET"},{":scheme","http"},{":path","/"},{":authority","www.example.com"} };
+    expectBlock(decoder,huffman ? "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"
+                                : "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",first,57);
+
+    Headers second = first;
+    second.push_back(make_pair("cache-control","no-cache"));
+    expectBlock(decoder,huffman ? "8286 84be 5886 a8eb 1064 9cbf"
+                                : "8286 84be 5808 6e6f 2d63 6163 6865",second,110);
+
+    Headers third = { {":method","GET"},{":scheme","https"},{":path","/index.html"},
+                      {":authority","www.example.com"},{"custom-key","custom-value"} };
+    expectBlock(decoder,huffman ? "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf"
+                                : "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+                third,164);
+
+    //  动态表现在是 [62]custom-key [63]cache-control [64]:authority
+    Headers table = { {"custom-key","custom-value"},{"cache-control","no-cache"},{":authority","www.example.com"} };
+    expectBlock(decoder,"bebfc0",table,164);
+}
+
+//  C.5：先把动态表改成256字节（3fe101），每个响应都会淘汰最老的项
+static void testResponses() {
+    HpackDecoder decoder;
+    const string date1 = "Mon, 21 Oct 2013 20:13:21 GMT",date2 = "Mon, 21 Oct 2013 20:13:22 GMT";
+    const string location = "https://www.example.com";
+    expectBlock(decoder,"3fe101"
+                        "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a"
+                        "3133 3a32 3120 474d 546e 1768 7474 7073 3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+                { {":status","302"},{"cache-control","private"},{"date",date1},{"location",location} },222);
+
+    //  放进:status 307时淘汰了:status 302
+    expectBlock(decoder,"4803 3330 37c1 c0bf",
+                { {":status","307"},{"cache-control","private"},{"date",date1},{"location",location} },222);
+
+    expectBlock(decoder,"88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 3a32 3220 474d 54c0"
+                        "5a04 677a 6970 7738 666f 6f3d 4153 444a 4b48 514b 425a 584f 5157 454f 5049 5541 5851"
+                        "5745 4f49 553b 206d 6178 2d61 6765 3d33 3630 303b 2076 6572 7369 6f6e 3d31",
+                { {":status","200"},{"cache-control","private"},{"date",date2},{"location",location},
+                  {"content-encoding","gzip"},
+                  {"set-cookie","foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"} },215);
+
+    //  表大小改成0时清空
+    expectBlock(decoder,"20",Headers(),0);
+}
+
+static void testErrors() {
+    const char* invalid[] = {
+        "80",                   //  索引0
+        "be",                   //  动态表是空的
+        "3fe21f",               //  表大小超过SETTINGS_HEADER_TABLE_SIZE
+        "8220",                 //  表大小更新不在开头
+        "410f7777",             //  字符串比头部块长
+        "1f9a",                 //  整数没有结束
+    };
+    for(const char* block : invalid) {
+        HpackDecoder decoder;
+        Hpack::HeaderList headers;
+        CHECK_EQ(decoder.decode(hex(block),headers,65536),HpackDecoder::DECODE_ERROR);
+    }
+
+    //  超过长度限制时只拒绝这个头部块，动态表照常更新，后面的头部块还能引用
+    HpackDecoder decoder;
+    Hpack::HeaderList headers;
+    CHECK_EQ(decoder.decode(hex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d"),headers,64),
+             HpackDecoder::DECODE_TOO_LARGE);
+    CHECK_EQ(decoder.tableSize(),57u);
+    headers.clear();
+    CHECK_EQ(decoder.decode(hex("be"),headers,64),HpackDecoder::DECODE_OK);
+    CHECK(headers == Headers({ {":authority","www.example.com"} }));
+}
+
+
+int main() {
+    testInteger();
+    testHuffman();
+    testRequests(false);
+    testRequests(true);
+    testResponses();
+    testErrors();
+    return testResult("hpack_test");
+}
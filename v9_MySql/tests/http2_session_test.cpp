@@ -0,0 +1,195 @@
+//  HTTP/2会话的流量控制测试  --  客户端只按收到的WINDOW_UPDATE发DATA：几个流同时上传时连接上缓存的请求体
+//  超过max_body_bytes后不再还连接窗口，超出窗口的DATA是FLOW_CONTROL_ERROR；请求交出去之后欠的窗口再还
+#include <string>
+#include <vector>
+#include "../Router.hpp"          //  HttpRequest.hpp和Router.hpp互相包含，要先包含Router.hpp
+#include "../Http2.hpp"
+#include "Check.hpp"
+using namespace std;
+
+
+#define FRAME 16384
+#define WINDOW 65535
+#define MAX_BODY 100000
+
+struct Frame {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+    string payload;
+};
+
+static uint32_t readUint32(const string& s,size_t pos) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(s.data()) + pos;
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static string frame(uint8_t type,uint8_t flags,uint32_t stream_id,const string& payload) {
+    string out;
+    out += static_cast<char>(payload.size() >> 16);
+    out += static_cast<char>(payload.size() >> 8);
+    out += static_cast<char>(payload.size());
+    out += static_cast<char>(type);
+    out += static_cast<char>(flags);
+    out += static_cast<char>(stream_id >> 24);
+    out += static_cast<char>(stream_id >> 16);
+    out += static_cast<char>(stream_id >> 8);
+    out += static_cast<char>(stream_id);
+    return out + payload;
+}
+
+//  取出服务器写的所有帧
+static vector<Frame> takeFrames(ChainBuffer& out) {
+    string data = out.copyOut(0,out.size());
+    out.consume(out.size());
+    vector<Frame> frames;
+    size_t pos = 0;
+    while(pos + 9 <= data.size()) {
+        Frame f;
+        size_t length = (static_cast<uint8_t>(data[pos]) << 16) | (static_cast<uint8_t>(data[pos + 1]) << 8) |
+                        static_cast<uint8_t>(data[pos + 2]);
+        f.type = data[pos + 3];
+        f.flags = data[pos + 4];
+        f.stream_id = readUint32(data,pos + 5) & 0x7fffffff;
+        f.payload = data.substr(pos + 9,length);
+        frames.push_back(f);
+        pos += 9 + length;
+    }
+    return frames;
+}
+
+//  模拟遵守流量控制的客户端：记下服务器给的窗口
+class Client {
+public:
+    explicit Client(const ServerConfig& config): session(config),conn_window(WINDOW) {
+        session.start(out);
+        send(string(H2_PREFACE,H2_PREFACE_LEN) + frame(Http2Session::SETTINGS,0,0,""));
+    }
+
+    //  打开一个POST请求的流，请求体之后再发
+    void open(uint32_t stream_id) {
+        send(frame(Http2Session::HEADERS,0x4,stream_id,"\x83\x86\x84"));
+        stream_windows[stream_id] = WINDOW;
+    }
+
+    //  发一个DATA帧，返回receive的结果
+    bool data(uint32_t stream_id,size_t n,bool end = false) {
+        conn_window -= n;
+        stream_windows[stream_id] -= n;
+        return send(frame(Http2Session::DATA,end ? 0x1 : 0,stream_id,string(n,'x')));
+    }
+
+    bool send(const string& bytes) {
+        in.append(bytes);
+        bool ok = session.receive(in,out,ready,100);
+        for(const Frame& f : takeFrames(out)) {
+            if(f.type == Http2Session::WINDOW_UPDATE) {
+                int64_t increment = readUint32(f.payload,0) & 0x7fffffff;
+                if(f.stream_id == 0) {
+                    conn_window += increment;
+                    conn_updates++;
+                } else {
+                    stream_windows[f.stream_id] += increment;
+                }
+            }
+            frames.push_back(f);
+        }
+        return ok;
+    }
+
+    Http2Session session;
+    ChainBuffer in,out;
+    vector<Http2Session::Request> ready;
+    vector<Frame> frames;
+    int64_t conn_window;
+    int conn_updates = 0;
+    int64_t stream_windows[16] = {};
+};
+
+//  四个流轮流上传，请求都没发完；连接上缓存的请求体到了max_body_bytes之后连接窗口不再增加，
+//  客户端用完窗口就发不了了，服务器缓存的总量不会超过max_body_bytes加一个窗口
+static void testBufferedBodyCap() {
+    ServerConfig config;
+    config.h2_window_bytes = WINDOW;
+    config.max_body_bytes = MAX_BODY;
+    Client client(config);
+    const uint32_t ids[] = { 1,3,5,7 };
+    for(uint32_t id : ids) client.open(id);
+    //  没有上限时窗口会一直还，发到远超上限就停下
+    size_t sent = 0;
+    bool progress = true;
+    while(progress && sent < 10 * MAX_BODY) {
+        progress = false;
+        for(uint32_t id : ids) {
+            size_t n = static_cast<size_t>(min<int64_t>(FRAME,min(client.conn_window,client.stream_windows[id])));
+            if(n == 0) continue;
+            CHECK(client.data(id,n));
+            sent += n;
+            progress = true;
+        }
+    }
+    CHECK(client.ready.empty());
+    CHECK_EQ(client.conn_window,0);
+    CHECK(sent > MAX_BODY);
+    CHECK(sent <= MAX_BODY + WINDOW);
+
+    //  流一个个发完，请求交给服务器，缓存降到max_body_bytes以下之后连接窗口还回来
+    int updates = client.conn_updates;
+    CHECK(client.data(1,0,true));
+    CHECK(client.data(3,0,true));
+    CHECK(client.data(5,0,true));
+    CHECK_EQ(client.ready.size(),3u);
+    CHECK(client.conn_updates > updates);
+    CHECK(client.conn_window > 0);
+}
+
+//  不管窗口继续发，整个连接的窗口用完之后的DATA是连接错误FLOW_CONTROL_ERROR
+static void testConnectionWindowOverrun() {
+    ServerConfig config;
+    config.h2_window_bytes = WINDOW;
+    config.max_body_bytes = MAX_BODY;
+    Client client(config);
+    const uint32_t ids[] = { 1,3,5,7 };
+    for(uint32_t id : ids) client.open(id);
+    bool ok = true;
+    for(int i = 0; ok && i < 100; ++i) {
+        ok = client.data(ids[i % 4],FRAME);
+    }
+    CHECK(!ok);
+    CHECK(client.conn_window < 0);
+    CHECK(client.session.isClosing());
+    const Frame& last = client.frames.back();
+    CHECK_EQ(last.type,Http2Session::GOAWAY);
+    CHECK_EQ(readUint32(last.payload,4),static_cast<uint32_t>(Http2Session::FLOW_CONTROL_ERROR));
+}
+
+//  只有一个流时窗口一直还，请求体能传完
+static void testSingleLargeBody() {
+    ServerConfig config;
+    config.h2_window_bytes = WINDOW;
+    config.max_body_bytes = MAX_BODY;
+    Client client(config);
+    client.open(1);
+    size_t sent = 0;
+    while(sent < MAX_BODY) {
+        size_t n = static_cast<size_t>(min<int64_t>(min<int64_t>(FRAME,MAX_BODY - sent),
+                                                    min(client.conn_window,client.stream_windows[1])));
+        CHECK(n > 0);
+        if(n == 0) break;
+        CHECK(client.data(1,n,sent + n == MAX_BODY));
+        sent += n;
+    }
+    CHECK_EQ(client.ready.size(),1u);
+    if(!client.ready.empty()) {
+        CHECK_EQ(client.ready[0].error,0);
+        CHECK_EQ(client.ready[0].request.getBody().size(),static_cast<size_t>(MAX_BODY));
+    }
+}
+
+
+int main() {
+    testBufferedBodyCap();
+    testConnectionWindowOverrun();
+    testSingleLargeBody();
+    return testResult("http2_session_test");
+}
@@ -0,0 +1,445 @@
+//  HTTP服务器的测试  --  在后台线程里启动整个服务器，通过本机的TCP连接发原始请求，检查收到的字节：
+//  HTTP/1.0的客户端请求流式发送的大文件时不用分块编码，响应体原样发送，发完关闭连接；
+//  请求体的长度不确定（Content-Length格式不对或者不一致，Transfer-Encoding有问题）时回400；
+//  一次最多读一个请求头加上请求体那么多数据，大的请求体和很长的流水线照样能处理完；
+//  HTTP/2同一批里的流各自处理完就发，快的不等慢的；
+//  HTTP/1.1流水线的请求由几个线程同时处理、完成的顺序不定，响应仍按请求的顺序发出，中途要关闭连接时后面的不再发
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../HttpServer.hpp"
+#include "Check.hpp"
+using namespace std;
+
+
+static string filler(size_t n) {
+    string s(n,'a');
+    for(size_t i = 0; i < n; ++i) s[i] = 'a' + (i * 7 + i / 26) % 26;
+    return s;
+}
+
+//  让内核分配一个空闲的端口
+static int freePort() {
+    int fd = socket(AF_INET,SOCK_STREAM,0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(fd,reinterpret_cast<sockaddr*>(&addr),len);
+    getsockname(fd,reinterpret_cast<sockaddr*>(&addr),&len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+static int connectTo(int port) {
+    int fd = socket(AF_INET,SOCK_STREAM,0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd,reinterpret_cast<sockaddr*>(&addr),sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    timeval timeout = { 10,0 };
+    setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+    return fd;
+}
+
+//  发出请求，一直读到服务器关闭连接（或者超时）；请求在另一个线程里发，服务器边读边回的时候两边都不会卡住
+static string exchange(int port,const string& request) {
+    int fd = connectTo(port);
+    if(fd < 0) return string();
+    thread sender([fd,&request]{
+        size_t sent = 0;
+        while(sent < request.size()) {
+            ssize_t n = send(fd,request.data() + sent,request.size() - sent,MSG_NOSIGNAL);
+            if(n <= 0) break;
+            sent += n;
+        }
+    });
+    string reply;
+    char buf[65536];
+    ssize_t n;
+    while((n = recv(fd,buf,sizeof(buf),0)) > 0) reply.append(buf,n);
+    sender.join();
+    close(fd);
+    return reply;
+}
+
+static string headersOf(const string& reply) {
+    size_t end = reply.find("\r\n\r\n");
+    return end == string::npos ? reply : reply.substr(0,end + 4);
+}
+
+static string bodyOf(const string& reply) {
+    size_t end = reply.find("\r\n\r\n");
+    return end == string::npos ? string() : reply.substr(end + 4);
+}
+
+//  把分块编码的响应体拼回原来的数据，格式不对时返回"<invalid>"
+static string unchunk(const string& body) {
+    string out;
+    size_t pos = 0;
+    while(1) {
+        size_t line = body.find("\r\n",pos);
+        if(line == string::npos) return "<invalid>";
+        size_t size = strtoul(body.c_str() + pos,nullptr,16);
+        if(size == 0) return body.compare(line,4,"\r\n\r\n") == 0 ? out : "<invalid>";
+        if(line + 2 + size + 2 > body.size()) return "<invalid>";
+        out.append(body,line + 2,size);
+        pos = line + 2 + size + 2;
+    }
+}
+
+static bool hasHeader(const string& headers,const string& line) {
+    return headers.find("\r\n" + line + "\r\n") != string::npos;
+}
+
+
+//  静态文件的根目录，里面放一个流式发送的大文件
+static string content;
+static int port;
+//  /delay/路由处理完的顺序
+static mutex delay_mutex;
+static vector<string> delay_finished;
+
+//  服务器的主循环不会返回，在后台线程里一直运行到测试进程退出
+static void startServer() {
+    char root[] = "/tmp/http_server_test.XXXXXX";
+    if(mkdtemp(root) == nullptr) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    content = filler(300 * 1024);
+    ofstream(string(root) + "/big.bin",ios::binary) << content;
+
+    ServerConfig config;
+    config.static_root = root;
+    config.static_embedded = false;
+    config.static_stream_bytes = 64 * 1024;
+    //  流水线里的慢请求同时处理
+    config.pool.min_threads = 8;
+    port = freePort();
+    //  数据库只被登录和注册的路由用到，测试不请求它们，不需要连接MySQL
+    static aligned_storage<sizeof(Database),alignof(Database)>::type db_storage;
+    Database& db = *reinterpret_cast<Database*>(&db_storage);
+    static HttpServer server(port,10,db,config);
+    //  /delay/<毫秒>[/后缀]：等这么久之后把路径作为响应体返回，并记下处理完的顺序
+    server.getRouter().addPrefixRoute("GET","/delay/",[](const HttpRequest& request) {
+        this_thread::sleep_for(chrono::milliseconds(atoi(request.getPath().c_str() + 7)));
+        {
+            lock_guard<mutex> lock(delay_mutex);
+            delay_finished.push_back(request.getPath());
+        }
+        HttpResponse response;
+        response.setHeader("Content-Type","text/plain");
+        response.setBody(request.getPath());
+        return response;
+    });
+    thread([]{ server.start(); }).detach();
+    for(int i = 0; i < 500; ++i) {
+        int fd = connectTo(port);
+        if(fd >= 0) {
+            close(fd);
+            return;
+        }
+        usleep(10 * 1000);
+    }
+    fprintf(stderr,"server did not start on port %d\n",port);
+    exit(1);
+}
+
+//  HTTP/1.0没有分块编码：不发Transfer-Encoding和Content-Length，响应体原样发送，以关闭连接结束
+static void testHttp10Stream() {
+    string reply = exchange(port,"GET /big.bin HTTP/1.0\r\n\r\n");
+    string headers = headersOf(reply);
+    CHECK(headers.compare(0,15,"HTTP/1.1 200 OK") == 0);
+    CHECK(headers.find("Transfer-Encoding") == string::npos);
+    CHECK(headers.find("Content-Length") == string::npos);
+    CHECK(hasHeader(headers,"Connection: close"));
+    CHECK(bodyOf(reply) == content);
+
+    //  客户端要求保持连接也一样，只能靠关闭连接表示响应体结束；后面流水线的请求不再回复
+    reply = exchange(port,"GET /big.bin HTTP/1.0\r\nConnection: keep-alive\r\n\r\n"
+                          "GET /big.bin HTTP/1.0\r\nConnection: keep-alive\r\n\r\n");
+    headers = headersOf(reply);
+    CHECK(headers.find("Transfer-Encoding") == string::npos);
+    CHECK(hasHeader(headers,"Connection: close"));
+    CHECK(bodyOf(reply) == content);
+
+    //  HTTP/1.1照常分块
+    reply = exchange(port,"GET /big.bin HTTP/1.1\r\nConnection: close\r\n\r\n");
+    headers = headersOf(reply);
+    CHECK(hasHeader(headers,"Transfer-Encoding: chunked"));
+    CHECK(unchunk(bodyOf(reply)) == content);
+}
+
+static int statusOf(const string& reply) {
+    return reply.compare(0,9,"HTTP/1.1 ") == 0 ? atoi(reply.c_str() + 9) : 0;
+}
+
+static int statusFor(const string& headers,const string& body = string()) {
+    return statusOf(exchange(port,"GET / HTTP/1.1\r\nConnection: close\r\n" + headers + "\r\n" + body));
+}
+
+static void testBodyFraming() {
+    CHECK_EQ(statusFor("Content-Length: 5\r\n","hello"),200);
+    CHECK_EQ(statusFor("Content-Length: 5\r\nContent-Length: 5\r\n","hello"),200);
+    CHECK_EQ(statusFor("Content-Length: 5, 5\r\n","hello"),200);
+    CHECK_EQ(statusFor("Content-Length: 12abc\r\n","hello"),400);
+    CHECK_EQ(statusFor("Content-Length: -1\r\n","hello"),400);
+    CHECK_EQ(statusFor("Content-Length: +5\r\n","hello"),400);
+    CHECK_EQ(statusFor("Content-Length: 0x5\r\n","hello"),400);
+    CHECK_EQ(statusFor("Content-Length:\t5\r\n","hello"),400);
+    CHECK_EQ(statusFor("Content-Length: \r\n"),400);
+    CHECK_EQ(statusFor("Content-Length: 99999999999999999999999\r\n","hello"),400);
+    //  重复而且不一致
+    CHECK_EQ(statusFor("Content-Length: 5\r\nContent-Length: 6\r\n","hello!"),400);
+    CHECK_EQ(statusFor("Content-Length: 5, 6\r\n","hello!"),400);
+
+    const string chunked_body = "5\r\nhello\r\n0\r\n\r\n";
+    CHECK_EQ(statusFor("Transfer-Encoding: chunked\r\n",chunked_body),200);
+    CHECK_EQ(statusFor("Transfer-Encoding: Chunked \r\n",chunked_body),200);
+    CHECK_EQ(statusFor("Transfer-Encoding: gzip, chunked\r\n",chunked_body),200);
+    //  最后一个编码不是chunked
+    CHECK_EQ(statusFor("Transfer-Encoding: notchunked\r\n",chunked_body),400);
+    CHECK_EQ(statusFor("Transfer-Encoding: chunked, gzip\r\n",chunked_body),400);
+    CHECK_EQ(statusFor("Transfer-Encoding: chunkedx\r\n",chunked_body),400);
+    //  和Content-Length同时出现
+    CHECK_EQ(statusFor("Transfer-Encoding: chunked\r\nContent-Length: 5\r\n",chunked_body),400);
+    CHECK_EQ(statusFor("Content-Length: 22\r\nTransfer-Encoding: chunked\r\n",chunked_body),400);
+}
+
+static size_t countOf(const string& text,const string& needle) {
+    size_t count = 0;
+    for(size_t pos = text.find(needle); pos != string::npos; pos = text.find(needle,pos + 1)) ++count;
+    return count;
+}
+
+//  输入缓冲区只读到max_header_bytes加上正在等的请求体，剩下的留在套接字里，之后还能接着读
+static void testReadLimit() {
+    ServerConfig defaults;
+    //  请求体比max_header_bytes大得多
+    string body = filler(defaults.max_header_bytes * 4);
+    CHECK_EQ(statusFor("Content-Length: " + to_string(body.size()) + "\r\n",body),200);
+
+    //  流水线的请求加起来远超过max_header_bytes，分几次读完，每个都有响应
+    const string request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    size_t count = defaults.max_header_bytes * 3 / request.size();
+    string pipeline;
+    for(size_t i = 0; i < count; ++i) pipeline += request;
+    pipeline += "GET / HTTP/1.1\r\nConnection: close\r\n\r\n";
+    CHECK_EQ(countOf(exchange(port,pipeline),"HTTP/1.1 200 OK\r\n"),count + 1);
+
+    //  请求头超过max_header_bytes时直接关闭
+    string reply = exchange(port,"GET / HTTP/1.1\r\nX-Big: " + filler(defaults.max_header_bytes * 2) + "\r\n\r\n");
+    CHECK(reply.empty());
+}
+
+static string h2Frame(uint8_t type,uint8_t flags,uint32_t stream_id,const string& payload) {
+    string out;
+    out += static_cast<char>(payload.size() >> 16);
+    out += static_cast<char>(payload.size() >> 8);
+    out += static_cast<char>(payload.size());
+    out += static_cast<char>(type);
+    out += static_cast<char>(flags);
+    out += static_cast<char>(stream_id >> 24);
+    out += static_cast<char>(stream_id >> 16);
+    out += static_cast<char>(stream_id >> 8);
+    out += static_cast<char>(stream_id);
+    return out + payload;
+}
+
+//  GET请求的头部块：:method GET和:scheme http用静态表的索引，:path是不索引的字面量
+static string h2Get(uint32_t stream_id,const string& path) {
+    string block = "\x82\x86\x04";
+    block += static_cast<char>(path.size());
+    block += path;
+    return h2Frame(Http2Session::HEADERS,Http2Session::FLAG_END_STREAM | Http2Session::FLAG_END_HEADERS,stream_id,block);
+}
+
+//  同一批里一个慢的流和一个快的流：快的先回，不等慢的处理完
+static void testHttp2Interleave() {
+    int fd = connectTo(port);
+    if(fd < 0) {
+        CHECK(!"connect");
+        return;
+    }
+    string request = string(H2_PREFACE,H2_PREFACE_LEN) + h2Frame(Http2Session::SETTINGS,0,0,"") +
+                     h2Get(1,"/delay/1000") + h2Get(3,"/delay/0");
+    auto start = chrono::steady_clock::now();
+    send(fd,request.data(),request.size(),MSG_NOSIGNAL);
+    vector<uint32_t> order;         //  响应的HEADERS按什么顺序到达
+    long fast_ms = -1;              //  快的流的响应多久到达
+    int finished = 0;
+    string in;
+    char buf[65536];
+    while(finished < 2) {
+        ssize_t n = recv(fd,buf,sizeof(buf),0);
+        if(n <= 0) break;
+        in.append(buf,n);
+        while(in.size() >= 9) {
+            size_t length = (static_cast<uint8_t>(in[0]) << 16) | (static_cast<uint8_t>(in[1]) << 8) |
+                            static_cast<uint8_t>(in[2]);
+            if(in.size() < 9 + length) break;
+            uint8_t type = in[3],flags = in[4];
+            uint32_t stream_id = ((static_cast<uint8_t>(in[5]) << 24) | (static_cast<uint8_t>(in[6]) << 16) |
+                                  (static_cast<uint8_t>(in[7]) << 8) | static_cast<uint8_t>(in[8])) & 0x7fffffff;
+            in.erase(0,9 + length);
+            if(stream_id == 0) continue;
+            if(type == Http2Session::HEADERS) {
+                order.push_back(stream_id);
+                if(stream_id == 3) {
+                    fast_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+                }
+            }
+            if((type == Http2Session::HEADERS || type == Http2Session::DATA) && (flags & Http2Session::FLAG_END_STREAM)) {
+                ++finished;
+            }
+        }
+    }
+    close(fd);
+    CHECK_EQ(finished,2);
+    CHECK(order == vector<uint32_t>({ 3,1 }));
+    CHECK(fast_ms >= 0 && fast_ms < 500);
+}
+
+//  按Content-Length把连续的响应拆开，返回各个响应体；带Connection: close的响应记在closes里
+static vector<string> bodiesOf(const string& reply,vector<bool>* closes = nullptr) {
+    vector<string> bodies;
+    size_t pos = 0;
+    while(pos < reply.size()) {
+        size_t end = reply.find("\r\n\r\n",pos);
+        if(end == string::npos) {
+            bodies.push_back("<truncated>");
+            break;
+        }
+        string headers = reply.substr(pos,end + 4 - pos);
+        size_t length_pos = headers.find("\r\nContent-Length: ");
+        size_t length = length_pos == string::npos ? 0 : strtoul(headers.c_str() + length_pos + 18,nullptr,10);
+        bodies.push_back(reply.substr(end + 4,length));
+        if(closes != nullptr) closes->push_back(hasHeader(headers,"Connection: close"));
+        pos = end + 4 + length;
+    }
+    return bodies;
+}
+
+static string delayRequest(const string& path,bool close = false) {
+    return "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n" + (close ? "Connection: close\r\n" : "") + "\r\n";
+}
+
+static vector<string> takeFinished() {
+    lock_guard<mutex> lock(delay_mutex);
+    vector<string> finished;
+    finished.swap(delay_finished);
+    return finished;
+}
+
+//  流水线的请求处理时间不同，在几个线程里同时处理，处理完的顺序和请求的顺序不一样；
+//  最后处理完的线程负责写整批响应，响应按请求的顺序发出
+static void testPipelineOrder() {
+    //  最慢的分别在批次的开头、中间和末尾
+    const vector<vector<int>> cases = {
+        { 400,0,200,100,0 },
+        { 0,100,400,0,200 },
+        { 0,200,0,100,400 },
+    };
+    for(const vector<int>& delays : cases) {
+        takeFinished();
+        vector<string> paths;
+        string pipeline;
+        for(size_t i = 0; i < delays.size(); ++i) {
+            paths.push_back("/delay/" + to_string(delays[i]) + "/" + to_string(i));
+            pipeline += delayRequest(paths.back(),i + 1 == delays.size());
+        }
+        vector<string> bodies = bodiesOf(exchange(port,pipeline));
+        CHECK(bodies == paths);
+        //  确实是乱序完成的：最慢的最后完成，先于它完成的有排在它后面的请求
+        vector<string> finished = takeFinished();
+        CHECK_EQ(finished.size(),paths.size());
+        CHECK(finished != paths);
+        if(!finished.empty()) CHECK(finished.back().compare(0,11,"/delay/400/") == 0);
+    }
+
+    //  超过max_pipeline_depth的请求分几批处理，每批都由最后完成的线程写出再接着处理下一批
+    ServerConfig defaults;
+    size_t count = defaults.max_pipeline_depth * 2 + 8;
+    vector<string> paths;
+    string pipeline;
+    for(size_t i = 0; i < count; ++i) {
+        paths.push_back("/delay/" + to_string(i % 5 == 0 ? 50 : 0) + "/" + to_string(i));
+        pipeline += delayRequest(paths.back(),i + 1 == count);
+    }
+    CHECK(bodiesOf(exchange(port,pipeline)) == paths);
+    takeFinished();
+}
+
+//  批次中间的请求要求关闭连接：它前面的响应照常按顺序发出，它自己的响应带Connection: close，
+//  后面的请求即使已经处理完也不再发送，发完就关闭；客户端在批次处理完之前断开不影响服务器
+static void testPipelineClose() {
+    string pipeline = delayRequest("/delay/300/0") + delayRequest("/delay/0/1",true) +
+                      delayRequest("/delay/0/2") + delayRequest("/delay/100/3");
+    vector<bool> closes;
+    auto start = chrono::steady_clock::now();
+    vector<string> bodies = bodiesOf(exchange(port,pipeline),&closes);
+    auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    CHECK(bodies == vector<string>({ "/delay/300/0","/delay/0/1" }));
+    CHECK(closes == vector<bool>({ false,true }));
+    //  是服务器关闭的连接，不是读超时
+    CHECK(elapsed < 5000);
+
+    //  HTTP/1.0不保持连接，同样结束这一批
+    pipeline = delayRequest("/delay/200/0") + "GET /delay/0/1 HTTP/1.0\r\n\r\n" + delayRequest("/delay/0/2");
+    CHECK(bodiesOf(exchange(port,pipeline)) == vector<string>({ "/delay/200/0","/delay/0/1" }));
+
+    //  写的时候才决定关闭：HTTP/1.0的客户端要求保持连接，但流式响应只能以关闭连接结束，
+    //  排在它前面的慢请求照常先发，流式响应体发完就关闭，后面的请求不再回复
+    pipeline = delayRequest("/delay/300/0") + "GET /big.bin HTTP/1.0\r\nConnection: keep-alive\r\n\r\n" +
+               delayRequest("/delay/0/2");
+    string reply = exchange(port,pipeline);
+    size_t next = reply.find("HTTP/1.1 200 OK",1);
+    CHECK(next != string::npos);
+    if(next != string::npos) {
+        CHECK(bodiesOf(reply.substr(0,next)) == vector<string>({ "/delay/300/0" }));
+        string rest = reply.substr(next);
+        CHECK(hasHeader(headersOf(rest),"Connection: close"));
+        CHECK(bodyOf(rest) == content);
+    }
+
+    //  客户端发完就断开，批次处理完时连接已经没了
+    int fd = connectTo(port);
+    CHECK(fd >= 0);
+    if(fd >= 0) {
+        pipeline = delayRequest("/delay/300/0") + delayRequest("/delay/0/1") + delayRequest("/delay/100/2");
+        send(fd,pipeline.data(),pipeline.size(),MSG_NOSIGNAL);
+        close(fd);
+    }
+    this_thread::sleep_for(chrono::milliseconds(500));
+    CHECK(bodiesOf(exchange(port,delayRequest("/delay/0/after",true))) == vector<string>({ "/delay/0/after" }));
+    takeFinished();
+}
+
+
+int main() {
+    startServer();
+    testHttp10Stream();
+    testBodyFraming();
+    testReadLimit();
+    testHttp2Interleave();
+    testPipelineOrder();
+    testPipelineClose();
+    int result = testResult("http_server_test");
+    fflush(stdout);
+    //  服务器线程还在运行，不走正常的退出流程
+    _exit(result);
+}
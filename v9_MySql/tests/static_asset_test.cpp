@@ -0,0 +1,205 @@
+//  静态资源范围请求的测试  --  通过StaticResponse::serve检查Range的解析（a-b、a-、-n、超出长度、格式错误、太多范围）、
+//  重叠和相邻范围的合并、multipart/byteranges的响应体、416、If-Range，以及大范围用分块编码边读边发时的内容
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../Router.hpp"          //  HttpRequest.hpp和Router.hpp互相包含，要先包含Router.hpp
+#include "../StaticAsset.hpp"
+#include "Check.hpp"
+using namespace std;
+
+
+class StringChunkSink : public ChunkSink {
+public:
+    void write(const char* data,size_t len) override {
+        out.append(data,len);
+    }
+
+    string out;
+};
+
+static string filler(size_t n) {
+    string s(n,'a');
+    for(size_t i = 0; i < n; ++i) s[i] = 'a' + (i * 7 + i / 26) % 26;
+    return s;
+}
+
+static shared_ptr<const StaticAsset> makeAsset(const string& content) {
+    shared_ptr<StaticAsset> asset = make_shared<StaticAsset>();
+    asset->load(content.data(),content.size(),1400000000,"text/plain",-1,false);
+    return asset;
+}
+
+static HttpResponse get(const shared_ptr<const StaticAsset>& asset,const string& range,
+                        const string& if_range = "",size_t stream_bytes = SIZE_MAX) {
+    HttpRequest request;
+    request.init("GET","/file.txt","HTTP/1.1");
+    if(!range.empty()) request.addHeader("Range",range);
+    if(!if_range.empty()) request.addHeader("If-Range",if_range);
+    return StaticResponse::serve(request,asset,stream_bytes);
+}
+
+//  响应体，分块编码的响应把生成函数一直调用到结束，calls是调用的次数
+static string bodyOf(const HttpResponse& response,int* calls = nullptr) {
+    if(!response.isChunked()) return response.getBody();
+    StringChunkSink sink;
+    int n = 1;
+    while(response.getProducer()(sink)) ++n;
+    if(calls != nullptr) *calls = n;
+    return sink.out;
+}
+
+//  按响应头里的分隔符拼出期望的multipart响应体
+static string multipart(const HttpResponse& response,const string& content,const vector<pair<size_t,size_t>>& ranges) {
+    string type = response.getHeader("Content-Type");
+    string prefix = "multipart/byteranges; boundary=";
+    if(type.compare(0,prefix.size(),prefix) != 0) return string();
+    string boundary = type.substr(prefix.size());
+    string body;
+    for(const auto& range : ranges) {
+        body += "\r\n--" + boundary + "\r\nContent-Type: text/plain\r\nContent-Range: bytes " +
+                to_string(range.first) + "-" + to_string(range.second) + "/" + to_string(content.size()) + "\r\n\r\n";
+        body += content.substr(range.first,range.second - range.first + 1);
+    }
+    return body + "\r\n--" + boundary + "--\r\n";
+}
+
+static void expectRange(const shared_ptr<const StaticAsset>& asset,const string& content,const string& range,
+                        size_t first,size_t last) {
+    HttpResponse response = get(asset,range);
+    CHECK_EQ(response.getStatusCode(),206);
+    CHECK(response.getHeader("Content-Range") ==
+          "bytes " + to_string(first) + "-" + to_string(last) + "/" + to_string(content.size()));
+    CHECK(bodyOf(response) == content.substr(first,last - first + 1));
+}
+
+static void expectFull(const shared_ptr<const StaticAsset>& asset,const string& content,const string& range) {
+    HttpResponse response = get(asset,range);
+    CHECK_EQ(response.getStatusCode(),200);
+    CHECK(response.getHeader("Content-Range").empty());
+    CHECK(bodyOf(response) == content);
+}
+
+static void testSingleRange() {
+    string content = filler(10000);
+    shared_ptr<const StaticAsset> asset = makeAsset(content);
+    expectRange(asset,content,"bytes=0-99",0,99);
+    expectRange(asset,content,"bytes=-100",9900,9999);
+    expectRange(asset,content,"bytes=9990-",9990,9999);
+    expectRange(asset,content,"bytes=9990-20000",9990,9999);
+    expectRange(asset,content,"bytes=5-5",5,5);
+    expectRange(asset,content,"bytes= 10-19 ",10,19);
+    //  最后n个字节超过长度时就是全部内容
+    expectFull(asset,content,"bytes=-20000");
+    //  超出长度的范围跳过，剩下的照常返回
+    expectRange(asset,content,"bytes=20000-,30-39",30,39);
+}
+
+//  重叠、相邻的范围合并成一个，不重叠的用multipart，按起点排序
+static void testCoalesce() {
+    string content = filler(10000);
+    shared_ptr<const StaticAsset> asset = makeAsset(content);
+    expectRange(asset,content,"bytes=0-99,100-199",0,199);
+    expectRange(asset,content,"bytes=50-149,0-99",0,149);
+    expectRange(asset,content,"bytes=10-19,12-15",10,19);
+
+    HttpResponse response = get(asset,"bytes=500-599, 0-9");
+    CHECK_EQ(response.getStatusCode(),206);
+    CHECK(response.getHeader("Content-Range").empty());
+    vector<pair<size_t,size_t>> ranges = { {0,9},{500,599} };
+    string expected = multipart(response,content,ranges);
+    CHECK(!expected.empty());
+    CHECK(bodyOf(response) == expected);
+
+    response = get(asset,"bytes=-10,0-9,20-29,25-34");
+    ranges = { {0,9},{20,34},{9990,9999} };
+    expected = multipart(response,content,ranges);
+    CHECK(!expected.empty());
+    CHECK(bodyOf(response) == expected);
+}
+
+//  覆盖全部内容、请求的总长超过内容（同一段要很多遍）、范围太多或者格式不对时返回完整内容
+static void testIgnored() {
+    string content = filler(10000);
+    shared_ptr<const StaticAsset> asset = makeAsset(content);
+    expectFull(asset,content,"bytes=0-");
+    expectFull(asset,content,"bytes=0-4999,5000-9999");
+    string repeated = "bytes=0-";
+    for(int i = 1; i < MAX_RANGES; ++i) repeated += ",0-";
+    expectFull(asset,content,repeated);
+    string overlapping = "bytes=0-6000";
+    for(int i = 1; i < 4; ++i) overlapping += ",0-6000";
+    expectFull(asset,content,overlapping);
+    string many = "bytes=0-0";
+    for(int i = 1; i <= MAX_RANGES; ++i) many += "," + to_string(i * 10) + "-" + to_string(i * 10);
+    expectFull(asset,content,many);
+    expectFull(asset,content,"bytes=5-1");
+    expectFull(asset,content,"bytes=abc");
+    expectFull(asset,content,"bytes=1-x");
+    expectFull(asset,content,"bytes=-");
+    expectFull(asset,content,"bytes=");
+    expectFull(asset,content,"items=0-1");
+}
+
+static void testUnsatisfiable() {
+    string content = filler(10000);
+    shared_ptr<const StaticAsset> asset = makeAsset(content);
+    const char* ranges[] = { "bytes=10000-","bytes=20000-30000","bytes=-0","bytes=10000-,20000-" };
+    for(const char* range : ranges) {
+        HttpResponse response = get(asset,range);
+        CHECK_EQ(response.getStatusCode(),416);
+        CHECK(response.getHeader("Content-Range") == "bytes */10000");
+    }
+}
+
+//  If-Range要求ETag强匹配或者日期完全相同，否则返回完整内容
+static void testIfRange() {
+    string content = filler(10000);
+    shared_ptr<const StaticAsset> asset = makeAsset(content);
+    CHECK_EQ(get(asset,"bytes=0-9",asset->etag).getStatusCode(),206);
+    CHECK_EQ(get(asset,"bytes=0-9",asset->last_modified_text).getStatusCode(),206);
+    CHECK_EQ(get(asset,"bytes=0-9","\"other\"").getStatusCode(),200);
+    CHECK_EQ(get(asset,"bytes=0-9","W/" + asset->etag).getStatusCode(),200);
+    CHECK_EQ(get(asset,"bytes=0-9",StaticResponse::httpDate(asset->last_modified + 1)).getStatusCode(),200);
+}
+
+//  范围加起来不小于stream_bytes时用分块编码，每次最多生成STREAM_PIECE字节左右，内容和复制的一样
+static void testStreamed() {
+    string content = filler(3 * STREAM_PIECE + 1234);
+    shared_ptr<const StaticAsset> asset = makeAsset(content);
+
+    HttpResponse response = get(asset,"bytes=1000-",string(),STREAM_PIECE);
+    CHECK_EQ(response.getStatusCode(),206);
+    CHECK(response.isChunked());
+    int calls = 0;
+    CHECK(bodyOf(response,&calls) == content.substr(1000));
+    CHECK_EQ(calls,4);
+
+    response = get(asset,"bytes=0-9,100-" + to_string(2 * STREAM_PIECE),string(),STREAM_PIECE);
+    CHECK(response.isChunked());
+    vector<pair<size_t,size_t>> ranges = { {0,9},{100,2 * STREAM_PIECE} };
+    CHECK(bodyOf(response) == multipart(response,content,ranges));
+
+    //  小于stream_bytes时复制进响应
+    response = get(asset,"bytes=0-99",string(),STREAM_PIECE);
+    CHECK(!response.isChunked());
+    CHECK(bodyOf(response) == content.substr(0,100));
+
+    //  完整响应也一样
+    response = get(asset,"",string(),STREAM_PIECE);
+    CHECK_EQ(response.getStatusCode(),200);
+    CHECK(response.isChunked());
+    CHECK(bodyOf(response) == content);
+}
+
+
+int main() {
+    testSingleRange();
+    testCoalesce();
+    testIgnored();
+    testUnsatisfiable();
+    testIfRange();
+    testStreamed();
+    return testResult("static_asset_test");
+}
@@ -0,0 +1,189 @@
+//  静态目录的路径规范化测试  --  ..、%2e%2e、编码的'/'、%00、重复的'/'、.段和末尾的..，
+//  越过根目录的都被拒绝，其他的规范化成相对于根目录的路径；再通过serve确认根目录外的文件读不到；
+//  文件缓存里同一个文件同时未命中时只加载一次
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../Router.hpp"          //  HttpRequest.hpp和Router.hpp互相包含，要先包含Router.hpp
+#include "../StaticFiles.hpp"
+#include "Check.hpp"
+using namespace std;
+
+
+static void expectPath(const string& url_path,const string& expected) {
+    string out = "<unchanged>";
+    bool ok = StaticFiles::normalize(url_path,out);
+    if(!ok || out != expected) fprintf(stderr,"normalize(\"%s\") = %s \"%s\"\n",url_path.c_str(),ok ? "true" : "false",out.c_str());
+    CHECK(ok);
+    CHECK(out == expected);
+}
+
+static void expectRejected(const string& url_path) {
+    string out;
+    bool ok = StaticFiles::normalize(url_path,out);
+    if(ok) fprintf(stderr,"normalize(\"%s\") accepted as \"%s\"\n",url_path.c_str(),out.c_str());
+    CHECK(!ok);
+}
+
+static void testNormalize() {
+    expectPath("index.html","index.html");
+    expectPath("css/site.css","css/site.css");
+    expectPath("","");
+    expectPath("docs/","docs/");
+    //  查询参数和片段去掉
+    expectPath("a.html?x=../../etc/passwd","a.html");
+    expectPath("a.html#../..","a.html");
+    //  重复的'/'和.段
+    expectPath("//a//b.html","a/b.html");
+    expectPath("./a/./b.html","a/b.html");
+    expectPath("a/.","a");
+    expectPath("%2e/a","a");
+    //  根目录以内的..
+    expectPath("a/b/../c.html","a/c.html");
+    expectPath("a/%2e%2e/c.html","c.html");
+    expectPath("a/b/..","a");
+    expectPath("a/..","");
+    //  编码的普通字符
+    expectPath("hello%20world.txt","hello world.txt");
+    expectPath("%41%62c","Abc");
+}
+
+static void testTraversal() {
+    expectRejected("..");
+    expectRejected("../etc/passwd");
+    expectRejected("/../etc/passwd");
+    expectRejected("a/../../etc/passwd");
+    expectRejected("a/b/../../..");
+    //  编码的.和/
+    expectRejected("%2e%2e/etc/passwd");
+    expectRejected("%2E%2E/etc/passwd");
+    expectRejected(".%2e/etc/passwd");
+    expectRejected("%2e./etc/passwd");
+    expectRejected("..%2fetc%2fpasswd");
+    expectRejected("a%2f..%2f..%2fetc%2fpasswd");
+    expectRejected("%2e%2e%2f%2e%2e%2fetc");
+    //  %00和格式不对的%
+    expectRejected("index.html%00.png");
+    expectRejected("%00");
+    expectRejected("a%2");
+    expectRejected("a%zz");
+    expectRejected("%");
+    //  隐藏文件
+    expectRejected(".git/config");
+    expectRejected("a/.env");
+    expectRejected("%2egit/config");
+}
+
+//  serve对拒绝的路径回404，根目录外的文件读不到，根目录里的照常返回
+static void testServe() {
+    char dir[] = "/tmp/static_files_test.XXXXXX";
+    if(mkdtemp(dir) == nullptr) {
+        CHECK(!"mkdtemp");
+        return;
+    }
+    string base = dir;
+    string root = base + "/root";
+    mkdir(root.c_str(),0755);
+    ofstream(base + "/secret.txt") << "secret";
+    ofstream(root + "/page.html") << "page";
+
+    ServerConfig config;
+    config.static_embedded = false;
+    StaticFiles files(root,"/static/",config);
+    const char* outside[] = {
+        "/static/../secret.txt","/static/%2e%2e/secret.txt","/static/..%2fsecret.txt",
+        "/static/a/../../secret.txt","/static/secret.txt%00.html",
+    };
+    for(const char* url : outside) {
+        HttpRequest request;
+        CHECK(request.init("GET",url,"HTTP/1.1"));
+        HttpResponse response = files.serve(request);
+        CHECK_EQ(response.getStatusCode(),404);
+        CHECK(response.getBody().find("secret") == string::npos);
+    }
+    HttpRequest request;
+    request.init("GET","/static/x/..//./page.html","HTTP/1.1");
+    HttpResponse response = files.serve(request);
+    CHECK_EQ(response.getStatusCode(),200);
+    CHECK(response.getBody() == "page");
+
+    unlink((root + "/page.html").c_str());
+    unlink((base + "/secret.txt").c_str());
+    rmdir(root.c_str());
+    rmdir(base.c_str());
+}
+
+//  很多线程同时取同一个没有缓存的文件：只有一个线程映射和预压缩，其他的等它，拿到的是同一个对象
+static void testSingleFlight() {
+    char dir[] = "/tmp/static_files_test.XXXXXX";
+    if(mkdtemp(dir) == nullptr) {
+        CHECK(!"mkdtemp");
+        return;
+    }
+    string root = dir;
+    string path = root + "/page.html";
+    //  预压缩几MB的文本要一段时间，足够让其他线程撞上正在加载的状态
+    string text;
+    for(int i = 0; text.size() < 4 * 1024 * 1024; ++i) text += "<p>line " + to_string(i * 7919 % 100003) + "</p>\n";
+    ofstream(path) << text;
+
+    const int threads = 8;
+    FileCache cache(root,64 * 1024 * 1024,60000,8 * 1024 * 1024,9);
+    vector<shared_ptr<const StaticAsset>> results(threads);
+    atomic<int> arrived(0);
+    vector<thread> workers;
+    for(int i = 0; i < threads; ++i) {
+        workers.push_back(thread([&,i]{
+            arrived++;
+            while(arrived < threads) this_thread::yield();
+            results[i] = cache.get(path);
+        }));
+    }
+    for(thread& worker : workers) worker.join();
+
+    const FileCacheStats& stats = cache.getStats();
+    CHECK_EQ(stats.misses.load(),1u);
+    CHECK_EQ(stats.misses + stats.hits + stats.waits,static_cast<uint64_t>(threads));
+    CHECK(stats.waits > 0);
+    for(int i = 0; i < threads; ++i) {
+        CHECK(results[i] != nullptr);
+        CHECK(results[i] == results[0]);
+    }
+    if(results[0]) CHECK_EQ(results[0]->body.size(),text.size());
+
+    //  加载失败（符号链接指到根目录外）时等待的线程同样被唤醒，都拿到nullptr，之后再取也不会卡住
+    string secret = root + ".secret";
+    ofstream(secret) << "secret";
+    string link = root + "/link.html";
+    CHECK_EQ(symlink(secret.c_str(),link.c_str()),0);
+    workers.clear();
+    arrived = 0;
+    for(int i = 0; i < threads; ++i) {
+        workers.push_back(thread([&,i]{
+            arrived++;
+            while(arrived < threads) this_thread::yield();
+            results[i] = cache.get(link);
+        }));
+    }
+    for(thread& worker : workers) worker.join();
+    for(int i = 0; i < threads; ++i) CHECK(results[i] == nullptr);
+    CHECK(cache.get(link) == nullptr);
+
+    unlink(link.c_str());
+    unlink(secret.c_str());
+    unlink(path.c_str());
+    rmdir(root.c_str());
+}
+
+
+int main() {
+    testNormalize();
+    testTraversal();
+    testServe();
+    testSingleFlight();
+    return testResult("static_files_test");
+}
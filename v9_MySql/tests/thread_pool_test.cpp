@@ -0,0 +1,296 @@
+//  线程池的压力测试  --  无锁环形队列（MpmcQueue）、EventCount的睡眠和唤醒、多个线程同时提交时任务不丢不重，
+//  取任务的顺序（严格按优先级，自己CPU的队列先于共用的，偷别的CPU的任务先于普通优先级）和低优先级任务的执行线程
+//  用-DCMAKE_CXX_FLAGS=-fsanitize=thread配置时就是在TSAN下跑，丢了唤醒的话会卡住，由ctest的超时报告
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../ThreadPool.hpp"
+#include "Check.hpp"
+using namespace std;
+
+
+static uint64_t nowMs() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//  容量取整、满和空、先进先出、队首的stamp
+static void testRingBasics() {
+    MpmcQueue<int> ring(5);
+    CHECK_EQ(ring.capacity(),8u);
+    uint64_t stamp = 0;
+    CHECK(!ring.frontStamp(stamp));
+    for(int i = 0; i < 8; ++i) CHECK(ring.tryPush(int(i),100 + i));
+    int extra = 8;
+    CHECK(!ring.tryPush(move(extra)));
+    CHECK_EQ(ring.sizeApprox(),8u);
+    CHECK(ring.frontStamp(stamp));
+    CHECK_EQ(stamp,100u);
+    for(int i = 0; i < 8; ++i) {
+        int value = -1;
+        CHECK(ring.tryPop(value));
+        CHECK_EQ(value,i);
+    }
+    int value;
+    CHECK(!ring.tryPop(value));
+    //  转第二圈，序号要跟着对
+    for(int round = 0; round < 3; ++round) {
+        for(int i = 0; i < 6; ++i) CHECK(ring.tryPush(int(i)));
+        for(int i = 0; i < 6; ++i) CHECK(ring.tryPop(value) && value == i);
+    }
+}
+
+//  4个生产者4个消费者，容量很小，满和空都会经常碰到：每个元素正好取出一次，同一个生产者的元素按放进去的顺序取出
+static void testRingConcurrent() {
+    const int producers = 4,consumers = 4,per_producer = 50000;
+    MpmcQueue<int> ring(64);
+    vector<atomic<int>> seen(producers * per_producer);
+    for(auto& n : seen) n = 0;
+    atomic<int> taken(0);
+    atomic<int> out_of_order(0);
+    vector<thread> threads;
+    for(int p = 0; p < producers; ++p) {
+        threads.emplace_back([&,p]{
+            for(int i = 0; i < per_producer; ++i) {
+                int value = p * per_producer + i;
+                while(!ring.tryPush(move(value))) this_thread::yield();
+            }
+        });
+    }
+    for(int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&]{
+            vector<int> last(producers,-1);
+            while(taken < producers * per_producer) {
+                int value;
+                if(!ring.tryPop(value)) {
+                    this_thread::yield();
+                    continue;
+                }
+                ++taken;
+                seen[value]++;
+                int p = value / per_producer;
+                if(value % per_producer <= last[p]) out_of_order++;
+                last[p] = value % per_producer;
+            }
+        });
+    }
+    for(thread& t : threads) t.join();
+    int wrong = 0;
+    for(auto& n : seen) if(n != 1) ++wrong;
+    CHECK_EQ(wrong,0);
+    CHECK_EQ(out_of_order.load(),0);
+    CHECK_EQ(ring.sizeApprox(),0u);
+}
+
+//  超时返回false；prepareWait之后的notify让wait立即返回；两个线程轮流睡下、互相叫醒很多次，丢一次唤醒就会卡住
+static void testEventCount() {
+    EventCount ec;
+    uint64_t start = nowMs();
+    uint32_t key = ec.prepareWait();
+    CHECK(!ec.wait(key,30));
+    CHECK(nowMs() - start >= 20);
+
+    key = ec.prepareWait();
+    ec.notifyOne();
+    start = nowMs();
+    CHECK(ec.wait(key,5000));
+    CHECK(nowMs() - start < 1000);
+
+    //  没有人等的时候notify不推进纪元
+    key = ec.prepareWait();
+    ec.cancelWait();
+    ec.notifyAll();
+    CHECK_EQ(ec.prepareWait(),key);
+    ec.cancelWait();
+
+    const int rounds = 20000;
+    atomic<int> turn(0);
+    auto play = [&](int me) {
+        for(int i = 0; i < rounds; ++i) {
+            while(turn.load() != me) {
+                uint32_t k = ec.prepareWait();
+                if(turn.load() == me) {
+                    ec.cancelWait();
+                    break;
+                }
+                ec.wait(k,-1);
+            }
+            turn = 1 - me;
+            ec.notifyAll();
+        }
+    };
+    thread other(play,1);
+    play(0);
+    other.join();
+    CHECK_EQ(turn.load(),0);
+}
+
+//  6个线程同时提交三种优先级的任务，队列很小，三种满了之后的策略都跑一遍：
+//  每个提交的任务要么执行了、要么被丢掉（调用了on_drop）、要么提交时被拒绝，只发生一种
+static void testPoolStress() {
+    for(int policy = 0; policy < 3; ++policy) {
+        for(int rep = 0; rep < 3; ++rep) {
+            atomic<long> ran(0),dropped(0),rejected(0),submitted(0);
+            {
+                ThreadPoolOptions options;
+                options.min_threads = 2;
+                options.max_threads = 8;
+                options.queue_capacity = 64;
+                options.keep_alive_ms = 5;
+                options.starvation_ms = 1;
+                options.queue_policy = static_cast<ThreadPoolOptions::QueuePolicy>(policy);
+                ThreadPool pool(options);
+                vector<thread> producers;
+                for(int p = 0; p < 6; ++p) {
+                    producers.emplace_back([&,p]{
+                        for(int i = 0; i < 5000; ++i) {
+                            submitted++;
+                            bool ok = pool.submit([&]{
+                                                      if(++ran % 1000 == 0) this_thread::sleep_for(chrono::microseconds(200));
+                                                  },
+                                                  [&]{ dropped++; },static_cast<TaskPriority>((i + p) % PRIORITY_CLASSES));
+                            if(!ok) rejected++;
+                            if(i % 2000 == 0) this_thread::sleep_for(chrono::milliseconds(10));
+                        }
+                    });
+                }
+                for(thread& t : producers) t.join();
+                //  队列满时enqueue会抛异常，等排队的任务执行完再提交
+                while(pool.getQueuedNum() > 0) this_thread::sleep_for(chrono::milliseconds(1));
+                future<int> answer = pool.enqueue([]{ return 42; });
+                CHECK_EQ(answer.get(),42);
+            }
+            //  析构时执行完所有排队的任务
+            CHECK_EQ(submitted.load(),ran.load() + dropped.load() + rejected.load());
+            if(policy == ThreadPoolOptions::BLOCK) CHECK_EQ(rejected.load() + dropped.load(),0);
+            if(policy == ThreadPoolOptions::REJECT) CHECK_EQ(dropped.load(),0);
+        }
+    }
+}
+
+//  只有一个工作线程的线程池，先用一个任务把它占住，放进去的任务在release之后按取任务的顺序执行，记在order里
+class Gate {
+public:
+    explicit Gate(ThreadPool& pool): started(false),released(false) {
+        pool.submit([this]{
+            worker = this_thread::get_id();
+            started = true;
+            while(!released) this_thread::sleep_for(chrono::milliseconds(1));
+        });
+        while(!started) this_thread::sleep_for(chrono::milliseconds(1));
+    }
+
+    //  返回一个把name记进order的任务
+    function<void()> record(const string& name) {
+        return [this,name]{
+            lock_guard<mutex> lock(order_mutex);
+            order += name;
+        };
+    }
+
+    //  放开工作线程，等到n个记录都执行完，超时返回false
+    bool release(size_t n) {
+        released = true;
+        for(int i = 0; i < 5000; ++i) {
+            {
+                lock_guard<mutex> lock(order_mutex);
+                if(order.size() >= n) return true;
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+    string result() {
+        lock_guard<mutex> lock(order_mutex);
+        return order;
+    }
+
+    thread::id worker;
+
+private:
+    atomic<bool> started;
+    atomic<bool> released;
+    mutex order_mutex;
+    string order;
+};
+
+static ThreadPoolOptions singleWorker() {
+    ThreadPoolOptions options;
+    options.min_threads = options.max_threads = 1;
+    options.starvation_ms = 0;
+    return options;
+}
+
+//  严格按优先级，同一优先级先进先出
+static void testPriorityOrder() {
+    ThreadPool pool(singleWorker());
+    Gate gate(pool);
+    pool.submit(gate.record("l"),nullptr,PRIORITY_LOW);
+    pool.submit(gate.record("n"),nullptr,PRIORITY_NORMAL);
+    pool.submit(gate.record("H"),nullptr,PRIORITY_HIGH);
+    pool.submit(gate.record("m"),nullptr,PRIORITY_NORMAL);
+    pool.submit(gate.record("I"),nullptr,PRIORITY_HIGH);
+    CHECK(gate.release(5));
+    CHECK_EQ(gate.result(),string("HInml"));
+}
+
+//  工作线程绑定在CPU 0上（只有一个线程，CPU 1的队列没有线程绑定）：
+//  先取自己CPU队列里的，再取共用的高优先级队列，再偷CPU 1队列里的，最后才是普通优先级
+static void testLocalAndSteal() {
+    ThreadPoolOptions options = singleWorker();
+    options.cpus = "0,1";
+    ThreadPool pool(options);
+    Gate gate(pool);
+    pool.submit(gate.record("n"),nullptr,PRIORITY_NORMAL);
+    pool.submit(gate.record("s"),nullptr,PRIORITY_HIGH,1);
+    pool.submit(gate.record("c"),nullptr,PRIORITY_HIGH);
+    pool.submit(gate.record("h"),nullptr,PRIORITY_HIGH,0);
+    CHECK(gate.release(4));
+    CHECK_EQ(gate.result(),string("hcsn"));
+}
+
+//  指定了low_cpus时低优先级的任务由绑定在那里的执行线程执行：工作线程被占住时照样执行，工作线程空闲时也不取
+static void testDedicatedLow() {
+    vector<int> allowed = Affinity::currentCpus();
+    if(allowed.empty()) return;
+    int low_cpu = allowed.back();
+    ThreadPoolOptions options = singleWorker();
+    options.low_cpus = to_string(low_cpu);
+    options.low_threads = 1;
+    ThreadPool pool(options);
+    Gate gate(pool);
+
+    atomic<int> low_ran(0);
+    atomic<bool> wrong_thread(false),wrong_cpus(false);
+    auto low = [&]{
+        if(this_thread::get_id() == gate.worker) wrong_thread = true;
+        if(Affinity::currentCpus() != vector<int>(1,low_cpu)) wrong_cpus = true;
+        low_ran++;
+    };
+    pool.submit(low,nullptr,PRIORITY_LOW);
+    pool.submit(gate.record("H"),nullptr,PRIORITY_HIGH);
+    for(int i = 0; i < 5000 && low_ran == 0; ++i) this_thread::sleep_for(chrono::milliseconds(1));
+    CHECK_EQ(low_ran.load(),1);
+    CHECK_EQ(gate.result(),string(""));
+    CHECK(gate.release(1));
+    for(int i = 0; i < 100; ++i) pool.submit(low,nullptr,PRIORITY_LOW);
+    for(int i = 0; i < 5000 && low_ran < 101; ++i) this_thread::sleep_for(chrono::milliseconds(1));
+    CHECK_EQ(low_ran.load(),101);
+    CHECK(!wrong_thread);
+    CHECK(!wrong_cpus);
+}
+
+
+int main() {
+    testRingBasics();
+    testRingConcurrent();
+    testEventCount();
+    testPoolStress();
+    testPriorityOrder();
+    testLocalAndSteal();
+    testDedicatedLow();
+    return testResult("thread_pool_test");
+}
@@ -0,0 +1,138 @@
+//  分层时间轮的测试  --  各层边界上的定时器级联下来后按时到期（不早到、不晚太多）、按到期顺序执行，
+//  取消（包括还在高层的和在回调里取消的）、重新添加、超过最大范围的定时器和nextTimeoutMs
+//  add以真实时间为基准，advance用的是测试自己推进的时间，所以到期时间允许晚SLACK_MS
+#include <string>
+#include <vector>
+#include "../TimerWheel.hpp"
+#include "Check.hpp"
+using namespace std;
+
+#define SLACK_MS 50
+
+
+//  每层的边界两边各放一个定时器，每次推进step毫秒，一直推进到最后一个到期
+static void testCascade(uint64_t step) {
+    const uint64_t delays[] = { 1,2,63,64,65,127,128,4095,4096,4097,262143,262144,262145,300000 };
+    const size_t n = sizeof(delays) / sizeof(delays[0]);
+    TimerWheel wheel(1);
+    uint64_t base = TimerWheel::nowMs();
+    uint64_t now = base;
+    vector<TimerNode> nodes(n);
+    vector<uint64_t> fired(n,0);
+    vector<size_t> order;
+    for(size_t i = 0; i < n; ++i) {
+        nodes[i].callback = [&,i]{
+            fired[i] = now;
+            order.push_back(i);
+        };
+        wheel.add(&nodes[i],delays[i]);
+    }
+    CHECK_EQ(wheel.size(),n);
+    while(wheel.size() > 0 && now < base + delays[n - 1] + SLACK_MS + step) {
+        now += step;
+        wheel.advance(now);
+    }
+    CHECK_EQ(wheel.size(),0u);
+    CHECK_EQ(order.size(),n);
+    for(size_t i = 0; i < n; ++i) {
+        CHECK(fired[i] >= base + delays[i]);
+        CHECK(fired[i] < base + delays[i] + step + SLACK_MS);
+        CHECK(!nodes[i].pending());
+    }
+    for(size_t i = 1; i < order.size(); ++i) CHECK(delays[order[i - 1]] <= delays[order[i]]);
+}
+
+static void testCancel() {
+    TimerWheel wheel(1);
+    uint64_t base = TimerWheel::nowMs();
+    string fired;
+    TimerNode a,b,c,d,e;
+    a.callback = [&]{ fired += "a"; };
+    b.callback = [&]{ fired += "b"; };
+    c.callback = [&]{ fired += "c"; };
+    d.callback = [&]{ fired += "d"; };
+    //  e到期时取消和它同一个槽里的d
+    e.callback = [&]{
+        fired += "e";
+        wheel.cancel(&d);
+    };
+    wheel.add(&a,10);
+    wheel.add(&b,10);
+    wheel.add(&c,5000);                 //  在第2层
+    wheel.add(&e,200);
+    wheel.add(&d,200);
+    CHECK_EQ(wheel.size(),5u);
+
+    wheel.cancel(&a);
+    CHECK(!a.pending());
+    CHECK_EQ(wheel.size(),4u);
+    wheel.cancel(&a);                   //  不在轮上时什么也不做
+    CHECK_EQ(wheel.size(),4u);
+
+    wheel.advance(base + 1000);
+    CHECK_EQ(fired,string("be"));
+    CHECK(!d.pending());
+    CHECK(c.pending());
+
+    //  还在高层时取消，级联之后不会再出现
+    wheel.cancel(&c);
+    CHECK_EQ(wheel.size(),0u);
+    wheel.advance(base + 10000);
+    CHECK_EQ(fired,string("be"));
+
+    //  重新添加一个已经在轮上的定时器，以后一次为准；时间轮已经推进到了base + 10000，从那里接着算
+    uint64_t now = base + 10000;
+    wheel.add(&a,5);
+    wheel.add(&a,3000);
+    CHECK_EQ(wheel.size(),1u);
+    wheel.advance(now + 1000);
+    CHECK_EQ(fired,string("be"));
+    wheel.advance(now + 3000 + SLACK_MS);
+    CHECK_EQ(fired,string("bea"));
+    CHECK_EQ(wheel.size(),0u);
+}
+
+//  超过64^4个tick的定时器先放在最高层的最远处，级联时再重新计算，最后按时到期
+static void testBeyondRange() {
+    TimerWheel wheel(1);
+    uint64_t base = TimerWheel::nowMs();
+    const uint64_t range = 1ULL << 24;
+    bool fired = false;
+    TimerNode node;
+    node.callback = [&]{ fired = true; };
+    wheel.add(&node,range + 1000);
+    wheel.advance(base + range - 1);
+    CHECK(!fired);
+    CHECK(node.pending());
+    wheel.advance(base + range + 900);
+    CHECK(!fired);
+    wheel.advance(base + range + 1000 + SLACK_MS);
+    CHECK(fired);
+}
+
+static void testNextTimeout() {
+    TimerWheel wheel(10);
+    uint64_t now = TimerWheel::nowMs();
+    CHECK_EQ(wheel.nextTimeoutMs(now),-1);
+    TimerNode node;
+    wheel.add(&node,30);
+    int timeout = wheel.nextTimeoutMs(now);
+    CHECK(timeout > 0 && timeout <= 30 + 10 + SLACK_MS);
+    //  第0层没有定时器时最多等到第0层转完一圈
+    wheel.cancel(&node);
+    wheel.add(&node,100000);
+    timeout = wheel.nextTimeoutMs(now);
+    CHECK(timeout > 0 && timeout <= 64 * 10);
+    CHECK_EQ(wheel.nextTimeoutMs(now + 100000),0);
+}
+
+
+int main() {
+    testCascade(1);
+    testCascade(7);
+    testCascade(1000);
+    testCancel();
+    testBeyondRange();
+    testNextTimeout();
+    return testResult("timer_wheel_test");
+}
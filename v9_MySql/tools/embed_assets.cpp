@@ -0,0 +1,151 @@
+//  构建时把静态资源目录嵌入程序  --  由CMake调用，生成EmbeddedAssets.inc
+//  每个文件生成原始内容和各个压缩版本的常量数组，以及预先算好的Content-Type，ETag和Last-Modified
+//  用法：embed_assets <目录> <输出文件>
+//  设置了SOURCE_DATE_EPOCH环境变量时用它作为所有文件的修改时间，保证构建结果可重现
+#include <sys/stat.h>
+#include <dirent.h>
+#include <time.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../Router.hpp"          //  HttpRequest.hpp和Router.hpp互相包含，要先包含Router.hpp
+#include "../Compression.hpp"
+#include "../MimeTypes.hpp"
+#include "../FileUtils.hpp"
+using namespace std;
+
+
+//  构建时压缩一次，用最高的压缩级别
+#define ZLIB_LEVEL 9
+#define BROTLI_LEVEL 11
+
+
+//  递归列出目录下的普通文件（相对路径），跳过以'.'开头的文件和目录
+static void listFiles(const string& root,const string& relative,vector<string>& files) {
+    string dir = relative.empty() ? root : root + "/" + relative;
+    DIR* d = opendir(dir.c_str());
+    if(d == nullptr) return;
+    while(struct dirent* entry = readdir(d)) {
+        string name = entry->d_name;
+        if(name.empty() || name[0] == '.') continue;
+        string path = relative.empty() ? name : relative + "/" + name;
+        struct stat st;
+        if(stat((root + "/" + path).c_str(),&st) == -1) continue;
+        if(S_ISDIR(st.st_mode)) listFiles(root,path,files);
+        else if(S_ISREG(st.st_mode)) files.push_back(path);
+    }
+    closedir(d);
+}
+
+
+static bool compressBody(Compression::Encoding encoding,const string& in,string& out) {
+    return Compression::compress(encoding,in,out,encoding == Compression::BROTLI ? BROTLI_LEVEL : ZLIB_LEVEL);
+}
+
+
+//  内容的64位FNV-1a哈希，用来生成ETag：内容不变ETag就不变，和构建时间无关
+static unsigned long long fnv1a(const string& data) {
+    unsigned long long hash = 1469598103934665603ULL;
+    for(unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+//  把字符串转义成C++字符串字面量
+static string quote(const string& str) {
+    string out = "\"";
+    for(char c : str) {
+        if(c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+
+//  输出一个字节数组
+static void writeArray(ostream& os,const string& name,const string& data) {
+    os << "static constexpr unsigned char " << name << "[] = {";
+    if(data.empty()) os << "0";
+    for(size_t i = 0;i < data.size();++i) {
+        if(i % 20 == 0) os << "\n    ";
+        os << static_cast<unsigned>(static_cast<unsigned char>(data[i])) << ",";
+    }
+    os << "\n};\n";
+}
+
+
+int main(int argc,char* argv[]) {
+    if(argc != 3) {
+        fprintf(stderr,"usage: %s <directory> <output>\n",argv[0]);
+        return 1;
+    }
+    string root = argv[1];
+    vector<string> files;
+    listFiles(root,"",files);
+    sort(files.begin(),files.end());
+    const char* epoch = getenv("SOURCE_DATE_EPOCH");
+
+    ostringstream os;
+    os << "//  由tools/embed_assets根据" << root << "生成，不要手动修改\n\n";
+    ostringstream table;
+    for(size_t i = 0;i < files.size();++i) {
+        string content = FileUtils::readfile(root + "/" + files[i]);
+        struct stat st;
+        stat((root + "/" + files[i]).c_str(),&st);
+        time_t mtime = epoch != nullptr ? static_cast<time_t>(atoll(epoch)) : st.st_mtime;
+        string type = MimeTypes::lookup(files[i]);
+
+        //  原始内容和各个压缩版本，压缩后没有变小的不保留
+        string variants[Compression::ENCODING_COUNT];
+        variants[Compression::IDENTITY] = content;
+        if(MimeTypes::compressible(type)) {
+            for(int e = Compression::GZIP;e < Compression::ENCODING_COUNT;++e) {
+                string out;
+                if(compressBody(static_cast<Compression::Encoding>(e),content,out) && out.size() < content.size()) {
+                    variants[e] = out;
+                }
+            }
+        }
+        for(int e = 0;e < Compression::ENCODING_COUNT;++e) {
+            writeArray(os,"embedded_" + to_string(i) + "_" + to_string(e),variants[e]);
+        }
+
+        char etag[64];
+        snprintf(etag,sizeof(etag),"\"e-%016llx\"",fnv1a(content));
+        char date[64];
+        struct tm tm;
+        gmtime_r(&mtime,&tm);
+        strftime(date,sizeof(date),"%a, %d %b %Y %H:%M:%S GMT",&tm);
+
+        table << "    {" << quote(files[i]) << "," << quote(type) << "," << quote(etag) << ","
+              << quote(date) << "," << static_cast<long long>(mtime) << ",\n     {";
+        for(int e = 0;e < Compression::ENCODING_COUNT;++e) {
+            table << (e ? "," : "") << "reinterpret_cast<const char*>(embedded_" << i << "_" << e << ")";
+        }
+        table << "},\n     {";
+        for(int e = 0;e < Compression::ENCODING_COUNT;++e) {
+            table << (e ? "," : "") << variants[e].size();
+        }
+        table << "}},\n";
+    }
+    os << "\nstatic const EmbeddedAsset embedded_assets[] = {\n" << table.str();
+    if(files.empty()) os << "    {\"\",\"\",\"\",\"\",0,{\"\",\"\",\"\",\"\"},{0,0,0,0}},\n";
+    os << "};\n";
+    os << "static const size_t embedded_asset_count = " << files.size() << ";\n";
+
+    ofstream ofs(argv[2],ios::binary | ios::trunc);
+    ofs << os.str();
+    if(!ofs) {
+        fprintf(stderr,"cannot write %s\n",argv[2]);
+        return 1;
+    }
+    return 0;
+}